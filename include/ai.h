@@ -0,0 +1,112 @@
+// ai.h
+//
+// Utility AI. Every species has a table of behaviors, each a weight times the product of its
+// considerations: an input such as health or distance to the nearest enemy, shaped by a
+// response curve into 0..1. The best-scoring behavior becomes the character's action until it
+// thinks again. New behaviors and species are new table rows in ai.cpp, not new code paths.
+//
+// Thinking is the expensive part: one scan of every character refreshes the perception
+// (nearest enemy and the enemies in detection range) and the behaviors are scored on it.
+// A character thinks every perceptionTicks of its species, staggered by its key so the
+// characters don't all think on the same tick. Between thoughts it acts on the cached
+// decision every tick, which is cheap.
+//
+// The budget caps the work per tick in characters scanned, not microseconds, so a replayed
+// session makes the same decisions on the same ticks. Characters that are due once the budget
+// is spent think first on the next tick.
+
+#ifndef AI_H
+#define AI_H
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+
+class Character;
+using CharacterPtr = std::shared_ptr<Character>;
+using CharacterList = std::vector<CharacterPtr>;
+
+enum AIAction : uint8_t {
+    ACTION_IDLE = 0,
+    ACTION_WANDER,
+    ACTION_CHASE,
+    ACTION_ATTACK,
+    ACTION_FLEE
+};
+
+enum AIInput : uint8_t {
+    INPUT_HEALTH = 0,       //health over max health
+    INPUT_ENEMY_DISTANCE,   //nearest enemy over detection range, 2 when there is none
+    INPUT_TOUCHING,         //1 if the nearest enemy is in melee contact
+    INPUT_THREATS           //enemies in detection range
+};
+
+enum AICurve : uint8_t {
+    CURVE_LINEAR = 0,   //a * x + b, clamped to 0..1
+    CURVE_AT_MOST,      //1 if x <= a
+    CURVE_AT_LEAST      //1 if x >= a
+};
+
+struct Consideration {
+    AIInput input;
+    AICurve curve;
+    float a;
+    float b;
+};
+
+struct Behavior {
+    AIAction action;
+    float weight;
+    uint8_t numConsiderations;
+    const Consideration* considerations;
+};
+
+struct Species {
+    uint8_t perceptionTicks;
+    uint8_t numBehaviors;
+    const Behavior* behaviors;
+};
+
+//What a character decided and saw when it last thought. Enemies are kept by key, not
+//pointer, so one that despawns in between is simply not found
+struct AIMemory {
+    AIAction action = ACTION_WANDER;
+    uint32_t target = 0;           //nearest enemy
+    float targetDistance = 0.0f;
+    std::vector<uint32_t> threats;
+    uint32_t nextThink = 0;
+    bool scheduled = false;
+};
+
+class AIEngine {
+public:
+    static const uint16_t DEFAULT_BUDGET = 256;
+
+    struct Stats {
+        uint32_t thinks = 0;
+        uint32_t deferred = 0;     //ticks that ran out of budget with characters still due
+        uint16_t spentLastTick = 0;
+    };
+
+    //Species for a character id; unknown ids get the first species
+    static const Species& speciesFor(uint8_t id);
+
+    //Lets the characters that are due think, within the budget
+    void update(const CharacterList& characters, uint32_t tick);
+
+    void setBudget(uint16_t budget) { _budget = budget; }
+    const Stats& getStats() const { return _stats; }
+
+private:
+    uint16_t _budget = DEFAULT_BUDGET;
+    size_t _cursor = 0;   //where the next tick starts, so deferred characters go first
+    Stats _stats;
+    std::vector<Character*> _due;
+
+    //Scans every character once, so costs characters.size() of the budget
+    void think(Character& character, const CharacterList& characters);
+    static float input(AIInput input, Character& character, Character* target);
+    static float respond(const Consideration& consideration, float x);
+};
+
+#endif //AI_H
@@ -9,9 +9,15 @@
 #include <vector>
 #include <memory>
 #include "TFT_eSPI.h"
-#include "Comms.h"
-#include "Map.h"
+#include "comms.h"
+#include "map.h"
 #include"character.h"
+#include "mac_table.h"
+#include "ai.h"
+#include "navigator.h"
+#include "crowd.h"
+
+#define MAX_CHARACTERS 32
 
 using CharacterPtr = std::shared_ptr<Character>; //shared ownership across battle instances
 using CharacterList = std::vector<CharacterPtr>;
@@ -27,19 +33,45 @@ public:
     // Initializes networking, local identity, display, RNG and local character
     void init();
 
+    //Initializes from a recorded session instead of the hardware, see session_replay.h.
+    //faces read back the recorded bytes; the replay records itself into recordBytes
+    void initReplay(uint32_t seed, DeviceId deviceId, uint32_t startMs, Transport* const faces[NUM_SIDES],
+                    size_t recordBytes);
+
     //Advances game state, handles networking and renders frame
     void update();
 
+    //One tick at nowMs, the only time the simulation sees during it
+    void update(uint32_t nowMs);
+
+    //Single-character commands from the debug serial port:
+    //  p  profiler dump        t  link telemetry
+    //  c  start packet capture d  dump and restart the capture
+    //  x  stop packet capture  s  dump the session recording
+    //  a  AI and nav stats     f  frame cache and present stats
+    //  w  power and duty cycle  b  run the benchmarks (BENCH_ENABLED builds)
+    void debugCommand(char command);
+
+    //On the host, also announces the spawn to the mesh
     void createCharacter(uint32_t senderMac, uint8_t id);
     void addCharacter(CharacterPtr character);
+    void removeCharacter(uint32_t mac);
+    //One tick of the simulation, as phases over all characters: perceive and decide, steer,
+    //separate and move, combat, animation
     void updateCharacters();
 
     //Send character state to neighboring cubes
     void sendCommands();
 
-    //Apply receives character state
+    //Apply received character state
     //Payload must match sendCommands()
-    void processCommands(const std::vector<uint8_t>& payload);
+    void processCommands(const uint8_t* payload, size_t len);
+
+    //Host: sends pending combat events in PACKET_COMBAT
+    void sendCombatEvents();
+
+    //Applies a PACKET_COMBAT payload, see combat.h
+    void applyCombatEvents(const uint8_t* events, size_t len);
 
     //Returns nullptr if not found
     Character* findCharacterByMac(uint32_t mac);
@@ -47,27 +79,69 @@ public:
     //Registers a new cube relative to this device
     void addCube(uint32_t mac, int sideFromThis);
 
-    //Removes cube from network topology
+    //Removes cube from network topology. On the host, characters of every cube that
+    //left with it are despawned mesh-wide
     void removeCube(uint32_t mac);
 
     //Adds a cube with a known path to host
-    void addCubeWithPath(uint32_t mac, const std::vector<uint8_t>& path);
+    void addCubeWithPath(uint32_t mac, const PackedPath& path);
+
+    //Called by Comms when the election settles on a new host. lostHost is the host whose
+    //failure started the election, 0 if none
+    void onHostChanged(uint32_t host, uint32_t lostHost);
+
+    //PACKET_TERRAIN from the host
+    void onTerrain(uint32_t mac, const uint8_t* packed);
 
     //Returns the path from host to this device
-    std::vector<uint8_t> getPathFromHost() const;
+    PackedPath getPathFromHost() const;
 
     bool isCharacterInCubeBounds(uint32_t cubeMac, int16_t charX, int16_t charY) const;
     Character* findNearestEnemy(Character* seeker);
     std::vector<Character*> findEnemiesInRange(Character* seeker, float range);
     uint32_t getMyMac();
+    Comms& getComms() { return comm; }
+    AIEngine& getAI() { return ai; }
+    Navigator& getNavigator() { return navigator; }
+    Crowd& getCrowd() { return crowd; }
+    const Map& getMap() const { return map; }
+    Display& getDisplay() { return *display; }
+
+    //Hash of every character's replicated state, for session checkpoints
+    uint32_t stateHash() const;
 
 private:
     CharacterList characters;
+    MacTable<Character*, MAX_CHARACTERS * 2> charactersByMac; //index into characters
     Comms comm;
+    AIEngine ai;
     Map map;
+    Navigator navigator{&map};
+    Crowd crowd;
     Display* display;
     TFT_eSPI* battle_tft;
     uint32_t myMac;
+
+    //Last state the host replicated, so a client promoted to host carries on from it
+    std::vector<uint8_t> lastSnapshot;
+    uint32_t lastSnapshotAt = 0;
+
+    //This tick's combat, and what the next sync still has to send
+    std::vector<CombatEvent> combatEvents;
+    std::vector<CombatEvent> pendingEvents;
+
+    //Terrain the host repeats round the cubes, one every TERRAIN_RESEND_MS
+    uint32_t terrainResentAt = 0;
+    uint8_t terrainCarousel = 0;
+
+    void start(uint32_t seed, uint32_t nowMs, size_t recordBytes);
+    void resolveCombat();
+    void animateCharacters();
+    void warmStart(uint32_t lostHost);
+    void placeNeighbors(uint32_t host);
+    void streamTerrain();
+    void sendTerrain(uint32_t mac, const uint8_t* packed);
+    void despawnCharacter(uint32_t mac);
 };
 
 #endif //BATTLE_H
\ No newline at end of file
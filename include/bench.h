@@ -0,0 +1,62 @@
+// bench.h
+//
+// Microbenchmarks of the hot paths: sprite blits, frame composition, enemy queries, world
+// bounds tests, crowd separation, state encode/decode and the Comms frame parser. Build with -DBENCH_ENABLED=1
+// and send 'b' on the debug port. Every case runs on objects built for it, parameterised over
+// character and cube counts, and doubles its iterations until it has run for MIN_TIME_US.
+//
+// The report goes to the debug port in Google Benchmark's JSON format, between
+// "[BENCH] BEGIN" and "[BENCH] END" lines. tools/bench_compare.py checks it against a stored
+// baseline. Nothing but the panel is touched, so a host build runs the same code: see
+// test/test_bench.
+//
+// A run reseeds gameRandom and restarts gameClock, and stops any session recording.
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <vector>
+#include "TFT_eSPI.h"
+
+#ifndef BENCH_ENABLED
+#define BENCH_ENABLED 0
+#endif
+
+class Benchmarks {
+public:
+    static const uint32_t MIN_TIME_US = 100000;
+    static const uint32_t MAX_ITERATIONS = 1u << 20;
+
+    explicit Benchmarks(TFT_eSPI* tft) : _tft(tft) {}
+
+    //Runs every case, then prints the report
+    void run();
+
+private:
+    struct Result {
+        const char* name;
+        int args[2];
+        uint8_t argCount;
+        uint32_t iterations;
+        float usPerIteration;
+    };
+
+    TFT_eSPI* _tft;
+    std::vector<Result> _results;
+
+    template <typename F>
+    void measure(const char* name, int arg0, int arg1, uint8_t argCount, F body);
+
+    void benchSpriteDraw(int characters);
+    void benchDisplayDraw(int characters, int cubes);
+    void benchEnemyQueries(int characters);
+    void benchWorldBounds(int cubes);
+    void benchCrowd(int characters);
+    void benchStateCodec(int characters);
+    void benchCommsParser(int frames);
+
+    void report() const;
+};
+
+#endif //BENCH_H
@@ -3,6 +3,9 @@
 
 #include "sprite.h"
 #include "map.h"
+#include "ai.h"
+#include "combat.h"
+#include <vector>
 
 class Battle;
 
@@ -11,12 +14,16 @@ public:
   Character(uint32_t mac, uint8_t id, TFT_eSPI* tft, Map* map, Battle* battle);
   ~Character();
 
-  void update();
-  void updateAI();
+  //Phases of a tick, each run over every character in turn by Battle::updateCharacters
+  void steer();           //picks a heading from the AI's decision
+  void integrate();       //moves along the heading and the crowd's separation
+  void declareAttack(std::vector<CombatEvent>& events);   //on a target still in contact
+  void animate();         //advances the sprite, starting the death clip once; clients too
+
   void setPosition(int16_t x, int16_t y);
-  void clientUpdate(uint8_t x, uint8_t y, uint8_t frame);
+  void clientUpdate(int16_t x, int16_t y, uint8_t clipState, bool mirrored);
 
-  void moveByDirection();
+  //Set the heading; the move itself happens in integrate()
   void moveToward(Character* target);
   void moveAwayFrom(Character* target);
   void moveAwayFromGroup(const std::vector<Character*>& targets);
@@ -26,9 +33,13 @@ public:
   std::vector<Character*> findEnemiesInRange(float range);
 
   float distanceTo(Character* other);
+  bool isTouching(Character* other);
   bool canAttack();
-  void performAttack(Character* target);
   void takeDamage(int dmg);
+  void kill();
+  void respawn();
+  //Clients learn of attacks from combat events, for effects
+  void noteAttack();
 
   bool isAlive();
 
@@ -36,8 +47,22 @@ public:
   uint8_t getId() const;
   int16_t getX() const;
   int16_t getY() const;
+  int16_t centerX() const;
+  int16_t centerY() const;
   uint8_t getZOrder() const;
   Sprite* getSprite() const;
+  float getHealthFraction() const;
+  int getHealth() const;
+  //0..255 of max health, as replicated in combat events
+  uint8_t getHealthScaled() const;
+  void setHealthScaled(uint8_t health);
+  uint32_t getDiedAt() const;
+  unsigned long getLastAttackTime() const;
+  float getDetectionRange() const;
+  AIMemory& memory();
+
+  //Set by Crowd every tick, added to the heading when moving
+  void setSeparation(float x, float y);
 
   void setMaxHealth(int health);
   void setSpeed(float speed);
@@ -47,6 +72,8 @@ public:
   uint32_t getMac();
   
 private:
+  void moveByDirection();
+
   uint32_t _mac;
   Sprite* _sprite;
   Map* _map;
@@ -60,6 +87,9 @@ private:
   float _ndy = 0.0f;
   float _movement = 0.0f;
   float _speed = 1.0f;
+  bool _moving = false;
+  float _sepX = 0.0f;
+  float _sepY = 0.0f;
 
   unsigned long _lastDirChange = 0;
   unsigned long _lastMoveTime = 0;
@@ -72,15 +102,13 @@ private:
   int _defense = 2;
   unsigned long _lastAttackTime = 0;
   unsigned long _attackCooldown = 1000; // ms cooldown between attacks
-  int _fleeThreshold = 20;               // health threshold to flee
-  float _attackRange = 20.0f;            // range to attack
+  uint8_t _attackReach = 2;              // px of slack around the sprite outline for melee contact
   float _detectionRange = 300.0f;         // range to detect enemies
 
   bool _alive = true;
-  Character* _target = nullptr;
-  String _currentAnimation = "null";
-
-  enum State { IDLE, WANDER, CHASE, ATTACK, FLEE, DEAD } _state = WANDER;
+  bool _deathPlayed = false;
+  uint32_t _diedAt = 0;
+  AIMemory _memory;
 };
 
 #endif // CHARACTER_H
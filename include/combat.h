@@ -0,0 +1,54 @@
+// combat.h
+//
+// Combat as events. In the combat phase every attacker in contact declares an ATTACK, and
+// only once all have are they resolved: damage lands on every target, then whoever dropped
+// to zero dies. The outcome doesn't depend on list order, and a pet killed this tick still
+// lands its own blow. Dead pets come back at full health RESPAWN_MS later.
+//
+// The host sends each tick's events reliably in PACKET_COMBAT, relayed mesh-wide, as many as
+// fit a control message. The state sync is lossy and superseded in the queues, and a missed
+// DEATH would leave a pet standing on a client. Clients apply them to keep health and deaths
+// in step without full stat blocks:
+//   ATTACK  [1][attacker sid][target sid]
+//   DAMAGE  [2][target sid][amount][health]
+//   DEATH   [3][sid]
+//   RESPAWN [4][sid][health]
+// health is scaled so 255 is the character's max health.
+
+#ifndef COMBAT_H
+#define COMBAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_COMBAT 0x0E   //combat events back to back, relayed mesh-wide
+
+static const uint32_t RESPAWN_MS = 10000;
+
+enum CombatEventType : uint8_t {
+    COMBAT_ATTACK = 1,
+    COMBAT_DAMAGE,
+    COMBAT_DEATH,
+    COMBAT_RESPAWN
+};
+
+struct CombatEvent {
+    CombatEventType type;
+    uint32_t subject;   //attacker for ATTACK, otherwise the character it happened to
+    uint32_t target;    //ATTACK only
+    uint8_t amount;     //damage, ATTACK and DAMAGE
+    uint8_t health;     //after the event, DAMAGE and RESPAWN
+};
+
+//Bytes on the wire including the type, 0 for an unknown type
+inline size_t combatEventLen(uint8_t type) {
+    switch (type) {
+        case COMBAT_ATTACK:  return 3;
+        case COMBAT_DAMAGE:  return 4;
+        case COMBAT_DEATH:   return 2;
+        case COMBAT_RESPAWN: return 3;
+    }
+    return 0;
+}
+
+#endif //COMBAT_H
@@ -6,13 +6,36 @@
 #include <vector>
 #include <deque>
 #include <stdint.h>
+#include "transport.h"
+#include "link_rate.h"
+#include "tx_queue.h"
+#include "reliable_link.h"
+#include "host_election.h"
+#include "identity.h"
+#include "packet_capture.h"
 
-#define NUM_SIDES 1 //UPDATE
+#define NUM_SIDES 4
+
+//A face only connects on a heartbeat, see power.h
+static const uint32_t HEARTBEAT_INTERVAL_MS = 1000;
+
+//Per-packet trace on the debug serial port ([RX], [TX], [HANDLE], [COMMAND], [CONTROL],
+//[FORWARD]). Printing a line takes longer than the frame it describes, so it's off by default.
+//Needs DEBUG_CONSOLE to show up anywhere
+#ifndef COMMS_TRACE
+#define COMMS_TRACE 0
+#endif
 
 // Packet types
 #define PACKET_HEARTBEAT 0x01
 #define PACKET_COMMAND   0x02
 
+// Control events, carried inside PACKET_RELIABLE
+#define PACKET_PATH      0x06   //sender's device id, host and path, relayed mesh-wide
+#define PACKET_SPAWN     0x07   //[sid][id], relayed mesh-wide
+#define PACKET_DESPAWN   0x08   //[sid], relayed mesh-wide
+#define PACKET_HOST      0x09   //election view of a new host, relayed mesh-wide
+
 enum Role {
     ROLE_UNASSIGNED = 0,
     ROLE_HOST,
@@ -20,32 +43,133 @@ enum Role {
 };
 
 struct RecentPacket {
-    uint32_t senderMac;
+    uint8_t senderSid;
     uint16_t seqNum;
 };
 
 struct Neighbor {
     uint32_t mac;
     bool isConnected;
-    HardwareSerial* serial;
-    uint32_t lastHeartbeat;
+    Transport* link;
+    uint32_t lastHeartbeat;   //last keepalive, or the heartbeat that connected it
+};
+
+//Per-face counters for field debugging
+struct LinkTelemetry {
+    uint32_t bytesIn;
+    uint32_t framesIn;
+    uint32_t packetsIn;       //after unbatching, including reliable deliveries
+    uint32_t bytesOut;
+    uint32_t framesOut;
+    uint32_t packetsOut;
+    uint32_t forwards;        //packets relayed onto this face
+    uint32_t duplicates;      //dropped by dedup
+    uint32_t lengthErrors;    //length mismatch or truncated batch
+    uint32_t badTags;         //unknown, or a control event outside the reliable channel
+    uint32_t skipped;         //bytes dropped looking for the start of a frame
+    uint32_t timeouts;
+    uint8_t queueHighWater;
+    uint16_t rttMs;           //smoothed keepalive round trip, 0 until measured
 };
 
 class Battle; //Forward declaration
+struct PackedPath;
 
 class Comms {
 public:
     Comms(Battle* battle);
+    ~Comms();
+
+    //Replaces a face's transport, e.g. with a MemoryTransport in a host simulation.
+    //Must be called before begin(). Comms does not take ownership
+    void setTransport(int side, Transport* link);
+
+    //Stands in for the MAC in efuse, e.g. when replaying another cube's session.
+    //Must be called before begin()
+    void setDeviceId(DeviceId id) { _deviceId = id; }
+
     void begin(int baud);
     void update();
 
+    //Blocks until bytes arrive on any face or the timeout expires.
+    //Returns false on timeout
+    bool waitForRx(uint32_t timeoutMs);
+
+    //True while any face is connected to a neighbor
+    bool hasNeighbors() const;
+
+    //Face a neighbor is connected on, or -1 if it isn't a direct neighbor
+    int faceOf(uint32_t mac) const;
+
+    //Neighbor connected on a face, 0 if none
+    uint32_t neighborOn(int side) const { return neighbors[side].isConnected ? neighbors[side].mac : 0; }
+
+    //Applies again the last PATH each neighbor sent about itself under the current host. A
+    //new host that isn't a neighbor places this cube through them; their paths don't change
+    //just because we started over, so they won't be sent again
+    void replayNeighborPaths();
+
+    //True while frames are queued or still leaving the wire on any face
+    bool txPending();
+
+    //Tells every face that light sleep starts or ends, see Transport::setAsleep()
+    void setAsleep(bool asleep);
+
+#ifdef ESP_PLATFORM
+    //Lets incoming data on every face wake the chip from light sleep, see power.h
+    void enableRxWakeup();
+#endif
+
     Role getRole() const { return _role; }
     uint32_t getHostMac() const { return _hostMac; }
     uint32_t getMyMac() const { return _myMac; }
+    DeviceId getDeviceId() const { return _deviceId; }
+    uint8_t getMySid() const { return _mySid; }
+
+    //Translate between the MAC keys used in this cube and the sids used on the wire.
+    //NO_SID and 0 mean the host has not assigned the device yet
+    uint8_t sidOf(uint32_t mac) const { return identities.sidOf(mac); }
+    uint32_t macOf(uint8_t sid) const { return identities.keyOf(sid); }
+
+    //Frees a departed device's sid. The host calls this after despawning it
+    void releaseSid(uint8_t sid) { identities.release(sid); }
 
-    //Sends a packet with tag and payload to all neighbors
+    //Binds a sid as a table flood would, for host simulations and benchmarks
+    void bindSid(uint8_t sid, DeviceId id) { identities.bind(sid, id); }
+
+    //Queues a packet with tag and payload for all neighbors
     void sendPacketToNeighbors(uint8_t tag, const uint8_t* payload, size_t len);
 
+    //Sends a control event reliably to every connected neighbor, which relays it once
+    void sendControl(uint8_t tag, const uint8_t* payload, size_t len);
+
+    //True while a face's reliable backlog is half full. Senders of bulk control traffic hold
+    //back, so the backlog keeps room for paths, joins and elections
+    bool controlCongested() const;
+
+    const ReliableLink::Stats& getReliableStats(int side) const { return reliable[side].getStats(); }
+    const HostElection::Stats& getElectionStats() const { return election.getStats(); }
+
+    //Outbound queue counters of a face, and its TX utilization over the last second in percent
+    const TxQueue::Stats& getTxStats(int side) const { return txQueues[side].getStats(); }
+    uint8_t getTxQueueDepth(int side) const { return txQueues[side].depth(); }
+    uint8_t getLinkUtilization(int side) const { return linkUtilization[side]; }
+    //Baud rate the face's transport runs at, and its negotiation counters
+    uint32_t getLinkBaud(int side) const { return appliedBaud[side]; }
+    const LinkRate::Stats& getLinkRateStats(int side) const { return linkRates[side].getStats(); }
+
+    LinkTelemetry getTelemetry(int side) const;
+    void printTelemetry() const;
+
+    //Raw frame capture on every face, see packet_capture.h
+    bool startCapture(size_t bytes = PacketCapture::DEFAULT_BYTES) { return capture.start(bytes); }
+    void stopCapture() { capture.stop(); }
+    const PacketCapture& getCapture() const { return capture; }
+
+    //Writes the capture to the debug serial port as [0xA5 0x5A 'C' 'P'][len(4)][pcap][sum],
+    //sum being the low byte of the sum of the pcap bytes
+    void dumpCapture();
+
 private:
     Battle* _battle;
 
@@ -57,6 +181,21 @@ private:
     Role _role;
     uint32_t _hostMac;
     uint32_t _myMac;
+    DeviceId _deviceId = 0;
+
+    //Session IDs. Clients ask each new host for one; the host floods its table after joins
+    IdentityTable identities;
+    uint8_t _mySid = IdentityTable::NO_SID;
+    uint32_t _joinedHost = 0;       //host that assigned _mySid
+    uint32_t _joinRequestedFrom = 0;
+    uint32_t _lastJoin = 0;
+    bool _announcePending = false;
+    uint32_t _lastAnnounce = 0;
+
+    //Our PATH payload as last flooded, resent whenever the host or our place changes
+    std::vector<uint8_t> _announcedPath;
+    //Last PATH payload each neighbor sent about itself
+    std::vector<uint8_t> neighborPaths[NUM_SIDES];
 
     uint32_t _lastSendTime;
 
@@ -64,23 +203,73 @@ private:
     uint16_t localSeqNum;  
 
     std::vector<uint8_t> rxBuffers[NUM_SIDES];
+    bool ownsLink[NUM_SIDES];
+
+    //Negotiated baud per face, and the rate the transport is actually running at
+    LinkRate linkRates[NUM_SIDES];
+    uint32_t appliedBaud[NUM_SIDES];
+    uint32_t lastLineErrors[NUM_SIDES];
+
+    //Packets waiting for each face, drained every update within a byte budget
+    TxQueue txQueues[NUM_SIDES];
+    uint32_t _lastUtilSample = 0;
+    uint32_t utilBytesMark[NUM_SIDES];
+    uint8_t linkUtilization[NUM_SIDES];
+
+    //Ordered, acknowledged channel per face for control events
+    ReliableLink reliable[NUM_SIDES];
+
+    HostElection election;
+    uint32_t _lastKeepalive = 0;
+
+    LinkTelemetry telemetry[NUM_SIDES];
+    PacketCapture capture;
+
+    //Last keepalive stamp from each neighbor, echoed back to measure the round trip
+    uint16_t peerStamp[NUM_SIDES];
+    uint32_t peerStampAt[NUM_SIDES];
+    bool hasPeerStamp[NUM_SIDES];
+
+#ifdef ESP_PLATFORM
+    //Event queues of every face's UART, so a single wait covers all faces
+    QueueSetHandle_t _rxEvents = nullptr;
+    void serviceRxEvents(TickType_t wait);
+#endif
 
     //Keep track of recently seen packets for duplicate suppression
     std::deque<RecentPacket> recentPackets; 
 
     //Internal methods
-    void handleIncomingPacket(int sideIdx, uint8_t* data, size_t len);
+    void handleIncomingPacket(int sideIdx, uint8_t* data, size_t len, bool reliableDelivery = false);
     void forwardPacket(int incomingSide, uint8_t* data, size_t len);
+    size_t buildPacket(uint8_t* packet, uint8_t tag, const uint8_t* payload, size_t len);
+    void sendPacketToSide(int sideIdx, uint8_t tag, const uint8_t* payload, size_t len);
+    void queuePacket(int sideIdx, const uint8_t* packet, size_t len);
+    void drainTxQueue(int sideIdx);
+    void sampleUtilization(uint32_t now);
+    void handleBatch(int sideIdx, uint8_t senderSid, const uint8_t* records, size_t len);
+    void handleReliable(int sideIdx, const uint8_t* payload, size_t len);
+    void serviceReliable(int sideIdx, uint32_t now);
+    void sendControlToSide(int sideIdx, uint8_t tag, const uint8_t* payload, size_t len);
+    void relayControl(int incomingSide, const uint8_t* data, size_t len);
+    void applyPath(int sideIdx, const uint8_t* payload, size_t len);
+    void announcePath();
+    size_t buildPathPayload(uint8_t* payload, PackedPath& path);
+    static uint8_t newSession();
+    void updateLinkRate(int sideIdx, uint32_t now);
     void sendHeartbeat();
     void reevaluateHost();
+    void sendKeepalives();
+    void onKeepaliveStamp(int sideIdx, const uint8_t* stamp, uint32_t now);
+    void requestSid(uint32_t now);
+    void handleJoin(const uint8_t* payload, size_t len);
+    void handleAssign(const uint8_t* payload, size_t len);
+    void announceIdentities(uint32_t now);
 
-    uint32_t getMacAddressHash();
-
-    // Check if we have already processed a packet with this sender MAC and sequence number
-    bool isDuplicatePacket(uint32_t senderMac, uint16_t seqNum);
+    static DeviceId readDeviceId();
 
-    //Add a packet to the recentPackets buffer
-    void addRecentPacket(uint32_t senderMac, uint16_t seqNum);
+    // Check if we have already processed a packet with this sender sid and sequence number
+    bool isDuplicatePacket(uint8_t senderSid, uint16_t seqNum);
 };
 
 #endif //COMMS_H
@@ -0,0 +1,55 @@
+// crowd.h
+//
+// Local avoidance, so chasers spread around a target instead of piling onto the same pixel.
+// Once per tick, before the characters move, Crowd buckets every living character by its
+// sprite center into a hashed grid of RADIUS cells and finds up to MAX_NEIGHBOURS nearest
+// within RADIUS of each. The separation is the sum of unit vectors away from them, each
+// weighted by how deep inside the radius it is; Character::moveByDirection adds it to its
+// heading.
+//
+// Each query looks at the 3x3 cells around the character, so a pass costs O(characters) as
+// long as they don't all stand in one cell. The radius is well inside melee contact, so
+// fighters still touch.
+
+#ifndef CROWD_H
+#define CROWD_H
+
+#include <stdint.h>
+#include <vector>
+#include <memory>
+
+class Character;
+using CharacterPtr = std::shared_ptr<Character>;
+using CharacterList = std::vector<CharacterPtr>;
+
+class Crowd {
+public:
+    static const uint8_t RADIUS_SHIFT = 4;
+    static const int16_t RADIUS = 1 << RADIUS_SHIFT;   //px between sprite centers
+    static const uint8_t MAX_NEIGHBOURS = 4;
+    static constexpr float WEIGHT = 1.5f;               //full overlap against a heading of 1
+
+    struct Stats {
+        uint16_t agents = 0;       //last pass
+        uint32_t candidates = 0;   //pairs tested in the last pass
+    };
+
+    //Sets every character's separation from its current neighbours
+    void update(const CharacterList& characters);
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    //Per pass scratch, kept so steady state doesn't allocate
+    std::vector<int16_t> _x;
+    std::vector<int16_t> _y;
+    std::vector<int16_t> _heads;   //first character in each bucket, -1 if empty
+    std::vector<int16_t> _next;    //next character in the same bucket
+    std::vector<uint16_t> _tested;
+    Stats _stats;
+
+    void separate(Character& character, size_t i, uint32_t mask);
+    static uint32_t bucketOf(int32_t cellX, int32_t cellY, uint32_t mask);
+};
+
+#endif //CROWD_H
@@ -1,7 +1,7 @@
 #pragma once
 #include <vector>
 #include <memory>
-#include "Character.h"  
+#include "character.h"
 #include "TFT_eSPI.h"
 
 using CharacterPtr = std::shared_ptr<Character>;
@@ -9,16 +9,63 @@ using CharacterList = std::vector<CharacterPtr>;
 
 class Map;  //Forward declaration
 
+//Target time between presented frames; the rate only ever drops below it
+#ifndef DISPLAY_FRAME_MS
+#define DISPLAY_FRAME_MS 33
+#endif
+
+//Compose and push time a frame may take before the rate backs off, so the panel never
+//eats the time comms and the simulation need
+#ifndef DISPLAY_FRAME_BUDGET_US
+#define DISPLAY_FRAME_BUDGET_US (DISPLAY_FRAME_MS * 1000 / 2)
+#endif
+
+//Backlight while dimmed, out of 255. Only boards with TFT_BL wired can dim
+#ifndef DISPLAY_DIM_LEVEL
+#define DISPLAY_DIM_LEVEL 24
+#endif
+
 class Display {
 public:
+    static const uint16_t MAX_FRAME_MS = 250;
+    static const uint8_t RECOVER_FRAMES = 16;   //on budget in a row before the rate steps back up
+
+    struct Stats {
+        uint32_t presented = 0;
+        uint32_t idle = 0;              //ticks skipped because nothing on screen changed
+        uint32_t deferred = 0;          //ticks skipped to hold the frame interval
+        uint32_t missedDeadlines = 0;   //frames over DISPLAY_FRAME_BUDGET_US
+        uint32_t lastFrameUs = 0;
+        uint16_t intervalMs = DISPLAY_FRAME_MS;
+    };
+
     Display(Map* map, TFT_eSPI* tft, uint16_t width, uint16_t height);
     ~Display();
 
     void setViewOrigin(int16_t originX, int16_t originY);
     void setCharacters(const CharacterList& characters);
+
+    //Composes and pushes a frame now
     void draw(const CharacterList& characters);
+    //Once per tick: pushes a frame only if the scene changed since the last one and the frame
+    //interval has passed. A frame over budget doubles the interval, up to MAX_FRAME_MS
+    void present(const CharacterList& characters);
+
     void setMac(uint32_t mac);
 
+    //Hash of the back buffer with the current scene composed, for session checkpoints. Doesn't
+    //depend on which frames were presented, so replays match whatever the pacing did
+    uint32_t frameHash();
+
+    //Last tick the panel was out of date, i.e. when something on screen last moved
+    uint32_t getChangedAt() const { return _changedAt; }
+
+    //Turns the backlight down while nothing moves. The frame itself is already frozen then
+    void setDimmed(bool dimmed);
+    bool isDimmed() const { return _dimmed; }
+
+    const Stats& getStats() const { return _stats; }
+
 private:
     Map* _map;
     TFT_eSPI* _tft;
@@ -26,9 +73,39 @@ private:
     TFT_eSprite _buffer;
     int16_t _originX = 0;
     int16_t _originY = 0;
+    uint32_t _mapVersion = 0;
+
+    //Terrain under the current view, composed only when the view or the terrain changes.
+    //Each frame copies back just what the last frame drew over, instead of clearing it all
+    struct Rect {
+        int16_t x, y, w, h;
+    };
+    TFT_eSprite _background;
+    uint32_t _terrainVersion = 0;
+    bool _backgroundStale = true;
+    std::vector<Rect> _dirty;
 
     CharacterList _sortedCharacters;
     bool _needsResort = true;
 
     int32_t myMac = 0;
+
+    //Scene signatures of the back buffer and of the panel
+    uint32_t _composedScene = 0;
+    uint32_t _presentedScene = 0;
+    uint32_t _presentedAt = 0;
+    uint32_t _changedAt = 0;
+    bool _dimmed = false;
+    uint8_t _onBudget = 0;
+    Stats _stats;
+
+    static const int16_t HEALTH_BAR_HEIGHT = 2;
+
+    void compose(const CharacterList& characters);
+    uint32_t sceneSignature(const CharacterList& characters) const;
+    void adaptRate(uint32_t frameUs);
+    void composeBackground();
+    void drawTile(uint8_t tile, int16_t x, int16_t y, int16_t worldX, int16_t worldY);
+    void restore(Rect rect);
+    void drawHealthBar(Character& character, int16_t x, int16_t y);
 };
@@ -0,0 +1,82 @@
+// frame_cache.h
+//
+// Decoded sprite frames in internal RAM. Sheets are const arrays in flash, and every pixel
+// drawn from one goes through the flash cache, which thrashes as soon as a frame draws a few
+// different sheets. The first time a frame is drawn, Sprite copies it here, cropped to its
+// opaque box and mirrored if it faces left, and every later draw reads the copy. Facing
+// either way then costs the same.
+//
+// Entries are kept up to FRAME_CACHE_BYTES in total; past that, the least recently used go
+// first. A frame bigger than the whole budget isn't cached and is drawn from flash.
+
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef FRAME_CACHE_BYTES
+#define FRAME_CACHE_BYTES 32768
+#endif
+
+class FrameCache {
+public:
+    static const uint8_t MAX_ENTRIES = 32;
+
+    struct Frame {
+        const void* sheet = nullptr;
+        uint8_t index = 0;
+        bool mirrored = false;
+        int16_t x = 0;           //crop within the frame as drawn
+        int16_t y = 0;
+        uint16_t width = 0;
+        uint16_t height = 0;
+        uint16_t* pixels = nullptr;   //width * height, row-major, transparent pixels kept
+        uint32_t lastUsed = 0;        //0 while unused
+    };
+
+    struct Stats {
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        uint32_t evictions = 0;
+        uint32_t bytes = 0;              //held now
+        uint32_t flashBytes = 0;         //read from sheets since the last endFrame()
+        uint32_t flashBytesLastFrame = 0;
+    };
+
+    explicit FrameCache(size_t budget = FRAME_CACHE_BYTES) : _budget(budget) {}
+    ~FrameCache();
+
+    //Marks the entry used; nullptr on a miss
+    const Frame* find(const void* sheet, uint8_t index, bool mirrored);
+
+    //Room for a width x height crop, evicting as needed. The caller fills pixels. nullptr if
+    //it can never fit
+    Frame* insert(const void* sheet, uint8_t index, bool mirrored, int16_t x, int16_t y,
+                  uint16_t width, uint16_t height);
+
+    void countFlashRead(uint32_t bytes) { _stats.flashBytes += bytes; }
+
+    //Called once per presented frame, rolls the per-frame counters
+    void endFrame();
+
+    //Evicts down to the new budget
+    void setBudget(size_t bytes);
+    void clear();
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    size_t _budget;
+    uint32_t _uses = 0;
+    Frame _entries[MAX_ENTRIES];
+    Stats _stats;
+
+    Frame* freeSlot();
+    void evict(Frame& entry);
+    bool evictOldest();
+};
+
+extern FrameCache frameCache;
+
+#endif //FRAME_CACHE_H
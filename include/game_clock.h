@@ -0,0 +1,38 @@
+// game_clock.h
+//
+// Time as the simulation sees it. Battle latches millis() once at the start of every tick, and
+// AI, animation and the Comms timers read gameClock.now() instead of millis(). Everything in a
+// tick sees the same instant, and a recorded session replayed with its tick times runs exactly
+// as it did live.
+
+#ifndef GAME_CLOCK_H
+#define GAME_CLOCK_H
+
+#include <stdint.h>
+
+class GameClock {
+public:
+    uint32_t now() const { return _now; }
+
+    //Ticks since start()
+    uint32_t ticks() const { return _ticks; }
+
+    //Sets the time before the first tick
+    void start(uint32_t nowMs) {
+        _now = nowMs;
+        _ticks = 0;
+    }
+
+    void tick(uint32_t nowMs) {
+        _now = nowMs;
+        _ticks++;
+    }
+
+private:
+    uint32_t _now = 0;
+    uint32_t _ticks = 0;
+};
+
+extern GameClock gameClock;
+
+#endif //GAME_CLOCK_H
@@ -0,0 +1,31 @@
+// game_random.h
+//
+// Random numbers for the simulation. A fixed xorshift generator instead of rand(), so one seed
+// gives the same sequence on the ESP32 and on a host replaying a recorded session.
+
+#ifndef GAME_RANDOM_H
+#define GAME_RANDOM_H
+
+#include <stdint.h>
+
+class GameRandom {
+public:
+    void seed(uint32_t seed) { _state = seed ? seed : 1; }
+
+    uint32_t next() {
+        _state ^= _state << 13;
+        _state ^= _state >> 17;
+        _state ^= _state << 5;
+        return _state;
+    }
+
+    //In [0, 1)
+    float nextFloat() { return (next() >> 8) * (1.0f / 16777216.0f); }
+
+private:
+    uint32_t _state = 1;
+};
+
+extern GameRandom gameRandom;
+
+#endif //GAME_RANDOM_H
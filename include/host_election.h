@@ -0,0 +1,67 @@
+// host_election.h
+//
+// Mesh-wide host election. Every cube floods its view of the election to its neighbors in
+// link keepalives:
+//   [epoch(2)][host(4)][beat(2)][lost host(4)]
+// A view with a higher epoch wins; within an epoch the higher host MAC wins, and a cube that
+// adopts a view puts itself forward if its own MAC is higher, so the whole mesh settles on its
+// highest MAC. The host bumps beat every keepalive and cubes relay the newest beat they have
+// seen. Once it stops advancing the host is gone: the cube that notices starts the next epoch
+// and names the lost host, so every cube learns which one left.
+//
+// HostElection does no I/O. Comms sends writeView() in keepalives and feeds received views
+// to onView().
+
+#ifndef HOST_ELECTION_H
+#define HOST_ELECTION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_KEEPALIVE 0x0A
+
+class HostElection {
+public:
+    static const size_t VIEW_LEN = 12;
+    static const uint32_t BEAT_INTERVAL_MS = 50;
+    static const uint32_t HOST_LOST_MS = 200;   //no new beat for this long
+
+    struct Stats {
+        uint16_t elections = 0;       //views adopted from a newer epoch, or started here
+        uint16_t hostLosses = 0;      //epochs started here because the beat stopped
+        uint32_t failoverMs = 0;      //last beat of the lost host to the current host
+    };
+
+    void begin(uint32_t myMac, uint32_t now);
+
+    //Advances the beat on the host and watches it everywhere else.
+    //connected is false while the cube has no neighbors, which makes it its own host
+    void update(uint32_t now, bool connected);
+
+    size_t writeView(uint8_t* out) const;
+
+    //Returns true if the view outranked ours and was adopted
+    bool onView(const uint8_t* in, size_t len, uint32_t now);
+
+    uint32_t host() const { return _host; }
+    uint16_t epoch() const { return _epoch; }
+    bool isHost() const { return _host == _myMac; }
+
+    //Host whose loss started the current epoch, 0 if none or once it wins again
+    uint32_t lostHost() const { return _lostHost; }
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    uint32_t _myMac = 0;
+    uint16_t _epoch = 0;
+    uint32_t _host = 0;
+    uint16_t _beat = 0;
+    uint32_t _beatAt = 0;       //when the beat last advanced
+    uint32_t _lostHost = 0;
+    uint32_t _lostBeatAt = 0;   //last beat of the lost host, for failover timing
+
+    Stats _stats;
+};
+
+#endif //HOST_ELECTION_H
@@ -0,0 +1,77 @@
+// identity.h
+//
+// Device identities. Every cube is known by its full 48-bit MAC, which neighbors learn from
+// heartbeats when a link comes up. On the wire a cube is named by a one-byte session ID (sid)
+// that the host hands out, so packet headers and state records stay short:
+//   PACKET_JOIN    [device id(6)][previous sid]          client asks the host for a sid
+//   PACKET_ASSIGN  [flags]{[sid][device id(6)]}...       host's whole table, relayed mesh-wide
+// The host floods its table after every join, split over as many messages as it takes. The
+// first message clears the receiver's copy, so every cube ends up with the same table and a
+// client promoted to host carries on with it; the other cubes keep their sids across a failover.
+//
+// Inside a cube the identity stays the 32-bit key the maps and the election are keyed by.
+// The key is a hash of all 48 bits, and the host refuses a device whose key is already taken
+// by a different MAC instead of letting the two be confused.
+
+#ifndef IDENTITY_H
+#define IDENTITY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "mac_table.h"
+
+typedef uint64_t DeviceId;  //48-bit MAC
+
+#define PACKET_JOIN   0x0B
+#define PACKET_ASSIGN 0x0C
+
+#define DEVICE_ID_LEN 6
+#define ASSIGN_FIRST  0x01   //receiver drops its table first
+#define ASSIGN_LAST   0x02   //table complete
+
+class IdentityTable {
+public:
+    static const uint8_t NO_SID = 0;
+    static const uint8_t MAX_SID = 64;
+
+    //32-bit key of a device, never 0
+    static uint32_t keyFor(DeviceId id);
+
+    static void writeId(uint8_t* out, DeviceId id);
+    static DeviceId readId(const uint8_t* in);
+
+    //Host only. Returns the device's sid, binding it to hint if that one is free and to the
+    //lowest free sid otherwise. NO_SID if the table is full or the key collides
+    uint8_t assign(DeviceId id, uint8_t hint);
+
+    //Records a binding announced by the host, replacing whatever either side was bound to
+    void bind(uint8_t sid, DeviceId id);
+    void release(uint8_t sid);
+    void clear();
+
+    //0 if the sid is not bound
+    uint32_t keyOf(uint8_t sid) const;
+    DeviceId idOf(uint8_t sid) const;
+
+    //NO_SID if the key is not bound
+    uint8_t sidOf(uint32_t key) const;
+
+    uint8_t size() const { return _count; }
+    uint16_t collisions() const { return _collisions; }
+
+private:
+    struct Entry {
+        DeviceId id;
+        uint32_t key;
+        bool used;
+    };
+
+    Entry _entries[MAX_SID + 1] = {};
+    MacTable<uint8_t, MAX_SID * 2> _sidByKey;
+    uint8_t _count = 0;
+    uint16_t _collisions = 0;
+
+    uint8_t find(DeviceId id) const;
+};
+
+#endif //IDENTITY_H
@@ -0,0 +1,96 @@
+// link_rate.h
+//
+// Per-face baud rate negotiation. Every link comes up at the safe base rate. The side with
+// the higher MAC then climbs a doubling ladder: it proposes the next rate, both ends switch,
+// and a few CRC-checked test patterns must come back clean before the rate is kept. A pattern
+// the responder missed while still switching goes again. The responder also keeps the rate
+// without the COMMIT once clean traffic shows the initiator did. A failed probe reverts and
+// caps the ladder for a while. A rising error rate or a silent link steps back down on its own.
+//
+// LinkRate does no I/O. Comms feeds it probe packets and RX outcomes, sends whatever probe
+// payload it returns on the same face, and applies baud() to the transport once TX is idle.
+// Until then the face only sends the probe, so a busy face still goes quiet for the switch.
+
+#ifndef LINK_RATE_H
+#define LINK_RATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_LINK_PROBE 0x03
+
+class LinkRate {
+public:
+    static const uint8_t MAX_STEP = 5;            //base << 5, 3.6864 Mbaud from 115200
+    static const size_t PATTERN_LEN = 48;
+    static const size_t MAX_PROBE_LEN = 3 + PATTERN_LEN + 2;
+
+    struct Stats {
+        uint16_t upgrades = 0;
+        uint16_t failedProbes = 0;
+        uint16_t fallbacks = 0;
+    };
+
+    void begin(uint32_t baseBaud);
+
+    //Drops back to the base rate, e.g. when the neighbor disconnects
+    void reset(uint32_t now);
+
+    //Only the initiator proposes rate changes; the other side just answers
+    void setLink(bool connected, bool initiator);
+
+    //Advances timers. applied is true once the transport runs at baud().
+    //Returns the length of a probe payload written to out, 0 if none
+    size_t update(uint32_t now, bool applied, uint8_t* out);
+
+    //Handles a PACKET_LINK_PROBE payload. Same return convention as update()
+    size_t onProbe(const uint8_t* in, size_t len, uint32_t now, uint8_t* out);
+
+    //Outcome of every frame received on this face, for the error-rate fallback
+    void onRxOk(uint32_t now);
+    void onRxError(uint32_t now, uint16_t count = 1);
+
+    uint32_t baud() const { return _baseBaud << _step; }
+    bool isProbing() const { return _state != IDLE; }
+    uint8_t step() const { return _step; }
+    const Stats& getStats() const { return _stats; }
+
+private:
+    enum Op : uint8_t { OP_PROPOSE = 1, OP_ACCEPT, OP_TEST, OP_TEST_OK, OP_COMMIT, OP_DOWNSHIFT };
+    enum State : uint8_t { IDLE, PROPOSED, TESTING, AWAIT_TEST };
+
+    uint32_t _baseBaud = 115200;
+    uint8_t _step = 0;
+    uint8_t _prevStep = 0;
+    uint8_t _ceiling = MAX_STEP;
+    State _state = IDLE;
+    uint8_t _round = 0;
+    bool _testSent = false;
+    uint32_t _testSentAt = 0;
+    bool _finalAnswered = false;     //responder: last TEST_OK sent, only COMMIT outstanding
+    uint32_t _finalAnsweredAt = 0;
+    bool _connected = false;
+    bool _initiator = false;
+
+    uint32_t _deadline = 0;
+    uint32_t _nextProbeAt = 0;
+    uint32_t _ceilingResetAt = 0;
+    uint32_t _lastRxOk = 0;
+    uint32_t _windowStart = 0;
+    uint16_t _windowOk = 0;
+    uint16_t _windowErrors = 0;
+    uint8_t _badWindows = 0;
+
+    Stats _stats;
+
+    void restartWindow(uint32_t now);
+    void failProbe(uint32_t now);
+    void stepDown(uint32_t now);
+    size_t writeProbe(uint8_t* out, Op op, uint8_t step, uint8_t round) const;
+    static void fillPattern(uint8_t* dst, uint8_t step, uint8_t round);
+};
+
+//CRC-16/CCITT-FALSE, shared with anything else that checks frames
+uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = 0xFFFF);
+
+#endif //LINK_RATE_H
@@ -0,0 +1,130 @@
+// mac_table.h
+//
+// Fixed-capacity open-addressing hash table keyed by 32-bit MAC hash.
+// Linear probing with backward-shift deletion, so there are no tombstones and no heap use.
+// MAC 0 is reserved as the empty marker and can never be stored.
+
+#ifndef MAC_TABLE_H
+#define MAC_TABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+template <typename T, uint16_t Capacity>
+class MacTable {
+    static_assert((Capacity & (Capacity - 1)) == 0, "MacTable capacity must be a power of two");
+
+public:
+    //Keep probe chains short by refusing inserts past 3/4 load
+    static const uint16_t MAX_ENTRIES = Capacity - Capacity / 4;
+
+    MacTable() { clear(); }
+
+    void clear() {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            _slots[i].mac = 0;
+        }
+        _count = 0;
+    }
+
+    uint16_t size() const { return _count; }
+    bool contains(uint32_t mac) const { return find(mac) != nullptr; }
+
+    //Returns nullptr if not found
+    T* find(uint32_t mac) {
+        int16_t idx = indexOf(mac);
+        return (idx < 0) ? nullptr : &_slots[idx].value;
+    }
+
+    const T* find(uint32_t mac) const {
+        int16_t idx = indexOf(mac);
+        return (idx < 0) ? nullptr : &_slots[idx].value;
+    }
+
+    //Inserts or overwrites. Returns nullptr if the table is full
+    T* insert(uint32_t mac, const T& value) {
+        if (mac == 0) return nullptr;
+
+        uint16_t i = home(mac);
+        while (_slots[i].mac != 0) {
+            if (_slots[i].mac == mac) {
+                _slots[i].value = value;
+                return &_slots[i].value;
+            }
+            i = (i + 1) & (Capacity - 1);
+        }
+
+        if (_count >= MAX_ENTRIES) return nullptr;
+
+        _slots[i].mac = mac;
+        _slots[i].value = value;
+        _count++;
+        return &_slots[i].value;
+    }
+
+    bool erase(uint32_t mac) {
+        int16_t found = indexOf(mac);
+        if (found < 0) return false;
+
+        //Shift later members of the probe chain back so lookups never hit a hole
+        uint16_t hole = found;
+        uint16_t j = hole;
+        while (true) {
+            j = (j + 1) & (Capacity - 1);
+            if (_slots[j].mac == 0) break;
+
+            uint16_t k = home(_slots[j].mac);
+            bool staysPut = (hole <= j) ? (hole < k && k <= j) : (hole < k || k <= j);
+            if (!staysPut) {
+                _slots[hole] = _slots[j];
+                hole = j;
+            }
+        }
+
+        _slots[hole].mac = 0;
+        _count--;
+        return true;
+    }
+
+    //Calls fn(mac, value) for every entry, in slot order
+    template <typename Fn>
+    void forEach(Fn fn) {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (_slots[i].mac != 0) fn(_slots[i].mac, _slots[i].value);
+        }
+    }
+
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        for (uint16_t i = 0; i < Capacity; i++) {
+            if (_slots[i].mac != 0) fn(_slots[i].mac, _slots[i].value);
+        }
+    }
+
+private:
+    struct Slot {
+        uint32_t mac;
+        T value;
+    };
+
+    Slot _slots[Capacity];
+    uint16_t _count;
+
+    //Fibonacci hashing spreads the XOR-folded MAC bits across the table
+    static uint16_t home(uint32_t mac) {
+        return ((mac * 2654435761u) >> 16) & (Capacity - 1);
+    }
+
+    int16_t indexOf(uint32_t mac) const {
+        if (mac == 0) return -1;
+
+        uint16_t i = home(mac);
+        while (_slots[i].mac != 0) {
+            if (_slots[i].mac == mac) return i;
+            i = (i + 1) & (Capacity - 1);
+        }
+        return -1;
+    }
+};
+
+#endif //MAC_TABLE_H
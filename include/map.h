@@ -1,14 +1,53 @@
 #pragma once
-#include <map>
-#include <vector>
 #include <cstdint>
+#include <cstring>
+#include "mac_table.h"
+#include "terrain.h"
 
+#define MAX_CUBES 32
+#define MAX_PATH_LEN 32
+#define NUM_CUBE_SIDES 4
 
+//Sides from host to a cube, stored inline as 2-bit directions (LSB first).
+//Same byte layout as the heartbeat path payload, so it can be sent as-is
+struct PackedPath {
+    uint8_t length = 0;
+    uint8_t bytes[(MAX_PATH_LEN + 3) / 4] = {};
+
+    uint8_t byteCount() const { return (length + 3) / 4; }
+    uint8_t get(uint8_t i) const { return (bytes[i >> 2] >> ((i & 3) * 2)) & 0x03; }
+
+    //Returns false once the path is full
+    bool push(uint8_t side) {
+        if (length >= MAX_PATH_LEN) return false;
+        bytes[length >> 2] |= (side & 0x03) << ((length & 3) * 2);
+        length++;
+        return true;
+    }
+
+    //Loads len directions from packed bytes, dropping any padding in the last byte
+    void assign(const uint8_t* packed, size_t packedLen, uint8_t len) {
+        *this = PackedPath();
+        if (len > packedLen * 4) len = packedLen * 4;
+        if (len > MAX_PATH_LEN) len = MAX_PATH_LEN;
+        for (uint8_t i = 0; i < len; i++) {
+            push((packed[i >> 2] >> ((i & 3) * 2)) & 0x03);
+        }
+    }
+};
+
+//Node of the topology tree rooted at the host. Coordinates and path are cached
+//from the parent, so attaching a cube never rewalks the path from host
 struct Cube {
     int16_t x;
     int16_t y;
     bool isHost;
-    std::vector<uint8_t> pathFromHost;
+    PackedPath pathFromHost;
+    uint32_t parentMac;                  //0 for the host or a cube whose ancestors are unknown
+    uint8_t sideFromParent;
+    uint32_t children[NUM_CUBE_SIDES];   //by side, 0 = empty
+    bool hasTerrain;
+    uint8_t terrain[TERRAIN_BYTES];      //tile ids, see terrain.h
 };
 
 class Map {
@@ -17,16 +56,74 @@ public:
 
     const Cube* getCubeInfo(uint32_t mac) const;
     void addCube(uint32_t newMac, uint32_t referenceMac, int sideFromThis);
-    void addCubeWithPath(uint32_t mac, const std::vector<uint8_t>& path);
+    //A cube whose ancestors aren't known yet, or whose face is still held by another cube,
+    //is placed as an orphan by its path's offsets and linked once its parent's place frees up
+    void addCubeWithPath(uint32_t mac, const PackedPath& path);
+    //Also prunes every cube that was reached through mac, orphans included
     void removeCube(uint32_t mac);
 
-    std::vector<uint8_t> getPathFromHost(uint32_t mac) const;
+    //Makes mac the host of the tree without dropping anyone: edges on the way up to the old
+    //host are reversed and coordinates recomputed. Returns false if mac isn't linked to the host
+    bool reroot(uint32_t mac);
+    uint32_t getRootMac() const { return _rootMac; }
+
+    //Bumped on every topology change, so consumers can skip work when it hasn't moved
+    uint32_t getVersion() const;
+
+    PackedPath getPathFromHost(uint32_t mac) const;
     bool isCharacterInCubeBounds(uint32_t cubeMac, int16_t charX, int16_t charY) const;
     bool isCharacterInWorld(int16_t charX, int16_t charY) const;
 
+    //True if every pixel of the rectangle lies on some cube. O(1) for sprite-sized rects
+    bool isRectInWorld(int16_t x, int16_t y, int16_t width, int16_t height) const;
+
     void setMyMac(uint32_t mac);
 
+    //False if the cube isn't on the map
+    bool setTerrain(uint32_t mac, const uint8_t* packed);
+    //Tile under a world point, TERRAIN_VOID off the map or where the host hasn't sent any yet
+    uint8_t getTerrainAt(int16_t x, int16_t y) const;
+    //Bumped whenever a cube's terrain arrives, apart from the topology version
+    uint32_t getTerrainVersion() const { return _terrainVersion; }
+
+    uint16_t cubeCount() const { return cubes.size(); }
+    template <typename Fn>
+    void forEachCube(Fn fn) const { cubes.forEach(fn); }
+
+    //Tile grid behind the world tests, one tile per cube. Tile (0, 0) is at the world's min corner
+    int16_t getGridMinX() const { return _gridMinX; }
+    int16_t getGridMinY() const { return _gridMinY; }
+    uint16_t getGridCols() const { return _gridCols; }
+    uint16_t getGridRows() const { return _gridRows; }
+    bool isTileOccupied(int32_t tileX, int32_t tileY) const;
+
+    static const int16_t CUBE_SIZE = 128;
+    static const uint8_t CUBE_SHIFT = 7;
+
 private:
-    std::map<uint32_t, Cube> cubes;
+    MacTable<Cube, MAX_CUBES * 2> cubes;   //never holds more than MAX_CUBES
     uint32_t myMac = 0;
+    uint32_t _rootMac = 0;
+    uint32_t _version = 0;
+    uint32_t _terrainVersion = 0;
+
+    void attach(uint32_t mac, uint32_t parentMac, uint8_t side, const PackedPath& path);
+    void unlinkFromParent(uint32_t mac);
+    void refreshSubtree(uint32_t mac);
+    static bool samePath(const PackedPath& a, const PackedPath& b);
+    static bool startsWith(const PackedPath& path, const PackedPath& prefix);
+    bool isOrphan(uint32_t mac, const Cube& cube) const;
+    bool isLinked(uint32_t mac) const;
+    void pruneUnlinked(const PackedPath* under);
+    void adoptOrphans();
+
+    //One bit per cube tile, row-major from the world's min corner.
+    //Rebuilt whenever cubes are added or removed
+    uint32_t _occupancy[(MAX_CUBES * MAX_CUBES + 31) / 32] = {};
+    int16_t _gridMinX = 0;
+    int16_t _gridMinY = 0;
+    uint16_t _gridCols = 0;
+    uint16_t _gridRows = 0;
+
+    void rebuildOccupancy();
 };
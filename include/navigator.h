@@ -0,0 +1,94 @@
+// navigator.h
+//
+// Flow fields over the cube world, so chasing and fleeing get around the corners of L-shaped
+// and sparse layouts instead of pushing into an edge. The world is cut into NAV_CELL_SIZE
+// cells, CELLS_PER_SIDE by CELLS_PER_SIDE per cube. A cell is walkable if a character's
+// footprint centered on it lies on the cubes.
+//
+// A field holds every cell's walking distance to one target, built breadth-first from the
+// target's cell. Fields are keyed by target, so all chasers of a target share one, and a
+// field is only rebuilt when the map version changes or the target moves to another cell.
+// After that, steering is a lookup of a few neighbouring cells per character.
+//
+// Up to MAX_FIELDS targets are kept; the least recently used is rebuilt for a new one.
+
+#ifndef NAVIGATOR_H
+#define NAVIGATOR_H
+
+#include <stdint.h>
+#include "map.h"
+
+class Navigator {
+public:
+    static const uint8_t NAV_SHIFT = 5;
+    static const int16_t NAV_CELL_SIZE = 1 << NAV_SHIFT;
+    static const uint8_t CELLS_PER_SIDE = Map::CUBE_SIZE / NAV_CELL_SIZE;
+    static const uint8_t CELLS_PER_TILE = CELLS_PER_SIDE * CELLS_PER_SIDE;
+    static const uint16_t MAX_CELLS = MAX_CUBES * CELLS_PER_TILE;
+    static const uint8_t MAX_FIELDS = 8;
+    static const uint16_t UNREACHABLE = 0xFFFF;
+
+    struct Stats {
+        uint32_t builds = 0;     //fields built or rebuilt
+        uint32_t topology = 0;   //cell grid rebuilds after map changes
+    };
+
+    explicit Navigator(const Map* map) : _map(map) {}
+
+    //Grows the footprint walkable cells must fit, to the largest sprite seen
+    void fitFootprint(uint16_t width, uint16_t height);
+
+    //Direction from (x, y) to the next cell on the shortest walk to the target whose key and
+    //position name the field. Points are sprite centers. False when the target is a cell
+    //away or less, or can't be reached: then a straight line is as good
+    bool toward(uint32_t key, int16_t x, int16_t y, int16_t targetX, int16_t targetY, float& dx, float& dy);
+
+    //Direction to the neighbouring cell that walks furthest from the target. False when
+    //cornered, i.e. no neighbour is further away
+    bool awayFrom(uint32_t key, int16_t x, int16_t y, int16_t targetX, int16_t targetY, float& dx, float& dy);
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    struct Field {
+        uint32_t key = 0;
+        int16_t source = -1;     //-1 once the cells under it changed
+        uint32_t lastUsed = 0;   //0 while unused
+        uint16_t dist[MAX_CELLS];
+    };
+
+    const Map* _map;
+    bool _dirty = true;
+    uint32_t _version = 0;
+    uint16_t _footprintW = 0;
+    uint16_t _footprintH = 0;
+    uint32_t _uses = 0;
+    Stats _stats;
+
+    //Slot of every occupied tile, row-major over the map's grid; cells are numbered by slot
+    uint8_t _tileSlot[MAX_CUBES * MAX_CUBES];
+    uint8_t _slotX[MAX_CUBES];
+    uint8_t _slotY[MAX_CUBES];
+    uint8_t _slots = 0;
+    uint32_t _walkable[(MAX_CELLS + 31) / 32];
+
+    Field _fields[MAX_FIELDS];
+    uint16_t _queue[MAX_CELLS];
+
+    void sync();
+    int16_t cellAt(int32_t cellX, int32_t cellY) const;
+    int16_t cellOf(int16_t x, int16_t y) const;
+    void cellCoords(int16_t cell, int32_t& cellX, int32_t& cellY) const;
+    void cellCenter(int16_t cell, int16_t& x, int16_t& y) const;
+    bool isWalkable(int16_t cell) const { return (_walkable[cell >> 5] >> (cell & 31)) & 1; }
+
+    const Field* field(uint32_t key, int16_t source);
+    void build(Field& field, int16_t source);
+
+    //Best neighbour nearer to (or further from) the target than cell, -1 if none. Unreachable
+    //cells, e.g. one the character stands in off-center, also look at the diagonals
+    int16_t bestNeighbour(const Field& field, int16_t cell, bool furthest) const;
+    bool steer(const Field& field, int16_t x, int16_t y, int16_t cell, bool furthest, float& dx, float& dy) const;
+};
+
+#endif //NAVIGATOR_H
@@ -0,0 +1,78 @@
+// packet_capture.h
+//
+// Optional capture of raw frames on every face, for finding bandwidth hogs and retransmit
+// storms without text logging on the link. Frames are kept as they crossed the wire, batches
+// included, in a byte ring (PSRAM when the board has it). Once full, the oldest frames go.
+//
+// exportPcap() writes a standard pcap file with link type USER0, so Wireshark opens it too.
+// Each packet starts with a 2-byte pseudo header [side][direction] ahead of the frame.
+// tools/capture_decode.py knows our tags.
+
+#ifndef PACKET_CAPTURE_H
+#define PACKET_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class PacketCapture {
+public:
+    enum Direction : uint8_t {
+        DIR_IN = 0,
+        DIR_OUT = 1
+    };
+
+    static const size_t DEFAULT_BYTES = 16384;
+    static const uint32_t LINKTYPE_USER0 = 147;
+
+    struct Stats {
+        uint32_t records = 0;   //captured since start()
+        uint32_t evicted = 0;   //overwritten before export
+    };
+
+    typedef void (*Sink)(const uint8_t* data, size_t len, void* ctx);
+
+    PacketCapture() {}
+    ~PacketCapture();
+
+    //Allocates the ring and starts recording. Returns false if there is no memory
+    bool start(size_t bytes = DEFAULT_BYTES);
+
+    //Stops recording and keeps the frames for export
+    void stop() { _active = false; }
+
+    //Frees the ring
+    void clear();
+
+    bool active() const { return _active; }
+    size_t capacity() const { return _size; }
+
+    void record(uint32_t timeUs, uint8_t side, Direction dir, const uint8_t* frame, size_t len);
+
+    //Size of exportPcap()'s output
+    size_t pcapSize() const;
+
+    //Streams the frames in the ring, oldest first, as a pcap file
+    void exportPcap(Sink sink, void* ctx) const;
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    static const size_t RECORD_HEADER = 8;   //[time us(4)][side][dir][len(2)], big-endian
+
+    uint8_t* _buf = nullptr;
+    size_t _size = 0;
+    size_t _head = 0;    //next write
+    size_t _tail = 0;    //oldest record
+    size_t _used = 0;
+    uint32_t _count = 0;
+    bool _active = false;
+    Stats _stats;
+
+    PacketCapture(const PacketCapture&);
+    PacketCapture& operator=(const PacketCapture&);
+
+    void put(const uint8_t* data, size_t len);
+    void peek(size_t pos, uint8_t* out, size_t len) const;
+};
+
+#endif //PACKET_CAPTURE_H
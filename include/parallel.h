@@ -0,0 +1,50 @@
+// parallel.h
+//
+// parallelFor for the independent phases of the character update. Host builds with
+// -DUPDATE_THREADS=N split large loops into N contiguous chunks, one per thread, so big
+// simulated battles use every core. The device, and the default host build, run the loop
+// inline on the calling task.
+//
+// Bodies must only write state owned by their index and must not draw from gameRandom, so
+// the outcome is the same for any thread count and replays still match.
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+#ifndef UPDATE_THREADS
+#define UPDATE_THREADS 1
+#endif
+
+#if UPDATE_THREADS > 1 && !defined(ESP_PLATFORM)
+#include <thread>
+#include <vector>
+#endif
+
+//Below this many items per thread, starting the threads costs more than they save
+static const size_t PARALLEL_MIN_CHUNK = 32;
+
+template <typename F>
+void parallelFor(size_t count, F body) {
+#if UPDATE_THREADS > 1 && !defined(ESP_PLATFORM)
+    size_t threads = count / PARALLEL_MIN_CHUNK;
+    if (threads > UPDATE_THREADS) threads = UPDATE_THREADS;
+    if (threads > 1) {
+        size_t chunk = (count + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        for (size_t begin = chunk; begin < count; begin += chunk) {
+            size_t end = begin + chunk < count ? begin + chunk : count;
+            workers.emplace_back([&body, begin, end]() {
+                for (size_t i = begin; i < end; i++) body(i);
+            });
+        }
+        for (size_t i = 0; i < chunk; i++) body(i);
+        for (auto& worker : workers) worker.join();
+        return;
+    }
+#endif
+    for (size_t i = 0; i < count; i++) body(i);
+}
+
+#endif //PARALLEL_H
@@ -0,0 +1,129 @@
+// power.h
+//
+// Low-power idle between ticks. loop() used to run Battle::update back to back at full clock,
+// so a cube on its own with one idle pet drew as much as a busy host. After each tick the
+// PowerManager picks a mode from what the tick left behind:
+//
+//   ACTIVE  connected and something on screen moved within POWER_QUIET_MS: full clock, next
+//           tick straight away, as before
+//   DOZE    connected and still, or frames still leaving a face: POWER_IDLE_MHZ, blocked on
+//           the UART events until data arrives or the tick period is up
+//   SLEEP   no neighbors and nothing to send: light sleep until the tick period is up or a
+//           face sees incoming data
+//
+// The UARTs stop in light sleep, so bytes arriving then only wake the chip and are lost. That's
+// why a connected cube never sleeps, only dozes. A neighbor plugged into a sleeping cube loses
+// the frame that woke it, and only a heartbeat connects a face, so after a wake from data the
+// cube dozes until a neighbor connects or HEARTBEAT_INTERVAL_MS has passed. Nothing waits
+// longer than POWER_TICK_MS, so our own keepalives still leave on time.
+//
+// The simulation only sees tick times, so idling changes how often it ticks but never what a
+// tick does, and recorded sessions replay the same. The backlight dims after POWER_DIM_MS
+// without a change on screen.
+//
+// Time is read from a microsecond clock as in MemoryTransport, so a host simulation can run
+// the manager on virtual time and check how long incoming frames wait against the heartbeat
+// deadline.
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+//Tick period when not ACTIVE. Every second tick is due to present a DISPLAY_FRAME_MS frame,
+//and it's well inside BEAT_INTERVAL_MS
+#ifndef POWER_TICK_MS
+#define POWER_TICK_MS 17
+#endif
+
+//How long a connected cube's screen has to stay still before it dozes. Keeps the clock from
+//flapping between frames of a moving scene
+#ifndef POWER_QUIET_MS
+#define POWER_QUIET_MS 500
+#endif
+
+#ifndef POWER_DIM_MS
+#define POWER_DIM_MS 10000
+#endif
+
+#ifndef POWER_ACTIVE_MHZ
+#define POWER_ACTIVE_MHZ 240
+#endif
+
+//Lowest clock that keeps the APB bus, and so the UART baud rates, at 80 MHz
+#ifndef POWER_IDLE_MHZ
+#define POWER_IDLE_MHZ 80
+#endif
+
+//Typical ESP32 supply current in each mode, radio off, for the estimate. The panel isn't counted
+#ifndef POWER_ACTIVE_UA
+#define POWER_ACTIVE_UA 50000
+#endif
+#ifndef POWER_DOZE_UA
+#define POWER_DOZE_UA 15000
+#endif
+#ifndef POWER_SLEEP_UA
+#define POWER_SLEEP_UA 800
+#endif
+
+class Battle;
+
+class PowerManager {
+public:
+    //Clock in microseconds, so simulations can run on virtual time
+    typedef uint32_t (*ClockFn)();
+
+    enum Mode : uint8_t {
+        POWER_ACTIVE = 0,
+        POWER_DOZE,
+        POWER_SLEEP,
+        NUM_POWER_MODES
+    };
+
+    struct Stats {
+        uint64_t awakeUs = 0;          //ticks, and the time between ACTIVE ticks
+        uint64_t dozeUs = 0;
+        uint64_t sleepUs = 0;
+        uint32_t ticks[NUM_POWER_MODES] = {};   //ticks followed by each mode
+        uint32_t sleeps = 0;
+        uint32_t rxWakes = 0;          //dozes and sleeps cut short by incoming data
+        uint32_t wakeLatencyUs = 0;    //from the last RX wake to the tick that reads it
+        uint32_t wakeLatencyUsMax = 0;
+    };
+
+    explicit PowerManager(ClockFn clock);
+
+    //Starts the first tick, and lets the debug console wake the chip. The faces wake it once
+    //Comms::enableRxWakeup() has run
+    void begin();
+
+    //Call after every tick: waits out the rest of the tick period in the quietest mode the
+    //cube allows, and dims the backlight on a still screen
+    void idle(Battle& battle);
+
+    Mode getMode() const { return _mode; }
+
+    //Percent of the time awake since begin(), and the average supply current that implies.
+    //Awake time is billed at POWER_ACTIVE_UA even while the clock is down
+    uint8_t dutyCycle() const;
+    uint32_t estimatedUa() const;
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    ClockFn _clock;
+    Mode _mode = POWER_ACTIVE;
+    uint32_t _tickStart = 0;
+    uint32_t _wokeAt = 0;
+    bool _rxWake = false;
+    bool _wakeHold = false;   //dozing after a wake until a neighbor connects
+    Stats _stats;
+
+    Mode chooseMode(Battle& battle);
+    void setMode(Mode mode);
+    void wait(Battle& battle, uint32_t us);
+};
+
+extern PowerManager power;
+
+#endif //POWER_H
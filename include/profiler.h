@@ -0,0 +1,96 @@
+// profiler.h
+//
+// Frame-time profiler. Each stage of Battle::update is timed with a scoped cycle counter
+// (ESP.getCycleCount() on the device, steady_clock on the host) and the last RING_SIZE
+// samples of every stage are kept in microseconds, so min/avg/p99 always describe recent
+// frames. Recording is two counter reads and one store per stage, cheap enough to leave on.
+//
+// dumpToSerial() writes the rings to the debug serial port as one binary frame:
+//   [0xA5 0x5A 'P' 'F'][version][len(2)][body][sum]
+//   body: [stage count] then per stage [id][parent][samples][total frames(4)][sample(2)]...
+// sum is the low byte of the sum of the body. tools/profile_dump.py turns a serial capture
+// into a per-stage table and folded stacks for a flame graph.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Build with -DPROFILER_ENABLED=0 to compile the scopes out
+#ifndef PROFILER_ENABLED
+#define PROFILER_ENABLED 1
+#endif
+
+enum ProfileStage : uint8_t {
+    STAGE_FRAME = 0,    //whole Battle::update
+    STAGE_COMMS,
+    STAGE_CHARACTERS,   //Battle::updateCharacters, the phases below
+    STAGE_COMPOSE,      //Display::draw into the back buffer
+    STAGE_PUSH,         //pushSprite to the panel
+    STAGE_AI,           //perceive and decide
+    STAGE_MOVE,         //steer, separate, integrate
+    STAGE_COMBAT,
+    STAGE_ANIMATE,
+    NUM_STAGES
+};
+
+class Profiler {
+public:
+    static const uint8_t RING_SIZE = 128;
+    static const uint8_t DUMP_VERSION = 1;
+    static const size_t MAX_DUMP = 8 + 1 + NUM_STAGES * (7 + RING_SIZE * 2);
+
+    struct Summary {
+        uint16_t minUs;
+        uint16_t avgUs;
+        uint16_t p99Us;
+        uint16_t maxUs;
+        uint8_t samples;
+    };
+
+    Profiler();
+
+    static uint32_t now();
+
+    //Stores elapsed counter ticks since start, saturated at 65535us
+    void record(ProfileStage stage, uint32_t start);
+
+    //Over the samples in the ring
+    Summary summarize(ProfileStage stage) const;
+
+    size_t writeDump(uint8_t* out) const;
+
+    void dumpToSerial() const;
+
+private:
+    struct Ring {
+        uint16_t samples[RING_SIZE];
+        uint8_t next;
+        uint8_t count;
+        uint32_t total;
+    };
+
+    Ring _rings[NUM_STAGES];
+};
+
+extern Profiler profiler;
+
+//Times the rest of the enclosing block
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage) : _stage(stage), _start(Profiler::now()) {}
+    ~ProfileScope() { profiler.record(_stage, _start); }
+
+private:
+    ProfileStage _stage;
+    uint32_t _start;
+};
+
+#if PROFILER_ENABLED
+#define PROFILE_SCOPE(stage) ProfileScope _profileScope##stage(stage)
+#else
+#define PROFILE_SCOPE(stage)
+#endif
+
+#endif //PROFILER_H
@@ -0,0 +1,133 @@
+// reliable_link.h
+//
+// Reliable, ordered delivery of control messages over one face. Character state stays on the
+// lossy stream; joins, paths, spawns and host changes come through here so a single lost
+// frame can't leave a cube out of the game.
+//
+// Every PACKET_RELIABLE payload starts with
+//   [session][peer session][seq][ack][sack bits]
+// followed by at most one message. ack is the next seq expected from the peer and bit i of
+// the sack byte marks ack + 1 + i as already received, so only the holes are retransmitted.
+// A frame without a message is a plain ACK, and the same ACK also rides on keepalives, see
+// writeAck(). Messages sent while the window is full wait in a backlog. Sessions change whenever a side resets, which
+// restarts numbering on both ends; frames that don't echo the receiver's current session are
+// only answered with an ACK, so the first exchange on a fresh link costs one round trip.
+//
+// ReliableLink does no I/O. Comms sends whatever poll() returns on the same face and hands
+// received payloads to onFrame(), then collects messages in order with nextDelivery().
+
+#ifndef RELIABLE_LINK_H
+#define RELIABLE_LINK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_RELIABLE 0x05
+
+class ReliableLink {
+public:
+    static const uint8_t WINDOW = 8;            //messages in flight, and buffered out of order
+    static const uint8_t BACKLOG = 24;          //messages waiting for the window to open
+    static const size_t MAX_MESSAGE = 64;
+    static const size_t HEADER_LEN = 5;
+    static const size_t MAX_FRAME = HEADER_LEN + MAX_MESSAGE;
+    static const size_t ACK_LEN = 4;            //[session][peer session][ack][sack bits]
+
+    struct Stats {
+        uint32_t sent = 0;
+        uint32_t retransmits = 0;
+        uint32_t fastRetransmits = 0;   //holes reported by a sack, resent before the timeout
+        uint32_t delivered = 0;
+        uint32_t duplicates = 0;
+        uint32_t backlogged = 0;        //send() with the window full, sent once it opens
+        uint32_t rejected = 0;          //send() with the backlog full too, or an oversized message
+        uint16_t srttMs = 0;
+        uint16_t rtoMs = 0;
+    };
+
+    //Drops everything in flight and starts a new session. session must not be 0
+    void reset(uint8_t session);
+
+    //Queues a message for in-order delivery, behind the window if it's full.
+    //Returns false only if the backlog is full as well
+    bool send(const uint8_t* msg, size_t len);
+
+    //Next frame to transmit: a new message, a due retransmit, or a pending ACK.
+    //Returns its length, 0 if nothing is due
+    size_t poll(uint32_t now, uint8_t* out);
+
+    //Handles a PACKET_RELIABLE payload
+    void onFrame(const uint8_t* in, size_t len, uint32_t now);
+
+    //Writes the current ACK, ACK_LEN bytes, for a frame of another kind on this face, and
+    //clears any pending one
+    size_t writeAck(uint8_t* out);
+
+    //Handles an ACK written by the peer's writeAck()
+    void onPiggybackAck(const uint8_t* in, uint32_t now);
+
+    //Copies the next in-order message to out. Returns its length, 0 if none is ready
+    size_t nextDelivery(uint8_t* out);
+
+    //Messages sent but not acknowledged yet
+    uint8_t inFlight() const { return (uint8_t)(_nextSeq - _sendBase); }
+    uint8_t backlog() const { return _backlogCount; }
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    struct TxSlot {
+        uint8_t len;
+        bool sent;
+        bool sacked;
+        bool retransmitted;     //Karn: no RTT samples from these
+        bool fastRetransmit;
+        uint32_t sentAt;
+        uint8_t data[MAX_MESSAGE];
+    };
+
+    struct Pending {
+        uint8_t len;
+        uint8_t data[MAX_MESSAGE];
+    };
+
+    struct RxSlot {
+        bool have;
+        uint8_t len;
+        uint8_t data[MAX_MESSAGE];
+    };
+
+    uint8_t _session = 1;
+    uint8_t _peerSession = 0;   //0 until the peer is heard
+
+    TxSlot _tx[WINDOW] = {};
+    uint8_t _sendBase = 0;
+    uint8_t _nextSeq = 0;
+
+    Pending _backlog[BACKLOG] = {};
+    uint8_t _backlogHead = 0;
+    uint8_t _backlogCount = 0;
+
+    RxSlot _rx[WINDOW] = {};
+    uint8_t _recvNext = 0;
+    bool _ackPending = false;
+    bool _ackNow = false;
+    uint32_t _ackDueAt = 0;
+
+    bool _haveRtt = false;
+    uint32_t _srtt = 0;
+    uint32_t _rttvar = 0;
+    uint32_t _rto = 0;
+
+    Stats _stats;
+
+    void restartNumbering();
+    void enqueue(const uint8_t* msg, size_t len);
+    void fillWindow();
+    uint8_t sackBits() const;
+    void onAck(uint8_t ack, uint8_t sack, uint32_t now);
+    void sampleRtt(uint32_t rtt);
+    size_t writeFrame(uint8_t* out, uint8_t seq, const TxSlot* slot);
+};
+
+#endif //RELIABLE_LINK_H
@@ -0,0 +1,105 @@
+// session_recorder.h
+//
+// Records everything a battle depends on from outside, so it can be replayed bit for bit:
+// the seed, the time of every tick and every chunk of bytes read from a face. Topology events
+// and periodic hashes of the character state and the framebuffer go in too, so a replay can
+// tell exactly where it stopped matching. See session_replay.h.
+//
+// Recording has to start at boot, before the first tick. Build with
+// -DSESSION_RECORD_BYTES=<n> and Battle::init records into an n-byte buffer (PSRAM when the
+// board has it). Once the buffer is full, recording stops at the last complete tick.
+//
+// Session layout, big-endian:
+//   [version][seed(4)][device id(6)][start ms(4)] then records:
+//   REC_TICK        [dt ms]          ms since the previous tick, up to 254
+//   REC_TICK_LONG   [dt ms(4)]
+//   REC_RX | side   [len][bytes]     one Transport::read of that face
+//   REC_EVENT       [event][mac(4)]
+//   REC_CHECKPOINT  [state hash(4)][frame hash(4)]  every CHECKPOINT_TICKS ticks
+//
+// dumpToSerial() sends it to the debug port as [0xA5 0x5A 'S' 'N'][len(4)][session][sum],
+// sum being the low byte of the sum of the session bytes. tools/session_dump.py saves it.
+
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "identity.h"
+
+//Bytes to record from boot, 0 to not record
+#ifndef SESSION_RECORD_BYTES
+#define SESSION_RECORD_BYTES 0
+#endif
+
+class SessionRecorder {
+public:
+    static const uint8_t VERSION = 1;
+    static const size_t HEADER_LEN = 1 + 4 + DEVICE_ID_LEN + 4;
+    static const uint32_t CHECKPOINT_TICKS = 16;
+    static const uint32_t HASH_SEED = 2166136261u;
+
+    enum Record : uint8_t {
+        REC_TICK = 0x01,
+        REC_TICK_LONG = 0x02,
+        REC_EVENT = 0x03,
+        REC_CHECKPOINT = 0x04,
+        REC_RX = 0x10           //low two bits are the side
+    };
+
+    enum Event : uint8_t {
+        EVENT_CUBE_ADDED = 1,
+        EVENT_CUBE_REMOVED,
+        EVENT_HOST_CHANGED,
+        EVENT_CHARACTER_ADDED,
+        EVENT_CHARACTER_REMOVED
+    };
+
+    SessionRecorder() {}
+    ~SessionRecorder();
+
+    //Allocates the buffer and writes the header. Returns false if there is no memory
+    bool start(size_t bytes, uint32_t seed, DeviceId deviceId, uint32_t startMs);
+    void stop() { _active = false; }
+
+    bool active() const { return _active; }
+
+    //Stopped early because the buffer was full
+    bool truncated() const { return _truncated; }
+
+    const uint8_t* data() const { return _buf; }
+    size_t size() const { return _len; }
+
+    void tick(uint32_t nowMs);
+    void rx(uint8_t side, const uint8_t* data, size_t len);
+    void event(Event event, uint32_t mac);
+    void checkpoint(uint32_t stateHash, uint32_t frameHash);
+
+    void dumpToSerial() const;
+
+    //Trades buffers and state with other, for a host process running several battles
+    void swap(SessionRecorder& other);
+
+    //FNV-1a, chained through h
+    static uint32_t hash(uint32_t h, const void* data, size_t len);
+
+private:
+    uint8_t* _buf = nullptr;
+    size_t _size = 0;
+    size_t _len = 0;
+    size_t _tickStart = 0;  //where the current tick's records begin
+    uint32_t _lastTick = 0;
+    bool _active = false;
+    bool _truncated = false;
+
+    SessionRecorder(const SessionRecorder&);
+    SessionRecorder& operator=(const SessionRecorder&);
+
+    //Drops the current tick and stops if len bytes don't fit
+    bool reserve(size_t len);
+    void put32(uint32_t v);
+};
+
+extern SessionRecorder sessionRecorder;
+
+#endif //SESSION_RECORDER_H
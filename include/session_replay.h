@@ -0,0 +1,80 @@
+// session_replay.h
+//
+// Plays a recorded session back into a Battle as fast as it will go. Every face is a
+// ReplayTransport that returns the recorded reads of the current tick, the clock steps through
+// the recorded tick times, and the seed and device id come from the session, so the battle sees
+// exactly what it saw live. The replay records itself while it runs. The first byte that differs
+// from the original, in a checkpoint hash, an event or a tick, is where it diverged.
+//
+// Outbound bytes are dropped and writes never back up, so TX pacing, and the link-rate state
+// that depends on it, is not reproduced. Neither feeds back into the simulation.
+//
+// test/test_replay runs each session of its corpus into a fresh Battle: a divergence is a
+// regression. Sessions saved from hardware with tools/session_dump.py can join it.
+// Ticks per second of the run measures the simulation and render paths on real traffic.
+
+#ifndef SESSION_REPLAY_H
+#define SESSION_REPLAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include "comms.h"
+
+class Battle;
+
+class ReplayTransport : public Transport {
+public:
+    //Queues one recorded read
+    void push(const uint8_t* data, size_t len);
+    void clear() { _reads.clear(); }
+
+    bool begin(uint32_t baud) override { return true; }
+    void setBaud(uint32_t baud) override {}
+
+    //Size of the next recorded read, so reads come back in the same pieces
+    size_t available() override;
+    size_t read(uint8_t* dst, size_t maxLen) override;
+    size_t write(const uint8_t* src, size_t len) override { return len; }
+    size_t writable() override { return MemoryTransport::TX_CAPACITY; }
+    bool txIdle() override { return true; }
+
+private:
+    std::deque<std::vector<uint8_t> > _reads;
+};
+
+class SessionReplay {
+public:
+    struct Result {
+        uint32_t ticks = 0;
+        uint32_t checkpoints = 0;   //checkpoints matched
+        bool diverged = false;
+        uint32_t divergedAtTick = 0;
+        uint32_t elapsedUs = 0;
+    };
+
+    //A session as written by SessionRecorder, without the serial framing. Not copied
+    SessionReplay(const uint8_t* session, size_t len);
+
+    bool valid() const { return _valid; }
+
+    //Initializes battle from the session and runs every recorded tick. battle must be fresh
+    Result run(Battle& battle);
+
+private:
+    const uint8_t* _data;
+    size_t _len;
+    bool _valid = false;
+    uint32_t _seed = 0;
+    DeviceId _deviceId = 0;
+    uint32_t _startMs = 0;
+
+    ReplayTransport _faces[NUM_SIDES];
+
+    //Queues the reads of the tick starting at pos and returns where the next tick starts.
+    //Sets now to the tick's time; counts checkpoints
+    size_t loadTick(size_t pos, uint32_t& now, uint32_t& checkpoints);
+};
+
+#endif //SESSION_REPLAY_H
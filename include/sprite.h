@@ -3,21 +3,55 @@
 #include <Arduino.h>
 #include <TFT_eSPI.h>
 #include <map>
+#include "frame_cache.h"
 
+//Clips every sheet defines, in this order
+enum ClipId : uint8_t {
+  CLIP_IDLE = 0,
+  CLIP_DEATH,
+  NUM_CLIPS
+};
+
+//A sprite's animation is (clip, start, speed) on the game clock's timeline, and the frame
+//is a pure function of the tick's time: no timers per sprite, and a looping clip lands on
+//the right frame however long the loop stalled. Replicating it is the clip and how far in
+//it the host is, one byte per character, which clients then play forward on their own.
 class Sprite {
 public:
+  static const uint16_t SPEED_NORMAL = 256;   //8.8 fixed point
+  static const uint8_t MAX_CLIP_FRAMES = 32;
+
   Sprite(TFT_eSPI* tft);
   void load(int id);
-  void addAnimation(const String& name, const uint8_t* indices, uint8_t count, uint16_t frameDuration, bool loop);
-  void play(const String& name, bool loop = true);
+
+  //Restarts clip from its first frame now, even if it is already playing
+  void play(ClipId clip, uint16_t speed = SPEED_NORMAL);
+  //Frame of the current clip at the tick's time
   void update();
   void drawTo(TFT_eSprite& buffer, int16_t x, int16_t y);
 
   uint8_t getFrame();
-  void setFrame(uint8_t frame);
+  ClipId getClip() const { return _clip; }
+
+  //Sheets face right; a mirrored sprite is drawn facing left, and touches with its mirrored
+  //outline
+  void setMirrored(bool mirrored) { _mirrored = mirrored; }
+  bool isMirrored() const { return _mirrored; }
+
+  //Clip from bit 5 up, frames into it in the low 5, as sent in the state sync. The sync keeps
+  //the top bit for the facing, so there is room for 4 clips
+  uint8_t getClipState() const;
+  //Follows a replicated clip state. A running clip is only realigned once it is more than a
+  //frame off, so clients animate smoothly between syncs
+  void setClipState(uint8_t state);
+
   uint16_t getFrameWidth();
   uint16_t getFrameHeight(); 
 
+  //Pixel-accurate contact test between the current frames of two sprites.
+  //reach dilates the other sprite's outline by that many pixels (0 = strict overlap)
+  bool overlaps(int16_t x, int16_t y, const Sprite& other, int16_t otherX, int16_t otherY, uint8_t reach = 0) const;
+
 private:
   TFT_eSPI* _tft;
   const uint16_t* _frames; 
@@ -29,16 +63,49 @@ private:
   uint16_t _transparentColor;
 
   uint8_t _currentFrame = 0;
+  bool _mirrored = false;
 
-  struct Animation {
-    uint8_t* frameIndices;
+  //Tight opaque box of one frame, in frame-local pixels. Empty when x1 < x0
+  struct MaskBounds {
+    int16_t x0, y0, x1, y1;
+  };
+
+  //1-bit opacity masks built once per sheet from the transparent colour.
+  //Row bits are LSB-first: bit n of word w is pixel (w * 32 + n)
+  struct FrameMasks {
+    uint16_t wordsPerRow;
+    uint16_t frameHeight;
+    uint32_t* rows;           //[frame][row][word]
+    uint32_t* mirroredRows;   //same, columns flipped for sprites facing left
+    MaskBounds* bounds;       //[frame], unmirrored
+  };
+
+  const FrameMasks* _masks = nullptr;
+
+  //Masks are shared by every Sprite that loads the same sheet
+  static std::map<const uint16_t*, const FrameMasks*> _maskCache;
+
+  static const FrameMasks* buildMasks(const uint16_t* frames, uint8_t totalFrames, uint16_t frameWidth,
+                                      uint16_t frameHeight, uint16_t sheetWidth, uint16_t transparentColor);
+  const uint32_t* maskRow(uint8_t frame, int16_t row) const;
+  MaskBounds maskBounds(uint8_t frame) const;
+
+  //The current frame from the RAM cache, copied in from the sheet on a miss. nullptr when
+  //it doesn't fit the cache
+  const FrameCache::Frame* cachedFrame();
+
+  struct Clip {
+    const uint8_t* frames;   //sheet frames, in order
     uint8_t frameCount;
-    uint8_t currentFrame;
-    uint16_t frameDuration;
-    unsigned long lastFrameTime;
+    uint16_t frameMs;        //at SPEED_NORMAL
     bool loop;
   };
 
-  std::map<String, Animation> _animations;
-  Animation* _currentAnim = nullptr;
+  const Clip* _clips = nullptr;   //NUM_CLIPS, shared by every sprite of the sheet
+  ClipId _clip = CLIP_IDLE;
+  uint32_t _clipStart = 0;
+  uint16_t _speed = SPEED_NORMAL;
+
+  //Frames into the current clip at time now, held on the last one for a clip that doesn't loop
+  uint8_t clipStep(uint32_t now) const;
 };
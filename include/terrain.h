@@ -0,0 +1,49 @@
+// terrain.h
+//
+// Ground tiles behind the pets. Each cube is TERRAIN_TILES_PER_SIDE tiles square, and its
+// tile ids are stored 4 bits each on its Map entry. The host generates them from the cube's
+// place in the world and streams them to the mesh in PACKET_TERRAIN, a cube per tick, so every
+// screen shows the same world. A cube with no terrain yet draws TERRAIN_VOID, i.e. the old
+// black screen.
+//
+// Terrain is only drawn, walking and fighting ignore it.
+
+#ifndef TERRAIN_H
+#define TERRAIN_H
+
+#include <stdint.h>
+
+#define PACKET_TERRAIN 0x0D   //[cube sid][packed tile ids], relayed mesh-wide
+
+static const uint8_t TERRAIN_SHIFT = 4;
+static const int16_t TERRAIN_TILE_SIZE = 1 << TERRAIN_SHIFT;
+static const uint8_t TERRAIN_TILES_PER_SIDE = 128 / TERRAIN_TILE_SIZE;   //per 128 px cube
+static const uint8_t TERRAIN_TILES = TERRAIN_TILES_PER_SIDE * TERRAIN_TILES_PER_SIDE;
+static const uint8_t TERRAIN_BYTES = TERRAIN_TILES / 2;
+
+//How often the host repeats one cube's terrain, for cubes that missed it
+static const uint32_t TERRAIN_RESEND_MS = 2000;
+
+enum TerrainTile : uint8_t {
+    TERRAIN_VOID = 0,
+    TERRAIN_GRASS,
+    TERRAIN_FLOWERS,
+    TERRAIN_DIRT,
+    TERRAIN_STONE,
+    TERRAIN_SAND,
+    NUM_TERRAIN_TILES
+};
+
+//Tile index is row-major within the cube
+inline uint8_t terrainTile(const uint8_t* packed, uint8_t index) {
+    return (packed[index >> 1] >> ((index & 1) * 4)) & 0x0F;
+}
+
+//Cheap integer hash of a point, stable across builds so every host generates the same world
+uint32_t terrainNoise(int32_t x, int32_t y);
+
+//Tiles for the cube whose top left corner is at (cubeX, cubeY) in host coordinates. The
+//same place always gets the same ground
+void generateTerrain(int16_t cubeX, int16_t cubeY, uint8_t* packed);
+
+#endif //TERRAIN_H
@@ -0,0 +1,194 @@
+// transport.h
+//
+// Byte links behind each cube face. Comms only talks to Transport, so the same protocol code
+// runs over ESP32 UARTs on the device and over in-memory links in a host simulation.
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+
+#ifdef ESP_PLATFORM
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#endif
+
+//UART0 is either the debug console or the third face's dedicated UART. With the console,
+//faces 0 and 2 share UART1, see FACE_WIRING in comms.cpp
+#ifndef DEBUG_CONSOLE
+#define DEBUG_CONSOLE 0
+#endif
+
+struct TransportStats {
+    uint32_t bytesIn = 0;
+    uint32_t bytesOut = 0;
+    uint32_t rxEvents = 0;      //times the face was woken by incoming data
+    uint32_t overflows = 0;     //RX data lost to a full FIFO or ring
+    uint32_t lineErrors = 0;    //framing/parity errors, or corrupted bytes on the host stand-in
+    uint32_t latencyUsSum = 0;  //host stand-in only: write-to-read delay of delivered bytes
+    uint32_t latencyUsMax = 0;
+    uint32_t wakeDrops = 0;     //host stand-in only: bytes lost waking from light sleep
+};
+
+class Transport {
+public:
+    virtual ~Transport() {}
+
+    virtual bool begin(uint32_t baud) = 0;
+    virtual void setBaud(uint32_t baud) = 0;
+
+    //Bytes that can be read right now
+    virtual size_t available() = 0;
+    virtual size_t read(uint8_t* dst, size_t maxLen) = 0;
+
+    //Never blocks. Returns how many bytes were accepted
+    virtual size_t write(const uint8_t* src, size_t len) = 0;
+
+    //Bytes write() would accept right now
+    virtual size_t writable() = 0;
+
+    //True once everything written has left the wire, so the baud rate can change safely
+    virtual bool txIdle() = 0;
+
+    //True when there may be unread data, so idle faces can be skipped without a read
+    virtual bool rxReady() { return available() > 0; }
+
+    //Moves queued TX bytes towards the wire. Called once per Comms::update
+    virtual void poll(uint32_t nowMs) {}
+
+    //Comms reports whether a neighbor is connected on this face
+    virtual void setLinked(bool linked) {}
+
+    //Light sleep starts or ends. The UARTs stop in between, so the byte that wakes the chip is
+    //lost. The hardware does this by itself, MemoryTransport models it for host simulations
+    virtual void setAsleep(bool asleep) {}
+
+    const TransportStats& getStats() const { return _stats; }
+
+protected:
+    TransportStats _stats;
+};
+
+#ifdef ESP_PLATFORM
+
+//Wiring of one face. Faces that list the same UART take turns on it while they look for a
+//neighbor; once one of them links, the UART stays with it until the neighbor leaves
+struct FaceWiring {
+    uart_port_t uart;
+    int8_t txPin;
+    int8_t rxPin;
+};
+
+//ESP-IDF UART driver with an ISR-fed RX ring and an event queue. TX goes through a small
+//software ring drained with uart_tx_chars, so writes never stall the loop
+class UartTransport : public Transport {
+public:
+    explicit UartTransport(const FaceWiring& wiring);
+
+    bool begin(uint32_t baud) override;
+    void setBaud(uint32_t baud) override;
+    size_t available() override;
+    size_t read(uint8_t* dst, size_t maxLen) override;
+    size_t write(const uint8_t* src, size_t len) override;
+    size_t writable() override;
+    bool txIdle() override;
+    bool rxReady() override;
+    void poll(uint32_t nowMs) override;
+    void setLinked(bool linked) override { _linked = linked; }
+
+    //Event queue of this face's UART, for waiting on several faces at once
+    QueueHandle_t eventQueue() const;
+
+    //Consumes one event from a queue returned by xQueueSelectFromSet
+    static void serviceEvent(QueueHandle_t queue);
+
+    //Lets data on this face wake the chip from light sleep. The bytes that wake it are lost,
+    //the sender's next frame gets through
+    void enableWakeup();
+
+    static const size_t TX_RING_SIZE = 512;
+
+private:
+    FaceWiring _wiring;
+    uint8_t _portFace;  //index of this face among the faces sharing its UART
+    uint32_t _baud = 0; //per face, applied whenever the face gets the UART
+
+    uint8_t _txRing[TX_RING_SIZE];
+    size_t _txHead = 0;
+    size_t _txCount = 0;
+    bool _rxReady = false;
+    bool _linked = false;
+
+    bool isActive() const;
+    void drainTx();
+
+    friend struct UartPort;
+};
+
+#endif //ESP_PLATFORM
+
+//Host stand-in for a wired face. Bytes written to one end become readable on the other after
+//the serialization delay of the configured baud rate, so per-face throughput and latency can
+//be measured without hardware
+class MemoryTransport : public Transport {
+public:
+    //Clock in microseconds, so simulations can run on virtual time
+    typedef uint32_t (*ClockFn)();
+
+    explicit MemoryTransport(ClockFn clock);
+
+    //Connects two endpoints back to back
+    static void connect(MemoryTransport& a, MemoryTransport& b);
+    //Pulls the two apart; bytes still on the wire are lost
+    static void disconnect(MemoryTransport& a);
+
+    bool begin(uint32_t baud) override;
+    void setBaud(uint32_t baud) override;
+    size_t available() override;
+    size_t read(uint8_t* dst, size_t maxLen) override;
+    size_t write(const uint8_t* src, size_t len) override;
+    size_t writable() override;
+    bool txIdle() override;
+    bool rxReady() override;
+
+    //Until woken, the first byte to arrive is dropped and only reports rxReady() once, as
+    //on a chip in light sleep
+    void setAsleep(bool asleep) override;
+
+    //Rate-dependent bit errors on bytes this end receives: none up to cleanBaud, then the bit error rate grows linearly
+    //and reaches berAtDouble at twice that rate. Bytes sent at a baud rate different from the
+    //receiver's always arrive as garbage
+    void setErrorModel(uint32_t cleanBaud, float berAtDouble, uint32_t seed = 1);
+
+    static const size_t TX_CAPACITY = 512;
+
+private:
+    struct TimedByte {
+        uint8_t value;
+        uint32_t sentUs;
+        uint32_t readyUs;
+        uint32_t baud;
+    };
+
+    ClockFn _clock;
+    MemoryTransport* _peer = nullptr;
+    uint32_t _baud = 0;
+    uint32_t _lineFreeUs = 0;  //when the last queued byte finishes on the wire
+    std::deque<TimedByte> _rx;
+    bool _asleep = false;
+    bool _woken = false;       //a byte woke this end, not yet reported
+
+    uint32_t _cleanBaud = 0;   //0 = error free
+    float _berAtDouble = 0.0f;
+    uint32_t _rng = 1;
+
+    size_t inFlight() const;
+    void dropWakeByte();
+    uint32_t nextRandom();
+    uint8_t corrupt(uint8_t value, uint32_t baud);
+};
+
+#endif //TRANSPORT_H
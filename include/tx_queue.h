@@ -0,0 +1,84 @@
+// tx_queue.h
+//
+// Outbound queue for one face. Packets wait here instead of going straight to the transport,
+// so several small ones can share a frame and a slow link never blocks the loop.
+//
+// Packets keep the usual 5-byte header while queued. When more than one fits, they go out
+// together in a PACKET_BATCH frame whose records are either the packet verbatim or, for
+// packets this cube originated, a short form without the session ID:
+//   [tag][len][sid][seq(2)][payload]           forwarded
+//   [tag | 0x80][len][seq(2)][payload]         origin = sid in the batch header
+
+#ifndef TX_QUEUE_H
+#define TX_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PACKET_BATCH 0x04
+#define BATCH_SHORT_RECORD 0x80
+
+//[tag][len][sid][seq(2)], ahead of every payload
+#define PACKET_HEADER_LEN 5
+
+class TxQueue {
+public:
+    static const uint8_t SLOTS = 12;
+    static const size_t MAX_PACKET = PACKET_HEADER_LEN + 255;
+
+    //Lower drains first
+    enum Priority : uint8_t {
+        PRIO_LINK = 0,      //rate probes
+        PRIO_HEARTBEAT,
+        PRIO_STATE,
+        PRIO_BULK
+    };
+
+    struct Stats {
+        uint32_t queued = 0;
+        uint32_t superseded = 0;   //state replaced by a newer copy before it was sent
+        uint32_t dropped = 0;      //queue full
+        uint32_t frames = 0;
+        uint32_t messages = 0;
+        uint32_t coalesced = 0;    //messages that shared a frame with another
+        uint32_t bytesSent = 0;
+        uint8_t highWater = 0;
+    };
+
+    //supersede: replaces a queued packet with the same tag and origin sid instead of
+    //queueing behind it. Returns false if the packet was dropped
+    bool push(const uint8_t* packet, size_t len, Priority priority, bool supersede);
+
+    //Writes the next frame to out, using at most maxBytes. Returns its length, or 0 if the
+    //queue is empty or the next packet doesn't fit yet
+    size_t nextFrame(uint8_t* out, size_t maxBytes, uint8_t mySid);
+
+    //Priority of the packet the next frame starts with. Only meaningful when not empty
+    Priority nextPriority() const;
+
+    bool empty() const { return _count == 0; }
+    uint8_t depth() const { return _count; }
+    void clear();
+
+    const Stats& getStats() const { return _stats; }
+
+private:
+    struct Slot {
+        bool used;
+        Priority priority;
+        uint32_t order;
+        uint16_t len;
+        uint8_t data[MAX_PACKET];
+    };
+
+    Slot _slots[SLOTS] = {};
+    uint8_t _count = 0;
+    uint32_t _nextOrder = 0;
+    Stats _stats;
+
+    int8_t nextSlot(const bool* taken) const;
+    static size_t recordLen(const Slot& slot, uint8_t mySid);
+    static uint8_t originOf(const uint8_t* packet) { return packet[2]; }
+};
+
+#endif //TX_QUEUE_H
@@ -0,0 +1,68 @@
+// Arduino.h
+//
+// Host stand-in for the parts of the Arduino core the game uses, so the native test build
+// compiles src/ unchanged. Time and Serial are controlled from host.h.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define PI 3.1415926535897932384626433832795
+
+typedef bool boolean;
+
+unsigned long millis();
+unsigned long micros();
+//Advances the virtual clock instead of blocking
+void delay(unsigned long ms);
+void yield();
+
+class HardwareSerial {
+public:
+    void begin(unsigned long baud) {}
+    void end() {}
+    operator bool() const { return true; }
+
+    //Nothing is ever typed into a host run
+    int available() { return 0; }
+    int read() { return -1; }
+
+    size_t write(uint8_t byte);
+    size_t write(const uint8_t* data, size_t len);
+    size_t print(const char* text);
+    size_t println(const char* text = "");
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    void flush() {}
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+public:
+    //Cycles of the virtual clock at the reported frequency
+    uint32_t getCycleCount();
+    uint32_t getCpuFreqMHz();
+    uint32_t getFreeHeap() { return 256 * 1024; }
+};
+
+extern EspClass ESP;
+
+//No PSRAM on the host, so plain heap
+inline void* ps_malloc(size_t bytes) {
+    return malloc(bytes);
+}
+
+bool setCpuFrequencyMhz(uint32_t mhz);
+uint32_t getCpuFrequencyMhz();
+
+#endif //HOST_ARDUINO_H
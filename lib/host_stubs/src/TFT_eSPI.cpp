@@ -0,0 +1,60 @@
+// TFT_eSPI.cpp
+#include "TFT_eSPI.h"
+#include <algorithm>
+#include <string.h>
+
+TFT_eSPI::TFT_eSPI(int16_t width, int16_t height)
+    : _width(width), _height(height), _pixels((size_t)width * height, TFT_BLACK) {}
+
+void TFT_eSPI::fillScreen(uint32_t color) {
+    std::fill(_pixels.begin(), _pixels.end(), (uint16_t)color);
+}
+
+void TFT_eSPI::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color) {
+    int32_t x0 = std::max<int32_t>(x, 0), x1 = std::min<int32_t>(x + w, _width);
+    int32_t y0 = std::max<int32_t>(y, 0), y1 = std::min<int32_t>(y + h, _height);
+    for (int32_t row = y0; row < y1; row++) {
+        for (int32_t col = x0; col < x1; col++) {
+            _pixels[(size_t)row * _width + col] = (uint16_t)color;
+        }
+    }
+}
+
+void TFT_eSPI::drawPixel(int32_t x, int32_t y, uint32_t color) {
+    if (x < 0 || y < 0 || x >= _width || y >= _height) return;
+    _pixels[(size_t)y * _width + x] = (uint16_t)color;
+}
+
+void TFT_eSPI::pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data) {
+    int32_t x0 = std::max<int32_t>(x, 0), x1 = std::min<int32_t>(x + w, _width);
+    int32_t y0 = std::max<int32_t>(y, 0), y1 = std::min<int32_t>(y + h, _height);
+    if (x0 >= x1) return;
+    for (int32_t row = y0; row < y1; row++) {
+        memcpy(&_pixels[(size_t)row * _width + x0], data + (size_t)(row - y) * w + (x0 - x),
+               (x1 - x0) * sizeof(uint16_t));
+    }
+}
+
+uint16_t TFT_eSPI::readPixel(int32_t x, int32_t y) const {
+    if (x < 0 || y < 0 || x >= _width || y >= _height) return 0;
+    return _pixels[(size_t)y * _width + x];
+}
+
+void* TFT_eSprite::createSprite(int16_t width, int16_t height, uint8_t frames) {
+    _width = width;
+    _height = height;
+    _pixels.assign((size_t)width * height, TFT_BLACK);
+    return _pixels.data();
+}
+
+void TFT_eSprite::deleteSprite() {
+    _width = 0;
+    _height = 0;
+    _pixels.clear();
+}
+
+void TFT_eSprite::pushSprite(int32_t x, int32_t y) {
+    if (_tft && created()) {
+        _tft->pushImage(x, y, _width, _height, _pixels.data());
+    }
+}
@@ -0,0 +1,71 @@
+// TFT_eSPI.h
+//
+// Host stand-in for the TFT_eSPI panel and sprite classes. A panel keeps the pixels pushed to
+// it, so a test can read back what the cube would show with readPixel(). Colors are stored as
+// given, without the byte swap the device sprites use, see toBuffer in sprite.cpp.
+
+#ifndef HOST_TFT_ESPI_H
+#define HOST_TFT_ESPI_H
+
+#include <stdint.h>
+#include <vector>
+
+#ifndef TFT_WIDTH
+#define TFT_WIDTH 128
+#endif
+#ifndef TFT_HEIGHT
+#define TFT_HEIGHT 128
+#endif
+
+#define TFT_BLACK 0x0000
+#define TFT_BLUE 0x001F
+#define TFT_RED 0xF800
+#define TFT_GREEN 0x07E0
+#define TFT_WHITE 0xFFFF
+
+class TFT_eSPI {
+public:
+    TFT_eSPI(int16_t width = TFT_WIDTH, int16_t height = TFT_HEIGHT);
+    virtual ~TFT_eSPI() {}
+
+    void init() {}
+    void setRotation(uint8_t rotation) {}
+
+    int16_t width() const { return _width; }
+    int16_t height() const { return _height; }
+
+    void fillScreen(uint32_t color);
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+    void drawPixel(int32_t x, int32_t y, uint32_t color);
+    //Clipped to the screen
+    void pushImage(int32_t x, int32_t y, int32_t w, int32_t h, const uint16_t* data);
+    uint16_t readPixel(int32_t x, int32_t y) const;
+
+protected:
+    int16_t _width;
+    int16_t _height;
+    std::vector<uint16_t> _pixels;
+};
+
+class TFT_eSprite : public TFT_eSPI {
+public:
+    explicit TFT_eSprite(TFT_eSPI* tft) : TFT_eSPI(0, 0), _tft(tft) {}
+
+    void* createSprite(int16_t width, int16_t height, uint8_t frames = 1);
+    void deleteSprite();
+    bool created() const { return !_pixels.empty(); }
+
+    void fillSprite(uint32_t color) { fillScreen(color); }
+    //Copies the sprite onto the panel it was made for
+    void pushSprite(int32_t x, int32_t y);
+
+    void* getPointer() { return _pixels.empty() ? nullptr : _pixels.data(); }
+    void setColorDepth(int8_t depth) {}
+    int8_t getColorDepth() const { return 16; }
+    void setSwapBytes(bool swap) {}
+
+private:
+    TFT_eSPI* _tft;
+};
+
+#endif //HOST_TFT_ESPI_H
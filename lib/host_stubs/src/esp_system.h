@@ -0,0 +1,22 @@
+// esp_system.h
+//
+// Host stand-in for the ESP-IDF calls that seed a cube and name it.
+
+#ifndef HOST_ESP_SYSTEM_H
+#define HOST_ESP_SYSTEM_H
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+
+typedef enum {
+    ESP_MAC_WIFI_STA = 0,
+} esp_mac_type_t;
+
+//A fixed sequence, so a test that calls Battle::init() runs the same every time
+uint32_t esp_random();
+
+//The MAC set with hostSetMac(), see host.h
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type);
+
+#endif //HOST_ESP_SYSTEM_H
@@ -0,0 +1,144 @@
+// host.cpp
+#include "host.h"
+#include "Arduino.h"
+#include "esp_system.h"
+#include <stdarg.h>
+#include <chrono>
+#include <thread>
+
+typedef std::chrono::steady_clock SteadyClock;
+
+static uint64_t virtualUs = 0;
+static bool realTime = false;
+static SteadyClock::time_point realSince;
+
+static std::string serialOutput;
+static bool serialEcho = false;
+
+static uint32_t cpuMhz = 240;
+static uint32_t randomState = 0x2545F491;
+static uint8_t macAddress[6] = { 0x24, 0x0A, 0xC4, 0x00, 0x00, 0x01 };
+
+HardwareSerial Serial;
+EspClass ESP;
+
+void hostSetTimeUs(uint64_t us) {
+    virtualUs = us;
+    realSince = SteadyClock::now();
+}
+
+void hostAdvanceUs(uint64_t us) {
+    virtualUs += us;
+}
+
+uint64_t hostTimeUs() {
+    if (!realTime) return virtualUs;
+    return virtualUs + std::chrono::duration_cast<std::chrono::microseconds>(SteadyClock::now() - realSince).count();
+}
+
+void hostUseRealTime(bool real) {
+    if (real == realTime) return;
+    hostSetTimeUs(hostTimeUs());
+    realTime = real;
+}
+
+const std::string& hostSerialOutput() {
+    return serialOutput;
+}
+
+void hostClearSerial() {
+    serialOutput.clear();
+}
+
+void hostEchoSerial(bool echo) {
+    serialEcho = echo;
+}
+
+void hostSetMac(const uint8_t mac[6]) {
+    memcpy(macAddress, mac, sizeof(macAddress));
+}
+
+unsigned long millis() {
+    return (unsigned long)(hostTimeUs() / 1000);
+}
+
+unsigned long micros() {
+    return (unsigned long)hostTimeUs();
+}
+
+void delay(unsigned long ms) {
+    if (realTime) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    } else {
+        virtualUs += (uint64_t)ms * 1000;
+    }
+}
+
+void yield() {}
+
+size_t HardwareSerial::write(uint8_t byte) {
+    return write(&byte, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t len) {
+    serialOutput.append((const char*)data, len);
+    if (serialEcho) {
+        fwrite(data, 1, len, stdout);
+        fflush(stdout);
+    }
+    return len;
+}
+
+size_t HardwareSerial::print(const char* text) {
+    return write((const uint8_t*)text, strlen(text));
+}
+
+size_t HardwareSerial::println(const char* text) {
+    return print(text) + print("\r\n");
+}
+
+size_t HardwareSerial::printf(const char* format, ...) {
+    char small[256];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(small, sizeof(small), format, args);
+    va_end(args);
+    if (len < 0) return 0;
+    if ((size_t)len < sizeof(small)) return write((const uint8_t*)small, len);
+
+    std::string text(len + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&text[0], text.size(), format, args);
+    va_end(args);
+    return write((const uint8_t*)text.data(), len);
+}
+
+uint32_t EspClass::getCycleCount() {
+    return (uint32_t)(hostTimeUs() * cpuMhz);
+}
+
+uint32_t EspClass::getCpuFreqMHz() {
+    return cpuMhz;
+}
+
+bool setCpuFrequencyMhz(uint32_t mhz) {
+    cpuMhz = mhz;
+    return true;
+}
+
+uint32_t getCpuFrequencyMhz() {
+    return cpuMhz;
+}
+
+//xorshift32
+uint32_t esp_random() {
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type) {
+    memcpy(mac, macAddress, sizeof(macAddress));
+    return 0;
+}
@@ -0,0 +1,28 @@
+// host.h
+//
+// Controls for the host stand-ins in this library. Time is virtual: millis() and micros() read
+// a clock that only moves when a test sets or advances it, or when the code under test calls
+// delay(), so simulations run as fast as they compute and every run is the same. Benchmarks
+// switch to the real clock. Serial keeps everything printed, for tests to read back.
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdint.h>
+#include <string>
+
+void hostSetTimeUs(uint64_t us);
+void hostAdvanceUs(uint64_t us);
+uint64_t hostTimeUs();
+
+//Real time from here on, for timing code; delay() then sleeps
+void hostUseRealTime(bool real);
+
+const std::string& hostSerialOutput();
+void hostClearSerial();
+//Also writes Serial to stdout, so the test runner's log carries it
+void hostEchoSerial(bool echo);
+
+void hostSetMac(const uint8_t mac[6]);
+
+#endif //HOST_H
@@ -0,0 +1,146 @@
+// ai.cpp
+#include "ai.h"
+#include "character.h"
+#include "parallel.h"
+#include <math.h>
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+//Warrior: runs when hurt, fights what it touches, chases what it sees, otherwise wanders
+static const Consideration WARRIOR_FLEE[] = {
+    { INPUT_HEALTH, CURVE_AT_MOST, 0.19f, 0.0f },
+};
+static const Consideration WARRIOR_ATTACK[] = {
+    { INPUT_TOUCHING, CURVE_AT_LEAST, 1.0f, 0.0f },
+};
+static const Consideration WARRIOR_CHASE[] = {
+    { INPUT_ENEMY_DISTANCE, CURVE_AT_MOST, 1.0f, 0.0f },
+};
+
+static const Behavior WARRIOR_BEHAVIORS[] = {
+    { ACTION_FLEE,   4.0f, COUNT_OF(WARRIOR_FLEE),   WARRIOR_FLEE },
+    { ACTION_ATTACK, 3.0f, COUNT_OF(WARRIOR_ATTACK), WARRIOR_ATTACK },
+    { ACTION_CHASE,  2.0f, COUNT_OF(WARRIOR_CHASE),  WARRIOR_CHASE },
+    { ACTION_WANDER, 1.0f, 0, nullptr },
+};
+
+//By character id
+static const Species SPECIES[] = {
+    { 4, COUNT_OF(WARRIOR_BEHAVIORS), WARRIOR_BEHAVIORS },
+};
+
+const Species& AIEngine::speciesFor(uint8_t id) {
+    return id < COUNT_OF(SPECIES) ? SPECIES[id] : SPECIES[0];
+}
+
+//Picks the characters due in list order, within the budget, then lets them think. Thinking
+//only writes the thinker's own memory, so it can run in parallel
+void AIEngine::update(const CharacterList& characters, uint32_t tick) {
+    _stats.spentLastTick = 0;
+    _due.clear();
+    size_t count = characters.size();
+    if (count == 0) return;
+    if (_cursor >= count) _cursor = 0;
+
+    uint32_t spent = 0;
+    for (size_t k = 0; k < count; k++) {
+        size_t i = (_cursor + k) % count;
+        Character& character = *characters[i];
+        if (!character.isAlive()) continue;
+
+        AIMemory& memory = character.memory();
+        uint8_t period = speciesFor(character.getId()).perceptionTicks;
+        if (!memory.scheduled) {
+            memory.nextThink = tick + character.getMac() % period;
+            memory.scheduled = true;
+        }
+        if ((int32_t)(tick - memory.nextThink) < 0) continue;
+
+        //The first one always runs, so a tiny budget still makes progress
+        if (spent >= _budget) {
+            _cursor = i;
+            _stats.deferred++;
+            break;
+        }
+
+        _due.push_back(&character);
+        spent += count;
+        memory.nextThink = tick + period;
+        _stats.thinks++;
+    }
+
+    _stats.spentLastTick = spent > 0xFFFF ? 0xFFFF : spent;
+    parallelFor(_due.size(), [&](size_t i) {
+        think(*_due[i], characters);
+    });
+}
+
+//Refreshes the perception in one pass and picks the best-scoring behavior
+void AIEngine::think(Character& character, const CharacterList& characters) {
+    AIMemory& memory = character.memory();
+    float range = character.getDetectionRange();
+    Character* nearest = nullptr;
+    float nearestDistance = 0.0f;
+
+    memory.threats.clear();
+    for (const auto& candidatePtr : characters) {
+        Character* candidate = candidatePtr.get();
+        if (candidate == &character || !candidate->isAlive()) continue;
+
+        float distance = character.distanceTo(candidate);
+        if (!nearest || distance < nearestDistance) {
+            nearest = candidate;
+            nearestDistance = distance;
+        }
+        if (distance <= range) {
+            memory.threats.push_back(candidate->getMac());
+        }
+    }
+    memory.target = nearest ? nearest->getMac() : 0;
+    memory.targetDistance = nearestDistance;
+
+    const Species& species = speciesFor(character.getId());
+    float bestScore = -1.0f;
+    for (uint8_t b = 0; b < species.numBehaviors; b++) {
+        const Behavior& behavior = species.behaviors[b];
+        float score = behavior.weight;
+        for (uint8_t c = 0; c < behavior.numConsiderations && score > 0.0f; c++) {
+            const Consideration& consideration = behavior.considerations[c];
+            score *= respond(consideration, input(consideration.input, character, nearest));
+        }
+
+        //Ties go to the earlier row
+        if (score > bestScore) {
+            bestScore = score;
+            memory.action = behavior.action;
+        }
+    }
+}
+
+float AIEngine::input(AIInput input, Character& character, Character* target) {
+    switch (input) {
+        case INPUT_HEALTH:
+            return character.getHealthFraction();
+        case INPUT_ENEMY_DISTANCE:
+            return target ? character.memory().targetDistance / character.getDetectionRange() : 2.0f;
+        case INPUT_TOUCHING:
+            return target && character.isTouching(target) ? 1.0f : 0.0f;
+        case INPUT_THREATS:
+            return character.memory().threats.size();
+    }
+    return 0.0f;
+}
+
+float AIEngine::respond(const Consideration& consideration, float x) {
+    switch (consideration.curve) {
+        case CURVE_LINEAR: {
+            float y = consideration.a * x + consideration.b;
+            return y < 0.0f ? 0.0f : (y > 1.0f ? 1.0f : y);
+        }
+        case CURVE_AT_MOST:
+            return x <= consideration.a ? 1.0f : 0.0f;
+        case CURVE_AT_LEAST:
+            return x >= consideration.a ? 1.0f : 0.0f;
+    }
+    return 0.0f;
+}
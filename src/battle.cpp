@@ -6,8 +6,26 @@
 #include "battle.h"
 #include "sprite.h"
 #include "display.h"
+#include "profiler.h"
+#include "parallel.h"
+#include "game_clock.h"
+#include "game_random.h"
+#include "session_recorder.h"
+#include "frame_cache.h"
+#include "terrain.h"
+#include "combat.h"
+#include "power.h"
+#include "bench.h"
 #include "esp_system.h"
 
+static const uint32_t SNAPSHOT_MAX_AGE_MS = 2000;
+static const size_t STATE_RECORD_LEN = 7;  //bytes per character in PACKET_COMMAND
+static const uint8_t STATE_FLAG_MIRRORED = 0x80;  //top bit of the clip state byte
+static_assert(MAX_CHARACTERS * STATE_RECORD_LEN <= 255, "a full state sync must fit one packet");
+static_assert(NUM_CLIPS <= 4, "clip ids share their byte with STATE_FLAG_MIRRORED");
+static const size_t MAX_PENDING_EVENTS = 64;
+static const size_t MAX_COMBAT_PAYLOAD = ReliableLink::MAX_MESSAGE - PACKET_HEADER_LEN;
+
 Battle::Battle(TFT_eSPI* tft, uint16_t width, uint16_t height)
     : characters(), comm(this), map(), display(nullptr), battle_tft(tft), myMac(0)
 {
@@ -20,13 +38,31 @@ Battle::~Battle() {
 
 // Initializes networking, local identity, display, RNG and local character
 void Battle::init() {
+    start(esp_random(), millis(), SESSION_RECORD_BYTES);
+}
+
+void Battle::initReplay(uint32_t seed, DeviceId deviceId, uint32_t startMs, Transport* const faces[NUM_SIDES],
+                        size_t recordBytes) {
+    for (int i = 0; i < NUM_SIDES; i++) {
+        comm.setTransport(i, faces[i]);
+    }
+    comm.setDeviceId(deviceId);
+    start(seed, startMs, recordBytes);
+}
+
+//Everything random and timed below derives from seed and nowMs, so a session replays exactly
+void Battle::start(uint32_t seed, uint32_t nowMs, size_t recordBytes) {
+    gameClock.start(nowMs);
+    gameRandom.seed(seed);
+
     comm.begin(115200);
     myMac = comm.getMyMac();
     display->setMac(myMac);
     map.addCube(myMac, 0, -1);
 
-    uint32_t seed = esp_random();
-    srand(seed);  
+    if (recordBytes > 0 && !sessionRecorder.start(recordBytes, seed, comm.getDeviceId(), nowMs)) {
+        Serial.println("[SESSION] Not enough memory to record");
+    }
 
     CharacterPtr newCharacter(new Character(myMac, 0, battle_tft, &map, this));
     addCharacter(newCharacter);
@@ -36,7 +72,18 @@ void Battle::init() {
 }
 
 void Battle::update() {
-    comm.update();
+    update(millis());
+}
+
+void Battle::update(uint32_t nowMs) {
+    gameClock.tick(nowMs);
+    sessionRecorder.tick(nowMs);
+
+    PROFILE_SCOPE(STAGE_FRAME);
+    {
+        PROFILE_SCOPE(STAGE_COMMS);
+        comm.update();
+    }
 
     //Update locally if not connected to a network
     if (comm.getRole() == ROLE_UNASSIGNED) {
@@ -47,113 +94,498 @@ void Battle::update() {
     if (comm.getRole() == ROLE_HOST) {
         updateCharacters();
         sendCommands();
+        sendCombatEvents();
+    }
+
+    if (comm.getRole() == ROLE_CLIENT) {
+        animateCharacters();
+    } else {
+        streamTerrain();
     }
 
     display->setCharacters(characters);
-    display->draw(characters);
+    display->present(characters);
+
+    if (sessionRecorder.active() && gameClock.ticks() % SessionRecorder::CHECKPOINT_TICKS == 0) {
+        sessionRecorder.checkpoint(stateHash(), display->frameHash());
+    }
+}
+
+void Battle::debugCommand(char command) {
+    switch (command) {
+        case 'p':
+            profiler.dumpToSerial();
+            break;
+        case 't':
+            comm.printTelemetry();
+            break;
+        case 'c':
+            if (!comm.startCapture()) {
+                Serial.println("[CAPTURE] Not enough memory");
+            }
+            break;
+        case 'd':
+            comm.dumpCapture();
+            break;
+        case 'x':
+            comm.stopCapture();
+            break;
+        case 's':
+            sessionRecorder.dumpToSerial();
+            break;
+        case 'a': {
+            const AIEngine::Stats& stats = ai.getStats();
+            Serial.printf("[AI] thinks=%u deferred=%u spentLastTick=%u\n",
+                          stats.thinks, stats.deferred, stats.spentLastTick);
+            Serial.printf("[AI] field builds=%u topology rebuilds=%u\n",
+                          navigator.getStats().builds, navigator.getStats().topology);
+            break;
+        }
+        case 'f': {
+            const FrameCache::Stats& stats = frameCache.getStats();
+            Serial.printf("[FRAMES] hits=%u misses=%u evictions=%u bytes=%u flashBytesLastFrame=%u\n",
+                          stats.hits, stats.misses, stats.evictions, stats.bytes, stats.flashBytesLastFrame);
+            const Display::Stats& present = display->getStats();
+            Serial.printf("[FRAMES] presented=%u idle=%u deferred=%u missed=%u lastFrameUs=%u intervalMs=%u\n",
+                          present.presented, present.idle, present.deferred, present.missedDeadlines,
+                          present.lastFrameUs, present.intervalMs);
+            break;
+        }
+        case 'w': {
+            const PowerManager::Stats& stats = power.getStats();
+            Serial.printf("[POWER] mode=%u duty=%u%% estimatedUa=%u dimmed=%d\n",
+                          power.getMode(), power.dutyCycle(), power.estimatedUa(), display->isDimmed());
+            Serial.printf("[POWER] ticks active=%u doze=%u sleep=%u sleeps=%u rxWakes=%u wakeLatencyUsMax=%u\n",
+                          stats.ticks[PowerManager::POWER_ACTIVE], stats.ticks[PowerManager::POWER_DOZE],
+                          stats.ticks[PowerManager::POWER_SLEEP], stats.sleeps, stats.rxWakes,
+                          stats.wakeLatencyUsMax);
+            break;
+        }
+#if BENCH_ENABLED
+        case 'b':
+            Benchmarks(battle_tft).run();
+            break;
+#endif
+    }
 }
 
 void Battle::addCharacter(CharacterPtr character) {
+    if (!charactersByMac.insert(character->getMac(), character.get())) {
+        Serial.printf("[BATTLE][WARN] Character table full, dropped %u\n", character->getMac());
+        return;
+    }
     characters.push_back(character);
+    navigator.fitFootprint(character->getSprite()->getFrameWidth(), character->getSprite()->getFrameHeight());
+    sessionRecorder.event(SessionRecorder::EVENT_CHARACTER_ADDED, character->getMac());
 }
 
 void Battle::createCharacter(uint32_t senderMac, uint8_t id) {
-    for (const auto& character : characters) {
-        if (character->getMac() == senderMac) {
-            return;
-        }
+    if (charactersByMac.contains(senderMac)) {
+        return;
     }
     CharacterPtr newCharacter(new Character(senderMac, id, battle_tft, &map, this));
     addCharacter(newCharacter);
     newCharacter->setPosition(160, 60);
+
+    uint8_t sid = comm.sidOf(senderMac);
+    if (comm.getRole() == ROLE_HOST && sid != IdentityTable::NO_SID) {
+        uint8_t spawn[2] = { sid, id };
+        comm.sendControl(PACKET_SPAWN, spawn, sizeof(spawn));
+    }
+}
+
+void Battle::removeCharacter(uint32_t mac) {
+    if (!charactersByMac.erase(mac)) {
+        return;
+    }
+    for (auto it = characters.begin(); it != characters.end(); ++it) {
+        if ((*it)->getMac() == mac) {
+            characters.erase(it);
+            break;
+        }
+    }
+    sessionRecorder.event(SessionRecorder::EVENT_CHARACTER_REMOVED, mac);
 }
 
 void Battle::updateCharacters() {
+    PROFILE_SCOPE(STAGE_CHARACTERS);
+    {
+        PROFILE_SCOPE(STAGE_AI);
+        ai.update(characters, gameClock.ticks());
+    }
+
+    //Headings in list order, since wandering draws from gameRandom and chasing builds
+    //shared flow fields. Moving only touches the mover
+    {
+        PROFILE_SCOPE(STAGE_MOVE);
+        for (auto& c : characters) {
+            c->steer();
+        }
+        crowd.update(characters);
+        parallelFor(characters.size(), [&](size_t i) {
+            characters[i]->integrate();
+        });
+    }
+
+    {
+        PROFILE_SCOPE(STAGE_COMBAT);
+        resolveCombat();
+    }
+
+    animateCharacters();
+}
+
+//Clients run this alone: clips come from the host, frames from the local clock
+void Battle::animateCharacters() {
+    PROFILE_SCOPE(STAGE_ANIMATE);
+    parallelFor(characters.size(), [&](size_t i) {
+        characters[i]->animate();
+    });
+}
+
+//Declared attacks land together, then deaths and respawns follow, so no attacker's place in
+//the list decides a fight. The events queue up for the next sync
+void Battle::resolveCombat() {
+    combatEvents.clear();
     for (auto& c : characters) {
-        c->update();
+        c->declareAttack(combatEvents);
+    }
+
+    size_t attacks = combatEvents.size();
+    for (size_t i = 0; i < attacks; i++) {
+        CombatEvent attack = combatEvents[i];
+        Character* target = findCharacterByMac(attack.target);
+        if (!target || !target->isAlive()) continue;
+
+        target->takeDamage(attack.amount);
+        CombatEvent damage = { COMBAT_DAMAGE, attack.target, 0, attack.amount, target->getHealthScaled() };
+        combatEvents.push_back(damage);
+    }
+
+    uint32_t now = gameClock.now();
+    for (auto& c : characters) {
+        if (c->isAlive() && c->getHealth() <= 0) {
+            c->kill();
+            CombatEvent death = { COMBAT_DEATH, c->getMac(), 0, 0, 0 };
+            combatEvents.push_back(death);
+        } else if (!c->isAlive() && now - c->getDiedAt() >= RESPAWN_MS) {
+            c->respawn();
+            CombatEvent respawn = { COMBAT_RESPAWN, c->getMac(), 0, 0, c->getHealthScaled() };
+            combatEvents.push_back(respawn);
+        }
+    }
+
+    //Older events are only cosmetic once a later one has the same character's health
+    pendingEvents.insert(pendingEvents.end(), combatEvents.begin(), combatEvents.end());
+    if (pendingEvents.size() > MAX_PENDING_EVENTS) {
+        pendingEvents.erase(pendingEvents.begin(), pendingEvents.end() - MAX_PENDING_EVENTS);
     }
 }
 
 void Battle::sendCommands() {
-    // Packet format (8 bytes per character):
-    // [0–3] MAC address
-    // [4]   Character ID
-    // [5]   X position
-    // [6]   Y position
-    // [7]   Sprite frame
+    // Packet format (7 bytes per character):
+    // [0]   Owner's session ID
+    // [1]   Character ID
+    // [2-3] X position, world pixels, signed big-endian
+    // [4-5] Y position
+    // [6]   Clip state, see Sprite::getClipState(), with STATE_FLAG_MIRRORED when facing left
 
     std::vector<uint8_t> payload;
     for (const auto& character : characters) {
-        uint32_t mac = character->getMac();
-        payload.push_back((mac >> 24) & 0xFF);
-        payload.push_back((mac >> 16) & 0xFF);
-        payload.push_back((mac >> 8) & 0xFF);
-        payload.push_back(mac & 0xFF);
+        //Owners the host hasn't assigned yet are sent once their sid exists
+        uint8_t sid = comm.sidOf(character->getMac());
+        if (sid == IdentityTable::NO_SID) continue;
+        payload.push_back(sid);
 
         payload.push_back(character->getId());
-        payload.push_back(character->getX());
-        payload.push_back(character->getY());
-        payload.push_back(character->getSprite()->getFrame());
+        //Full world coordinates: a layout several cubes wide runs past 255
+        uint16_t x = character->getX();
+        uint16_t y = character->getY();
+        payload.push_back(x >> 8);
+        payload.push_back(x & 0xFF);
+        payload.push_back(y >> 8);
+        payload.push_back(y & 0xFF);
+        uint8_t clipState = character->getSprite()->getClipState();
+        payload.push_back(character->getSprite()->isMirrored() ? clipState | STATE_FLAG_MIRRORED : clipState);
     }
 
     comm.sendPacketToNeighbors(PACKET_COMMAND, payload.data(), payload.size());
 }
 
-void Battle::processCommands(const std::vector<uint8_t>& payload) {
-    size_t charDataSize = 8; // bytes per character
-    for (size_t i = 0; i + charDataSize <= payload.size(); i += charDataSize) {
-        uint32_t mac = (payload[i] << 24) |
-                (payload[i + 1] << 16) |
-                (payload[i + 2] << 8) |
-                payload[i + 3];
+//Events that don't fit, or find the reliable channel backed up, wait for the next tick
+void Battle::sendCombatEvents() {
+    size_t sent = 0;
+    while (sent < pendingEvents.size() && !comm.controlCongested()) {
+        uint8_t payload[MAX_COMBAT_PAYLOAD];
+        size_t len = 0;
+        for (; sent < pendingEvents.size(); sent++) {
+            const CombatEvent& event = pendingEvents[sent];
+            if (len + combatEventLen(event.type) > MAX_COMBAT_PAYLOAD) break;
+
+            payload[len++] = event.type;
+            payload[len++] = comm.sidOf(event.subject);
+            switch (event.type) {
+                case COMBAT_ATTACK:
+                    payload[len++] = comm.sidOf(event.target);
+                    break;
+                case COMBAT_DAMAGE:
+                    payload[len++] = event.amount;
+                    payload[len++] = event.health;
+                    break;
+                case COMBAT_RESPAWN:
+                    payload[len++] = event.health;
+                    break;
+                default:
+                    break;
+            }
+        }
+        comm.sendControl(PACKET_COMBAT, payload, len);
+    }
+    pendingEvents.erase(pendingEvents.begin(), pendingEvents.begin() + sent);
+}
 
-        uint8_t id = payload[i + 4];
-        uint8_t x = payload[i + 5];
-        uint8_t y = payload[i + 6];
-        uint8_t frame = payload[i + 7];
+void Battle::processCommands(const uint8_t* payload, size_t len) {
+    if (payload != lastSnapshot.data()) {
+        lastSnapshot.assign(payload, payload + len);
+        lastSnapshotAt = gameClock.now();
+    }
+
+    for (size_t i = 0; i + STATE_RECORD_LEN <= len; i += STATE_RECORD_LEN) {
+        //Sids not in our table yet are picked up after the next table flood
+        uint32_t mac = comm.macOf(payload[i]);
+        if (mac == 0) continue;
+
+        uint8_t id = payload[i + 1];
+        int16_t x = (int16_t)((payload[i + 2] << 8) | payload[i + 3]);
+        int16_t y = (int16_t)((payload[i + 4] << 8) | payload[i + 5]);
+        uint8_t clipState = payload[i + 6] & ~STATE_FLAG_MIRRORED;
+        bool mirrored = payload[i + 6] & STATE_FLAG_MIRRORED;
 
         Character* c = findCharacterByMac(mac);
         if (c) {
-            c->clientUpdate(x, y, frame);
+            c->clientUpdate(x, y, clipState, mirrored);
         } else {
             CharacterPtr newCharacter(new Character(mac, id, battle_tft, &map, this));
             addCharacter(newCharacter);
-            newCharacter->clientUpdate(x, y, frame);
+            newCharacter->clientUpdate(x, y, clipState, mirrored);
             display->setCharacters(characters);
         }
     }
 }
 
-Character* Battle::findCharacterByMac(uint32_t mac) {
-    for (const auto& character : characters) {
-        if (character->getMac() == mac) {
-            return character.get();
+void Battle::applyCombatEvents(const uint8_t* events, size_t len) {
+    for (size_t pos = 0; pos < len;) {
+        uint8_t type = events[pos];
+        size_t eventLen = combatEventLen(type);
+        if (eventLen == 0 || pos + eventLen > len) break;
+
+        Character* c = findCharacterByMac(comm.macOf(events[pos + 1]));
+        if (c) {
+            switch (type) {
+                case COMBAT_ATTACK:
+                    c->noteAttack();
+                    break;
+                case COMBAT_DAMAGE:
+                    c->setHealthScaled(events[pos + 3]);
+                    break;
+                case COMBAT_DEATH:
+                    if (c->isAlive()) c->kill();
+                    break;
+                case COMBAT_RESPAWN:
+                    c->respawn();
+                    c->setHealthScaled(events[pos + 2]);
+                    break;
+            }
         }
+        pos += eventLen;
     }
-    return nullptr;
+}
+
+Character* Battle::findCharacterByMac(uint32_t mac) {
+    Character** found = charactersByMac.find(mac);
+    return found ? *found : nullptr;
 }
 
 void Battle::addCube(uint32_t newMac, int sideFromThis) {
   map.addCube(newMac, myMac, sideFromThis);
+  sessionRecorder.event(SessionRecorder::EVENT_CUBE_ADDED, newMac);
 }
 
 void Battle::removeCube(uint32_t mac) {
+    sessionRecorder.event(SessionRecorder::EVENT_CUBE_REMOVED, mac);
+
+    //Losing the host must not drop everyone else; the election names the next one
+    if (mac == map.getRootMac()) {
+        map.reroot(myMac);
+    }
     map.removeCube(mac);
+
+    //The whole subtree behind mac left the map, not just mac itself
+    std::vector<uint32_t> gone;
+    for (const auto& character : characters) {
+        uint32_t owner = character->getMac();
+        if (owner != myMac && !map.getCubeInfo(owner)) {
+            gone.push_back(owner);
+        }
+    }
+    //Only the host tells everyone; a cube without one just forgets the pets it can't reach
+    for (uint32_t owner : gone) {
+        if (comm.getRole() == ROLE_HOST) {
+            despawnCharacter(owner);
+        } else {
+            removeCharacter(owner);
+        }
+    }
 }
 
-void Battle::addCubeWithPath(uint32_t mac, const std::vector<uint8_t>& path) {
+//Removes a character here and on every other cube, and frees its owner's sid
+void Battle::despawnCharacter(uint32_t mac) {
+    removeCharacter(mac);
+    uint8_t sid = comm.sidOf(mac);
+    if (sid == IdentityTable::NO_SID) return;
+
+    comm.sendControl(PACKET_DESPAWN, &sid, 1);
+    comm.releaseSid(sid);
+}
+
+void Battle::addCubeWithPath(uint32_t mac, const PackedPath& path) {
+    //Display picks up this cube's new origin from the map version
     map.addCubeWithPath(mac, path);
+    sessionRecorder.event(SessionRecorder::EVENT_CUBE_ADDED, mac);
+}
 
-    if (mac == myMac) {
-        const Cube* c = map.getCubeInfo(myMac);
-        if (c) {
-            display->setViewOrigin(c->x, c->y);
+
+void Battle::onHostChanged(uint32_t host, uint32_t lostHost) {
+    sessionRecorder.event(SessionRecorder::EVENT_HOST_CHANGED, host);
+
+    //Keep the layout and move the origin; only a host this cube has never placed starts over
+    if (!map.reroot(host)) {
+        map.addCubeWithPath(host, PackedPath());
+        placeNeighbors(host);
+    }
+
+    if (host == myMac) {
+        warmStart(lostHost);
+    }
+
+    //Only its neighbors time the lost host out; the rest of the mesh drops it here
+    if (lostHost != 0 && lostHost != myMac && lostHost != host && map.getCubeInfo(lostHost)) {
+        removeCube(lostHost);
+    }
+}
+
+//Starting over drops the old tree, this cube included. What the neighbor table still knows
+//goes back in; cubes further out wait for their next PATH
+void Battle::placeNeighbors(uint32_t host) {
+    PackedPath mine;
+    if (host != myMac) {
+        int face = comm.faceOf(host);
+        if (face < 0) {
+            comm.replayNeighborPaths();
+            return;
+        }
+        mine.push((face + 2) % NUM_SIDES);
+        map.addCubeWithPath(myMac, mine);
+    }
+
+    for (int i = 0; i < NUM_SIDES; i++) {
+        uint32_t mac = comm.neighborOn(i);
+        if (mac == 0 || mac == host) continue;
+        PackedPath path = mine;
+        if (!path.push(i)) continue;
+        map.addCubeWithPath(mac, path);
+    }
+}
+
+//Takes over from the last state the previous host replicated instead of whatever this cube
+//last simulated on its own, so pets keep their place and frame across a failover
+void Battle::warmStart(uint32_t lostHost) {
+    //A snapshot from a mesh this cube left long ago says nothing about this one
+    if (!lastSnapshot.empty() && (uint32_t)(gameClock.now() - lastSnapshotAt) < SNAPSHOT_MAX_AGE_MS) {
+        processCommands(lastSnapshot.data(), lastSnapshot.size());
+
+        //Characters the old host no longer replicated are stale
+        std::vector<uint32_t> stale;
+        for (const auto& character : characters) {
+            uint32_t mac = character->getMac();
+            if (mac == myMac) continue;
+
+            bool replicated = false;
+            for (size_t i = 0; i + STATE_RECORD_LEN <= lastSnapshot.size(); i += STATE_RECORD_LEN) {
+                if (comm.macOf(lastSnapshot[i]) == mac) {
+                    replicated = true;
+                    break;
+                }
+            }
+            if (!replicated) stale.push_back(mac);
+        }
+        for (uint32_t mac : stale) {
+            despawnCharacter(mac);
         }
     }
+
+    if (lostHost != 0 && lostHost != myMac && charactersByMac.contains(lostHost)) {
+        despawnCharacter(lostHost);
+    }
+
+    Serial.printf("[BATTLE] Took over as host with %u characters\n", (unsigned)characters.size());
+    sendCommands();
+}
+
+void Battle::onTerrain(uint32_t mac, const uint8_t* packed) {
+    //The host generates its own
+    if (comm.getRole() == ROLE_HOST) return;
+    map.setTerrain(mac, packed);
+}
+
+//Cubes with no ground yet get it here, from where they sit, one per tick so a mesh joining at
+//once doesn't fill the reliable backlog. The host also sends it to the mesh, and repeats one
+//cube's every TERRAIN_RESEND_MS for any that missed it
+void Battle::streamTerrain() {
+    bool host = comm.getRole() == ROLE_HOST;
+    if (host && comm.controlCongested()) return;
+
+    uint32_t next = 0;
+    int16_t x = 0;
+    int16_t y = 0;
+    map.forEachCube([&](uint32_t mac, const Cube& cube) {
+        if (next != 0 || cube.hasTerrain) return;
+        //Cubes are named by sid on the wire, so one the host hasn't assigned waits
+        if (host && comm.sidOf(mac) == IdentityTable::NO_SID) return;
+        next = mac;
+        x = cube.x;
+        y = cube.y;
+    });
+    if (next != 0) {
+        uint8_t packed[TERRAIN_BYTES];
+        generateTerrain(x, y, packed);
+        map.setTerrain(next, packed);
+        if (host) sendTerrain(next, packed);
+        return;
+    }
+
+    if (!host || map.cubeCount() == 0 || gameClock.now() - terrainResentAt < TERRAIN_RESEND_MS) return;
+    terrainResentAt = gameClock.now();
+
+    uint8_t index = 0;
+    uint8_t resend = terrainCarousel++ % map.cubeCount();
+    map.forEachCube([&](uint32_t mac, const Cube& cube) {
+        if (index++ == resend && cube.hasTerrain) sendTerrain(mac, cube.terrain);
+    });
 }
 
+//[cube sid][packed tile ids]
+void Battle::sendTerrain(uint32_t mac, const uint8_t* packed) {
+    uint8_t sid = comm.sidOf(mac);
+    if (sid == IdentityTable::NO_SID) return;
 
-std::vector<uint8_t> Battle::getPathFromHost() const {
+    uint8_t payload[1 + TERRAIN_BYTES];
+    payload[0] = sid;
+    memcpy(payload + 1, packed, TERRAIN_BYTES);
+    comm.sendControl(PACKET_TERRAIN, payload, sizeof(payload));
+}
+
+PackedPath Battle::getPathFromHost() const {
     return map.getPathFromHost(myMac);
 }
 
@@ -165,6 +597,28 @@ uint32_t Battle::getMyMac() {
     return myMac;
 }
 
+uint32_t Battle::stateHash() const {
+    uint32_t h = SessionRecorder::HASH_SEED;
+    for (const auto& character : characters) {
+        uint8_t record[10];
+        uint32_t mac = character->getMac();
+        int16_t x = character->getX();
+        int16_t y = character->getY();
+        record[0] = (mac >> 24) & 0xFF;
+        record[1] = (mac >> 16) & 0xFF;
+        record[2] = (mac >> 8) & 0xFF;
+        record[3] = mac & 0xFF;
+        record[4] = character->getId();
+        record[5] = (x >> 8) & 0xFF;
+        record[6] = x & 0xFF;
+        record[7] = (y >> 8) & 0xFF;
+        record[8] = y & 0xFF;
+        record[9] = character->getSprite()->getFrame();
+        h = SessionRecorder::hash(h, record, sizeof(record));
+    }
+    return h;
+}
+
 Character* Battle::findNearestEnemy(Character* seeker) {
     Character* nearest = nullptr;
     float nearestDist = 999999.0f;
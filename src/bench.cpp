@@ -0,0 +1,339 @@
+// bench.cpp
+#include "bench.h"
+
+#if BENCH_ENABLED
+
+#include "battle.h"
+#include "display.h"
+#include "sprite.h"
+#include "game_clock.h"
+#include "game_random.h"
+#include "session_recorder.h"
+#include "session_replay.h"
+#include "crowd.h"
+#include <memory>
+
+static const uint32_t BENCH_SEED = 0xC0FFEE;
+static const DeviceId FIRST_DEVICE = 0x246F28000001ULL;   //this cube; other owners follow it
+static const uint32_t FIRST_CUBE = 1000;
+
+static const int CHARACTER_COUNTS[] = { 1, 8, 32 };
+static const int CUBE_COUNTS[] = { 1, 4, 9, 16 };
+static const int FRAME_COUNTS[] = { 1, 8, 32 };
+#ifdef ESP_PLATFORM
+static const int CROWD_COUNTS[] = { 8, 32, 64 };   //characters are big for the heap
+#else
+static const int CROWD_COUNTS[] = { 8, 32, 128, 512 };
+#endif
+static const size_t NUM_POINTS = 64;
+
+#define COUNT_OF(a) (sizeof(a) / sizeof((a)[0]))
+
+//Results of the queries go here, so the calls can't be optimised away
+static volatile uint32_t benchSink;
+
+//A battle whose Comms has a sid bound for every owner, as after a table flood, and the state
+//payload that placed their characters
+struct BenchBattle {
+    ReplayTransport faces[NUM_SIDES];
+    std::unique_ptr<Battle> battle;
+    std::vector<uint8_t> state;
+};
+
+static void setUpBattle(BenchBattle& bench, TFT_eSPI* tft, int characters) {
+    Transport* faces[NUM_SIDES];
+    for (int i = 0; i < NUM_SIDES; i++) {
+        faces[i] = &bench.faces[i];
+    }
+    bench.battle.reset(new Battle(tft, 128, 128));
+    bench.battle->initReplay(BENCH_SEED, FIRST_DEVICE, 0, faces, 0);
+
+    Comms& comm = bench.battle->getComms();
+    bench.state.clear();
+    for (int i = 0; i < characters; i++) {
+        uint8_t sid = i + 1;
+        comm.bindSid(sid, FIRST_DEVICE + i);
+        uint16_t x = gameRandom.next() % 200;
+        uint16_t y = gameRandom.next() % 100;
+        bench.state.push_back(sid);
+        bench.state.push_back(0);
+        bench.state.push_back(x >> 8);
+        bench.state.push_back(x & 0xFF);
+        bench.state.push_back(y >> 8);
+        bench.state.push_back(y & 0xFF);
+        bench.state.push_back(0);
+    }
+    bench.battle->processCommands(bench.state.data(), bench.state.size());
+}
+
+//Square-ish block of cubes, row by row from the host at the top left
+static int buildGrid(Map& map, int cubes) {
+    int cols = 1;
+    while (cols * cols < cubes) cols++;
+
+    for (int i = 0; i < cubes; i++) {
+        uint32_t mac = FIRST_CUBE + i;
+        if (i == 0) {
+            map.addCube(mac, 0, -1);
+        } else if (i % cols != 0) {
+            map.addCube(mac, mac - 1, 0);
+        } else {
+            map.addCube(mac, mac - cols, 3);
+        }
+    }
+    return cols;
+}
+
+template <typename F>
+void Benchmarks::measure(const char* name, int arg0, int arg1, uint8_t argCount, F body) {
+    //Warm up lazy state such as sprite masks and the sorted draw list
+    body();
+
+    uint32_t iterations = 1;
+    uint32_t elapsed = 0;
+    while (true) {
+        uint32_t start = micros();
+        for (uint32_t i = 0; i < iterations; i++) {
+            body();
+        }
+        elapsed = micros() - start;
+        if (elapsed >= MIN_TIME_US || iterations >= MAX_ITERATIONS) break;
+        iterations *= 2;
+        yield();
+    }
+
+    Result result = { name, { arg0, arg1 }, argCount, iterations, (float)elapsed / iterations };
+    _results.push_back(result);
+}
+
+void Benchmarks::run() {
+    if (sessionRecorder.active()) {
+        sessionRecorder.stop();
+        Serial.println("[BENCH] Session recording stopped");
+    }
+    Serial.println("[BENCH] Running");
+
+    _results.clear();
+    gameClock.start(0);
+    gameRandom.seed(BENCH_SEED);
+
+    for (size_t c = 0; c < COUNT_OF(CHARACTER_COUNTS); c++) {
+        benchSpriteDraw(CHARACTER_COUNTS[c]);
+    }
+    for (size_t c = 0; c < COUNT_OF(CHARACTER_COUNTS); c++) {
+        for (size_t k = 0; k < COUNT_OF(CUBE_COUNTS); k++) {
+            benchDisplayDraw(CHARACTER_COUNTS[c], CUBE_COUNTS[k]);
+        }
+    }
+    for (size_t c = 0; c < COUNT_OF(CHARACTER_COUNTS); c++) {
+        benchEnemyQueries(CHARACTER_COUNTS[c]);
+        benchStateCodec(CHARACTER_COUNTS[c]);
+    }
+    for (size_t k = 0; k < COUNT_OF(CUBE_COUNTS); k++) {
+        benchWorldBounds(CUBE_COUNTS[k]);
+    }
+    for (size_t c = 0; c < COUNT_OF(CROWD_COUNTS); c++) {
+        benchCrowd(CROWD_COUNTS[c]);
+    }
+    for (size_t f = 0; f < COUNT_OF(FRAME_COUNTS); f++) {
+        benchCommsParser(FRAME_COUNTS[f]);
+    }
+
+    report();
+}
+
+//One sprite blitted once per character into an off-screen buffer
+void Benchmarks::benchSpriteDraw(int characters) {
+    TFT_eSprite buffer(_tft);
+    buffer.createSprite(128, 128);
+    Sprite sprite(_tft);
+    sprite.load(0);
+
+    int16_t xs[32], ys[32];
+    for (int i = 0; i < characters; i++) {
+        xs[i] = gameRandom.next() % 96;
+        ys[i] = gameRandom.next() % 96;
+    }
+
+    measure("BM_SpriteDrawTo", characters, 0, 1, [&]() {
+        for (int i = 0; i < characters; i++) {
+            sprite.drawTo(buffer, xs[i], ys[i]);
+        }
+    });
+    buffer.deleteSprite();
+}
+
+//Compose and push with characters spread over the whole world
+void Benchmarks::benchDisplayDraw(int characters, int cubes) {
+    Map map;
+    int cols = buildGrid(map, cubes);
+    int rows = (cubes + cols - 1) / cols;
+
+    Display display(&map, _tft, 128, 128);
+    display.setMac(FIRST_CUBE);
+
+    CharacterList list;
+    for (int i = 0; i < characters; i++) {
+        CharacterPtr character(new Character(IdentityTable::keyFor(FIRST_DEVICE + i), 0, _tft, &map, nullptr));
+        character->setPosition(gameRandom.next() % (cols * Map::CUBE_SIZE - 32),
+                               gameRandom.next() % (rows * Map::CUBE_SIZE - 32));
+        list.push_back(character);
+    }
+    display.setCharacters(list);
+
+    measure("BM_DisplayDraw", characters, cubes, 2, [&]() {
+        display.draw(list);
+    });
+}
+
+void Benchmarks::benchEnemyQueries(int characters) {
+    BenchBattle bench;
+    setUpBattle(bench, _tft, characters);
+    Battle& battle = *bench.battle;
+
+    std::vector<Character*> seekers;
+    for (int i = 0; i < characters; i++) {
+        seekers.push_back(battle.findCharacterByMac(IdentityTable::keyFor(FIRST_DEVICE + i)));
+    }
+
+    size_t next = 0;
+    measure("BM_FindNearestEnemy", characters, 0, 1, [&]() {
+        benchSink += battle.findNearestEnemy(seekers[next++ % seekers.size()]) != nullptr;
+    });
+    measure("BM_FindEnemiesInRange", characters, 0, 1, [&]() {
+        benchSink += battle.findEnemiesInRange(seekers[next++ % seekers.size()], 64.0f).size();
+    });
+}
+
+//Points and sprite-sized rects scattered over the world and a margin around it
+void Benchmarks::benchWorldBounds(int cubes) {
+    Map map;
+    int cols = buildGrid(map, cubes);
+    int span = cols * Map::CUBE_SIZE + 128;
+
+    int16_t xs[NUM_POINTS], ys[NUM_POINTS];
+    for (size_t i = 0; i < NUM_POINTS; i++) {
+        xs[i] = (int16_t)(gameRandom.next() % span) - 64;
+        ys[i] = (int16_t)(gameRandom.next() % span) - 64;
+    }
+
+    size_t next = 0;
+    measure("BM_MapIsCharacterInWorld", cubes, 0, 1, [&]() {
+        size_t i = next++ % NUM_POINTS;
+        benchSink += map.isCharacterInWorld(xs[i], ys[i]);
+    });
+    measure("BM_MapIsRectInWorld", cubes, 0, 1, [&]() {
+        size_t i = next++ % NUM_POINTS;
+        benchSink += map.isRectInWorld(xs[i], ys[i], 32, 32);
+    });
+}
+
+//One separation pass at a constant density of about one character per sprite, so a run
+//that scales linearly shows a flat time per character
+void Benchmarks::benchCrowd(int characters) {
+    Map map;
+    int side = 8;
+    while (side * side < characters * 40 * 40) side += 8;
+
+    CharacterList list;
+    for (int i = 0; i < characters; i++) {
+        CharacterPtr character(new Character(IdentityTable::keyFor(FIRST_DEVICE + i), 0, _tft, &map, nullptr));
+        character->setPosition(gameRandom.next() % side, gameRandom.next() % side);
+        list.push_back(character);
+    }
+
+    Crowd crowd;
+    measure("BM_CrowdSeparation", characters, 0, 1, [&]() {
+        crowd.update(list);
+        benchSink += crowd.getStats().candidates;
+    });
+}
+
+//State replication: the host's encode and a client's decode of the same characters
+void Benchmarks::benchStateCodec(int characters) {
+    BenchBattle bench;
+    setUpBattle(bench, _tft, characters);
+    Battle& battle = *bench.battle;
+
+    measure("BM_SendCommands", characters, 0, 1, [&]() {
+        battle.sendCommands();
+    });
+    measure("BM_ProcessCommands", characters, 0, 1, [&]() {
+        battle.processCommands(bench.state.data(), bench.state.size());
+    });
+}
+
+//State frames for 8 characters arriving on one face, read in the transport's pieces
+void Benchmarks::benchCommsParser(int frames) {
+    BenchBattle bench;
+    setUpBattle(bench, _tft, 8);
+    Comms& comm = bench.battle->getComms();
+
+    const size_t frameLen = PACKET_HEADER_LEN + bench.state.size();
+    std::vector<uint8_t> stream(frames * frameLen);
+    for (int f = 0; f < frames; f++) {
+        uint8_t* frame = &stream[f * frameLen];
+        frame[0] = PACKET_COMMAND;
+        frame[1] = bench.state.size();
+        frame[2] = 2;
+        memcpy(frame + PACKET_HEADER_LEN, bench.state.data(), bench.state.size());
+    }
+
+    //Fresh sequence numbers, or dedup would drop every frame after the first pass
+    uint16_t seq = 0;
+    measure("BM_CommsParseCommands", frames, 0, 1, [&]() {
+        for (int f = 0; f < frames; f++) {
+            uint8_t* frame = &stream[f * frameLen];
+            seq++;
+            frame[3] = seq >> 8;
+            frame[4] = seq & 0xFF;
+        }
+        for (size_t pos = 0; pos < stream.size(); pos += 64) {
+            size_t len = stream.size() - pos < 64 ? stream.size() - pos : 64;
+            bench.faces[0].push(&stream[pos], len);
+        }
+        comm.update();
+    });
+}
+
+void Benchmarks::report() const {
+    Serial.println("[BENCH] BEGIN");
+    Serial.println("{");
+    Serial.println("  \"context\": {");
+    Serial.println("    \"executable\": \"cubepets\",");
+    Serial.println("    \"num_cpus\": 1,");
+#ifdef ESP_PLATFORM
+    Serial.printf("    \"mhz_per_cpu\": %u,\n", ESP.getCpuFreqMHz());
+#else
+    Serial.println("    \"mhz_per_cpu\": 0,");
+#endif
+    Serial.println("    \"library_build_type\": \"release\"");
+    Serial.println("  },");
+    Serial.println("  \"benchmarks\": [");
+
+    for (size_t i = 0; i < _results.size(); i++) {
+        const Result& r = _results[i];
+        char name[48];
+        if (r.argCount == 2) {
+            snprintf(name, sizeof(name), "%s/%d/%d", r.name, r.args[0], r.args[1]);
+        } else {
+            snprintf(name, sizeof(name), "%s/%d", r.name, r.args[0]);
+        }
+
+        Serial.println("    {");
+        Serial.printf("      \"name\": \"%s\",\n", name);
+        Serial.printf("      \"run_name\": \"%s\",\n", name);
+        Serial.println("      \"run_type\": \"iteration\",");
+        Serial.printf("      \"iterations\": %u,\n", r.iterations);
+        Serial.printf("      \"real_time\": %.3f,\n", r.usPerIteration);
+        Serial.printf("      \"cpu_time\": %.3f,\n", r.usPerIteration);
+        Serial.println("      \"time_unit\": \"us\"");
+        Serial.println(i + 1 < _results.size() ? "    }," : "    }");
+    }
+
+    Serial.println("  ]");
+    Serial.println("}");
+    Serial.println("[BENCH] END");
+}
+
+#endif //BENCH_ENABLED
@@ -1,6 +1,7 @@
 #include "character.h"
 #include "battle.h"
-#include <cstdlib>      // rand(), srand()
+#include "game_clock.h"
+#include "game_random.h"
 #include <cmath>
 
 Character::Character(uint32_t mac, uint8_t id, TFT_eSPI* tft, Map* map, Battle* battle)
@@ -8,75 +9,60 @@ Character::Character(uint32_t mac, uint8_t id, TFT_eSPI* tft, Map* map, Battle*
 {
   _sprite = new Sprite(tft);
   _sprite->load(id);
-  _sprite->play("idle");
+  _sprite->play(CLIP_IDLE);
 
   _health = 100;
   _maxHealth = 100;
   _attackPower = 10;
   _defense = 2;
   _alive = true;
-  _state = WANDER;
   _attackCooldown = 1000; // 1 second
   _lastAttackTime = 0;
-  _fleeThreshold = 20;
 }
 
 Character::~Character() {
   delete _sprite;
 }
 
-void Character::update() {
-    if (!_alive) {
-        if (_currentAnimation != "death") {
-            _sprite->play("death", false);
-            _currentAnimation = "death";
-        }
-        _sprite->update();
-        return;
-    }
+//Acts on the decision the AI engine cached at the last think by picking a heading. Enemies
+//are looked up by key every tick, so positions are fresh and one that went away is skipped.
+//Attacks wait for declareAttack, after everyone has moved
+void Character::steer() {
+  _moving = false;
+  if (!_alive) return;
 
-    updateAI();
-    _sprite->update();
-}
+  Character* target = _memory.target ? _battle->findCharacterByMac(_memory.target) : nullptr;
+  if (target && !target->isAlive()) target = nullptr;
 
-
-void Character::updateAI() {
-  unsigned long now = millis();
-
-  if (_health <= 0) {
-    _alive = false;
-    _state = DEAD;
-    return;
-  }
-
-  Character* target = findNearestEnemy();
-  float dist = (target) ? distanceTo(target) : 9999;
-
-  if (_health < _fleeThreshold) {
-    _state = FLEE;
-  } else if (target && dist <= _attackRange) {
-    _state = ATTACK;
-  } else if (target && dist <= _detectionRange) {
-    _state = CHASE;
-  } else {
-    _state = WANDER;
-  }
-
-  switch (_state) {
-    case WANDER:
+  switch (_memory.action) {
+    case ACTION_WANDER:
       wanderRandomly();
       break;
-    case CHASE:
-      moveToward(target);
-      break;
-    case ATTACK:
-      if (canAttack()) {
-        performAttack(target);
+    case ACTION_CHASE:
+      if (target) {
+        moveToward(target);
+      } else {
+        wanderRandomly();
       }
       break;
-    case FLEE: {
-      // Get all nearby enemies for fleeing
-      std::vector<Character*> enemiesNearby = _battle->findEnemiesInRange(this, _detectionRange);
+    case ACTION_FLEE: {
+      //Walk the nearest enemy's field uphill; once cornered, back away from the whole group
+      float dx, dy;
+      if (target && _battle->getNavigator().awayFrom(target->getMac(), centerX(), centerY(),
+                                                     target->centerX(), target->centerY(), dx, dy)) {
+        float len = sqrtf(dx * dx + dy * dy);
+        _ndx = dx / len;
+        _ndy = dy / len;
+        _movement = _speed * 2.5f;
+        _moving = true;
+        break;
+      }
+
+      std::vector<Character*> enemiesNearby;
+      for (uint32_t mac : _memory.threats) {
+        Character* enemy = _battle->findCharacterByMac(mac);
+        if (enemy) enemiesNearby.push_back(enemy);
+      }
       moveAwayFromGroup(enemiesNearby);
       break;
     }
@@ -85,6 +71,36 @@ void Character::updateAI() {
   }
 }
 
+void Character::integrate() {
+  if (_moving) {
+    moveByDirection();
+  }
+}
+
+//Only declares the blow; Battle lands all of a tick's attacks together
+void Character::declareAttack(std::vector<CombatEvent>& events) {
+  if (!_alive || _memory.action != ACTION_ATTACK) return;
+
+  Character* target = _memory.target ? _battle->findCharacterByMac(_memory.target) : nullptr;
+  if (!target || !target->isAlive() || !isTouching(target) || !canAttack()) return;
+
+  int damage = _attackPower - target->_defense;
+  if (damage < 1) damage = 1;
+  if (damage > 255) damage = 255;
+
+  CombatEvent attack = { COMBAT_ATTACK, _mac, target->getMac(), (uint8_t)damage, 0 };
+  events.push_back(attack);
+  _lastAttackTime = gameClock.now();
+}
+
+void Character::animate() {
+  if (!_alive && !_deathPlayed) {
+    _sprite->play(CLIP_DEATH);
+    _deathPlayed = true;
+  }
+  _sprite->update();
+}
+
 
 Character* Character::findNearestEnemy() {
   return _battle->findNearestEnemy(this); // You need to implement this in your Map class
@@ -96,48 +112,69 @@ float Character::distanceTo(Character* other) {
   return sqrtf(dx * dx + dy * dy);
 }
 
-bool Character::canAttack() {
-  return millis() - _lastAttackTime >= _attackCooldown;
+//Melee contact is tested against the sprites' opaque outlines rather than a radius
+bool Character::isTouching(Character* other) {
+  return _sprite->overlaps(_x, _y, *other->getSprite(), other->getX(), other->getY(), _attackReach);
 }
 
-void Character::performAttack(Character* target) {
-  int damage = _attackPower - target->_defense;
-  if (damage < 1) damage = 1;
-  target->takeDamage(damage);
-  _lastAttackTime = millis();
+bool Character::canAttack() {
+  return gameClock.now() - _lastAttackTime >= _attackCooldown;
 }
 
+//Death is decided once all of the tick's damage is in, see kill()
 void Character::takeDamage(int dmg) {
   _health -= dmg;
-  if (_health <= 0) {
+  if (_health < 0) {
     _health = 0;
-    _alive = false;
   }
 }
 
+void Character::kill() {
+  _health = 0;
+  _alive = false;
+  _diedAt = gameClock.now();
+}
+
+void Character::respawn() {
+  _health = _maxHealth;
+  _alive = true;
+  _deathPlayed = false;
+  _sprite->play(CLIP_IDLE);
+}
+
+void Character::noteAttack() {
+  _lastAttackTime = gameClock.now();
+}
+
 void Character::wanderRandomly() {
-  unsigned long now = millis();
+  unsigned long now = gameClock.now();
 
   if (now - _lastDirChange > _directionInterval) {
-    float angle = ((rand() / (float)RAND_MAX) * 2.0f * PI);
+    float angle = (gameRandom.nextFloat() * 2.0f * PI);
     _ndx = cosf(angle);
     _ndy = sinf(angle);
     _movement = _speed * 2.0f;
     _lastDirChange = now;
   }
 
-  moveByDirection();
+  _moving = true;
 }
 
+//Follows the target's flow field around the edges of the world, and goes straight once close
 void Character::moveToward(Character* target) {
-  float dx = target->getX() - _x;
-  float dy = target->getY() - _y;
+  float dx, dy;
+  if (!_battle || !_battle->getNavigator().toward(target->getMac(), centerX(), centerY(),
+                                                  target->centerX(), target->centerY(), dx, dy)) {
+    dx = target->getX() - _x;
+    dy = target->getY() - _y;
+  }
   float len = sqrtf(dx * dx + dy * dy);
+  if (len == 0) return;
   _ndx = dx / len;
   _ndy = dy / len;
   _movement = _speed * 2.0f;
 
-  moveByDirection();
+  _moving = true;
 }
 
 void Character::moveAwayFrom(Character* target) {
@@ -148,7 +185,7 @@ void Character::moveAwayFrom(Character* target) {
   _ndy = dy / len;
   _movement = _speed * 2.5f;
 
-  moveByDirection();
+  _moving = true;
 }
 
 void Character::moveAwayFromGroup(const std::vector<Character*>& targets) {
@@ -184,7 +221,7 @@ void Character::moveAwayFromGroup(const std::vector<Character*>& targets) {
 
     if (len == 0) {
         // Exactly on average position, pick random direction
-        float angle = ((rand() / (float)RAND_MAX) * 2.0f * M_PI);
+        float angle = (gameRandom.nextFloat() * 2.0f * M_PI);
         _ndx = cosf(angle);
         _ndy = sinf(angle);
     } else {
@@ -194,23 +231,39 @@ void Character::moveAwayFromGroup(const std::vector<Character*>& targets) {
 
     _movement = _speed * 2.5f;
 
-    moveByDirection();
+    _moving = true;
 }
 
 void Character::moveByDirection() {
-  unsigned long now = millis();
+  unsigned long now = gameClock.now();
 
   if (now - _lastMoveTime > _moveInterval) {
-    int16_t newX = _x + (int16_t)(_ndx * _movement);
-    int16_t newY = _y + (int16_t)(_ndy * _movement);
+    //Heading plus the crowd's push away from neighbours, no faster than the heading alone
+    float dx = _ndx + _sepX;
+    float dy = _ndy + _sepY;
+    float len = sqrtf(dx * dx + dy * dy);
+    if (len > 1.0f) {
+        dx /= len;
+        dy /= len;
+    }
+
+    int16_t newX = _x + (int16_t)(dx * _movement);
+    int16_t newY = _y + (int16_t)(dy * _movement);
     int16_t width = _sprite->getFrameWidth();
     int16_t height = _sprite->getFrameHeight();
 
-    if (_map->isCharacterInWorld(newX, newY) &&
-        _map->isCharacterInWorld(newX + width - 1, newY) &&
-        _map->isCharacterInWorld(newX, newY + height - 1) &&
-        _map->isCharacterInWorld(newX + width - 1, newY + height - 1)) {
+    //Face the way it's going
+    if (newX != _x) {
+        _sprite->setMirrored(newX < _x);
+    }
+
+    //Slide along an edge instead of stopping dead against it
+    if (_map->isRectInWorld(newX, newY, width, height)) {
+        _x = newX;
+        _y = newY;
+    } else if (newX != _x && _map->isRectInWorld(newX, _y, width, height)) {
         _x = newX;
+    } else if (newY != _y && _map->isRectInWorld(_x, newY, width, height)) {
         _y = newY;
     }
 
@@ -227,14 +280,28 @@ void Character::setPosition(int16_t x, int16_t y) {
   _y = y;
 }
 
-void Character::clientUpdate(uint8_t x, uint8_t y, uint8_t frame) {
+//Facing is replicated rather than read off the step since the last sync, as contact tests
+//depend on it
+void Character::clientUpdate(int16_t x, int16_t y, uint8_t clipState, bool mirrored) {
+  _sprite->setMirrored(mirrored);
   setPosition(x, y);
-  _sprite->setFrame(frame);
+  _sprite->setClipState(clipState);
 }
 
 uint8_t Character::getId() const {return _id;}
+float Character::getHealthFraction() const { return _maxHealth > 0 ? (float)_health / _maxHealth : 0.0f; }
+int Character::getHealth() const { return _health; }
+uint8_t Character::getHealthScaled() const { return _maxHealth > 0 ? (uint8_t)(_health * 255 / _maxHealth) : 0; }
+void Character::setHealthScaled(uint8_t health) { _health = (health * _maxHealth + 127) / 255; }
+uint32_t Character::getDiedAt() const { return _diedAt; }
+unsigned long Character::getLastAttackTime() const { return _lastAttackTime; }
+float Character::getDetectionRange() const { return _detectionRange; }
+AIMemory& Character::memory() { return _memory; }
+void Character::setSeparation(float x, float y) { _sepX = x; _sepY = y; }
 int16_t Character::getX() const { return _x; }
 int16_t Character::getY() const { return _y; }
+int16_t Character::centerX() const { return _x + _sprite->getFrameWidth() / 2; }
+int16_t Character::centerY() const { return _y + _sprite->getFrameHeight() / 2; }
 uint8_t Character::getZOrder() const { return _zOrder; }
 Sprite* Character::getSprite() const { return _sprite; }
 
@@ -1,52 +1,251 @@
 // comms.cpp
 #include "comms.h"
 #include "battle.h"
+#include "link_rate.h"
+#include "game_clock.h"
+#include "game_random.h"
+#include "session_recorder.h"
+#include "terrain.h"
+#include "combat.h"
 #include <esp_system.h>
 #include <Arduino.h>
 
+#if COMMS_TRACE
+#define TRACE(...) Serial.printf(__VA_ARGS__)
+#else
+#define TRACE(...) do {} while (0)
+#endif
+
 static const int MAX_RECENT_PACKETS = 100;
+static const size_t TX_BUDGET_PER_TICK = 512;  //bytes handed to one face per update
+static const uint32_t KEEPALIVE_INTERVAL_MS = HostElection::BEAT_INTERVAL_MS;
+static const uint32_t LINK_TIMEOUT_MS = 200;
+static const uint32_t PROBE_LINK_TIMEOUT_MS = 1000;  //a failed rate probe silences the link for a while
+static const uint32_t JOIN_RETRY_MS = 1000;
+static const uint32_t ANNOUNCE_INTERVAL_MS = 100;    //joins arriving together share one table flood
+static const size_t PATH_HEADER_LEN = DEVICE_ID_LEN + 5;
+static const size_t ASSIGN_ENTRY_LEN = 1 + DEVICE_ID_LEN;
+static const size_t KEEPALIVE_STAMP_LEN = 6;   //[stamp(2)][echo(2)][held(2)] after the view
+static const size_t KEEPALIVE_LEN = HostElection::VIEW_LEN + KEEPALIVE_STAMP_LEN + ReliableLink::ACK_LEN;
+static const uint16_t NO_ECHO = 0xFFFF;
+
+//Tags that travel as frames of their own, with a payload length they could have
+static bool isFrameHeader(uint8_t tag, uint8_t payloadLen) {
+    switch (tag) {
+        case PACKET_HEARTBEAT:
+            return payloadLen >= PATH_HEADER_LEN && payloadLen <= PATH_HEADER_LEN + sizeof(PackedPath().bytes);
+        case PACKET_KEEPALIVE:
+            return payloadLen >= HostElection::VIEW_LEN && payloadLen <= KEEPALIVE_LEN;
+        case PACKET_LINK_PROBE:
+            return payloadLen <= LinkRate::MAX_PROBE_LEN;
+        case PACKET_RELIABLE:
+            return payloadLen >= ReliableLink::HEADER_LEN && payloadLen <= ReliableLink::MAX_FRAME;
+        case PACKET_COMMAND:
+        case PACKET_BATCH:
+            return payloadLen > 0;
+    }
+    return false;
+}
+
+#ifdef ESP_PLATFORM
+//Face to UART wiring. Three faces get a UART each and only the fourth shares one: it takes
+//turns with face 1 while neither has a neighbor, and works whenever face 1 is free. Builds
+//with the debug console give UART0 to it, and faces 0 and 2 share UART1 as well
+static const FaceWiring FACE_WIRING[NUM_SIDES] = {
+    { UART_NUM_1, 17, 16 },
+    { UART_NUM_2, 26, 25 },
+#if DEBUG_CONSOLE
+    { UART_NUM_1, 33, 32 },
+#else
+    { UART_NUM_0, 33, 32 },
+#endif
+    { UART_NUM_2, 14, 27 },
+};
+#else
+static uint32_t hostClockUs() {
+    return micros();
+}
+#endif
 
 Comms::Comms(Battle* battle)
     : _battle(battle), _role(ROLE_UNASSIGNED), _hostMac(0), _lastSendTime(0), localSeqNum(0)
 {
     for (int i = 0; i < NUM_SIDES; i++) {
         neighbors[i] = {};
-        neighbors[i].serial = new HardwareSerial(i + 1);
+#ifdef ESP_PLATFORM
+        neighbors[i].link = new UartTransport(FACE_WIRING[i]);
+#else
+        //An unconnected stand-in until a simulation wires the face with setTransport()
+        neighbors[i].link = new MemoryTransport(hostClockUs);
+#endif
+        ownsLink[i] = true;
         latestCommandPackets[i].clear();
         hasPendingCommand[i] = false;
+        utilBytesMark[i] = 0;
+        linkUtilization[i] = 0;
+        telemetry[i] = {};
+        peerStamp[i] = 0;
+        peerStampAt[i] = 0;
+        hasPeerStamp[i] = false;
+    }
+}
+
+Comms::~Comms() {
+#ifdef ESP_PLATFORM
+    //The UART drivers outlive us, so a set their queues joined has to stay too
+    bool hasUarts = false;
+    for (int i = 0; i < NUM_SIDES; i++) {
+        if (ownsLink[i]) hasUarts = true;
+    }
+    if (_rxEvents && !hasUarts) vQueueDelete(_rxEvents);
+#endif
+
+    for (int i = 0; i < NUM_SIDES; i++) {
+        if (ownsLink[i]) delete neighbors[i].link;
     }
 }
 
+void Comms::setTransport(int side, Transport* link) {
+    if (side < 0 || side >= NUM_SIDES) return;
+    if (ownsLink[side]) delete neighbors[side].link;
+    neighbors[side].link = link;
+    ownsLink[side] = false;
+}
+
 void Comms::begin(int baud) {
-    _myMac = getMacAddressHash();
-    _lastSendTime = millis();
+    if (_deviceId == 0) {
+        _deviceId = readDeviceId();
+    }
+    _myMac = IdentityTable::keyFor(_deviceId);
+    _lastSendTime = gameClock.now();
+    _lastUtilSample = _lastSendTime;
+
+    //Random start, so unassigned cubes sharing sid 0 don't dedup each other's joins
+    localSeqNum = gameRandom.next() & 0xFFFF;
+
+#ifdef ESP_PLATFORM
+    _rxEvents = xQueueCreateSet(NUM_SIDES * 16);
+#endif
 
     for (int i = 0; i < NUM_SIDES; ++i) {
-        neighbors[i].serial->begin(baud, SERIAL_8N1, 16, 17);  // update pins as needed
+        neighbors[i].link->begin(baud);
+        linkRates[i].begin(baud);
+        reliable[i].reset(newSession());
+        appliedBaud[i] = baud;
+        lastLineErrors[i] = neighbors[i].link->getStats().lineErrors;
         neighbors[i].isConnected = false;
+        neighbors[i].link->setLinked(false);
         neighbors[i].lastHeartbeat = 0;
         neighbors[i].mac = 0;
+
+#ifdef ESP_PLATFORM
+        if (!ownsLink[i]) continue;
+
+        //Faces sharing a UART share its queue, which may only join the set once
+        QueueHandle_t queue = static_cast<UartTransport*>(neighbors[i].link)->eventQueue();
+        bool alreadyAdded = false;
+        for (int j = 0; j < i; ++j) {
+            if (ownsLink[j] && static_cast<UartTransport*>(neighbors[j].link)->eventQueue() == queue) {
+                alreadyAdded = true;
+            }
+        }
+        if (queue && !alreadyAdded) {
+            xQueueAddToSet(queue, _rxEvents);
+        }
+#endif
+    }
+
+    election.begin(_myMac, gameClock.now());
+    Serial.printf("[INIT] MAC: %012llx | Key: %u\n", (unsigned long long)_deviceId, _myMac);
+}
+
+#ifdef ESP_PLATFORM
+//Marks faces that have data by draining the UART event queues
+void Comms::serviceRxEvents(TickType_t wait) {
+    QueueSetMemberHandle_t member;
+    while ((member = xQueueSelectFromSet(_rxEvents, wait)) != nullptr) {
+        UartTransport::serviceEvent((QueueHandle_t)member);
+        wait = 0;
+    }
+}
+#endif
+
+bool Comms::waitForRx(uint32_t timeoutMs) {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (neighbors[i].link->rxReady()) return true;
+    }
+
+#ifdef ESP_PLATFORM
+    serviceRxEvents(pdMS_TO_TICKS(timeoutMs));
+
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (neighbors[i].link->rxReady()) return true;
+    }
+#else
+    //Millisecond steps, so a host simulation on a virtual clock wakes at the first byte
+    for (uint32_t waited = 0; waited < timeoutMs; ++waited) {
+        delay(1);
+        for (int i = 0; i < NUM_SIDES; ++i) {
+            if (neighbors[i].link->rxReady()) return true;
+        }
     }
+#endif
+    return false;
+}
 
-    Serial.printf("[INIT] MAC: %u\n", _myMac);
+#ifdef ESP_PLATFORM
+void Comms::enableRxWakeup() {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (ownsLink[i]) {
+            static_cast<UartTransport*>(neighbors[i].link)->enableWakeup();
+        }
+    }
 }
+#endif
 
 void Comms::update() {
+#ifdef ESP_PLATFORM
+    serviceRxEvents(0);
+#endif
+
     for (int i = 0; i < NUM_SIDES; ++i) {
         auto& side = neighbors[i];
-        auto& serial = *side.serial;
+        Transport& link = *side.link;
+        link.poll(gameClock.now());
 
-        while (serial.available()) {
-            rxBuffers[i].push_back(serial.read());
+        //Only faces woken by an RX event are read
+        uint8_t chunk[64];
+        size_t got;
+        bool resyncing = false;
+        while (link.rxReady() && (got = link.read(chunk, sizeof(chunk))) > 0) {
+            rxBuffers[i].insert(rxBuffers[i].end(), chunk, chunk + got);
+            telemetry[i].bytesIn += got;
+            sessionRecorder.rx(i, chunk, got);
 
-            while (rxBuffers[i].size() >= 8) {
+            while (rxBuffers[i].size() >= PACKET_HEADER_LEN) {
                 uint8_t tag = rxBuffers[i][0];
                 uint8_t payloadLen = rxBuffers[i][1];
-                size_t expectedLen = 8 + payloadLen;
+                size_t expectedLen = PACKET_HEADER_LEN + payloadLen;
+
+                //A frame cut short, e.g. by the byte lost waking from light sleep, would have
+                //the parser read a length from the middle of it. Slide to the next plausible header
+                if (!isFrameHeader(tag, payloadLen)) {
+                    if (!resyncing) linkRates[i].onRxError(gameClock.now());
+                    resyncing = true;
+                    telemetry[i].skipped++;
+                    rxBuffers[i].erase(rxBuffers[i].begin());
+                    continue;
+                }
+                resyncing = false;
 
                 if (rxBuffers[i].size() < expectedLen)
                     break;
 
+                telemetry[i].framesIn++;
+                if (capture.active()) {
+                    capture.record(micros(), i, PacketCapture::DIR_IN, rxBuffers[i].data(), expectedLen);
+                }
+
                 //Intercept command packets to buffer only the latest
                 if (tag == PACKET_COMMAND) {
                     //Replace any existing buffered command packet for this side
@@ -56,25 +255,40 @@ void Comms::update() {
                     rxBuffers[i].erase(rxBuffers[i].begin(), rxBuffers[i].begin() + expectedLen);
                 } else {
                     //For other tags, process immediately
-                    Serial.printf("[RX] Packet from side %d | Tag: %u | PayloadLen: %u | TotalLen: %u\n", i, tag, payloadLen, expectedLen);
+                    TRACE("[RX] Packet from side %d | Tag: %u | PayloadLen: %u | TotalLen: %u\n", i, tag, payloadLen, expectedLen);
                     handleIncomingPacket(i, rxBuffers[i].data(), expectedLen);
                     rxBuffers[i].erase(rxBuffers[i].begin(), rxBuffers[i].begin() + expectedLen);
                 }
             }
         }
 
-        uint32_t now = millis();
-        if (side.isConnected && (uint32_t)(now - side.lastHeartbeat) > 3000) {
+        uint32_t now = gameClock.now();
+        updateLinkRate(i, now);
+        serviceReliable(i, now);
+
+        //A failed probe ends long after the last clean frame, so the face keeps the longer
+        //timeout until it's back on the old rate
+        bool probing = linkRates[i].isProbing() || linkRates[i].baud() != appliedBaud[i];
+        uint32_t timeout = probing ? PROBE_LINK_TIMEOUT_MS : LINK_TIMEOUT_MS;
+        if (side.isConnected && (uint32_t)(now - side.lastHeartbeat) > timeout) {
             Serial.printf("[TIMEOUT] Neighbor on side %d disconnected (MAC %u)\n", i, side.mac);
+            telemetry[i].timeouts++;
 
-            //notify battle of disconnection
-            if (_role == ROLE_HOST) {
+            //notify battle of disconnection. Every cube keeps its own map current
+            if (_battle) {
                 _battle->removeCube(side.mac);
             }
 
             side.isConnected = false;
+            link.setLinked(false);
             side.mac = 0;
+            neighborPaths[i].clear();
             side.lastHeartbeat = 0;
+            hasPeerStamp[i] = false;
+            txQueues[i].clear();
+            reliable[i].reset(newSession());
+            linkRates[i].setLink(false, false);
+            linkRates[i].reset(now);
             reevaluateHost();
         }
     }
@@ -82,83 +296,197 @@ void Comms::update() {
     //Process one latest command packet per side per update cycle
     for (int i = 0; i < NUM_SIDES; ++i) {
         if (hasPendingCommand[i]) {
-            Serial.printf("[COMMAND] Processing latest buffered command packet from side %d\n", i);
+            TRACE("[COMMAND] Processing latest buffered command packet from side %d\n", i);
             handleIncomingPacket(i, latestCommandPackets[i].data(), latestCommandPackets[i].size());
             hasPendingCommand[i] = false;
             latestCommandPackets[i].clear();
         }
     }
 
-    uint32_t now = millis();
-    if ((uint32_t)(now - _lastSendTime) > 1000) {
-        Serial.println("[TX] Sending heartbeat...");
+    uint32_t now = gameClock.now();
+    election.update(now, hasNeighbors());
+    reevaluateHost();
+
+    if (_role == ROLE_CLIENT && (_mySid == IdentityTable::NO_SID || _joinedHost != _hostMac)) {
+        if (_joinRequestedFrom != _hostMac || (uint32_t)(now - _lastJoin) >= JOIN_RETRY_MS) {
+            requestSid(now);
+        }
+    }
+    if (_role == ROLE_HOST && _announcePending && (uint32_t)(now - _lastAnnounce) >= ANNOUNCE_INTERVAL_MS) {
+        announceIdentities(now);
+    }
+    announcePath();
+
+    if ((uint32_t)(now - _lastKeepalive) >= KEEPALIVE_INTERVAL_MS) {
+        sendKeepalives();
+        _lastKeepalive = now;
+    }
+
+    if ((uint32_t)(now - _lastSendTime) > HEARTBEAT_INTERVAL_MS) {
+        TRACE("[TX] Sending heartbeat...\n");
         sendHeartbeat();
         _lastSendTime = now;
     }
+
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        drainTxQueue(i);
+    }
+
+    if ((uint32_t)(now - _lastUtilSample) >= 1000) {
+        sampleUtilization(now);
+    }
 }
 
-//Helper: pack a vector of 2-bit directions into bytes
-static void packDirections(const std::vector<uint8_t>& directions, std::vector<uint8_t>& outPacked) {
-    outPacked.clear();
-    uint8_t currentByte = 0;
-    int bitsFilled = 0;
+//Hands queued frames to the transport, never more than it accepts without blocking
+void Comms::drainTxQueue(int sideIdx) {
+    Transport& link = *neighbors[sideIdx].link;
+    TxQueue& queue = txQueues[sideIdx];
+    size_t budget = TX_BUDGET_PER_TICK;
+    uint8_t frame[TxQueue::MAX_PACKET];
 
-    for (uint8_t dir : directions) {
-        currentByte |= (dir & 0x03) << bitsFilled;
-        bitsFilled += 2;
-        if (bitsFilled == 8) {
-            outPacked.push_back(currentByte);
-            currentByte = 0;
-            bitsFilled = 0;
+    //Once a rate switch is decided, only the probe announcing it still goes at the old rate.
+    //The rest waits, so a busy face still goes quiet long enough to switch
+    bool switching = linkRates[sideIdx].baud() != appliedBaud[sideIdx];
+
+    while (!queue.empty()) {
+        if (switching && queue.nextPriority() != TxQueue::PRIO_LINK) break;
+        size_t room = min(budget, link.writable());
+        size_t frameLen = queue.nextFrame(frame, room, _mySid);
+        if (frameLen == 0) break;
+
+        if (capture.active()) {
+            capture.record(micros(), sideIdx, PacketCapture::DIR_OUT, frame, frameLen);
         }
+        link.write(frame, frameLen);
+        budget -= frameLen;
     }
-    if (bitsFilled > 0) {
-        outPacked.push_back(currentByte);
+}
+
+//Share of each face's line rate used since the last sample
+void Comms::sampleUtilization(uint32_t now) {
+    uint32_t elapsed = now - _lastUtilSample;
+    _lastUtilSample = now;
+
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        uint32_t sent = txQueues[i].getStats().bytesSent;
+        uint32_t bytes = sent - utilBytesMark[i];
+        utilBytesMark[i] = sent;
+
+        //10 bits per byte on the wire
+        uint64_t capacity = (uint64_t)appliedBaud[i] * elapsed / 10000;
+        uint64_t pct = capacity > 0 ? (uint64_t)bytes * 100 / capacity : 0;
+        linkUtilization[i] = pct > 100 ? 100 : (uint8_t)pct;
     }
 }
 
-//Helper: unpack 2-bit directions from bytes
-static void unpackDirections(const uint8_t* packed, size_t length, std::vector<uint8_t>& outDirections) {
-    outDirections.clear();
-    for (size_t i = 0; i < length; ++i) {
-        uint8_t byte = packed[i];
-        for (int shift = 0; shift < 8; shift += 2) {
-            uint8_t dir = (byte >> shift) & 0x03;
-            outDirections.push_back(dir);
-        }
+//Applies a negotiated baud once the face's TX has drained, then runs the rate handshake
+void Comms::updateLinkRate(int sideIdx, uint32_t now) {
+    Transport& link = *neighbors[sideIdx].link;
+    LinkRate& rate = linkRates[sideIdx];
+
+    uint32_t lineErrors = link.getStats().lineErrors;
+    if (lineErrors != lastLineErrors[sideIdx]) {
+        rate.onRxError(now, lineErrors - lastLineErrors[sideIdx]);
+        lastLineErrors[sideIdx] = lineErrors;
+    }
+
+    //A queued probe still belongs to the old rate, e.g. the ACCEPT of a proposal
+    TxQueue& queue = txQueues[sideIdx];
+    bool probeQueued = !queue.empty() && queue.nextPriority() == TxQueue::PRIO_LINK;
+    if (rate.baud() != appliedBaud[sideIdx] && !probeQueued && link.txIdle()) {
+        link.setBaud(rate.baud());
+        appliedBaud[sideIdx] = rate.baud();
+        //Bytes straddling the switch are garbage, and keepalives need a moment to resume
+        rxBuffers[sideIdx].clear();
+        neighbors[sideIdx].lastHeartbeat = now;
+        Serial.printf("[LINK] Side %d now at %u baud\n", sideIdx, appliedBaud[sideIdx]);
+    }
+
+    uint8_t probe[LinkRate::MAX_PROBE_LEN];
+    size_t probeLen = rate.update(now, appliedBaud[sideIdx] == rate.baud(), probe);
+    if (probeLen > 0) {
+        sendPacketToSide(sideIdx, PACKET_LINK_PROBE, probe, probeLen);
     }
 }
 
-void Comms::sendPacketToNeighbors(uint8_t tag, const uint8_t* payload, size_t len) {
+//Fills the 5-byte header and payload into a TxQueue::MAX_PACKET buffer, returns total length.
+//The length byte can't describe a longer payload, so that returns 0 and sends nothing
+size_t Comms::buildPacket(uint8_t* packet, uint8_t tag, const uint8_t* payload, size_t len) {
+    if (len > TxQueue::MAX_PACKET - PACKET_HEADER_LEN) {
+        Serial.printf("[ERROR] Tag %u payload of %u bytes is too long, dropped\n", tag, (unsigned)len);
+        return 0;
+    }
     localSeqNum++;
-    size_t totalLen = 8 + len; // tag + len + mac(4) + seq(2) + payload
-    uint8_t packet[totalLen];
 
     packet[0] = tag;
     packet[1] = len;
-    packet[2] = (_myMac >> 24) & 0xFF;
-    packet[3] = (_myMac >> 16) & 0xFF;
-    packet[4] = (_myMac >> 8) & 0xFF;
-    packet[5] = _myMac & 0xFF;
-    packet[6] = (localSeqNum >> 8) & 0xFF;
-    packet[7] = localSeqNum & 0xFF;
+    packet[2] = _mySid;
+    packet[3] = (localSeqNum >> 8) & 0xFF;
+    packet[4] = localSeqNum & 0xFF;
 
     if (len > 0) {
-        memcpy(packet + 8, payload, len);
+        memcpy(packet + PACKET_HEADER_LEN, payload, len);
     }
+    return PACKET_HEADER_LEN + len; // tag + len + sid + seq(2) + payload
+}
+
+//Link-local packets such as rate probes go to one face only and are never forwarded
+void Comms::sendPacketToSide(int sideIdx, uint8_t tag, const uint8_t* payload, size_t len) {
+    uint8_t packet[TxQueue::MAX_PACKET];
+    size_t totalLen = buildPacket(packet, tag, payload, len);
+    if (totalLen == 0) return;
+    queuePacket(sideIdx, packet, totalLen);
+}
+
+void Comms::sendPacketToNeighbors(uint8_t tag, const uint8_t* payload, size_t len) {
+    uint8_t packet[TxQueue::MAX_PACKET];
+    size_t totalLen = buildPacket(packet, tag, payload, len);
+    if (totalLen == 0) return;
 
-    Serial.printf("[TX] Tag: %u | Seq: %u | Len: %u\n", tag, localSeqNum, len);
+    TRACE("[TX] Tag: %u | Seq: %u | Len: %u\n", tag, localSeqNum, len);
 
     for (int i = 0; i < NUM_SIDES; i++) {
-        neighbors[i].serial->write(packet, totalLen);
-        Serial.printf("[TX] Sent to neighbor %d (MAC %u)\n", i, neighbors[i].mac);
+        //Heartbeats go out on every face so new neighbors can find us
+        if (tag != PACKET_HEARTBEAT && !neighbors[i].isConnected) continue;
+        queuePacket(i, packet, totalLen);
+        TRACE("[TX] Queued for neighbor %d (MAC %u)\n", i, neighbors[i].mac);
+    }
+}
+
+//Heartbeats and state jump ahead of everything else, and a newer copy of either replaces
+//one still waiting from the same origin
+void Comms::queuePacket(int sideIdx, const uint8_t* packet, size_t len) {
+    uint8_t tag = packet[0];
+    TxQueue::Priority priority = TxQueue::PRIO_BULK;
+    bool supersede = false;
+
+    switch (tag) {
+        case PACKET_LINK_PROBE:
+            priority = TxQueue::PRIO_LINK;
+            break;
+        case PACKET_HEARTBEAT:
+        case PACKET_KEEPALIVE:
+            priority = TxQueue::PRIO_HEARTBEAT;
+            supersede = true;
+            break;
+        case PACKET_RELIABLE:
+            priority = TxQueue::PRIO_HEARTBEAT;
+            break;
+        case PACKET_COMMAND:
+            priority = TxQueue::PRIO_STATE;
+            supersede = true;
+            break;
+    }
+
+    if (!txQueues[sideIdx].push(packet, len, priority, supersede)) {
+        Serial.printf("[TX] Side %d queue full, dropped tag %u\n", sideIdx, tag);
     }
 }
 
-bool Comms::isDuplicatePacket(uint32_t senderMac, uint16_t seqNum) {
+bool Comms::isDuplicatePacket(uint8_t senderSid, uint16_t seqNum) {
     for (auto& p : recentPackets) {
-        if (p.senderMac == senderMac && p.seqNum == seqNum) {
-            Serial.printf("[DUPLICATE] MAC: %u | Seq: %u\n", senderMac, seqNum);
+        if (p.senderSid == senderSid && p.seqNum == seqNum) {
+            Serial.printf("[DUPLICATE] SID: %u | Seq: %u\n", senderSid, seqNum);
             return true;
         }
     }
@@ -166,189 +494,706 @@ bool Comms::isDuplicatePacket(uint32_t senderMac, uint16_t seqNum) {
     if (recentPackets.size() >= MAX_RECENT_PACKETS) {
         recentPackets.pop_front();
     }
-    recentPackets.push_back({senderMac, seqNum});
+    recentPackets.push_back({senderSid, seqNum});
     return false;
 }
 
-void Comms::handleIncomingPacket(int sideIdx, uint8_t* data, size_t len) {
-    if (len < 8) return;
+static bool isControlEvent(uint8_t tag) {
+    return tag == PACKET_PATH || tag == PACKET_SPAWN || tag == PACKET_DESPAWN ||
+           tag == PACKET_HOST || tag == PACKET_JOIN || tag == PACKET_ASSIGN || tag == PACKET_TERRAIN ||
+           tag == PACKET_COMBAT;
+}
+
+void Comms::handleIncomingPacket(int sideIdx, uint8_t* data, size_t len, bool reliableDelivery) {
+    if (len < PACKET_HEADER_LEN) return;
 
     uint8_t tag = data[0];
     uint8_t payloadLen = data[1];
-    uint32_t senderMac = (data[2] << 24) | (data[3] << 16) | (data[4] << 8) | data[5];
-    uint16_t seqNum = (data[6] << 8) | data[7];
+    uint8_t senderSid = data[2];
+    uint16_t seqNum = (data[3] << 8) | data[4];
 
-    if (len != 8 + payloadLen) {
-        Serial.printf("[ERROR] Length mismatch. Expected: %u, Got: %u\n", 8 + payloadLen, len);
+    telemetry[sideIdx].packetsIn++;
+
+    if (len != (size_t)PACKET_HEADER_LEN + payloadLen) {
+        Serial.printf("[ERROR] Length mismatch. Expected: %u, Got: %u\n", PACKET_HEADER_LEN + payloadLen, (unsigned)len);
+        telemetry[sideIdx].lengthErrors++;
+        linkRates[sideIdx].onRxError(gameClock.now());
         return;
     }
 
-    Serial.printf("[HANDLE] Side %d | MAC: %u | Seq: %u | Tag: %u | PayloadLen: %u\n",
-                  sideIdx, senderMac, seqNum, tag, payloadLen);
+    TRACE("[HANDLE] Side %d | SID: %u | Seq: %u | Tag: %u | PayloadLen: %u\n",
+          sideIdx, senderSid, seqNum, tag, payloadLen);
 
-    if (isDuplicatePacket(senderMac, seqNum)) return;
+    //Any well-formed frame, even a duplicate, shows the link is clean at its current rate
+    if (tag == PACKET_HEARTBEAT || tag == PACKET_COMMAND || tag == PACKET_LINK_PROBE ||
+        tag == PACKET_BATCH || tag == PACKET_RELIABLE || tag == PACKET_KEEPALIVE) {
+        linkRates[sideIdx].onRxOk(gameClock.now());
+    }
 
-    uint8_t* payload = data + 8;
+    uint8_t* payload = data + PACKET_HEADER_LEN;
 
-    switch (tag) {
-        case PACKET_HEARTBEAT: {
-            neighbors[sideIdx].lastHeartbeat = millis();
-            neighbors[sideIdx].mac = senderMac;
-            bool wasConnected = neighbors[sideIdx].isConnected;
-            neighbors[sideIdx].isConnected = true;
+    //Keepalives prove the neighbor is there and carry its election view
+    if (tag == PACKET_KEEPALIVE) {
+        Neighbor& side = neighbors[sideIdx];
+        if (side.isConnected) {
+            side.lastHeartbeat = gameClock.now();
+        }
+        if (payloadLen >= HostElection::VIEW_LEN + KEEPALIVE_STAMP_LEN) {
+            onKeepaliveStamp(sideIdx, payload + HostElection::VIEW_LEN, gameClock.now());
+        }
+        if (payloadLen >= KEEPALIVE_LEN) {
+            reliable[sideIdx].onPiggybackAck(payload + HostElection::VIEW_LEN + KEEPALIVE_STAMP_LEN, gameClock.now());
+        }
+        //Not before the heartbeat: a cube that wins here only beats once it has a neighbor
+        if (side.isConnected && election.onView(payload, payloadLen, gameClock.now())) {
+            reevaluateHost();
+        }
+        return;
+    }
 
-            if (!wasConnected) {
-                reevaluateHost();
+    //Heartbeats only find the neighbor on this face, they are never forwarded
+    if (tag == PACKET_HEARTBEAT) {
+        if (payloadLen < PATH_HEADER_LEN || neighbors[sideIdx].isConnected) return;
 
-                if (payloadLen >= 5) {
-                    //Parse Host MAC
-                    uint32_t hostMacInPayload = (payload[0] << 24) | (payload[1] << 16) | (payload[2] << 8) | payload[3];
-                    uint8_t pathLen = payload[4];
-                    size_t packedLen = payloadLen - 5;
-
-                    //Unpack path directions
-                    std::vector<uint8_t> directions;
-                    unpackDirections(payload + 5, packedLen, directions);
-                    if (directions.size() > pathLen) {
-                        directions.resize(pathLen);
-                    }
+        uint32_t senderMac = IdentityTable::keyFor(IdentityTable::readId(payload));
+        neighbors[sideIdx].mac = senderMac;
+        neighbors[sideIdx].lastHeartbeat = gameClock.now();
+        neighbors[sideIdx].isConnected = true;
+        neighbors[sideIdx].link->setLinked(true);
 
-                    //Add this cube’s side as the next step in the path
-                    directions.push_back(sideIdx);
+        //The higher MAC drives rate negotiation on this link
+        linkRates[sideIdx].setLink(true, _myMac > senderMac);
+        reevaluateHost();
 
-                    //Update sender’s path in map
-                    if (_battle) {
-                        _battle->addCubeWithPath(senderMac, directions);
-                    }
+        applyPath(sideIdx, payload, payloadLen);
 
-                    //Create a character
-                    if (_myMac == _hostMac && _battle) {
-                        _battle->createCharacter(senderMac, 0);
-                    }
+        //Repeat our path on the reliable channel, so the neighbor places us
+        //even if this edge was missed
+        PackedPath path;
+        uint8_t pathPayload[PATH_HEADER_LEN + sizeof(path.bytes)];
+        size_t pathLen = buildPathPayload(pathPayload, path);
+        sendControlToSide(sideIdx, PACKET_PATH, pathPayload, pathLen);
 
-                    //If this is client, and this learned full path to host, store path
-                    if (_myMac != _hostMac && _battle) {
-                        std::vector<uint8_t> myPath = directions;
-                        _battle->addCubeWithPath(_myMac, myPath);
-                    }
-                } else {
-                    // No path = direct neighbor to host
-                    if (_battle) {
-                        _battle->addCubeWithPath(senderMac, { (unsigned char)sideIdx });
+        Serial.printf("[HEARTBEAT] Side %d | MAC %u connected\n", sideIdx, senderMac);
+        return;
+    }
+
+    //Batches are link-local wrappers; their records are dedup'd and forwarded one by one
+    if (tag == PACKET_BATCH) {
+        handleBatch(sideIdx, senderSid, payload, payloadLen);
+        return;
+    }
+
+    //Reliable frames are link-local too; the messages inside go through dedup below
+    if (tag == PACKET_RELIABLE) {
+        handleReliable(sideIdx, payload, payloadLen);
+        return;
+    }
+
+    //Control events only ever travel on the reliable channel; a bare one is line noise
+    if (isControlEvent(tag) && !reliableDelivery) {
+        Serial.printf("[ERROR] Control tag %u outside the reliable channel\n", tag);
+        telemetry[sideIdx].badTags++;
+        linkRates[sideIdx].onRxError(gameClock.now());
+        return;
+    }
+
+    if (isDuplicatePacket(senderSid, seqNum)) {
+        telemetry[sideIdx].duplicates++;
+        return;
+    }
+
+    switch (tag) {
+        case PACKET_COMMAND:
+            TRACE("[COMMAND] Processing command packet from SID %u\n", senderSid);
+            _battle->processCommands(payload, payloadLen);
+            forwardPacket(sideIdx, data, len);
+            break;
+
+        case PACKET_PATH:
+            applyPath(sideIdx, payload, payloadLen);
+            relayControl(sideIdx, data, len);
+            break;
+
+        case PACKET_SPAWN:
+            if (payloadLen >= 2 && _battle) {
+                uint32_t mac = identities.keyOf(payload[0]);
+                if (mac != 0) {
+                    _battle->createCharacter(mac, payload[1]);
+                }
+            }
+            relayControl(sideIdx, data, len);
+            break;
+
+        case PACKET_DESPAWN:
+            if (payloadLen >= 1) {
+                uint32_t mac = identities.keyOf(payload[0]);
+                identities.release(payload[0]);
+                if (mac == _myMac) {
+                    //Wrongly reported gone: keep our pet and get a sid again
+                    _mySid = IdentityTable::NO_SID;
+                    if (_role == ROLE_HOST) {
+                        _mySid = identities.assign(_deviceId, IdentityTable::NO_SID);
+                        _announcePending = true;
                     }
+                } else if (mac != 0 && _battle) {
+                    _battle->removeCharacter(mac);
                 }
+            }
+            relayControl(sideIdx, data, len);
+            break;
 
-                Serial.printf("[HEARTBEAT] Side %d | MAC %u connected\n", sideIdx, senderMac);
+        case PACKET_HOST:
+            //Same view as the keepalives, delivered reliably
+            if (election.onView(payload, payloadLen, gameClock.now())) {
+                reevaluateHost();
             }
+            relayControl(sideIdx, data, len);
+            break;
 
-            forwardPacket(sideIdx, data, len);
+        case PACKET_TERRAIN:
+            if (payloadLen >= 1 + TERRAIN_BYTES && _battle) {
+                //Cubes the table doesn't name yet get theirs on a later resend
+                uint32_t mac = identities.keyOf(payload[0]);
+                if (mac != 0) {
+                    _battle->onTerrain(mac, payload + 1);
+                }
+            }
+            relayControl(sideIdx, data, len);
             break;
-        }
 
+        case PACKET_COMBAT:
+            //A host runs its own combat, e.g. while two meshes merge
+            if (_role != ROLE_HOST && _battle) {
+                _battle->applyCombatEvents(payload, payloadLen);
+            }
+            relayControl(sideIdx, data, len);
+            break;
 
+        case PACKET_JOIN:
+            //Only the host answers; everyone else passes the request on
+            if (_role == ROLE_HOST) {
+                handleJoin(payload, payloadLen);
+            } else {
+                relayControl(sideIdx, data, len);
+            }
+            break;
 
-        case PACKET_COMMAND:
-            Serial.printf("[COMMAND] Processing command packet from MAC %u\n", senderMac);
-            _battle->processCommands(std::vector<uint8_t>(payload, payload + payloadLen));
-            forwardPacket(sideIdx, data, len);
+        case PACKET_ASSIGN:
+            //A host keeps its own table, e.g. while two meshes merge
+            if (_role != ROLE_HOST) {
+                handleAssign(payload, payloadLen);
+                relayControl(sideIdx, data, len);
+            }
             break;
 
+        case PACKET_LINK_PROBE: {
+            uint8_t reply[LinkRate::MAX_PROBE_LEN];
+            size_t replyLen = linkRates[sideIdx].onProbe(payload, payloadLen, gameClock.now(), reply);
+            if (replyLen > 0) {
+                sendPacketToSide(sideIdx, PACKET_LINK_PROBE, reply, replyLen);
+            }
+            break;
+        }
+
         default:
             Serial.printf("[ERROR] Unknown tag: %u\n", tag);
-            break;
+            telemetry[sideIdx].badTags++;
+            linkRates[sideIdx].onRxError(gameClock.now());
+            return;
+    }
+}
+
+//Unpacks a PACKET_BATCH frame and handles each record as if it had arrived on its own
+void Comms::handleBatch(int sideIdx, uint8_t senderSid, const uint8_t* records, size_t len) {
+    uint8_t packet[TxQueue::MAX_PACKET];
+    size_t pos = 0;
+
+    while (pos + 2 <= len) {
+        uint8_t tag = records[pos];
+        uint8_t payloadLen = records[pos + 1];
+        bool isShort = tag & BATCH_SHORT_RECORD;
+        size_t recordLen = (isShort ? PACKET_HEADER_LEN - 1 : PACKET_HEADER_LEN) + payloadLen;
+
+        if (pos + recordLen > len) {
+            Serial.printf("[ERROR] Truncated batch record from side %d\n", sideIdx);
+            telemetry[sideIdx].lengthErrors++;
+            linkRates[sideIdx].onRxError(gameClock.now());
+            return;
+        }
+
+        if (isShort) {
+            //Short records were sent by the batch's own sender
+            packet[0] = tag & ~BATCH_SHORT_RECORD;
+            packet[1] = payloadLen;
+            packet[2] = senderSid;
+            memcpy(packet + 3, records + pos + 2, 2 + payloadLen);
+        } else {
+            memcpy(packet, records + pos, recordLen);
+        }
+        pos += recordLen;
+
+        if (packet[0] == PACKET_BATCH) continue;
+        handleIncomingPacket(sideIdx, packet, PACKET_HEADER_LEN + payloadLen);
+    }
+}
+
+//Feeds a PACKET_RELIABLE payload to the face's channel and handles what it releases, in order
+void Comms::handleReliable(int sideIdx, const uint8_t* payload, size_t len) {
+    ReliableLink& channel = reliable[sideIdx];
+    channel.onFrame(payload, len, gameClock.now());
+
+    uint8_t msg[ReliableLink::MAX_MESSAGE];
+    size_t msgLen;
+    while ((msgLen = channel.nextDelivery(msg)) > 0) {
+        if (msg[0] == PACKET_RELIABLE || msg[0] == PACKET_BATCH) continue;
+        handleIncomingPacket(sideIdx, msg, msgLen, true);
+    }
+}
+
+//Sends new messages, retransmits and ACKs that are due on a face
+void Comms::serviceReliable(int sideIdx, uint32_t now) {
+    uint8_t frame[ReliableLink::MAX_FRAME];
+    size_t frameLen;
+    while ((frameLen = reliable[sideIdx].poll(now, frame)) > 0) {
+        sendPacketToSide(sideIdx, PACKET_RELIABLE, frame, frameLen);
+    }
+}
+
+void Comms::sendControl(uint8_t tag, const uint8_t* payload, size_t len) {
+    uint8_t packet[TxQueue::MAX_PACKET];
+    size_t totalLen = buildPacket(packet, tag, payload, len);
+    if (totalLen == 0) return;
+
+    //Remember our own event so it isn't handled again if the mesh relays it back
+    isDuplicatePacket(_mySid, localSeqNum);
+
+    TRACE("[CONTROL] Tag: %u | Seq: %u | Len: %u\n", tag, localSeqNum, len);
+    relayControl(-1, packet, totalLen);
+}
+
+bool Comms::controlCongested() const {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (neighbors[i].isConnected && reliable[i].backlog() >= ReliableLink::BACKLOG / 2) return true;
+    }
+    return false;
+}
+
+void Comms::sendControlToSide(int sideIdx, uint8_t tag, const uint8_t* payload, size_t len) {
+    uint8_t packet[TxQueue::MAX_PACKET];
+    size_t totalLen = buildPacket(packet, tag, payload, len);
+    if (totalLen == 0) return;
+    if (!reliable[sideIdx].send(packet, totalLen)) {
+        Serial.printf("[CONTROL] Side %d backlog full, dropped tag %u\n", sideIdx, tag);
+    }
+}
+
+void Comms::relayControl(int incomingSide, const uint8_t* data, size_t len) {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (i == incomingSide || !neighbors[i].isConnected) continue;
+        if (!reliable[i].send(data, len)) {
+            Serial.printf("[CONTROL] Side %d backlog full, dropped tag %u\n", i, data[0]);
+        } else if (incomingSide >= 0) {
+            telemetry[i].forwards++;
+        }
     }
 }
 
 void Comms::forwardPacket(int incomingSide, uint8_t* data, size_t len) {
     for (int i = 0; i < NUM_SIDES; ++i) {
         if (i != incomingSide && neighbors[i].isConnected) {
-            neighbors[i].serial->write(data, len);
-            Serial.printf("[FORWARD] Packet forwarded from side %d to side %d\n", incomingSide, i);
+            queuePacket(i, data, len);
+            telemetry[i].forwards++;
+            TRACE("[FORWARD] Packet forwarded from side %d to side %d\n", incomingSide, i);
         }
     }
 }
 
-void Comms::sendHeartbeat() {
-    std::vector<uint8_t> path;
-
+//Device ID, host MAC, path length and packed path from host, as sent in heartbeats and PACKET_PATH
+size_t Comms::buildPathPayload(uint8_t* payload, PackedPath& path) {
     //For host, path is empty
-    if (_role == ROLE_HOST) {
-        path.clear();
-    } else {
-        //For clients, get their path from _battle 
+    //For clients, get their path from _battle 
+    path = PackedPath();
+    if (_role != ROLE_HOST) {
         path = _battle->getPathFromHost();
     }
 
-    std::vector<uint8_t> packedPath;
-    packDirections(path, packedPath);
+    //The full 48-bit ID, so the neighbor knows exactly who is on this face
+    IdentityTable::writeId(payload, _deviceId);
+    payload += DEVICE_ID_LEN;
 
-    std::vector<uint8_t> payload;
     //Append 4 bytes of Host MAC
-    payload.push_back((_hostMac >> 24) & 0xFF);
-    payload.push_back((_hostMac >> 16) & 0xFF);
-    payload.push_back((_hostMac >> 8) & 0xFF);
-    payload.push_back(_hostMac & 0xFF);
+    payload[0] = (_hostMac >> 24) & 0xFF;
+    payload[1] = (_hostMac >> 16) & 0xFF;
+    payload[2] = (_hostMac >> 8) & 0xFF;
+    payload[3] = _hostMac & 0xFF;
 
     //Append path length 
-    payload.push_back((uint8_t)path.size());
+    payload[4] = path.length;
 
-    //Append packed path bytes
-    payload.insert(payload.end(), packedPath.begin(), packedPath.end());
+    //Append packed path bytes, already in wire layout
+    memcpy(payload + 5, path.bytes, path.byteCount());
+    return PATH_HEADER_LEN + path.byteCount();
+}
 
-    sendPacketToNeighbors(PACKET_HEARTBEAT, payload.data(), payload.size());
+void Comms::sendHeartbeat() {
+    PackedPath path;
+    uint8_t payload[PATH_HEADER_LEN + sizeof(path.bytes)];
+    size_t len = buildPathPayload(payload, path);
+    sendPacketToNeighbors(PACKET_HEARTBEAT, payload, len);
 }
 
-void Comms::reevaluateHost() {
-    bool anyConnected = false;
+//Only the host's neighbors hear it directly, so every cube floods its own place once it has
+//one. The host then knows cubes beyond its faces, and so does whoever hosts next
+void Comms::announcePath() {
+    if (_role == ROLE_UNASSIGNED || !_battle) {
+        _announcedPath.clear();
+        return;
+    }
+    if (_role == ROLE_CLIENT && !_battle->getMap().getCubeInfo(_myMac)) return;
+
+    PackedPath path;
+    uint8_t payload[PATH_HEADER_LEN + sizeof(path.bytes)];
+    size_t len = buildPathPayload(payload, path);
+    if (len == _announcedPath.size() && memcmp(payload, _announcedPath.data(), len) == 0) return;
+
+    _announcedPath.assign(payload, payload + len);
+    sendControl(PACKET_PATH, payload, len);
+}
+
+//Places the sender using the path it reported. Only a neighbor's own PATH also places this cube
+void Comms::applyPath(int sideIdx, const uint8_t* payload, size_t payloadLen) {
+    if (payloadLen < PATH_HEADER_LEN || !_battle) return;
+    uint32_t senderMac = IdentityTable::keyFor(IdentityTable::readId(payload));
+    bool direct = neighbors[sideIdx].isConnected && neighbors[sideIdx].mac == senderMac;
+    if (direct && payload != neighborPaths[sideIdx].data()) {
+        neighborPaths[sideIdx].assign(payload, payload + payloadLen);
+    }
+    payload += DEVICE_ID_LEN;
+
+    //Parse Host MAC
+    uint32_t hostMacInPayload = (payload[0] << 24) | (payload[1] << 16) | (payload[2] << 8) | payload[3];
+    uint8_t pathLen = payload[4];
+    size_t packedLen = payloadLen - PATH_HEADER_LEN;
+
+    //The sender's own path from its host
+    PackedPath senderPath;
+    senderPath.assign(payload + 5, packedLen, pathLen);
+
+    //A path from another host is in someone else's coordinates; until the election agrees,
+    //place a neighbor next to this cube as we see it
+    if (hostMacInPayload == 0 || hostMacInPayload != _battle->getMap().getRootMac()) {
+        if (!direct) return;
+        PackedPath beside = _battle->getPathFromHost();
+        beside.push(sideIdx);
+        _battle->addCubeWithPath(senderMac, beside);
+        return;
+    }
+
+    _battle->addCubeWithPath(senderMac, senderPath);
+    if (!direct || _myMac == hostMacInPayload) return;
+
+    //This cube sits on the sender's opposite face, one step past it. Where faces form a loop
+    //there are several ways here; taking only shorter ones keeps neighbors from flipping each other
+    PackedPath myPath = senderPath;
+    myPath.push((sideIdx + 2) % NUM_SIDES);
+    const Cube* me = _battle->getMap().getCubeInfo(_myMac);
+    if (!me || myPath.length < me->pathFromHost.length) {
+        _battle->addCubeWithPath(_myMac, myPath);
+    }
+}
+
+void Comms::replayNeighborPaths() {
+    if (!_battle) return;
     for (int i = 0; i < NUM_SIDES; ++i) {
-        if (neighbors[i].isConnected) {
-            anyConnected = true;
-            break;
-        }
+        const std::vector<uint8_t>& path = neighborPaths[i];
+        if (!neighbors[i].isConnected || path.size() < PATH_HEADER_LEN) continue;
+
+        //One from an older host would only be placed beside a cube that isn't placed yet
+        const uint8_t* host = path.data() + DEVICE_ID_LEN;
+        uint32_t hostMac = (host[0] << 24) | (host[1] << 16) | (host[2] << 8) | host[3];
+        if (hostMac != _battle->getMap().getRootMac()) continue;
+
+        applyPath(i, path.data(), path.size());
+    }
+}
+
+bool Comms::hasNeighbors() const {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (neighbors[i].isConnected) return true;
+    }
+    return false;
+}
+
+void Comms::setAsleep(bool asleep) {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        neighbors[i].link->setAsleep(asleep);
+    }
+}
+
+int Comms::faceOf(uint32_t mac) const {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (neighbors[i].isConnected && neighbors[i].mac == mac) return i;
+    }
+    return -1;
+}
+
+bool Comms::txPending() {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        if (!txQueues[i].empty() || !neighbors[i].link->txIdle()) return true;
+    }
+    return false;
+}
+
+//On every face, so a neighbor that connected first doesn't time out before it hears our heartbeat.
+//Each one also echoes the neighbor's last stamp, which times the round trip
+void Comms::sendKeepalives() {
+    uint8_t payload[KEEPALIVE_LEN];
+    size_t len = election.writeView(payload);
+    uint32_t now = gameClock.now();
+
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        uint16_t held = hasPeerStamp[i] ? (uint16_t)min(now - peerStampAt[i], (uint32_t)NO_ECHO - 1) : NO_ECHO;
+        uint8_t* stamp = payload + len;
+        stamp[0] = (now >> 8) & 0xFF;
+        stamp[1] = now & 0xFF;
+        stamp[2] = peerStamp[i] >> 8;
+        stamp[3] = peerStamp[i] & 0xFF;
+        stamp[4] = held >> 8;
+        stamp[5] = held & 0xFF;
+        //Saves the reliable channel a bare ACK frame
+        size_t ackLen = reliable[i].writeAck(stamp + KEEPALIVE_STAMP_LEN);
+        sendPacketToSide(i, PACKET_KEEPALIVE, payload, len + KEEPALIVE_STAMP_LEN + ackLen);
     }
+}
+
+//Round trip = time since our echoed stamp, less the time the neighbor held it
+void Comms::onKeepaliveStamp(int sideIdx, const uint8_t* stamp, uint32_t now) {
+    peerStamp[sideIdx] = ((uint16_t)stamp[0] << 8) | stamp[1];
+    peerStampAt[sideIdx] = now;
+    hasPeerStamp[sideIdx] = true;
+
+    uint16_t echo = ((uint16_t)stamp[2] << 8) | stamp[3];
+    uint16_t held = ((uint16_t)stamp[4] << 8) | stamp[5];
+    if (held == NO_ECHO) return;
+
+    uint16_t rtt = (uint16_t)((uint16_t)now - echo - held);
+    if (rtt > LINK_TIMEOUT_MS) return;
 
-    if (!anyConnected) {
+    //Same 1/8 gain as the reliable channel's srtt
+    uint16_t& smoothed = telemetry[sideIdx].rttMs;
+    smoothed = smoothed == 0 ? (rtt ? rtt : 1) : (uint16_t)((smoothed * 7 + rtt) / 8);
+}
+
+LinkTelemetry Comms::getTelemetry(int side) const {
+    LinkTelemetry t = telemetry[side];
+    const TxQueue::Stats& tx = txQueues[side].getStats();
+    t.bytesOut = tx.bytesSent;
+    t.framesOut = tx.frames;
+    t.packetsOut = tx.messages;
+    t.queueHighWater = tx.highWater;
+    return t;
+}
+
+void Comms::printTelemetry() const {
+    for (int i = 0; i < NUM_SIDES; ++i) {
+        LinkTelemetry t = getTelemetry(i);
+        const ReliableLink::Stats& rel = reliable[i].getStats();
+        Serial.printf("[STATS] Side %d | in %u B %u fr %u pk | out %u B %u fr %u pk | fwd %u dup %u | "
+                      "lenErr %u badTag %u skip %u timeout %u | q %u/%u | rtt %u ms | rexmit %u backlog %u drop %u\n",
+                      i, t.bytesIn, t.framesIn, t.packetsIn, t.bytesOut, t.framesOut, t.packetsOut,
+                      t.forwards, t.duplicates, t.lengthErrors, t.badTags, t.skipped, t.timeouts,
+                      t.queueHighWater, TxQueue::SLOTS, t.rttMs, rel.retransmits, rel.backlogged, rel.rejected);
+    }
+}
+
+//Accumulates what the capture export writes, for the trailing checksum
+struct CaptureDump {
+    uint8_t sum;
+};
+
+static void writeCaptureChunk(const uint8_t* data, size_t len, void* ctx) {
+    CaptureDump* dump = static_cast<CaptureDump*>(ctx);
+    for (size_t i = 0; i < len; i++) {
+        dump->sum += data[i];
+    }
+    Serial.write(data, len);
+}
+
+void Comms::dumpCapture() {
+    bool wasActive = capture.active();
+    capture.stop();
+
+    uint32_t len = capture.pcapSize();
+    uint8_t header[8] = {
+        0xA5, 0x5A, 'C', 'P',
+        (uint8_t)(len >> 24), (uint8_t)(len >> 16), (uint8_t)(len >> 8), (uint8_t)len
+    };
+    Serial.write(header, sizeof(header));
+
+    CaptureDump dump = { 0 };
+    capture.exportPcap(writeCaptureChunk, &dump);
+    Serial.write(&dump.sum, 1);
+
+    //Carry on with an empty ring, so consecutive dumps don't overlap
+    if (wasActive) capture.start(capture.capacity());
+}
+
+//Follows the mesh-wide election
+void Comms::reevaluateHost() {
+    if (!hasNeighbors()) {
         if (_role != ROLE_UNASSIGNED) {
             _role = ROLE_UNASSIGNED;
             _hostMac = 0;
+
+            //Sids only mean something inside the mesh we left
+            identities.clear();
+            _mySid = IdentityTable::NO_SID;
+            _joinedHost = 0;
+            _joinRequestedFrom = 0;
             Serial.println("[ROLE] Became UNASSIGNED (no connected neighbors)");
         }
         return;
     }
 
-    uint32_t highestMac = _myMac;
+    uint32_t elected = election.host();
 
-    for (int i = 0; i < NUM_SIDES; ++i) {
-        if (neighbors[i].isConnected && neighbors[i].mac > highestMac) {
-            highestMac = neighbors[i].mac;
-        }
-    }
-
-    if (highestMac == _myMac && _role != ROLE_HOST) {
+    if (elected == _myMac && _role != ROLE_HOST) {
         _role = ROLE_HOST;
         _hostMac = _myMac;
-        Serial.println("[ROLE] Became HOST");
+        Serial.printf("[ROLE] Became HOST (epoch %u)\n", election.epoch());
+
+        //Keep our sid from the table we followed as a client, then tell everyone
+        _mySid = identities.assign(_deviceId, _mySid);
+        _joinedHost = _myMac;
+        _announcePending = true;
 
         if (_battle) {
-            std::vector<uint8_t> emptyPath;
-            _battle->addCubeWithPath(_myMac, emptyPath); // host at origin
+            _battle->onHostChanged(_myMac, election.lostHost());
         }
-    } else if (_role != ROLE_CLIENT || _hostMac != highestMac) {
+
+        uint8_t view[HostElection::VIEW_LEN];
+        size_t len = election.writeView(view);
+        sendControl(PACKET_HOST, view, len);
+    } else if (elected != _myMac && (_role != ROLE_CLIENT || _hostMac != elected)) {
         _role = ROLE_CLIENT;
-        _hostMac = highestMac;
-        Serial.printf("[ROLE] Became CLIENT to %u\n", highestMac);
+        _hostMac = elected;
+        Serial.printf("[ROLE] Became CLIENT to %u (epoch %u)\n", elected, election.epoch());
+
+        if (_battle) {
+            _battle->onHostChanged(elected, election.lostHost());
+        }
     }
 }
 
 
-uint32_t Comms::getMacAddressHash() {
-    uint8_t mac[6];
-    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+//Any non-zero value; a new one on every reset tells the peer to restart numbering
+uint8_t Comms::newSession() {
+    uint8_t session = gameRandom.next() & 0xFF;
+    return session ? session : 1;
+}
+
+//Asks the host for a sid, naming the one we had so it can be kept
+void Comms::requestSid(uint32_t now) {
+    uint8_t payload[DEVICE_ID_LEN + 1];
+    IdentityTable::writeId(payload, _deviceId);
+    payload[DEVICE_ID_LEN] = _mySid;
+    sendControl(PACKET_JOIN, payload, sizeof(payload));
+
+    _joinRequestedFrom = _hostMac;
+    _lastJoin = now;
+}
+
+//Host side of PACKET_JOIN
+void Comms::handleJoin(const uint8_t* payload, size_t len) {
+    if (len < DEVICE_ID_LEN + 1) return;
+
+    DeviceId id = IdentityTable::readId(payload);
+    uint8_t sid = identities.assign(id, payload[DEVICE_ID_LEN]);
+    if (sid == IdentityTable::NO_SID) {
+        uint8_t holder = identities.sidOf(IdentityTable::keyFor(id));
+        if (holder != IdentityTable::NO_SID) {
+            Serial.printf("[ID][WARN] %012llx collides with %012llx on key %u, refused\n",
+                          (unsigned long long)id, (unsigned long long)identities.idOf(holder),
+                          IdentityTable::keyFor(id));
+        } else {
+            Serial.printf("[ID][WARN] No free sid for %012llx\n", (unsigned long long)id);
+        }
+        return;
+    }
+
+    Serial.printf("[ID] %012llx is sid %u\n", (unsigned long long)id, sid);
+    _announcePending = true;
+}
+
+//Host floods its whole table, then gives every device in it a character
+void Comms::announceIdentities(uint32_t now) {
+    const size_t perMessage = (ReliableLink::MAX_MESSAGE - PACKET_HEADER_LEN - 1) / ASSIGN_ENTRY_LEN;
+    uint8_t payload[1 + perMessage * ASSIGN_ENTRY_LEN];
+    uint8_t flags = ASSIGN_FIRST;
+    size_t count = 0;
+
+    for (uint8_t sid = 1; sid <= IdentityTable::MAX_SID; sid++) {
+        if (identities.keyOf(sid) != 0) {
+            uint8_t* entry = payload + 1 + count * ASSIGN_ENTRY_LEN;
+            entry[0] = sid;
+            IdentityTable::writeId(entry + 1, identities.idOf(sid));
+            count++;
+        }
 
-    uint32_t hash = 0;
-    for (int i = 0; i < 6; i++) {
-        hash ^= ((uint32_t)mac[i]) << ((i % 4) * 8);
+        if (count == perMessage || sid == IdentityTable::MAX_SID) {
+            if (sid == IdentityTable::MAX_SID) flags |= ASSIGN_LAST;
+            payload[0] = flags;
+            sendControl(PACKET_ASSIGN, payload, 1 + count * ASSIGN_ENTRY_LEN);
+            flags = 0;
+            count = 0;
+        }
+    }
+
+    _announcePending = false;
+    _lastAnnounce = now;
+
+    if (!_battle) return;
+    for (uint8_t sid = 1; sid <= IdentityTable::MAX_SID; sid++) {
+        uint32_t mac = identities.keyOf(sid);
+        if (mac != 0 && mac != _myMac) {
+            _battle->createCharacter(mac, 0);
+        }
     }
-    return hash;
+}
+
+//Client side of the table flood
+void Comms::handleAssign(const uint8_t* payload, size_t len) {
+    if (len < 1) return;
+
+    uint8_t flags = payload[0];
+    if (flags & ASSIGN_FIRST) {
+        identities.clear();
+    }
+
+    for (size_t pos = 1; pos + ASSIGN_ENTRY_LEN <= len; pos += ASSIGN_ENTRY_LEN) {
+        identities.bind(payload[pos], IdentityTable::readId(payload + pos + 1));
+    }
+
+    if (flags & ASSIGN_LAST) {
+        uint8_t sid = identities.sidOf(_myMac);
+        if (identities.idOf(sid) != _deviceId) {
+            //The key belongs to a device the host admitted before us
+            sid = IdentityTable::NO_SID;
+        }
+        if (sid != _mySid) {
+            Serial.printf("[ID] Our sid is now %u (%u devices)\n", sid, identities.size());
+        }
+        _mySid = sid;
+        if (sid != IdentityTable::NO_SID) {
+            _joinedHost = _hostMac;
+        }
+    }
+}
+
+DeviceId Comms::readDeviceId() {
+    uint8_t mac[DEVICE_ID_LEN];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    return IdentityTable::readId(mac);
 }
 
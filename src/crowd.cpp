@@ -0,0 +1,113 @@
+// crowd.cpp
+#include "crowd.h"
+#include "character.h"
+#include "parallel.h"
+#include <math.h>
+
+uint32_t Crowd::bucketOf(int32_t cellX, int32_t cellY, uint32_t mask) {
+    return ((uint32_t)cellX * 73856093u ^ (uint32_t)cellY * 19349663u) & mask;
+}
+
+void Crowd::update(const CharacterList& characters) {
+    size_t count = characters.size();
+    _stats.agents = 0;
+    _stats.candidates = 0;
+
+    //At least twice as many buckets as characters keeps the chains short
+    uint32_t buckets = 16;
+    while (buckets < count * 2) buckets <<= 1;
+    uint32_t mask = buckets - 1;
+
+    _x.resize(count);
+    _y.resize(count);
+    _next.resize(count);
+    _tested.assign(count, 0);
+    _heads.assign(buckets, -1);
+
+    for (size_t i = 0; i < count; i++) {
+        Character& character = *characters[i];
+        if (!character.isAlive()) continue;
+
+        _x[i] = character.centerX();
+        _y[i] = character.centerY();
+        uint32_t bucket = bucketOf(_x[i] >> RADIUS_SHIFT, _y[i] >> RADIUS_SHIFT, mask);
+        _next[i] = _heads[bucket];
+        _heads[bucket] = i;
+        _stats.agents++;
+    }
+
+    //Each query only writes its own character, so they can run in parallel
+    parallelFor(count, [&](size_t i) {
+        separate(*characters[i], i, mask);
+    });
+    for (size_t i = 0; i < count; i++) {
+        _stats.candidates += _tested[i];
+    }
+}
+
+void Crowd::separate(Character& character, size_t i, uint32_t mask) {
+    if (!character.isAlive()) {
+        character.setSeparation(0.0f, 0.0f);
+        return;
+    }
+
+    const int32_t radiusSq = (int32_t)RADIUS * RADIUS;
+
+    //Nearest first
+    int16_t nearest[MAX_NEIGHBOURS];
+    int32_t nearestSq[MAX_NEIGHBOURS];
+    uint8_t found = 0;
+
+    int32_t cellX = _x[i] >> RADIUS_SHIFT;
+    int32_t cellY = _y[i] >> RADIUS_SHIFT;
+    uint32_t visited[9];
+    uint8_t numVisited = 0;
+    for (int32_t dy = -1; dy <= 1; dy++) {
+        for (int32_t dx = -1; dx <= 1; dx++) {
+            //Neighbouring cells can hash to the same bucket; walk it once
+            uint32_t bucket = bucketOf(cellX + dx, cellY + dy, mask);
+            bool seen = false;
+            for (uint8_t v = 0; v < numVisited && !seen; v++) {
+                seen = visited[v] == bucket;
+            }
+            if (seen) continue;
+            visited[numVisited++] = bucket;
+
+            for (int16_t j = _heads[bucket]; j >= 0; j = _next[j]) {
+                if ((size_t)j == i) continue;
+                _tested[i]++;
+
+                int32_t offX = _x[i] - _x[j];
+                int32_t offY = _y[i] - _y[j];
+                int32_t distSq = offX * offX + offY * offY;
+                if (distSq >= radiusSq) continue;
+                if (found == MAX_NEIGHBOURS && distSq >= nearestSq[found - 1]) continue;
+
+                uint8_t at = found < MAX_NEIGHBOURS ? found++ : found - 1;
+                while (at > 0 && nearestSq[at - 1] > distSq) {
+                    nearest[at] = nearest[at - 1];
+                    nearestSq[at] = nearestSq[at - 1];
+                    at--;
+                }
+                nearest[at] = j;
+                nearestSq[at] = distSq;
+            }
+        }
+    }
+
+    float sepX = 0.0f;
+    float sepY = 0.0f;
+    for (uint8_t n = 0; n < found; n++) {
+        int16_t j = nearest[n];
+        float dist = sqrtf((float)nearestSq[n]);
+        float push = 1.0f - dist / RADIUS;
+        if (dist == 0.0f) {
+            //Same pixel: split them along x by list order
+            sepX += (size_t)j > i ? -push : push;
+        } else {
+            sepX += (_x[i] - _x[j]) / dist * push;
+            sepY += (_y[i] - _y[j]) / dist * push;
+        }
+    }
+    character.setSeparation(sepX * WEIGHT, sepY * WEIGHT);
+}
@@ -1,18 +1,29 @@
 #include "display.h"
 #include "battle.h"  
+#include "map.h"
+#include "profiler.h"
+#include "session_recorder.h"
+#include "frame_cache.h"
+#include "terrain.h"
+#include "game_clock.h"
 #include <algorithm>
 
 Display::Display(Map* map, TFT_eSPI* tft, uint16_t width, uint16_t height)
-    : _map(map), _tft(tft), _width(width), _height(height), _buffer(tft)
+    : _map(map), _tft(tft), _width(width), _height(height), _buffer(tft), _background(tft)
 {
     _buffer.createSprite(_width, _height);
+    _background.createSprite(_width, _height);
 }
 
 Display::~Display() {
     _buffer.deleteSprite();
+    _background.deleteSprite();
 }
 
 void Display::setViewOrigin(int16_t originX, int16_t originY) {
+    if (originX != _originX || originY != _originY) {
+        _backgroundStale = true;
+    }
     _originX = originX;
     _originY = originY;
 }
@@ -23,7 +34,117 @@ void Display::setCharacters(const CharacterList& characters) {
 }
 
 void Display::draw(const CharacterList& characters) {
-    _buffer.fillSprite(TFT_BLACK);
+    uint32_t scene = sceneSignature(characters);
+    {
+        PROFILE_SCOPE(STAGE_COMPOSE);
+        compose(characters);
+        frameCache.endFrame();
+    }
+    _composedScene = scene;
+
+    PROFILE_SCOPE(STAGE_PUSH);
+    _buffer.pushSprite(0, 0);
+    _presentedScene = scene;
+}
+
+void Display::present(const CharacterList& characters) {
+    uint32_t now = gameClock.now();
+    uint32_t scene = sceneSignature(characters);
+    if (scene == _presentedScene) {
+        _stats.idle++;
+        return;
+    }
+    _changedAt = now;
+    if (now - _presentedAt < _stats.intervalMs) {
+        _stats.deferred++;
+        return;
+    }
+
+    uint32_t start = micros();
+    //A checkpoint may already have composed this scene
+    if (scene != _composedScene) {
+        PROFILE_SCOPE(STAGE_COMPOSE);
+        compose(characters);
+        frameCache.endFrame();
+        _composedScene = scene;
+    }
+    {
+        PROFILE_SCOPE(STAGE_PUSH);
+        _buffer.pushSprite(0, 0);
+    }
+    _presentedScene = scene;
+    _presentedAt = now;
+    _stats.presented++;
+    adaptRate(micros() - start);
+}
+
+void Display::setDimmed(bool dimmed) {
+    if (dimmed == _dimmed) return;
+    _dimmed = dimmed;
+#ifdef TFT_BL
+    uint8_t level = dimmed ? DISPLAY_DIM_LEVEL : 255;
+    analogWrite(TFT_BL, TFT_BACKLIGHT_ON == HIGH ? level : 255 - level);
+#endif
+}
+
+//Halves the rate on a frame over budget, and only steps back up after a run of frames within
+//it, so one slow frame doesn't make the rate flap
+void Display::adaptRate(uint32_t frameUs) {
+    _stats.lastFrameUs = frameUs;
+    if (frameUs > DISPLAY_FRAME_BUDGET_US) {
+        _stats.missedDeadlines++;
+        _stats.intervalMs = min(_stats.intervalMs * 2, (int)MAX_FRAME_MS);
+        _onBudget = 0;
+        return;
+    }
+    if (_stats.intervalMs > DISPLAY_FRAME_MS && ++_onBudget >= RECOVER_FRAMES) {
+        _stats.intervalMs = max(_stats.intervalMs / 2, DISPLAY_FRAME_MS);
+        _onBudget = 0;
+    }
+}
+
+//Everything compose() draws from; an unchanged signature means an unchanged frame
+uint32_t Display::sceneSignature(const CharacterList& characters) const {
+    uint32_t view[4] = { _map->getVersion(), _map->getTerrainVersion(),
+                         ((uint32_t)(uint16_t)_originX << 16) | (uint16_t)_originY, (uint32_t)myMac };
+    uint32_t h = SessionRecorder::hash(SessionRecorder::HASH_SEED, view, sizeof(view));
+    for (const auto& c : characters) {
+        Sprite* sprite = c->getSprite();
+        int16_t record[5] = { c->getX(), c->getY(), (int16_t)c->getZOrder(),
+                              (int16_t)((sprite->getFrame() << 1) | sprite->isMirrored()),
+                              (int16_t)(c->isAlive() ? c->getHealth() : -1) };
+        h = SessionRecorder::hash(h, record, sizeof(record));
+    }
+    return h;
+}
+
+//Renders the visible characters into the back buffer
+void Display::compose(const CharacterList& characters) {
+    //Follow this cube's position whenever the topology changes
+    if (_map->getVersion() != _mapVersion) {
+        const Cube* me = _map->getCubeInfo(myMac);
+        if (me) {
+            setViewOrigin(me->x, me->y);
+        }
+        _mapVersion = _map->getVersion();
+        _backgroundStale = true;
+    }
+    if (_map->getTerrainVersion() != _terrainVersion) {
+        _terrainVersion = _map->getTerrainVersion();
+        _backgroundStale = true;
+    }
+
+    if (_backgroundStale) {
+        composeBackground();
+        _dirty.clear();
+        restore({ 0, 0, (int16_t)_width, (int16_t)_height });
+        _backgroundStale = false;
+    } else {
+        for (const Rect& rect : _dirty) {
+            restore(rect);
+        }
+        _dirty.clear();
+    }
 
     struct VisibleChar {
         CharacterPtr character;
@@ -60,12 +181,91 @@ void Display::draw(const CharacterList& characters) {
         if (it != visible.end()) {
             Sprite* sprite = character->getSprite();
             sprite->drawTo(_buffer, it->screenX, it->screenY);
+            drawHealthBar(*character, it->screenX, it->screenY);
+            _dirty.push_back({ it->screenX, it->screenY,
+                               (int16_t)sprite->getFrameWidth(), (int16_t)sprite->getFrameHeight() });
         }
     }
+}
 
-    _buffer.pushSprite(0, 0);
+void Display::composeBackground() {
+    //Tiles sit on the world grid, whatever the origin
+    int16_t startX = -(int16_t)(((_originX % TERRAIN_TILE_SIZE) + TERRAIN_TILE_SIZE) % TERRAIN_TILE_SIZE);
+    int16_t startY = -(int16_t)(((_originY % TERRAIN_TILE_SIZE) + TERRAIN_TILE_SIZE) % TERRAIN_TILE_SIZE);
+
+    for (int16_t y = startY; y < _height; y += TERRAIN_TILE_SIZE) {
+        for (int16_t x = startX; x < _width; x += TERRAIN_TILE_SIZE) {
+            int16_t worldX = _originX + x;
+            int16_t worldY = _originY + y;
+            drawTile(_map->getTerrainAt(worldX, worldY), x, y, worldX, worldY);
+        }
+    }
+}
+
+//A base colour with a few specks of detail, scattered the same way on every screen
+void Display::drawTile(uint8_t tile, int16_t x, int16_t y, int16_t worldX, int16_t worldY) {
+    static const uint16_t BASE[NUM_TERRAIN_TILES] = { 0x0000, 0x2C43, 0x2C43, 0x6A63, 0x7BEF, 0xDD4D };
+    static const uint16_t DETAIL[NUM_TERRAIN_TILES] = { 0x0000, 0x3E66, 0xFFE0, 0x5202, 0x5ACB, 0xC48A };
+    static const uint8_t SPECKS = 6;
+    if (tile >= NUM_TERRAIN_TILES) tile = TERRAIN_VOID;
+
+    _background.fillRect(x, y, TERRAIN_TILE_SIZE, TERRAIN_TILE_SIZE, BASE[tile]);
+    if (tile == TERRAIN_VOID) return;
+
+    uint32_t noise = terrainNoise(worldX >> TERRAIN_SHIFT, worldY >> TERRAIN_SHIFT);
+    for (uint8_t i = 0; i < SPECKS; i++) {
+        noise = noise * 1664525u + 1013904223u;
+        uint8_t at = noise >> 24;
+        _background.drawPixel(x + (at & 0x0F), y + (at >> 4), DETAIL[tile]);
+    }
+}
+
+//Copies a rect of the background into the back buffer, clipped to the screen
+void Display::restore(Rect rect) {
+    if (rect.x < 0) { rect.w += rect.x; rect.x = 0; }
+    if (rect.y < 0) { rect.h += rect.y; rect.y = 0; }
+    if (rect.x + rect.w > _width) rect.w = _width - rect.x;
+    if (rect.y + rect.h > _height) rect.h = _height - rect.y;
+    if (rect.w <= 0 || rect.h <= 0) return;
+
+    uint16_t* to = (uint16_t*)_buffer.getPointer();
+    const uint16_t* from = (const uint16_t*)_background.getPointer();
+    if (!to || !from) {
+        //No memory for the background layer, so no terrain either
+        _buffer.fillRect(rect.x, rect.y, rect.w, rect.h, TFT_BLACK);
+        return;
+    }
+
+    for (int16_t row = rect.y; row < rect.y + rect.h; row++) {
+        size_t offset = (size_t)row * _width + rect.x;
+        memcpy(to + offset, from + offset, rect.w * sizeof(uint16_t));
+    }
+}
+
+//Along the top of the frame, only once hurt
+void Display::drawHealthBar(Character& character, int16_t x, int16_t y) {
+    float health = character.getHealthFraction();
+    if (!character.isAlive() || health >= 1.0f) return;
+
+    int16_t width = character.getSprite()->getFrameWidth();
+    int16_t filled = (int16_t)(width * health);
+    _buffer.fillRect(x, y, width, HEALTH_BAR_HEIGHT, TFT_RED);
+    _buffer.fillRect(x, y, filled, HEALTH_BAR_HEIGHT, TFT_GREEN);
 }
 
 void Display::setMac(uint32_t mac) {
     myMac = mac;
+}
+
+uint32_t Display::frameHash() {
+    uint32_t scene = sceneSignature(_sortedCharacters);
+    if (scene != _composedScene) {
+        compose(_sortedCharacters);
+        _composedScene = scene;
+    }
+
+    const uint8_t* pixels = (const uint8_t*)_buffer.getPointer();
+    if (!pixels) return 0;
+    size_t bytes = (size_t)_width * _height * _buffer.getColorDepth() / 8;
+    return SessionRecorder::hash(SessionRecorder::HASH_SEED, pixels, bytes);
 }
\ No newline at end of file
@@ -0,0 +1,96 @@
+// frame_cache.cpp
+#include "frame_cache.h"
+#include <stdlib.h>
+
+FrameCache frameCache;
+
+FrameCache::~FrameCache() {
+    clear();
+}
+
+const FrameCache::Frame* FrameCache::find(const void* sheet, uint8_t index, bool mirrored) {
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
+        Frame& entry = _entries[i];
+        if (entry.lastUsed && entry.sheet == sheet && entry.index == index && entry.mirrored == mirrored) {
+            entry.lastUsed = ++_uses;
+            _stats.hits++;
+            return &entry;
+        }
+    }
+    _stats.misses++;
+    return nullptr;
+}
+
+FrameCache::Frame* FrameCache::insert(const void* sheet, uint8_t index, bool mirrored, int16_t x, int16_t y,
+                                      uint16_t width, uint16_t height) {
+    size_t bytes = (size_t)width * height * sizeof(uint16_t);
+    if (bytes == 0 || bytes > _budget) return nullptr;
+
+    while (_stats.bytes + bytes > _budget) {
+        if (!evictOldest()) return nullptr;
+    }
+    Frame* slot = freeSlot();
+    if (!slot) {
+        evictOldest();
+        slot = freeSlot();
+    }
+
+    //Plain malloc is internal RAM; ps_malloc would put the frame back behind a cache
+    uint16_t* pixels = (uint16_t*)malloc(bytes);
+    if (!pixels) return nullptr;
+
+    slot->sheet = sheet;
+    slot->index = index;
+    slot->mirrored = mirrored;
+    slot->x = x;
+    slot->y = y;
+    slot->width = width;
+    slot->height = height;
+    slot->pixels = pixels;
+    slot->lastUsed = ++_uses;
+    _stats.bytes += bytes;
+    return slot;
+}
+
+void FrameCache::endFrame() {
+    _stats.flashBytesLastFrame = _stats.flashBytes;
+    _stats.flashBytes = 0;
+}
+
+void FrameCache::setBudget(size_t bytes) {
+    _budget = bytes;
+    while (_stats.bytes > _budget && evictOldest()) {}
+}
+
+void FrameCache::clear() {
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
+        if (_entries[i].lastUsed) evict(_entries[i]);
+    }
+}
+
+void FrameCache::evict(Frame& entry) {
+    _stats.bytes -= (uint32_t)entry.width * entry.height * sizeof(uint16_t);
+    free(entry.pixels);
+    entry = Frame();
+}
+
+FrameCache::Frame* FrameCache::freeSlot() {
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
+        if (!_entries[i].lastUsed) return &_entries[i];
+    }
+    return nullptr;
+}
+
+bool FrameCache::evictOldest() {
+    Frame* oldest = nullptr;
+    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
+        if (_entries[i].lastUsed && (!oldest || _entries[i].lastUsed < oldest->lastUsed)) {
+            oldest = &_entries[i];
+        }
+    }
+    if (!oldest) return false;
+
+    evict(*oldest);
+    _stats.evictions++;
+    return true;
+}
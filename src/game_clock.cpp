@@ -0,0 +1,6 @@
+// game_clock.cpp
+#include "game_clock.h"
+#include "game_random.h"
+
+GameClock gameClock;
+GameRandom gameRandom;
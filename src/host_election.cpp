@@ -0,0 +1,103 @@
+// host_election.cpp
+#include "host_election.h"
+
+void HostElection::begin(uint32_t myMac, uint32_t now) {
+    _myMac = myMac;
+    _epoch = 0;
+    _host = myMac;
+    _beat = 0;
+    _beatAt = now;
+    _lostHost = 0;
+}
+
+void HostElection::update(uint32_t now, bool connected) {
+    if (!connected) {
+        //Alone: host of itself, and the epoch carries over into the next mesh it meets
+        _host = _myMac;
+        _beatAt = now;
+        return;
+    }
+
+    if (_host == _myMac) {
+        if ((uint32_t)(now - _beatAt) >= BEAT_INTERVAL_MS) {
+            _beat++;
+            _beatAt = now;
+        }
+        return;
+    }
+
+    if ((uint32_t)(now - _beatAt) >= HOST_LOST_MS) {
+        _lostHost = _host;
+        _lostBeatAt = _beatAt;
+        _epoch++;
+        _host = _myMac;
+        _beat = 0;
+        _beatAt = now;
+        _stats.hostLosses++;
+        _stats.elections++;
+        _stats.failoverMs = now - _lostBeatAt;
+    }
+}
+
+size_t HostElection::writeView(uint8_t* out) const {
+    out[0] = _epoch >> 8;
+    out[1] = _epoch & 0xFF;
+    out[2] = (_host >> 24) & 0xFF;
+    out[3] = (_host >> 16) & 0xFF;
+    out[4] = (_host >> 8) & 0xFF;
+    out[5] = _host & 0xFF;
+    out[6] = _beat >> 8;
+    out[7] = _beat & 0xFF;
+    out[8] = (_lostHost >> 24) & 0xFF;
+    out[9] = (_lostHost >> 16) & 0xFF;
+    out[10] = (_lostHost >> 8) & 0xFF;
+    out[11] = _lostHost & 0xFF;
+    return VIEW_LEN;
+}
+
+bool HostElection::onView(const uint8_t* in, size_t len, uint32_t now) {
+    if (len < VIEW_LEN) return false;
+
+    uint16_t epoch = ((uint16_t)in[0] << 8) | in[1];
+    uint32_t host = ((uint32_t)in[2] << 24) | ((uint32_t)in[3] << 16) | ((uint32_t)in[4] << 8) | in[5];
+    uint16_t beat = ((uint16_t)in[6] << 8) | in[7];
+    uint32_t lost = ((uint32_t)in[8] << 24) | ((uint32_t)in[9] << 16) | ((uint32_t)in[10] << 8) | in[11];
+    if (host == 0) return false;
+
+    int16_t newer = (int16_t)(epoch - _epoch);
+
+    //Same election: only the beat can move
+    if (newer == 0 && host == _host) {
+        if ((int16_t)(beat - _beat) > 0) {
+            _beat = beat;
+            _beatAt = now;
+        }
+        return false;
+    }
+
+    if (newer < 0 || (newer == 0 && host < _host)) return false;
+
+    if (newer > 0) {
+        if (_lostHost != lost && lost != 0) {
+            //Heard of the loss before noticing it, time it from our last beat
+            _lostBeatAt = _beatAt;
+        }
+        _lostHost = lost;
+        _stats.elections++;
+    }
+
+    _epoch = epoch;
+    _host = host > _myMac ? host : _myMac;
+    _beat = _host == host ? beat : 0;
+    _beatAt = now;
+
+    //A host that was only cut off comes back and wins again; it is no longer lost
+    if (_lostHost == _host) {
+        _lostHost = 0;
+    }
+
+    if (_lostHost != 0) {
+        _stats.failoverMs = now - _lostBeatAt;
+    }
+    return true;
+}
@@ -0,0 +1,105 @@
+// identity.cpp
+#include "identity.h"
+
+//splitmix64 finalizer, so MACs that differ in a single byte land far apart
+uint32_t IdentityTable::keyFor(DeviceId id) {
+    uint64_t z = id + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    uint32_t key = (uint32_t)z ^ (uint32_t)(z >> 32);
+    return key ? key : 1;
+}
+
+void IdentityTable::writeId(uint8_t* out, DeviceId id) {
+    for (int i = 0; i < DEVICE_ID_LEN; i++) {
+        out[i] = (id >> (8 * (DEVICE_ID_LEN - 1 - i))) & 0xFF;
+    }
+}
+
+DeviceId IdentityTable::readId(const uint8_t* in) {
+    DeviceId id = 0;
+    for (int i = 0; i < DEVICE_ID_LEN; i++) {
+        id = (id << 8) | in[i];
+    }
+    return id;
+}
+
+uint8_t IdentityTable::find(DeviceId id) const {
+    for (uint8_t sid = 1; sid <= MAX_SID; sid++) {
+        if (_entries[sid].used && _entries[sid].id == id) return sid;
+    }
+    return NO_SID;
+}
+
+uint8_t IdentityTable::assign(DeviceId id, uint8_t hint) {
+    uint8_t sid = find(id);
+    if (sid != NO_SID) return sid;
+
+    //Another MAC already hashes to this key
+    if (_sidByKey.contains(keyFor(id))) {
+        _collisions++;
+        return NO_SID;
+    }
+
+    //A cube keeps its sid across a failover when nobody took it meanwhile
+    if (hint != NO_SID && hint <= MAX_SID && !_entries[hint].used) {
+        sid = hint;
+    } else {
+        for (uint8_t s = 1; s <= MAX_SID && sid == NO_SID; s++) {
+            if (!_entries[s].used) sid = s;
+        }
+        if (sid == NO_SID) return NO_SID;
+    }
+
+    bind(sid, id);
+    return sid;
+}
+
+void IdentityTable::bind(uint8_t sid, DeviceId id) {
+    if (sid == NO_SID || sid > MAX_SID) return;
+
+    release(sid);
+    release(find(id));
+
+    uint32_t key = keyFor(id);
+    const uint8_t* previous = _sidByKey.find(key);
+    if (previous) release(*previous);
+
+    _entries[sid].id = id;
+    _entries[sid].key = key;
+    _entries[sid].used = true;
+    _sidByKey.insert(key, sid);
+    _count++;
+}
+
+void IdentityTable::release(uint8_t sid) {
+    if (sid == NO_SID || sid > MAX_SID || !_entries[sid].used) return;
+
+    _sidByKey.erase(_entries[sid].key);
+    _entries[sid].used = false;
+    _count--;
+}
+
+void IdentityTable::clear() {
+    for (uint8_t sid = 1; sid <= MAX_SID; sid++) {
+        _entries[sid].used = false;
+    }
+    _sidByKey.clear();
+    _count = 0;
+}
+
+uint32_t IdentityTable::keyOf(uint8_t sid) const {
+    if (sid == NO_SID || sid > MAX_SID || !_entries[sid].used) return 0;
+    return _entries[sid].key;
+}
+
+DeviceId IdentityTable::idOf(uint8_t sid) const {
+    if (sid == NO_SID || sid > MAX_SID || !_entries[sid].used) return 0;
+    return _entries[sid].id;
+}
+
+uint8_t IdentityTable::sidOf(uint32_t key) const {
+    const uint8_t* sid = _sidByKey.find(key);
+    return sid ? *sid : NO_SID;
+}
@@ -0,0 +1,268 @@
+// link_rate.cpp
+#include "link_rate.h"
+#include <string.h>
+
+static const uint32_t PROBE_TIMEOUT_MS = 150;      //per step of the handshake
+static const uint8_t TEST_ROUNDS = 4;              //clean patterns needed to keep a rate
+static const uint32_t TEST_RETRY_MS = 40;          //resend an unanswered pattern
+static const uint32_t CLIMB_INTERVAL_MS = 200;     //between successful steps
+static const uint32_t PROBE_BACKOFF_MS = 10000;    //after a failed probe
+static const uint32_t CEILING_RETRY_MS = 60000;    //before a failed rate is tried again
+static const uint32_t SILENCE_FALLBACK_MS = 1000;  //no clean frame at a raised rate
+static const uint32_t ERROR_WINDOW_MS = 1000;
+static const uint16_t MIN_WINDOW_ERRORS = 3;      //and over 5% of frames
+
+static bool reached(uint32_t now, uint32_t deadline) {
+    return (int32_t)(now - deadline) >= 0;
+}
+
+uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+void LinkRate::begin(uint32_t baseBaud) {
+    _baseBaud = baseBaud;
+    reset(0);
+}
+
+void LinkRate::reset(uint32_t now) {
+    _step = 0;
+    _prevStep = 0;
+    _ceiling = MAX_STEP;
+    _state = IDLE;
+    _nextProbeAt = now + CLIMB_INTERVAL_MS;
+    _lastRxOk = now;
+    restartWindow(now);
+}
+
+void LinkRate::setLink(bool connected, bool initiator) {
+    _connected = connected;
+    _initiator = initiator;
+}
+
+size_t LinkRate::update(uint32_t now, bool applied, uint8_t* out) {
+    //Both ends stop hearing each other after a bad switch, so both land back on the base rate
+    if (_step > 0 && reached(now, _lastRxOk + SILENCE_FALLBACK_MS) && _state != TESTING && _state != AWAIT_TEST) {
+        _ceiling = _step - 1;
+        _ceilingResetAt = now + CEILING_RETRY_MS;
+        _step = 0;
+        _state = IDLE;
+        _lastRxOk = now;
+        _stats.fallbacks++;
+        restartWindow(now);
+        return 0;
+    }
+
+    //Error-rate fallback, evaluated once per window
+    if (reached(now, _windowStart + ERROR_WINDOW_MS)) {
+        bool tooManyErrors = _windowErrors >= MIN_WINDOW_ERRORS &&
+                             (uint32_t)_windowErrors * 20 > (uint32_t)_windowOk + _windowErrors;
+        restartWindow(now);
+        _badWindows = tooManyErrors ? _badWindows + 1 : 0;
+
+        //Two bad windows in a row, so a burst around a switch doesn't cost a rate
+        if (_badWindows >= 2 && _step > 0 && _state == IDLE) {
+            _badWindows = 0;
+            stepDown(now);
+            return writeProbe(out, OP_DOWNSHIFT, _step, 0);
+        }
+    }
+
+    if (_ceiling < MAX_STEP && reached(now, _ceilingResetAt)) {
+        _ceiling = MAX_STEP;
+    }
+
+    switch (_state) {
+        case IDLE:
+            if (_connected && _initiator && applied && _step < _ceiling && reached(now, _nextProbeAt)) {
+                _state = PROPOSED;
+                _deadline = now + PROBE_TIMEOUT_MS;
+                return writeProbe(out, OP_PROPOSE, _step + 1, 0);
+            }
+            break;
+
+        case PROPOSED:
+            if (reached(now, _deadline)) {
+                //Never heard back at the old rate; nothing changed, just try later
+                _state = IDLE;
+                _nextProbeAt = now + PROBE_BACKOFF_MS;
+            }
+            break;
+
+        case TESTING:
+            if (reached(now, _deadline)) {
+                failProbe(now);
+            } else if (applied && (!_testSent || reached(now, _testSentAt + TEST_RETRY_MS))) {
+                //First pattern goes out once the switch has taken effect. The other end may
+                //switch a tick later and lose it, so an unanswered one goes again
+                if (!_testSent) _deadline = now + PROBE_TIMEOUT_MS;
+                _testSent = true;
+                _testSentAt = now;
+                return writeProbe(out, OP_TEST, _step, _round);
+            }
+            break;
+
+        case AWAIT_TEST:
+            if (reached(now, _deadline)) {
+                //COMMIT is sent once and can be lost. The initiator gives up on a missing
+                //TEST_OK within PROBE_TIMEOUT_MS, so clean traffic after that means it kept the rate
+                if (_finalAnswered && reached(_lastRxOk, _finalAnsweredAt + PROBE_TIMEOUT_MS)) {
+                    _state = IDLE;
+                    _stats.upgrades++;
+                } else {
+                    failProbe(now);
+                }
+            }
+            break;
+    }
+    return 0;
+}
+
+size_t LinkRate::onProbe(const uint8_t* in, size_t len, uint32_t now, uint8_t* out) {
+    if (len < 3) return 0;
+
+    Op op = (Op)in[0];
+    uint8_t step = in[1];
+    uint8_t round = in[2];
+    if (step > MAX_STEP) return 0;
+
+    switch (op) {
+        case OP_PROPOSE:
+            if (step != _step + 1 || step > _ceiling) return 0;
+            //The next proposal at this rate is as good as the COMMIT it implies
+            if (_state == AWAIT_TEST && _finalAnswered) _stats.upgrades++;
+            _prevStep = _step;
+            _step = step;
+            _state = AWAIT_TEST;
+            _round = 0;
+            _finalAnswered = false;
+            _deadline = now + PROBE_TIMEOUT_MS * 2;
+            restartWindow(now);
+            return writeProbe(out, OP_ACCEPT, step, 0);
+
+        case OP_ACCEPT:
+            if (_state != PROPOSED || step != _step + 1) return 0;
+            _prevStep = _step;
+            _step = step;
+            _state = TESTING;
+            _round = 0;
+            _testSent = false;
+            _deadline = now + PROBE_TIMEOUT_MS * 2;
+            restartWindow(now);
+            return 0;
+
+        case OP_TEST: {
+            if (_state != AWAIT_TEST || step != _step || len < 3 + PATTERN_LEN + 2) return 0;
+
+            uint8_t expected[PATTERN_LEN];
+            fillPattern(expected, step, round);
+            uint16_t crc = ((uint16_t)in[3 + PATTERN_LEN] << 8) | in[4 + PATTERN_LEN];
+            if (memcmp(expected, in + 3, PATTERN_LEN) != 0 || crc16(in + 3, PATTERN_LEN) != crc) {
+                onRxError(now);
+                return 0;
+            }
+            _deadline = now + PROBE_TIMEOUT_MS * 2;
+            if (round + 1 >= TEST_ROUNDS) {
+                _finalAnswered = true;
+                _finalAnsweredAt = now;
+            }
+            return writeProbe(out, OP_TEST_OK, step, round);
+        }
+
+        case OP_TEST_OK:
+            if (_state != TESTING || step != _step || round != _round) return 0;
+            _round++;
+            if (_round < TEST_ROUNDS) {
+                _deadline = now + PROBE_TIMEOUT_MS;
+                _testSentAt = now;
+                return writeProbe(out, OP_TEST, _step, _round);
+            }
+            _state = IDLE;
+            _nextProbeAt = now + CLIMB_INTERVAL_MS;
+            _stats.upgrades++;
+            return writeProbe(out, OP_COMMIT, _step, 0);
+
+        case OP_COMMIT:
+            if (_state == AWAIT_TEST && step == _step) {
+                _state = IDLE;
+                _stats.upgrades++;
+            }
+            return 0;
+
+        case OP_DOWNSHIFT:
+            if (step < _step) {
+                _ceiling = step;
+                _ceilingResetAt = now + CEILING_RETRY_MS;
+                _step = step;
+                _state = IDLE;
+                _stats.fallbacks++;
+                restartWindow(now);
+            }
+            return 0;
+    }
+    return 0;
+}
+
+void LinkRate::onRxOk(uint32_t now) {
+    _lastRxOk = now;
+    if (_windowOk < UINT16_MAX) _windowOk++;
+}
+
+void LinkRate::onRxError(uint32_t now, uint16_t count) {
+    _windowErrors = (_windowErrors > UINT16_MAX - count) ? UINT16_MAX : _windowErrors + count;
+}
+
+//Garbage around a rate switch is expected and must not count against the new rate
+void LinkRate::restartWindow(uint32_t now) {
+    _windowStart = now;
+    _windowOk = 0;
+    _windowErrors = 0;
+}
+
+void LinkRate::failProbe(uint32_t now) {
+    _ceiling = _step - 1;
+    _ceilingResetAt = now + CEILING_RETRY_MS;
+    _step = _prevStep;
+    _state = IDLE;
+    _lastRxOk = now;
+    _nextProbeAt = now + PROBE_BACKOFF_MS;
+    _stats.failedProbes++;
+    restartWindow(now);
+}
+
+void LinkRate::stepDown(uint32_t now) {
+    _ceiling = _step - 1;
+    _ceilingResetAt = now + CEILING_RETRY_MS;
+    _step--;
+    _lastRxOk = now;
+    _nextProbeAt = now + PROBE_BACKOFF_MS;
+    _stats.fallbacks++;
+    restartWindow(now);
+}
+
+size_t LinkRate::writeProbe(uint8_t* out, Op op, uint8_t step, uint8_t round) const {
+    out[0] = op;
+    out[1] = step;
+    out[2] = round;
+    if (op != OP_TEST) return 3;
+
+    fillPattern(out + 3, step, round);
+    uint16_t crc = crc16(out + 3, PATTERN_LEN);
+    out[3 + PATTERN_LEN] = crc >> 8;
+    out[4 + PATTERN_LEN] = crc & 0xFF;
+    return 3 + PATTERN_LEN + 2;
+}
+
+//Alternating bits and long runs, the patterns most likely to fail at a marginal rate
+void LinkRate::fillPattern(uint8_t* dst, uint8_t step, uint8_t round) {
+    static const uint8_t base[] = { 0x55, 0xAA, 0x00, 0xFF, 0x0F, 0xF0, 0x33, 0xCC };
+    for (size_t i = 0; i < PATTERN_LEN; i++) {
+        dst[i] = base[i % sizeof(base)] ^ (uint8_t)(i * 29 + step * 7 + round * 13);
+    }
+}
@@ -1,4 +1,5 @@
 #include "battle.h"
+#include "power.h"
 #include "TFT_eSPI.h"
 
 TFT_eSPI tft;
@@ -7,20 +8,34 @@ Battle battle(&tft, 128, 128);
 
 
 void setup() {
+  //Without the console UART0 belongs to a face, and Serial output goes nowhere
+#if DEBUG_CONSOLE
   Serial.begin(115200);
   while (!Serial);
   Serial.println("Setup");
+#endif
   delay(100);
   tft.init();
   tft.setRotation(0);
   tft.fillScreen(TFT_BLUE);
 
   battle.init();
+  battle.getComms().enableRxWakeup();
+  power.begin();
 }
 
 
 
 void loop() {
   battle.update();
+
+#if DEBUG_CONSOLE
+  while (Serial.available() > 0) {
+    battle.debugCommand(Serial.read());
+  }
+#endif
+
+  //Rest of the tick in light sleep or at a lower clock, whatever the scene allows
+  power.idle(battle);
 }
 
@@ -1,97 +1,430 @@
 #include "map.h"
 #include <Arduino.h> // for Serial.printf
 
-static const int16_t sideOffsetsX[] = {128, 0, -128, 0};
-static const int16_t sideOffsetsY[] = {0, -128, 0, 128};
+static const int16_t sideOffsetsX[NUM_CUBE_SIDES] = {128, 0, -128, 0};
+static const int16_t sideOffsetsY[NUM_CUBE_SIDES] = {0, -128, 0, 128};
+
+static_assert(MacTable<Cube, MAX_CUBES * 2>::MAX_ENTRIES >= MAX_CUBES, "the cube table must hold MAX_CUBES");
 
 Map::Map() {}
 
 void Map::addCube(uint32_t newMac, uint32_t referenceMac, int sideFromThis) {
-    if (cubes.count(newMac)) return;
+    if (newMac == 0 || cubes.contains(newMac)) return;
 
-    int16_t x = 0;
-    int16_t y = 0;
+    const Cube* reference = cubes.find(referenceMac);
+    if (sideFromThis >= 0 && sideFromThis < NUM_CUBE_SIDES && reference) {
+        PackedPath path = reference->pathFromHost;
+        path.push(sideFromThis);
+        attach(newMac, referenceMac, sideFromThis, path);
+    } else {
+        // Root cube at 0,0
+        attach(newMac, 0, 0, PackedPath());
+        if (_rootMac == 0) _rootMac = newMac;
+    }
 
-    if (sideFromThis != -1 && cubes.count(referenceMac)) {
-        auto it = cubes.find(referenceMac);
-        x = it->second.x;
-        y = it->second.y;
+    const Cube* cube = cubes.find(newMac);
+    if (cube) {
+        Serial.printf("[MAP] Added cube %u at (%d, %d)\n", newMac, cube->x, cube->y);
+    }
+}
 
-        switch (sideFromThis) {
-            case 0: x += 128; break;
-            case 1: y -= 128; break;
-            case 2: x -= 128; break;
-            case 3: y += 128; break;
+void Map::addCubeWithPath(uint32_t mac, const PackedPath& path) {
+    if (mac == 0) return;
+
+    //Repeated heartbeats carry the same path, nothing to do
+    const Cube* existing = cubes.find(mac);
+    if (existing && samePath(existing->pathFromHost, path) &&
+        (path.length > 0 || mac == _rootMac)) {
+        return;
+    }
+
+    if (path.length == 0) {
+        // Host cube at 0,0. A different host makes every cached position stale
+        if (_rootMac != mac && cubes.contains(_rootMac)) {
+            removeCube(_rootMac);
         }
+        _rootMac = mac;
+        attach(mac, 0, 0, path);
+        Serial.printf("[MAP] Added host cube %u at (0,0)\n", mac);
+        return;
     }
-    // else x,y = 0 (root cube)   
 
-    cubes[newMac] = {x, y, (newMac == myMac), {}};
-    Serial.printf("[MAP] Added cube %u at (%d, %d)\n", newMac, x, y);
+    //Follow the known tree down the path, O(depth). Only the last step is new
+    uint32_t node = _rootMac;
+    uint8_t depth = 0;
+    while (node != 0 && node != mac && depth + 1 < path.length) {
+        node = cubes.find(node)->children[path.get(depth)];
+        depth++;
+    }
+
+    uint8_t side = path.get(path.length - 1);
+    if (node != 0 && node != mac && depth + 1 == path.length) {
+        attach(mac, node, side, path);
+    } else {
+        //Ancestors not known yet: place by walking the offsets, adopted once they attach
+        attach(mac, 0, side, path);
+    }
+
+    const Cube* cube = cubes.find(mac);
+    if (cube) {
+        Serial.printf("[MAP] Added cube %u at (%d, %d) with path length %u\n", mac, cube->x, cube->y, path.length);
+    }
 }
 
+//Removes the cube and every cube reached through it, in one pass
+void Map::removeCube(uint32_t mac) {
+    Cube* cube = cubes.find(mac);
+    if (!cube) return;
+
+    Serial.printf("[MAP] Removed cube %u from (%d, %d)\n", mac, cube->x, cube->y);
+    PackedPath removedPath = cube->pathFromHost;
+    bool wasLinked = isLinked(mac);
+    unlinkFromParent(mac);
 
+    uint32_t pending[MAX_CUBES];
+    uint8_t count = 0;
+    pending[count++] = mac;
 
-void Map::addCubeWithPath(uint32_t mac, const std::vector<uint8_t>& path) {
-    if (mac == 0) return;
+    while (count > 0) {
+        uint32_t current = pending[--count];
+        Cube* c = cubes.find(current);
+        if (!c) continue;
 
-    if (path.empty()) {
-        // Host cube at 0,0
-        cubes[mac] = {0, 0, true, {}};
-        Serial.printf("[MAP] Added host cube %u at (0,0)\n", mac);
-        return;
+        for (uint8_t s = 0; s < NUM_CUBE_SIDES; s++) {
+            if (c->children[s] != 0 && count < MAX_CUBES) {
+                pending[count++] = c->children[s];
+            }
+        }
+        if (current != mac) {
+            Serial.printf("[MAP] Pruned cube %u behind %u\n", current, mac);
+        }
+        cubes.erase(current);
+        if (current == _rootMac) _rootMac = 0;
     }
 
+    //Orphans waiting for a cube behind this one would never be adopted now
+    if (wasLinked) {
+        pruneUnlinked(&removedPath);
+    }
+
+    //A cube that was waiting for this face can have it now
+    adoptOrphans();
+
+    _version++;
+    rebuildOccupancy();
+}
+
+bool Map::reroot(uint32_t mac) {
+    if (mac == _rootMac) return cubes.contains(mac);
+
+    //Chain from mac up to the current host
+    uint32_t chain[MAX_CUBES];
+    uint8_t length = 0;
+    uint32_t node = mac;
+    while (node != 0 && length < MAX_CUBES) {
+        chain[length++] = node;
+        if (node == _rootMac) break;
+        const Cube* cube = cubes.find(node);
+        node = cube ? cube->parentMac : 0;
+    }
+    if (length == 0 || chain[length - 1] != _rootMac) return false;
+
+    //Flip each edge, top down. From the child's side the parent sits on the opposite face
+    for (int i = length - 1; i > 0; i--) {
+        Cube* parent = cubes.find(chain[i]);
+        Cube* child = cubes.find(chain[i - 1]);
+        uint8_t side = child->sideFromParent;
+        uint8_t back = (side + 2) % NUM_CUBE_SIDES;
+
+        parent->children[side] = 0;
+        child->children[back] = chain[i];
+        parent->parentMac = chain[i - 1];
+        parent->sideFromParent = back;
+        parent->isHost = false;
+    }
+
+    //Orphans hang off paths from the old host, which say nothing about where they are now.
+    //Their next PATH places them again
+    pruneUnlinked(nullptr);
+
+    Cube* root = cubes.find(mac);
+    root->parentMac = 0;
+    root->isHost = true;
+    root->x = 0;
+    root->y = 0;
+    root->pathFromHost = PackedPath();
+    _rootMac = mac;
+
+    refreshSubtree(mac);
+    _version++;
+    rebuildOccupancy();
+    Serial.printf("[MAP] Rerooted at %u\n", mac);
+    return true;
+}
+
+uint32_t Map::getVersion() const { return _version; }
+
+bool Map::setTerrain(uint32_t mac, const uint8_t* packed) {
+    Cube* cube = cubes.find(mac);
+    if (!cube) return false;
+
+    if (cube->hasTerrain && memcmp(cube->terrain, packed, TERRAIN_BYTES) == 0) return true;
+    memcpy(cube->terrain, packed, TERRAIN_BYTES);
+    cube->hasTerrain = true;
+    _terrainVersion++;
+    return true;
+}
+
+uint8_t Map::getTerrainAt(int16_t x, int16_t y) const {
+    uint8_t tile = TERRAIN_VOID;
+    cubes.forEach([&](uint32_t, const Cube& cube) {
+        if (!cube.hasTerrain || x < cube.x || y < cube.y || x >= cube.x + CUBE_SIZE || y >= cube.y + CUBE_SIZE) return;
+        uint8_t col = (x - cube.x) >> TERRAIN_SHIFT;
+        uint8_t row = (y - cube.y) >> TERRAIN_SHIFT;
+        tile = terrainTile(cube.terrain, row * TERRAIN_TILES_PER_SIDE + col);
+    });
+    return tile;
+}
+
+bool Map::samePath(const PackedPath& a, const PackedPath& b) {
+    return a.length == b.length && memcmp(a.bytes, b.bytes, a.byteCount()) == 0;
+}
+
+bool Map::startsWith(const PackedPath& path, const PackedPath& prefix) {
+    if (prefix.length > path.length) return false;
+    for (uint8_t i = 0; i < prefix.length; i++) {
+        if (path.get(i) != prefix.get(i)) return false;
+    }
+    return true;
+}
+
+//Placed by offsets, not linked to the host's tree
+bool Map::isOrphan(uint32_t mac, const Cube& cube) const {
+    return cube.parentMac == 0 && mac != _rootMac;
+}
+
+bool Map::isLinked(uint32_t mac) const {
+    for (uint8_t depth = 0; mac != 0 && depth <= MAX_CUBES; depth++) {
+        if (mac == _rootMac) return true;
+        const Cube* cube = cubes.find(mac);
+        mac = cube ? cube->parentMac : 0;
+    }
+    return false;
+}
+
+//Drops orphans and everything hanging off them, only those placed behind under if given
+void Map::pruneUnlinked(const PackedPath* under) {
+    uint32_t doomed[MAX_CUBES];
+    uint8_t count = 0;
+    cubes.forEach([&](uint32_t mac, const Cube& c) {
+        if (count >= MAX_CUBES || isLinked(mac)) return;
+        if (under && (c.pathFromHost.length <= under->length || !startsWith(c.pathFromHost, *under))) return;
+        doomed[count++] = mac;
+    });
+    for (uint8_t i = 0; i < count; i++) {
+        Serial.printf("[MAP] Pruned orphan cube %u\n", doomed[i]);
+        unlinkFromParent(doomed[i]);
+        cubes.erase(doomed[i]);
+    }
+}
+
+//Links every orphan whose parent's place is now in the tree and whose face there is free.
+//Each adoption can free the way for orphans further out, so it runs until nothing moves
+void Map::adoptOrphans() {
+    bool adopted = true;
+    while (adopted) {
+        adopted = false;
+
+        uint32_t orphans[MAX_CUBES];
+        uint8_t orphanCount = 0;
+        cubes.forEach([&](uint32_t mac, const Cube& c) {
+            if (isOrphan(mac, c) && c.pathFromHost.length > 0 && orphanCount < MAX_CUBES) {
+                orphans[orphanCount++] = mac;
+            }
+        });
+
+        for (uint8_t i = 0; i < orphanCount; i++) {
+            Cube* orphan = cubes.find(orphans[i]);
+            const PackedPath& path = orphan->pathFromHost;
+
+            uint32_t node = _rootMac;
+            for (uint8_t depth = 0; node != 0 && depth + 1 < path.length; depth++) {
+                node = cubes.find(node)->children[path.get(depth)];
+            }
+            uint8_t side = path.get(path.length - 1);
+            Cube* parent = cubes.find(node);
+            if (!parent || parent->children[side] != 0) continue;
+
+            parent->children[side] = orphans[i];
+            orphan->parentMac = node;
+            orphan->sideFromParent = side;
+            refreshSubtree(node);
+            Serial.printf("[MAP] Linked cube %u under %u\n", orphans[i], node);
+            adopted = true;
+        }
+    }
+}
+
+//Places mac under parentMac (0 = unlinked) and moves any subtree it already had
+void Map::attach(uint32_t mac, uint32_t parentMac, uint8_t side, const PackedPath& path) {
     int16_t x = 0;
     int16_t y = 0;
-    for (uint8_t side : path) {
-        if (side < 1) {                   //UPDATE TO NUMBER OF SIDES
-            x += sideOffsetsX[side];
-            y += sideOffsetsY[side];
-        } else {
-            Serial.printf("[MAP][WARN] Invalid side %u in path\n", side);
+
+    Cube* parent = cubes.find(parentMac);
+    if (parent && parent->children[side] != 0 && parent->children[side] != mac) {
+        //A face holds one neighbor. The one there only leaves on its own disconnect, until
+        //then the newcomer waits as an orphan and is adopted into the freed face
+        Serial.printf("[MAP] Face %u of %u is taken, %u waits for it\n", side, parentMac, mac);
+        parent = nullptr;
+        parentMac = 0;
+    }
+    if (parent) {
+        x = parent->x + sideOffsetsX[side];
+        y = parent->y + sideOffsetsY[side];
+    } else {
+        for (uint8_t i = 0; i < path.length; i++) {
+            x += sideOffsetsX[path.get(i)];
+            y += sideOffsetsY[path.get(i)];
+        }
+    }
+
+    Cube* cube = cubes.find(mac);
+    if (cube) {
+        unlinkFromParent(mac);
+    } else {
+        //The walk stacks and the occupancy grid hold MAX_CUBES, though the table takes more
+        Cube fresh = {};
+        cube = cubes.size() < MAX_CUBES ? cubes.insert(mac, fresh) : nullptr;
+        if (!cube) {
+            Serial.printf("[MAP][WARN] Cube table full, dropped %u\n", mac);
+            return;
         }
     }
 
-    cubes[mac] = {x, y, false, path};
-    Serial.printf("[MAP] Added cube %u at (%d, %d) with path length %zu\n", mac, x, y, path.size());
+    cube->x = x;
+    cube->y = y;
+    cube->isHost = (path.length == 0 && parentMac == 0);
+    cube->pathFromHost = path;
+    cube->parentMac = parent ? parentMac : 0;
+    cube->sideFromParent = side;
+
+    if (parent) {
+        cubes.find(parentMac)->children[side] = mac;
+    }
+
+    refreshSubtree(mac);
+    if (parent || cube->isHost) {
+        adoptOrphans();
+    }
+    _version++;
+    rebuildOccupancy();
 }
 
-void Map::removeCube(uint32_t mac) {
-    auto it = cubes.find(mac);
-    if (it != cubes.end()) {
-        Serial.printf("[MAP] Removed cube %u from (%d, %d)\n", mac, it->second.x, it->second.y);
-        cubes.erase(it);
+void Map::unlinkFromParent(uint32_t mac) {
+    Cube* cube = cubes.find(mac);
+    if (!cube || cube->parentMac == 0) return;
+
+    Cube* parent = cubes.find(cube->parentMac);
+    if (parent && parent->children[cube->sideFromParent] == mac) {
+        parent->children[cube->sideFromParent] = 0;
+    }
+    cube->parentMac = 0;
+}
+
+//Recomputes cached coords and paths below mac from its own, O(subtree)
+void Map::refreshSubtree(uint32_t mac) {
+    uint32_t pending[MAX_CUBES];
+    uint8_t count = 0;
+    pending[count++] = mac;
+
+    while (count > 0) {
+        const Cube* node = cubes.find(pending[--count]);
+        if (!node) continue;
+
+        for (uint8_t s = 0; s < NUM_CUBE_SIDES; s++) {
+            Cube* child = cubes.find(node->children[s]);
+            if (!child) continue;
+
+            child->x = node->x + sideOffsetsX[s];
+            child->y = node->y + sideOffsetsY[s];
+            child->pathFromHost = node->pathFromHost;
+            child->pathFromHost.push(s);
+            if (count < MAX_CUBES) pending[count++] = node->children[s];
+        }
     }
 }
 
-std::vector<uint8_t> Map::getPathFromHost(uint32_t mac) const {
-    auto it = cubes.find(mac);
-    if (it != cubes.end()) {
-        return it->second.pathFromHost;
+PackedPath Map::getPathFromHost(uint32_t mac) const {
+    const Cube* cube = cubes.find(mac);
+    if (cube) {
+        return cube->pathFromHost;
     }
-    return {};
+    return PackedPath();
+}
+
+void Map::rebuildOccupancy() {
+    memset(_occupancy, 0, sizeof(_occupancy));
+    _gridCols = 0;
+    _gridRows = 0;
+    if (cubes.size() == 0) return;
+
+    int16_t minX = INT16_MAX, minY = INT16_MAX;
+    int16_t maxX = INT16_MIN, maxY = INT16_MIN;
+    cubes.forEach([&](uint32_t, const Cube& cube) {
+        minX = min(minX, cube.x);
+        minY = min(minY, cube.y);
+        maxX = max(maxX, cube.x);
+        maxY = max(maxY, cube.y);
+    });
+
+    //A layout of N cubes spans at most N tiles on each axis
+    _gridMinX = minX;
+    _gridMinY = minY;
+    _gridCols = min(((maxX - minX) >> CUBE_SHIFT) + 1, MAX_CUBES);
+    _gridRows = min(((maxY - minY) >> CUBE_SHIFT) + 1, MAX_CUBES);
+
+    cubes.forEach([&](uint32_t, const Cube& cube) {
+        int32_t tileX = (cube.x - minX) >> CUBE_SHIFT;
+        int32_t tileY = (cube.y - minY) >> CUBE_SHIFT;
+        if (tileX >= _gridCols || tileY >= _gridRows) return;
+        size_t bit = (size_t)tileY * _gridCols + tileX;
+        _occupancy[bit >> 5] |= 1u << (bit & 31);
+    });
+}
+
+bool Map::isTileOccupied(int32_t tileX, int32_t tileY) const {
+    if (tileX < 0 || tileY < 0 || tileX >= _gridCols || tileY >= _gridRows) return false;
+    size_t bit = (size_t)tileY * _gridCols + tileX;
+    return (_occupancy[bit >> 5] >> (bit & 31)) & 1;
 }
 
 bool Map::isCharacterInWorld(int16_t charX, int16_t charY) const {
-    for (const auto& pair : cubes) {
-        const Cube& cube = pair.second;
-        int16_t x = cube.x;
-        int16_t y = cube.y;
-
-        if (charX >= x && charX < x + 128 &&
-            charY >= y && charY < y + 128) {
-            return true;
+    return isTileOccupied(((int32_t)charX - _gridMinX) >> CUBE_SHIFT,
+                          ((int32_t)charY - _gridMinY) >> CUBE_SHIFT);
+}
+
+bool Map::isRectInWorld(int16_t x, int16_t y, int16_t width, int16_t height) const {
+    if (width <= 0 || height <= 0) return false;
+
+    int32_t tileX0 = ((int32_t)x - _gridMinX) >> CUBE_SHIFT;
+    int32_t tileY0 = ((int32_t)y - _gridMinY) >> CUBE_SHIFT;
+    int32_t tileX1 = ((int32_t)x + width - 1 - _gridMinX) >> CUBE_SHIFT;
+    int32_t tileY1 = ((int32_t)y + height - 1 - _gridMinY) >> CUBE_SHIFT;
+
+    //Every tile the rect touches must be a cube, so gaps in concave layouts are rejected
+    for (int32_t ty = tileY0; ty <= tileY1; ty++) {
+        for (int32_t tx = tileX0; tx <= tileX1; tx++) {
+            if (!isTileOccupied(tx, ty)) return false;
         }
     }
-    return false;
+    return true;
 }
 
 bool Map::isCharacterInCubeBounds(uint32_t cubeMac, int16_t charX, int16_t charY) const {
-    auto it = cubes.find(cubeMac);
-    if (it == cubes.end()) return false;
+    const Cube* found = cubes.find(cubeMac);
+    if (!found) return false;
 
-    const Cube& cube = it->second;
+    const Cube& cube = *found;
     const int16_t cubeWidth = 128;
     const int16_t cubeHeight = 128;
 
@@ -101,11 +434,7 @@ bool Map::isCharacterInCubeBounds(uint32_t cubeMac, int16_t charX, int16_t charY
 
 //Returns pointer to Cube info if found, otherwise nullptr
 const Cube* Map::getCubeInfo(uint32_t mac) const {
-    auto it = cubes.find(mac);
-    if (it != cubes.end()) {
-        return &(it->second);
-    }
-    return nullptr;
+    return cubes.find(mac);
 }
 
 void Map::setMyMac(uint32_t mac) {myMac = mac;}
\ No newline at end of file
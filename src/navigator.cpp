@@ -0,0 +1,181 @@
+// navigator.cpp
+#include "navigator.h"
+#include <string.h>
+
+static const int8_t NEIGHBOUR_X[] = { 0, 1, 0, -1, 1, 1, -1, -1 };
+static const int8_t NEIGHBOUR_Y[] = { -1, 0, 1, 0, -1, 1, 1, -1 };
+
+void Navigator::fitFootprint(uint16_t width, uint16_t height) {
+    if (width <= _footprintW && height <= _footprintH) return;
+    if (width > _footprintW) _footprintW = width;
+    if (height > _footprintH) _footprintH = height;
+    _dirty = true;
+}
+
+//Renumbers the cells and their walkability after the map or the footprint changed
+void Navigator::sync() {
+    if (!_dirty && _map->getVersion() == _version) return;
+    _dirty = false;
+    _version = _map->getVersion();
+    _stats.topology++;
+
+    uint16_t cols = _map->getGridCols();
+    uint16_t rows = _map->getGridRows();
+    memset(_tileSlot, 0xFF, sizeof(_tileSlot));
+    _slots = 0;
+    for (uint16_t ty = 0; ty < rows; ty++) {
+        for (uint16_t tx = 0; tx < cols && _slots < MAX_CUBES; tx++) {
+            if (!_map->isTileOccupied(tx, ty)) continue;
+            _tileSlot[ty * cols + tx] = _slots;
+            _slotX[_slots] = tx;
+            _slotY[_slots] = ty;
+            _slots++;
+        }
+    }
+
+    memset(_walkable, 0, sizeof(_walkable));
+    int16_t width = _footprintW ? _footprintW : 1;
+    int16_t height = _footprintH ? _footprintH : 1;
+    for (int16_t cell = 0; cell < _slots * CELLS_PER_TILE; cell++) {
+        int16_t x, y;
+        cellCenter(cell, x, y);
+        if (_map->isRectInWorld(x - width / 2, y - height / 2, width, height)) {
+            _walkable[cell >> 5] |= 1u << (cell & 31);
+        }
+    }
+
+    for (uint8_t i = 0; i < MAX_FIELDS; i++) {
+        _fields[i].source = -1;
+    }
+}
+
+int16_t Navigator::cellAt(int32_t cellX, int32_t cellY) const {
+    if (cellX < 0 || cellY < 0) return -1;
+    int32_t tileX = cellX / CELLS_PER_SIDE;
+    int32_t tileY = cellY / CELLS_PER_SIDE;
+    if (tileX >= _map->getGridCols() || tileY >= _map->getGridRows()) return -1;
+
+    uint8_t slot = _tileSlot[tileY * _map->getGridCols() + tileX];
+    if (slot == 0xFF) return -1;
+    return slot * CELLS_PER_TILE + (cellY % CELLS_PER_SIDE) * CELLS_PER_SIDE + cellX % CELLS_PER_SIDE;
+}
+
+int16_t Navigator::cellOf(int16_t x, int16_t y) const {
+    return cellAt(((int32_t)x - _map->getGridMinX()) >> NAV_SHIFT, ((int32_t)y - _map->getGridMinY()) >> NAV_SHIFT);
+}
+
+void Navigator::cellCoords(int16_t cell, int32_t& cellX, int32_t& cellY) const {
+    uint8_t slot = cell / CELLS_PER_TILE;
+    uint8_t sub = cell % CELLS_PER_TILE;
+    cellX = _slotX[slot] * CELLS_PER_SIDE + sub % CELLS_PER_SIDE;
+    cellY = _slotY[slot] * CELLS_PER_SIDE + sub / CELLS_PER_SIDE;
+}
+
+void Navigator::cellCenter(int16_t cell, int16_t& x, int16_t& y) const {
+    int32_t cellX, cellY;
+    cellCoords(cell, cellX, cellY);
+    x = _map->getGridMinX() + (cellX << NAV_SHIFT) + NAV_CELL_SIZE / 2;
+    y = _map->getGridMinY() + (cellY << NAV_SHIFT) + NAV_CELL_SIZE / 2;
+}
+
+const Navigator::Field* Navigator::field(uint32_t key, int16_t source) {
+    _uses++;
+    Field* found = nullptr;
+    for (uint8_t i = 0; i < MAX_FIELDS && !found; i++) {
+        if (_fields[i].lastUsed && _fields[i].key == key) found = &_fields[i];
+    }
+
+    if (!found) {
+        found = &_fields[0];
+        for (uint8_t i = 1; i < MAX_FIELDS; i++) {
+            if (_fields[i].lastUsed < found->lastUsed) found = &_fields[i];
+        }
+        found->key = key;
+        found->source = -1;
+    }
+
+    if (found->source != source) {
+        build(*found, source);
+    }
+    found->lastUsed = _uses;
+    return found;
+}
+
+//Breadth-first over walkable cells. The source itself is seeded even when the target stands
+//somewhere its footprint wouldn't fit centered
+void Navigator::build(Field& field, int16_t source) {
+    _stats.builds++;
+    field.source = source;
+    for (uint16_t i = 0; i < _slots * CELLS_PER_TILE; i++) {
+        field.dist[i] = UNREACHABLE;
+    }
+
+    uint16_t head = 0, tail = 0;
+    field.dist[source] = 0;
+    _queue[tail++] = source;
+    while (head < tail) {
+        int16_t cell = _queue[head++];
+        int32_t cellX, cellY;
+        cellCoords(cell, cellX, cellY);
+
+        for (uint8_t n = 0; n < 4; n++) {
+            int16_t next = cellAt(cellX + NEIGHBOUR_X[n], cellY + NEIGHBOUR_Y[n]);
+            if (next < 0 || !isWalkable(next) || field.dist[next] != UNREACHABLE) continue;
+            field.dist[next] = field.dist[cell] + 1;
+            _queue[tail++] = next;
+        }
+    }
+}
+
+int16_t Navigator::bestNeighbour(const Field& field, int16_t cell, bool furthest) const {
+    uint16_t here = field.dist[cell];
+    uint8_t count = here == UNREACHABLE ? 8 : 4;
+    if (here == UNREACHABLE) here = furthest ? 0 : UNREACHABLE;
+
+    int32_t cellX, cellY;
+    cellCoords(cell, cellX, cellY);
+    int16_t best = -1;
+    uint16_t bestDist = here;
+    for (uint8_t n = 0; n < count; n++) {
+        int16_t next = cellAt(cellX + NEIGHBOUR_X[n], cellY + NEIGHBOUR_Y[n]);
+        if (next < 0 || field.dist[next] == UNREACHABLE) continue;
+
+        uint16_t dist = field.dist[next];
+        if (furthest ? dist > bestDist : dist < bestDist) {
+            best = next;
+            bestDist = dist;
+        }
+    }
+    return best;
+}
+
+bool Navigator::steer(const Field& field, int16_t x, int16_t y, int16_t cell, bool furthest, float& dx, float& dy) const {
+    int16_t next = bestNeighbour(field, cell, furthest);
+    if (next < 0) return false;
+
+    int16_t nextX, nextY;
+    cellCenter(next, nextX, nextY);
+    dx = nextX - x;
+    dy = nextY - y;
+    return true;
+}
+
+bool Navigator::toward(uint32_t key, int16_t x, int16_t y, int16_t targetX, int16_t targetY, float& dx, float& dy) {
+    sync();
+    int16_t source = cellOf(targetX, targetY);
+    int16_t cell = cellOf(x, y);
+    if (source < 0 || cell < 0) return false;
+
+    const Field* f = field(key, source);
+    if (f->dist[cell] <= 1) return false;
+    return steer(*f, x, y, cell, false, dx, dy);
+}
+
+bool Navigator::awayFrom(uint32_t key, int16_t x, int16_t y, int16_t targetX, int16_t targetY, float& dx, float& dy) {
+    sync();
+    int16_t source = cellOf(targetX, targetY);
+    int16_t cell = cellOf(x, y);
+    if (source < 0 || cell < 0) return false;
+
+    return steer(*field(key, source), x, y, cell, true, dx, dy);
+}
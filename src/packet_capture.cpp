@@ -0,0 +1,128 @@
+// packet_capture.cpp
+#include "packet_capture.h"
+#include <stdlib.h>
+#include <string.h>
+#ifdef ESP_PLATFORM
+#include <Arduino.h>
+#endif
+
+PacketCapture::~PacketCapture() {
+    clear();
+}
+
+bool PacketCapture::start(size_t bytes) {
+    if (!_buf || _size != bytes) {
+        clear();
+#ifdef ESP_PLATFORM
+        //NULL on boards without PSRAM
+        _buf = (uint8_t*)ps_malloc(bytes);
+#endif
+        if (!_buf) _buf = (uint8_t*)malloc(bytes);
+        if (!_buf) return false;
+        _size = bytes;
+    }
+
+    _head = 0;
+    _tail = 0;
+    _used = 0;
+    _count = 0;
+    _stats = Stats();
+    _active = true;
+    return true;
+}
+
+void PacketCapture::clear() {
+    free(_buf);
+    _buf = nullptr;
+    _size = 0;
+    _used = 0;
+    _count = 0;
+    _active = false;
+}
+
+void PacketCapture::put(const uint8_t* data, size_t len) {
+    size_t first = len < _size - _head ? len : _size - _head;
+    memcpy(_buf + _head, data, first);
+    memcpy(_buf, data + first, len - first);
+    _head = (_head + len) % _size;
+    _used += len;
+}
+
+void PacketCapture::peek(size_t pos, uint8_t* out, size_t len) const {
+    pos %= _size;
+    size_t first = len < _size - pos ? len : _size - pos;
+    memcpy(out, _buf + pos, first);
+    memcpy(out + first, _buf, len - first);
+}
+
+void PacketCapture::record(uint32_t timeUs, uint8_t side, Direction dir, const uint8_t* frame, size_t len) {
+    if (!_active || RECORD_HEADER + len > _size) return;
+
+    //Make room by dropping the oldest frames
+    while (_size - _used < RECORD_HEADER + len) {
+        uint8_t header[RECORD_HEADER];
+        peek(_tail, header, RECORD_HEADER);
+        size_t oldLen = RECORD_HEADER + (((size_t)header[6] << 8) | header[7]);
+        _tail = (_tail + oldLen) % _size;
+        _used -= oldLen;
+        _count--;
+        _stats.evicted++;
+    }
+
+    uint8_t header[RECORD_HEADER] = {
+        (uint8_t)(timeUs >> 24), (uint8_t)(timeUs >> 16), (uint8_t)(timeUs >> 8), (uint8_t)timeUs,
+        side, dir, (uint8_t)(len >> 8), (uint8_t)len
+    };
+    put(header, RECORD_HEADER);
+    put(frame, len);
+    _count++;
+    _stats.records++;
+}
+
+size_t PacketCapture::pcapSize() const {
+    //24-byte file header, and a 16-byte record header plus 2-byte pseudo header per frame
+    //in place of our 8-byte one
+    return 24 + _used + _count * (16 + 2 - RECORD_HEADER);
+}
+
+static void putLe32(uint8_t* out, uint32_t v) {
+    out[0] = v & 0xFF;
+    out[1] = (v >> 8) & 0xFF;
+    out[2] = (v >> 16) & 0xFF;
+    out[3] = (v >> 24) & 0xFF;
+}
+
+void PacketCapture::exportPcap(Sink sink, void* ctx) const {
+    uint8_t header[24] = {};
+    putLe32(header, 0xA1B2C3D4);    //microsecond timestamps
+    header[4] = 2;                  //version 2.4
+    header[6] = 4;
+    putLe32(header + 16, 0xFFFF);   //snaplen
+    putLe32(header + 20, LINKTYPE_USER0);
+    sink(header, sizeof(header), ctx);
+
+    size_t pos = _tail;
+    for (uint32_t i = 0; i < _count; i++) {
+        uint8_t rec[RECORD_HEADER];
+        peek(pos, rec, RECORD_HEADER);
+        uint32_t timeUs = ((uint32_t)rec[0] << 24) | ((uint32_t)rec[1] << 16) | ((uint32_t)rec[2] << 8) | rec[3];
+        size_t len = ((size_t)rec[6] << 8) | rec[7];
+
+        uint8_t out[16 + 2];
+        putLe32(out, timeUs / 1000000);
+        putLe32(out + 4, timeUs % 1000000);
+        putLe32(out + 8, 2 + len);
+        putLe32(out + 12, 2 + len);
+        out[16] = rec[4];
+        out[17] = rec[5];
+        sink(out, sizeof(out), ctx);
+
+        //The frame may wrap around the end of the ring
+        size_t start = (pos + RECORD_HEADER) % _size;
+        size_t first = len < _size - start ? len : _size - start;
+        sink(_buf + start, first, ctx);
+        if (len > first) sink(_buf, len - first, ctx);
+
+        pos = (pos + RECORD_HEADER + len) % _size;
+    }
+}
@@ -0,0 +1,142 @@
+// power.cpp
+#include "power.h"
+#include "battle.h"
+#include "display.h"
+#include "game_clock.h"
+#include <Arduino.h>
+
+#ifdef ESP_PLATFORM
+#include "driver/uart.h"
+#include "esp_sleep.h"
+
+#if DEBUG_CONSOLE
+//RX edges on the debug console that wake the chip
+static const int CONSOLE_WAKE_EDGES = 3;
+#endif
+#endif
+
+//The byte that wakes the chip is lost, and a face only connects on a heartbeat. After a wake
+//the cube stays up for the next one, plus a tick for it to leave and one to be read
+static const uint32_t WAKE_HOLD_US = (HEARTBEAT_INTERVAL_MS + 2 * POWER_TICK_MS) * 1000UL;
+
+static uint32_t microsClock() {
+    return micros();
+}
+
+PowerManager power(microsClock);
+
+PowerManager::PowerManager(ClockFn clock) : _clock(clock) {}
+
+void PowerManager::begin() {
+#if defined(ESP_PLATFORM) && DEBUG_CONSOLE
+    //The console wakes it too, so debug commands still work on a lone cube. A command typed
+    //while it sleeps is lost and has to be sent again
+    uart_set_wakeup_threshold(UART_NUM_0, CONSOLE_WAKE_EDGES);
+    esp_sleep_enable_uart_wakeup(UART_NUM_0);
+#endif
+    _mode = POWER_ACTIVE;
+    _tickStart = _clock();
+}
+
+void PowerManager::idle(Battle& battle) {
+    uint32_t now = _clock();
+    uint32_t spent = now - _tickStart;
+    _stats.awakeUs += spent;
+    if (_rxWake) {
+        _stats.wakeLatencyUs = _tickStart - _wokeAt;
+        if (_stats.wakeLatencyUs > _stats.wakeLatencyUsMax) _stats.wakeLatencyUsMax = _stats.wakeLatencyUs;
+        _rxWake = false;
+    }
+
+    Display& display = battle.getDisplay();
+    display.setDimmed(gameClock.now() - display.getChangedAt() >= POWER_DIM_MS);
+
+    Mode mode = chooseMode(battle);
+    setMode(mode);
+    _stats.ticks[mode]++;
+
+    uint32_t periodUs = POWER_TICK_MS * 1000UL;
+    if (mode != POWER_ACTIVE && spent < periodUs) {
+        wait(battle, periodUs - spent);
+    }
+    _tickStart = _clock();
+}
+
+//Light sleep stops the UARTs, so only a cube with nobody to hear and nothing to send sleeps
+PowerManager::Mode PowerManager::chooseMode(Battle& battle) {
+    Comms& comms = battle.getComms();
+    if (!comms.hasNeighbors()) {
+        bool holding = _wakeHold && (int32_t)(_clock() - _wokeAt - WAKE_HOLD_US) < 0;
+        _wakeHold = holding;
+        return holding || comms.txPending() ? POWER_DOZE : POWER_SLEEP;
+    }
+    _wakeHold = false;
+    uint32_t stillMs = gameClock.now() - battle.getDisplay().getChangedAt();
+    return stillMs >= POWER_QUIET_MS ? POWER_DOZE : POWER_ACTIVE;
+}
+
+//The clock only changes with the mode, as every switch stalls the CPU for a moment
+void PowerManager::setMode(Mode mode) {
+#ifdef ESP_PLATFORM
+    uint32_t mhz = mode == POWER_ACTIVE ? POWER_ACTIVE_MHZ : POWER_IDLE_MHZ;
+    if (getCpuFrequencyMhz() != mhz) {
+        setCpuFrequencyMhz(mhz);
+    }
+#endif
+    _mode = mode;
+}
+
+void PowerManager::wait(Battle& battle, uint32_t us) {
+    Comms& comms = battle.getComms();
+    uint32_t start = _clock();
+    bool rx;
+
+    if (_mode == POWER_SLEEP) {
+        //Bytes that landed after the tick read its faces would sit out the whole sleep
+        if (comms.waitForRx(0)) {
+            rx = true;
+        } else {
+#ifdef ESP_PLATFORM
+            //Debug output still in the FIFO would be cut off mid-byte
+            Serial.flush();
+            esp_sleep_enable_timer_wakeup(us);
+            esp_light_sleep_start();
+            esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+            rx = cause == ESP_SLEEP_WAKEUP_UART || cause == ESP_SLEEP_WAKEUP_GPIO;
+#else
+            comms.setAsleep(true);
+            rx = comms.waitForRx(us / 1000);
+            comms.setAsleep(false);
+#endif
+            _stats.sleeps++;
+        }
+    } else {
+        rx = comms.waitForRx(us / 1000);
+    }
+
+    uint32_t woke = _clock();
+    if (_mode == POWER_SLEEP) {
+        _stats.sleepUs += woke - start;
+    } else {
+        _stats.dozeUs += woke - start;
+    }
+    if (rx) {
+        _stats.rxWakes++;
+        _wokeAt = woke;
+        _rxWake = true;
+        _wakeHold = true;
+    }
+}
+
+uint8_t PowerManager::dutyCycle() const {
+    uint64_t total = _stats.awakeUs + _stats.dozeUs + _stats.sleepUs;
+    return total ? (uint8_t)(_stats.awakeUs * 100 / total) : 100;
+}
+
+uint32_t PowerManager::estimatedUa() const {
+    uint64_t total = _stats.awakeUs + _stats.dozeUs + _stats.sleepUs;
+    if (!total) return POWER_ACTIVE_UA;
+    uint64_t charge = _stats.awakeUs * POWER_ACTIVE_UA + _stats.dozeUs * POWER_DOZE_UA +
+                      _stats.sleepUs * POWER_SLEEP_UA;
+    return (uint32_t)(charge / total);
+}
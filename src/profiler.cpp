@@ -0,0 +1,119 @@
+// profiler.cpp
+#include "profiler.h"
+#include <Arduino.h>
+#include <algorithm>
+#include <string.h>
+#ifndef ESP_PLATFORM
+#include <chrono>
+#endif
+
+Profiler profiler;
+
+//Stage each one is nested in, for the folded stacks. 0xFF for a root
+static const uint8_t STAGE_PARENT[NUM_STAGES] = {
+    0xFF,           //STAGE_FRAME
+    STAGE_FRAME,    //STAGE_COMMS
+    STAGE_FRAME,    //STAGE_CHARACTERS
+    STAGE_FRAME,    //STAGE_COMPOSE
+    STAGE_FRAME,    //STAGE_PUSH
+    STAGE_CHARACTERS,   //STAGE_AI
+    STAGE_CHARACTERS,   //STAGE_MOVE
+    STAGE_CHARACTERS,   //STAGE_COMBAT
+    STAGE_CHARACTERS,   //STAGE_ANIMATE
+};
+
+static const uint8_t DUMP_MAGIC[4] = { 0xA5, 0x5A, 'P', 'F' };
+
+Profiler::Profiler() {
+    memset(_rings, 0, sizeof(_rings));
+}
+
+uint32_t Profiler::now() {
+#ifdef ESP_PLATFORM
+    return ESP.getCycleCount();
+#else
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void Profiler::record(ProfileStage stage, uint32_t start) {
+    //Read every sample, the power manager drops the clock between ticks (see power.h)
+#ifdef ESP_PLATFORM
+    uint32_t ticksPerUs = ESP.getCpuFreqMHz();
+#else
+    uint32_t ticksPerUs = 1;
+#endif
+
+    uint32_t us = (now() - start) / ticksPerUs;
+    Ring& ring = _rings[stage];
+    ring.samples[ring.next] = us > 0xFFFF ? 0xFFFF : us;
+    ring.next = (ring.next + 1) % RING_SIZE;
+    if (ring.count < RING_SIZE) ring.count++;
+    ring.total++;
+}
+
+Profiler::Summary Profiler::summarize(ProfileStage stage) const {
+    Summary summary = {};
+    const Ring& ring = _rings[stage];
+    summary.samples = ring.count;
+    if (ring.count == 0) return summary;
+
+    uint16_t sorted[RING_SIZE];
+    memcpy(sorted, ring.samples, ring.count * sizeof(uint16_t));
+    std::sort(sorted, sorted + ring.count);
+
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < ring.count; i++) {
+        sum += sorted[i];
+    }
+
+    summary.minUs = sorted[0];
+    summary.maxUs = sorted[ring.count - 1];
+    summary.avgUs = sum / ring.count;
+    summary.p99Us = sorted[(ring.count * 99 + 99) / 100 - 1];
+    return summary;
+}
+
+size_t Profiler::writeDump(uint8_t* out) const {
+    uint8_t* body = out + 7;
+    size_t len = 0;
+
+    body[len++] = NUM_STAGES;
+    for (uint8_t s = 0; s < NUM_STAGES; s++) {
+        const Ring& ring = _rings[s];
+        body[len++] = s;
+        body[len++] = STAGE_PARENT[s];
+        body[len++] = ring.count;
+        body[len++] = (ring.total >> 24) & 0xFF;
+        body[len++] = (ring.total >> 16) & 0xFF;
+        body[len++] = (ring.total >> 8) & 0xFF;
+        body[len++] = ring.total & 0xFF;
+
+        //Oldest first
+        uint8_t first = (ring.next + RING_SIZE - ring.count) % RING_SIZE;
+        for (uint8_t i = 0; i < ring.count; i++) {
+            uint16_t us = ring.samples[(first + i) % RING_SIZE];
+            body[len++] = us >> 8;
+            body[len++] = us & 0xFF;
+        }
+    }
+
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += body[i];
+    }
+
+    memcpy(out, DUMP_MAGIC, sizeof(DUMP_MAGIC));
+    out[4] = DUMP_VERSION;
+    out[5] = (len >> 8) & 0xFF;
+    out[6] = len & 0xFF;
+    out[7 + len] = sum;
+    return 8 + len;
+}
+
+void Profiler::dumpToSerial() const {
+    static uint8_t dump[MAX_DUMP];
+    size_t len = writeDump(dump);
+    Serial.write(dump, len);
+}
@@ -0,0 +1,305 @@
+// reliable_link.cpp
+#include "reliable_link.h"
+#include <string.h>
+
+static const uint32_t INITIAL_RTO_MS = 250;
+static const uint32_t MIN_RTO_MS = 40;
+static const uint32_t MAX_RTO_MS = 2000;
+static const uint32_t ACK_DELAY_MS = 20;    //how long an ACK waits for a message to ride on
+
+void ReliableLink::reset(uint8_t session) {
+    _session = session;
+    _peerSession = 0;
+    _sendBase = 0;
+    _nextSeq = 0;
+    for (uint8_t i = 0; i < WINDOW; i++) {
+        _tx[i].sent = false;
+        _rx[i].have = false;
+    }
+    _recvNext = 0;
+    _ackPending = false;
+    _ackNow = false;
+    _backlogHead = 0;
+    _backlogCount = 0;
+
+    _haveRtt = false;
+    _srtt = 0;
+    _rttvar = 0;
+    _rto = INITIAL_RTO_MS;
+    _stats.srttMs = 0;
+    _stats.rtoMs = _rto;
+}
+
+bool ReliableLink::send(const uint8_t* msg, size_t len) {
+    if (len == 0 || len > MAX_MESSAGE || (inFlight() >= WINDOW && _backlogCount >= BACKLOG)) {
+        _stats.rejected++;
+        return false;
+    }
+
+    //Behind anything already waiting, so order holds
+    if (inFlight() >= WINDOW || _backlogCount > 0) {
+        Pending& pending = _backlog[(_backlogHead + _backlogCount) % BACKLOG];
+        pending.len = len;
+        memcpy(pending.data, msg, len);
+        _backlogCount++;
+        _stats.backlogged++;
+        fillWindow();
+        return true;
+    }
+
+    enqueue(msg, len);
+    return true;
+}
+
+void ReliableLink::enqueue(const uint8_t* msg, size_t len) {
+    TxSlot& slot = _tx[_nextSeq % WINDOW];
+    slot.len = len;
+    slot.sent = false;
+    slot.sacked = false;
+    slot.retransmitted = false;
+    slot.fastRetransmit = false;
+    memcpy(slot.data, msg, len);
+    _nextSeq++;
+}
+
+//Moves waiting messages into whatever the last ACK freed
+void ReliableLink::fillWindow() {
+    while (_backlogCount > 0 && inFlight() < WINDOW) {
+        const Pending& pending = _backlog[_backlogHead];
+        enqueue(pending.data, pending.len);
+        _backlogHead = (_backlogHead + 1) % BACKLOG;
+        _backlogCount--;
+    }
+}
+
+size_t ReliableLink::poll(uint32_t now, uint8_t* out) {
+    fillWindow();
+
+    //New messages first, in order
+    for (uint8_t seq = _sendBase; seq != _nextSeq; seq++) {
+        TxSlot& slot = _tx[seq % WINDOW];
+        if (!slot.sent) {
+            slot.sent = true;
+            slot.sentAt = now;
+            _stats.sent++;
+            return writeFrame(out, seq, &slot);
+        }
+    }
+
+    //Then holes the peer reported and timeouts, oldest first
+    for (uint8_t seq = _sendBase; seq != _nextSeq; seq++) {
+        TxSlot& slot = _tx[seq % WINDOW];
+        if (slot.sacked) continue;
+
+        bool timedOut = (uint32_t)(now - slot.sentAt) >= _rto;
+        if (!slot.fastRetransmit && !timedOut) continue;
+
+        if (slot.fastRetransmit) {
+            slot.fastRetransmit = false;
+            _stats.fastRetransmits++;
+        } else if (seq == _sendBase) {
+            //Back off once per timeout of the oldest message, not once per message
+            _rto = _rto * 2 > MAX_RTO_MS ? MAX_RTO_MS : _rto * 2;
+            _stats.rtoMs = _rto;
+        }
+        slot.retransmitted = true;
+        slot.sentAt = now;
+        _stats.retransmits++;
+        return writeFrame(out, seq, &slot);
+    }
+
+    if (_ackPending && (_ackNow || (int32_t)(now - _ackDueAt) >= 0)) {
+        return writeFrame(out, 0, nullptr);
+    }
+    return 0;
+}
+
+void ReliableLink::onFrame(const uint8_t* in, size_t len, uint32_t now) {
+    if (len < HEADER_LEN || in[0] == 0) return;
+
+    uint8_t peerSession = in[0];
+    uint8_t echoedSession = in[1];
+    uint8_t seq = in[2];
+
+    //The peer reset, so its receive side expects numbering from 0 again
+    if (peerSession != _peerSession) {
+        _peerSession = peerSession;
+        restartNumbering();
+    }
+
+    size_t msgLen = len - HEADER_LEN;
+
+    //Sent before the peer knew our current session: its ACK means nothing and its numbering
+    //is stale. Answering at once tells the peer our session, so it restarts and resends
+    if (echoedSession != _session) {
+        if (msgLen > 0) {
+            _ackPending = true;
+            _ackNow = true;
+        }
+        return;
+    }
+
+    onAck(in[3], in[4], now);
+    if (msgLen == 0 || msgLen > MAX_MESSAGE) return;
+
+    if (!_ackPending) {
+        _ackDueAt = now + ACK_DELAY_MS;
+    }
+    _ackPending = true;
+
+    int8_t ahead = (int8_t)(seq - _recvNext);
+    if (ahead < 0 || ahead >= (int8_t)WINDOW) {
+        //Already delivered, so our ACK was lost; or too far ahead to buffer
+        _stats.duplicates++;
+        _ackNow = true;
+        return;
+    }
+
+    RxSlot& slot = _rx[seq % WINDOW];
+    if (slot.have) {
+        _stats.duplicates++;
+        _ackNow = true;
+        return;
+    }
+    slot.have = true;
+    slot.len = msgLen;
+    memcpy(slot.data, in + HEADER_LEN, msgLen);
+
+    //A gap: the sack tells the sender right away what to resend
+    if (ahead > 0) {
+        _ackNow = true;
+    }
+}
+
+size_t ReliableLink::writeAck(uint8_t* out) {
+    out[0] = _session;
+    out[1] = _peerSession;
+    out[2] = _recvNext;
+    out[3] = sackBits();
+    _ackPending = false;
+    _ackNow = false;
+    return ACK_LEN;
+}
+
+//Session changes are left to PACKET_RELIABLE, a piggybacked ACK only counts within the current one
+void ReliableLink::onPiggybackAck(const uint8_t* in, uint32_t now) {
+    if (in[0] == 0 || in[0] != _peerSession || in[1] != _session) return;
+    onAck(in[2], in[3], now);
+}
+
+size_t ReliableLink::nextDelivery(uint8_t* out) {
+    RxSlot& slot = _rx[_recvNext % WINDOW];
+    if (!slot.have) return 0;
+
+    memcpy(out, slot.data, slot.len);
+    slot.have = false;
+    _recvNext++;
+    _stats.delivered++;
+    return slot.len;
+}
+
+void ReliableLink::onAck(uint8_t ack, uint8_t sack, uint32_t now) {
+    uint8_t acked = ack - _sendBase;
+    if (acked > inFlight()) return;   //stale
+
+    for (uint8_t i = 0; i < acked; i++) {
+        TxSlot& slot = _tx[(uint8_t)(_sendBase + i) % WINDOW];
+        if (slot.sent && !slot.retransmitted && !slot.sacked) {
+            sampleRtt(now - slot.sentAt);
+        }
+    }
+    _sendBase = ack;
+
+    int8_t highest = -1;
+    for (uint8_t i = 0; i + 1 < WINDOW; i++) {
+        if (!(sack & (1 << i))) continue;
+        uint8_t offset = i + 1;
+        if (offset >= inFlight()) break;
+
+        TxSlot& slot = _tx[(uint8_t)(_sendBase + offset) % WINDOW];
+        if (slot.sent && !slot.sacked && !slot.retransmitted) {
+            sampleRtt(now - slot.sentAt);
+        }
+        slot.sacked = true;
+        highest = offset;
+    }
+
+    //Two later messages must have arrived first, so a late frame isn't mistaken for a loss
+    uint8_t sackedAbove = 0;
+    for (int8_t offset = highest; offset >= 0; offset--) {
+        TxSlot& slot = _tx[(uint8_t)(_sendBase + offset) % WINDOW];
+        if (slot.sacked) {
+            sackedAbove++;
+        } else if (sackedAbove >= 2 && slot.sent && !slot.retransmitted) {
+            slot.fastRetransmit = true;
+        }
+    }
+}
+
+//RFC 6298 estimator, in milliseconds
+void ReliableLink::sampleRtt(uint32_t rtt) {
+    if (!_haveRtt) {
+        _srtt = rtt;
+        _rttvar = rtt / 2;
+        _haveRtt = true;
+    } else {
+        uint32_t err = _srtt > rtt ? _srtt - rtt : rtt - _srtt;
+        _rttvar = (3 * _rttvar + err) / 4;
+        _srtt = (7 * _srtt + rtt) / 8;
+    }
+
+    _rto = _srtt + 4 * _rttvar;
+    if (_rto < MIN_RTO_MS) _rto = MIN_RTO_MS;
+    if (_rto > MAX_RTO_MS) _rto = MAX_RTO_MS;
+
+    _stats.srttMs = _srtt > UINT16_MAX ? UINT16_MAX : _srtt;
+    _stats.rtoMs = _rto;
+}
+
+//Unacknowledged messages are renumbered from 0 and sent again; buffered input is dropped
+void ReliableLink::restartNumbering() {
+    TxSlot pending[WINDOW];
+    uint8_t count = 0;
+    for (uint8_t seq = _sendBase; seq != _nextSeq; seq++) {
+        pending[count++] = _tx[seq % WINDOW];
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        _tx[i] = pending[i];
+        _tx[i].sent = false;
+        _tx[i].sacked = false;
+        _tx[i].retransmitted = false;
+        _tx[i].fastRetransmit = false;
+    }
+    _sendBase = 0;
+    _nextSeq = count;
+
+    for (uint8_t i = 0; i < WINDOW; i++) {
+        _rx[i].have = false;
+    }
+    _recvNext = 0;
+    _ackPending = false;
+    _ackNow = false;
+}
+
+//Every frame carries the current ACK, so a queued message clears any pending one
+size_t ReliableLink::writeFrame(uint8_t* out, uint8_t seq, const TxSlot* slot) {
+    out[0] = _session;
+    out[1] = _peerSession;
+    out[2] = seq;
+    out[3] = _recvNext;
+    out[4] = sackBits();
+    _ackPending = false;
+    _ackNow = false;
+
+    if (!slot) return HEADER_LEN;
+    memcpy(out + HEADER_LEN, slot->data, slot->len);
+    return HEADER_LEN + slot->len;
+}
+
+uint8_t ReliableLink::sackBits() const {
+    uint8_t sack = 0;
+    for (uint8_t i = 0; i + 1 < WINDOW; i++) {
+        if (_rx[(uint8_t)(_recvNext + 1 + i) % WINDOW].have) sack |= 1 << i;
+    }
+    return sack;
+}
@@ -0,0 +1,146 @@
+// session_recorder.cpp
+#include "session_recorder.h"
+#include <Arduino.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utility>
+
+SessionRecorder sessionRecorder;
+
+static const uint8_t DUMP_MAGIC[4] = { 0xA5, 0x5A, 'S', 'N' };
+
+SessionRecorder::~SessionRecorder() {
+    free(_buf);
+}
+
+bool SessionRecorder::start(size_t bytes, uint32_t seed, DeviceId deviceId, uint32_t startMs) {
+    if (bytes < HEADER_LEN) return false;
+
+    if (!_buf || _size != bytes) {
+        free(_buf);
+        _buf = nullptr;
+#ifdef ESP_PLATFORM
+        //NULL on boards without PSRAM
+        _buf = (uint8_t*)ps_malloc(bytes);
+#endif
+        if (!_buf) _buf = (uint8_t*)malloc(bytes);
+        if (!_buf) {
+            _size = 0;
+            return false;
+        }
+        _size = bytes;
+    }
+
+    _len = 0;
+    _buf[_len++] = VERSION;
+    put32(seed);
+    IdentityTable::writeId(_buf + _len, deviceId);
+    _len += DEVICE_ID_LEN;
+    put32(startMs);
+
+    _tickStart = _len;
+    _lastTick = startMs;
+    _active = true;
+    _truncated = false;
+    return true;
+}
+
+bool SessionRecorder::reserve(size_t len) {
+    if (_len + len <= _size) return true;
+
+    //A replay can only stop between ticks
+    _len = _tickStart;
+    _active = false;
+    _truncated = true;
+    return false;
+}
+
+void SessionRecorder::put32(uint32_t v) {
+    _buf[_len++] = (v >> 24) & 0xFF;
+    _buf[_len++] = (v >> 16) & 0xFF;
+    _buf[_len++] = (v >> 8) & 0xFF;
+    _buf[_len++] = v & 0xFF;
+}
+
+void SessionRecorder::tick(uint32_t nowMs) {
+    if (!_active) return;
+
+    _tickStart = _len;
+    uint32_t dt = nowMs - _lastTick;
+    _lastTick = nowMs;
+
+    if (dt < 0xFF) {
+        if (!reserve(2)) return;
+        _buf[_len++] = REC_TICK;
+        _buf[_len++] = dt;
+    } else {
+        if (!reserve(5)) return;
+        _buf[_len++] = REC_TICK_LONG;
+        put32(dt);
+    }
+}
+
+void SessionRecorder::rx(uint8_t side, const uint8_t* data, size_t len) {
+    //Split reads longer than a length byte holds
+    while (_active && len > 0) {
+        size_t chunk = len < 0xFF ? len : 0xFF;
+        if (!reserve(2 + chunk)) return;
+        _buf[_len++] = REC_RX | (side & 0x03);
+        _buf[_len++] = chunk;
+        memcpy(_buf + _len, data, chunk);
+        _len += chunk;
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+void SessionRecorder::event(Event event, uint32_t mac) {
+    if (!_active || !reserve(6)) return;
+    _buf[_len++] = REC_EVENT;
+    _buf[_len++] = event;
+    put32(mac);
+}
+
+void SessionRecorder::checkpoint(uint32_t stateHash, uint32_t frameHash) {
+    if (!_active || !reserve(9)) return;
+    _buf[_len++] = REC_CHECKPOINT;
+    put32(stateHash);
+    put32(frameHash);
+}
+
+void SessionRecorder::dumpToSerial() const {
+    uint8_t header[8];
+    memcpy(header, DUMP_MAGIC, sizeof(DUMP_MAGIC));
+    header[4] = (_len >> 24) & 0xFF;
+    header[5] = (_len >> 16) & 0xFF;
+    header[6] = (_len >> 8) & 0xFF;
+    header[7] = _len & 0xFF;
+
+    uint8_t sum = 0;
+    for (size_t i = 0; i < _len; i++) {
+        sum += _buf[i];
+    }
+
+    Serial.write(header, sizeof(header));
+    if (_len > 0) Serial.write(_buf, _len);
+    Serial.write(&sum, 1);
+}
+
+void SessionRecorder::swap(SessionRecorder& other) {
+    std::swap(_buf, other._buf);
+    std::swap(_size, other._size);
+    std::swap(_len, other._len);
+    std::swap(_tickStart, other._tickStart);
+    std::swap(_lastTick, other._lastTick);
+    std::swap(_active, other._active);
+    std::swap(_truncated, other._truncated);
+}
+
+uint32_t SessionRecorder::hash(uint32_t h, const void* data, size_t len) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+    return h;
+}
@@ -0,0 +1,146 @@
+// session_replay.cpp
+#include "session_replay.h"
+#include "session_recorder.h"
+#include "battle.h"
+#include <Arduino.h>
+#include <string.h>
+
+//Extra room in the replay's own recording, so a replay that records more than the original
+//still shows where it diverged
+static const size_t RECORD_SLACK = 64;
+
+void ReplayTransport::push(const uint8_t* data, size_t len) {
+    _reads.push_back(std::vector<uint8_t>(data, data + len));
+}
+
+size_t ReplayTransport::available() {
+    return _reads.empty() ? 0 : _reads.front().size();
+}
+
+size_t ReplayTransport::read(uint8_t* dst, size_t maxLen) {
+    if (_reads.empty()) return 0;
+
+    std::vector<uint8_t>& next = _reads.front();
+    size_t n = next.size() < maxLen ? next.size() : maxLen;
+    memcpy(dst, next.data(), n);
+    if (n == next.size()) {
+        _reads.pop_front();
+    } else {
+        next.erase(next.begin(), next.begin() + n);
+    }
+    return n;
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+//Length of the record at p, 0 if it is unknown or runs past end
+static size_t recordLen(const uint8_t* p, const uint8_t* end) {
+    size_t len = 0;
+    switch (p[0]) {
+        case SessionRecorder::REC_TICK:       len = 2; break;
+        case SessionRecorder::REC_TICK_LONG:  len = 5; break;
+        case SessionRecorder::REC_EVENT:      len = 6; break;
+        case SessionRecorder::REC_CHECKPOINT: len = 9; break;
+        default:
+            if ((p[0] & ~0x03) == SessionRecorder::REC_RX && end - p >= 2) {
+                len = 2 + p[1];
+            }
+            break;
+    }
+    return len > 0 && (size_t)(end - p) >= len ? len : 0;
+}
+
+static bool isTick(uint8_t record) {
+    return record == SessionRecorder::REC_TICK || record == SessionRecorder::REC_TICK_LONG;
+}
+
+SessionReplay::SessionReplay(const uint8_t* session, size_t len)
+    : _data(session), _len(len)
+{
+    if (len < SessionRecorder::HEADER_LEN || session[0] != SessionRecorder::VERSION) return;
+
+    _seed = get32(session + 1);
+    _deviceId = IdentityTable::readId(session + 5);
+    _startMs = get32(session + 5 + DEVICE_ID_LEN);
+
+    const uint8_t* end = session + len;
+    for (const uint8_t* p = session + SessionRecorder::HEADER_LEN; p < end; ) {
+        size_t recLen = recordLen(p, end);
+        if (recLen == 0) return;
+        p += recLen;
+    }
+    _valid = true;
+}
+
+size_t SessionReplay::loadTick(size_t pos, uint32_t& now, uint32_t& checkpoints) {
+    const uint8_t* end = _data + _len;
+
+    if (_data[pos] == SessionRecorder::REC_TICK) {
+        now += _data[pos + 1];
+    } else {
+        now += get32(_data + pos + 1);
+    }
+    pos += recordLen(_data + pos, end);
+
+    while (pos < _len && !isTick(_data[pos])) {
+        const uint8_t* p = _data + pos;
+        if ((p[0] & ~0x03) == SessionRecorder::REC_RX) {
+            _faces[p[0] & 0x03].push(p + 2, p[1]);
+        } else if (p[0] == SessionRecorder::REC_CHECKPOINT) {
+            checkpoints++;
+        }
+        pos += recordLen(p, end);
+    }
+    return pos;
+}
+
+SessionReplay::Result SessionReplay::run(Battle& battle) {
+    Result result;
+    if (!_valid) {
+        result.diverged = true;
+        return result;
+    }
+
+    Transport* faces[NUM_SIDES];
+    for (int i = 0; i < NUM_SIDES; i++) {
+        _faces[i].clear();
+        faces[i] = &_faces[i];
+    }
+    battle.initReplay(_seed, _deviceId, _startMs, faces, _len + RECORD_SLACK);
+
+    //Records written by init itself come before the first tick
+    size_t pos = SessionRecorder::HEADER_LEN;
+    while (pos < _len && !isTick(_data[pos])) {
+        pos += recordLen(_data + pos, _data + _len);
+    }
+
+    size_t checked = 0;
+    uint32_t now = _startMs;
+    uint32_t checkpoints = 0;
+    uint32_t start = micros();
+
+    while (true) {
+        //Everything recorded so far must match the original up to the next tick.
+        //divergedAtTick 0 means init already differed
+        const uint8_t* replayed = sessionRecorder.data();
+        if (sessionRecorder.size() != pos || memcmp(replayed + checked, _data + checked, pos - checked) != 0) {
+            result.diverged = true;
+            result.divergedAtTick = result.ticks;
+            break;
+        }
+        result.checkpoints += checkpoints;
+        checked = pos;
+        if (pos >= _len) break;
+
+        checkpoints = 0;
+        pos = loadTick(pos, now, checkpoints);
+        battle.update(now);
+        result.ticks++;
+    }
+
+    result.elapsedUs = micros() - start;
+    sessionRecorder.stop();
+    return result;
+}
@@ -1,6 +1,12 @@
 #include "sprite.h"
+#include "game_clock.h"
 #include "assets/warrior.h"
 
+static const uint8_t WARRIOR_IDLE[] = { 0, 1, 2, 3, 4, 5 };
+static const uint8_t WARRIOR_DEATH[] = { 6, 7, 8, 9 };
+
+std::map<const uint16_t*, const Sprite::FrameMasks*> Sprite::_maskCache;
+
 Sprite::Sprite(TFT_eSPI* tft)
   : _tft(tft),
     _frames(0),
@@ -8,7 +14,6 @@ Sprite::Sprite(TFT_eSPI* tft)
     _frameWidth(0),
     _frameHeight(0),
     _transparentColor(TFT_WHITE),
-    _currentAnim(nullptr),
     _currentFrame(0)
 {
   _sheetWidth = _frameWidth * _totalFrames; 
@@ -17,18 +22,19 @@ Sprite::Sprite(TFT_eSPI* tft)
 void Sprite::load(int id) {
   switch (id) {
     case 0: {
+      static const Clip clips[NUM_CLIPS] = {
+        { WARRIOR_IDLE, sizeof(WARRIOR_IDLE), 100, true },
+        { WARRIOR_DEATH, sizeof(WARRIOR_DEATH), 100, false },
+      };
+
       _frames = warrior;
       _totalFrames = 10;
       _frameWidth = 39;
       _frameHeight = 47;
       _sheetWidth = _frameWidth * _totalFrames;
+      _clips = clips;
 
-      uint8_t idle[] = { 0, 1, 2, 3, 4, 5 };
-      addAnimation("idle", idle, 6, 100, true); // looping
-
-      uint8_t death[] = { 6, 7, 8, 9 };
-      addAnimation("death", death, 4, 100, false); // non-looping
-
+      _masks = buildMasks(_frames, _totalFrames, _frameWidth, _frameHeight, _sheetWidth, _transparentColor);
       break;
     }
     default:
@@ -36,63 +42,292 @@ void Sprite::load(int id) {
   }
 }
 
-void Sprite::addAnimation(const String& name, const uint8_t* indices, uint8_t count, uint16_t frameDuration, bool loop) {
-  uint8_t* frameCopy = new uint8_t[count];
-  memcpy(frameCopy, indices, count);
-  Animation anim = { frameCopy, count, 0, frameDuration, millis(), loop };
-  _animations[name] = anim;
+void Sprite::play(ClipId clip, uint16_t speed) {
+  if (!_clips || clip >= NUM_CLIPS) return;
+  _clip = clip;
+  _clipStart = gameClock.now();
+  _speed = speed;
+  _currentFrame = _clips[clip].frames[0];
 }
 
-void Sprite::play(const String& name, bool loop) {
-  auto it = _animations.find(name);
-  if (it != _animations.end()) {
-    _currentAnim = &it->second;
-    _currentAnim->currentFrame = 0;
-    _currentAnim->lastFrameTime = millis();
-    _currentAnim->loop = loop; // Update loop in case it changes dynamically
-    _currentFrame = _currentAnim->frameIndices[0];
+uint8_t Sprite::clipStep(uint32_t now) const {
+  const Clip& clip = _clips[_clip];
+  uint32_t elapsed = (uint32_t)(((uint64_t)(now - _clipStart) * _speed) >> 8);
+  uint32_t step = elapsed / clip.frameMs;
+  if (clip.loop) {
+    return step % clip.frameCount;
   }
+  return step < clip.frameCount ? step : clip.frameCount - 1;
 }
 
 void Sprite::update() {
-  if (_currentAnim) {
-    unsigned long now = millis();
-    if (now - _currentAnim->lastFrameTime >= _currentAnim->frameDuration) {
-      if (_currentAnim->currentFrame < _currentAnim->frameCount - 1) {
-        _currentAnim->currentFrame++;
-      } else if (_currentAnim->loop) {
-        _currentAnim->currentFrame = 0;
-      } else {
-        // Stay on last frame
-      }
-      _currentFrame = _currentAnim->frameIndices[_currentAnim->currentFrame];
-      _currentAnim->lastFrameTime = now;
+  if (!_clips) return;
+  _currentFrame = _clips[_clip].frames[clipStep(gameClock.now())];
+}
+
+uint8_t Sprite::getClipState() const {
+  if (!_clips) return 0;
+  return (_clip << 5) | clipStep(gameClock.now());
+}
+
+void Sprite::setClipState(uint8_t state) {
+  if (!_clips) return;
+  ClipId clip = (ClipId)(state >> 5);
+  uint8_t step = state & (MAX_CLIP_FRAMES - 1);
+  if (clip >= NUM_CLIPS || step >= _clips[clip].frameCount) return;
+
+  uint32_t now = gameClock.now();
+  if (clip == _clip) {
+    int16_t drift = (int16_t)clipStep(now) - step;
+    if (_clips[clip].loop) {
+      //Either way round the loop
+      int16_t count = _clips[clip].frameCount;
+      if (drift > count / 2) drift -= count;
+      if (drift < -count / 2) drift += count;
+    }
+    if (drift >= -1 && drift <= 1) {
+      update();
+      return;
     }
   }
+
+  //Start the clip as far back as the host is into it
+  _clip = clip;
+  _speed = SPEED_NORMAL;
+  _clipStart = now - (uint32_t)step * _clips[clip].frameMs;
+  update();
+}
+
+//16-bit sprites on the device hold each pixel byte-swapped, in the panel's SPI order
+static inline uint16_t toBuffer(uint16_t color) {
+#ifdef ESP_PLATFORM
+  return (color >> 8) | (color << 8);
+#else
+  return color;
+#endif
 }
 
+//Part of a width x height image at (x, y) that lands in a bufferWidth x bufferHeight buffer,
+//in image pixels: columns [x0, x1) and rows [y0, y1). False if none of it does
+static bool clipToBuffer(int16_t bufferWidth, int16_t bufferHeight, int16_t x, int16_t y,
+                         int16_t width, int16_t height, int16_t& x0, int16_t& y0, int16_t& x1, int16_t& y1) {
+  x0 = x < 0 ? -x : 0;
+  y0 = y < 0 ? -y : 0;
+  x1 = x + width > bufferWidth ? bufferWidth - x : width;
+  y1 = y + height > bufferHeight ? bufferHeight - y : height;
+  return x0 < x1 && y0 < y1;
+}
+
+//Clipped once per draw, so only the visible rows and columns are touched
 void Sprite::drawTo(TFT_eSprite& buffer, int16_t x, int16_t y) {
+  if (_masks && _masks->bounds[_currentFrame].x1 < _masks->bounds[_currentFrame].x0) return;   //fully transparent
+
+  int16_t bufferWidth = buffer.width();
+  int16_t bufferHeight = buffer.height();
+  int16_t x0, y0, x1, y1;
+
+  const FrameCache::Frame* frame = cachedFrame();
+  if (frame) {
+    int16_t left = x + frame->x;
+    int16_t top = y + frame->y;
+    if (!clipToBuffer(bufferWidth, bufferHeight, left, top, frame->width, frame->height, x0, y0, x1, y1)) return;
+
+    uint16_t* pixels = (uint16_t*)buffer.getPointer();
+    if (pixels && buffer.getColorDepth() == 16) {
+      for (int16_t py = y0; py < y1; py++) {
+        const uint16_t* from = frame->pixels + (size_t)py * frame->width;
+        uint16_t* to = pixels + (size_t)(top + py) * bufferWidth + left;
+        for (int16_t px = x0; px < x1; px++) {
+          if (from[px] != _transparentColor) {
+            to[px] = toBuffer(from[px]);
+          }
+        }
+      }
+      return;
+    }
+
+    for (int16_t py = y0; py < y1; py++) {
+      const uint16_t* from = frame->pixels + (size_t)py * frame->width;
+      for (int16_t px = x0; px < x1; px++) {
+        if (from[px] != _transparentColor) {
+          buffer.drawPixel(left + px, top + py, from[px]);
+        }
+      }
+    }
+    return;
+  }
+
+  //Too big to cache, straight from the sheet
+  if (!clipToBuffer(bufferWidth, bufferHeight, x, y, _frameWidth, _frameHeight, x0, y0, x1, y1)) return;
+
   uint16_t framesPerRow = _sheetWidth / _frameWidth;
   uint16_t frameX = (_currentFrame % framesPerRow) * _frameWidth;
   uint16_t frameY = (_currentFrame / framesPerRow) * _frameHeight;
 
-  for (uint16_t py = 0; py < _frameHeight; py++) {
-    for (uint16_t px = 0; px < _frameWidth; px++) {
-      uint32_t index = (frameY + py) * _sheetWidth + (frameX + px);
+  for (int16_t py = y0; py < y1; py++) {
+    for (int16_t px = x0; px < x1; px++) {
+      uint16_t sheetX = _mirrored ? _frameWidth - 1 - px : px;
+      uint32_t index = (frameY + py) * _sheetWidth + (frameX + sheetX);
       uint16_t pixel = _frames[index];
       if (pixel != _transparentColor) {
         buffer.drawPixel(x + px, y + py, pixel);
       }
     }
   }
+  frameCache.countFlashRead((uint32_t)(x1 - x0) * (y1 - y0) * sizeof(uint16_t));
 }
 
-uint8_t Sprite::getFrame() { return _currentFrame; }
+const FrameCache::Frame* Sprite::cachedFrame() {
+  if (!_masks) return nullptr;
+  const FrameCache::Frame* cached = frameCache.find(_frames, _currentFrame, _mirrored);
+  if (cached) return cached;
+
+  //Only the opaque box is worth keeping
+  const MaskBounds& b = _masks->bounds[_currentFrame];
+  uint16_t width = b.x1 - b.x0 + 1;
+  uint16_t height = b.y1 - b.y0 + 1;
+  int16_t cropX = _mirrored ? _frameWidth - 1 - b.x1 : b.x0;
+
+  FrameCache::Frame* frame = frameCache.insert(_frames, _currentFrame, _mirrored, cropX, b.y0, width, height);
+  if (!frame) return nullptr;
 
-void Sprite::setFrame(uint8_t frame) {
-  _currentAnim = nullptr;
-  _currentFrame = frame;
+  uint16_t framesPerRow = _sheetWidth / _frameWidth;
+  uint16_t frameX = (_currentFrame % framesPerRow) * _frameWidth;
+  uint16_t frameY = (_currentFrame / framesPerRow) * _frameHeight;
+
+  uint16_t* out = frame->pixels;
+  for (uint16_t py = 0; py < height; py++) {
+    const uint16_t* row = _frames + (uint32_t)(frameY + b.y0 + py) * _sheetWidth + frameX;
+    for (uint16_t px = 0; px < width; px++) {
+      *out++ = _mirrored ? row[b.x1 - px] : row[b.x0 + px];
+    }
+  }
+  frameCache.countFlashRead((uint32_t)width * height * sizeof(uint16_t));
+  return frame;
 }
 
+uint8_t Sprite::getFrame() { return _currentFrame; }
+
 uint16_t Sprite::getFrameWidth() { return _frameWidth; }
 uint16_t Sprite::getFrameHeight() { return _frameHeight; }
+
+const Sprite::FrameMasks* Sprite::buildMasks(const uint16_t* frames, uint8_t totalFrames, uint16_t frameWidth,
+                                             uint16_t frameHeight, uint16_t sheetWidth, uint16_t transparentColor) {
+  auto cached = _maskCache.find(frames);
+  if (cached != _maskCache.end()) {
+    return cached->second;
+  }
+
+  FrameMasks* masks = new FrameMasks();
+  masks->wordsPerRow = (frameWidth + 31) / 32;
+  masks->frameHeight = frameHeight;
+  masks->rows = new uint32_t[(size_t)totalFrames * frameHeight * masks->wordsPerRow]();
+  masks->mirroredRows = new uint32_t[(size_t)totalFrames * frameHeight * masks->wordsPerRow]();
+  masks->bounds = new MaskBounds[totalFrames];
+
+  uint16_t framesPerRow = sheetWidth / frameWidth;
+
+  for (uint8_t f = 0; f < totalFrames; f++) {
+    uint16_t frameX = (f % framesPerRow) * frameWidth;
+    uint16_t frameY = (f / framesPerRow) * frameHeight;
+    MaskBounds& b = masks->bounds[f];
+    b = { (int16_t)frameWidth, (int16_t)frameHeight, -1, -1 };
+
+    for (uint16_t py = 0; py < frameHeight; py++) {
+      size_t rowStart = ((size_t)f * frameHeight + py) * masks->wordsPerRow;
+      uint32_t* row = masks->rows + rowStart;
+      uint32_t* mirroredRow = masks->mirroredRows + rowStart;
+      for (uint16_t px = 0; px < frameWidth; px++) {
+        uint32_t index = (frameY + py) * sheetWidth + (frameX + px);
+        if (frames[index] == transparentColor) continue;
+
+        row[px >> 5] |= 1u << (px & 31);
+        uint16_t mx = frameWidth - 1 - px;
+        mirroredRow[mx >> 5] |= 1u << (mx & 31);
+        if ((int16_t)px < b.x0) b.x0 = px;
+        if ((int16_t)px > b.x1) b.x1 = px;
+        if ((int16_t)py < b.y0) b.y0 = py;
+        if ((int16_t)py > b.y1) b.y1 = py;
+      }
+    }
+  }
+
+  _maskCache[frames] = masks;
+  return masks;
+}
+
+//Returns nullptr for rows outside the frame
+const uint32_t* Sprite::maskRow(uint8_t frame, int16_t row) const {
+  if (row < 0 || row >= (int16_t)_masks->frameHeight) return nullptr;
+  const uint32_t* rows = _mirrored ? _masks->mirroredRows : _masks->rows;
+  return rows + ((size_t)frame * _masks->frameHeight + row) * _masks->wordsPerRow;
+}
+
+Sprite::MaskBounds Sprite::maskBounds(uint8_t frame) const {
+  MaskBounds b = _masks->bounds[frame];
+  if (_mirrored && b.x1 >= b.x0) {
+    int16_t x0 = _frameWidth - 1 - b.x1;
+    b.x1 = _frameWidth - 1 - b.x0;
+    b.x0 = x0;
+  }
+  return b;
+}
+
+//32 mask bits starting at a signed pixel offset; pixels outside the row read as clear
+static uint32_t maskBits(const uint32_t* row, uint16_t words, int16_t offset) {
+  if (!row || offset <= -32) return 0;
+  if (offset < 0) return maskBits(row, words, 0) << (-offset);
+
+  uint16_t word = offset >> 5;
+  uint8_t shift = offset & 31;
+  if (word >= words) return 0;
+
+  uint32_t bits = row[word] >> shift;
+  if (shift && word + 1 < words) {
+    bits |= row[word + 1] << (32 - shift);
+  }
+  return bits;
+}
+
+bool Sprite::overlaps(int16_t x, int16_t y, const Sprite& other, int16_t otherX, int16_t otherY, uint8_t reach) const {
+  if (!_masks || !other._masks) return false;
+
+  MaskBounds a = maskBounds(_currentFrame);
+  MaskBounds b = other.maskBounds(other._currentFrame);
+  if (a.x1 < a.x0 || b.x1 < b.x0) return false;
+
+  //Bounding box rejection in world space, with the other box grown by reach
+  int16_t left   = max(x + a.x0, otherX + b.x0 - reach);
+  int16_t right  = min(x + a.x1, otherX + b.x1 + reach);
+  int16_t top    = max(y + a.y0, otherY + b.y0 - reach);
+  int16_t bottom = min(y + a.y1, otherY + b.y1 + reach);
+  if (left > right || top > bottom) return false;
+
+  uint16_t wordsA = _masks->wordsPerRow;
+  uint16_t wordsB = other._masks->wordsPerRow;
+
+  for (int16_t wy = top; wy <= bottom; wy++) {
+    const uint32_t* rowA = maskRow(_currentFrame, wy - y);
+
+    for (int16_t wx = left; wx <= right; wx += 32) {
+      uint8_t span = min(32, right - wx + 1);
+      uint32_t keep = (span == 32) ? 0xFFFFFFFFu : ((1u << span) - 1);
+
+      uint32_t bitsA = maskBits(rowA, wordsA, wx - x) & keep;
+      if (!bitsA) continue;
+
+      //Dilate the other mask by reach: OR neighbouring rows and shifted columns
+      uint32_t bitsB = 0;
+      for (int16_t dy = -reach; dy <= reach; dy++) {
+        const uint32_t* rowB = other.maskRow(other._currentFrame, wy + dy - otherY);
+        if (!rowB) continue;
+        for (int16_t dx = -reach; dx <= reach; dx++) {
+          bitsB |= maskBits(rowB, wordsB, wx + dx - otherX);
+        }
+      }
+
+      if (bitsA & bitsB) return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,31 @@
+// terrain.cpp
+#include "terrain.h"
+#include <string.h>
+
+uint32_t terrainNoise(int32_t x, int32_t y) {
+    uint32_t h = (uint32_t)x * 0x8DA6B343u ^ (uint32_t)y * 0xD8163841u;
+    h ^= h >> 13;
+    h *= 0x9E3779B1u;
+    return h ^ (h >> 16);
+}
+
+void generateTerrain(int16_t cubeX, int16_t cubeY, uint8_t* packed) {
+    static const uint8_t BASES[] = { TERRAIN_GRASS, TERRAIN_GRASS, TERRAIN_DIRT, TERRAIN_SAND };
+    memset(packed, 0, TERRAIN_BYTES);
+
+    //One ground per cube, with scattered patches of the next
+    uint8_t base = BASES[terrainNoise(cubeX >> 7, cubeY >> 7) % sizeof(BASES)];
+    for (uint8_t i = 0; i < TERRAIN_TILES; i++) {
+        int32_t tileX = (cubeX >> TERRAIN_SHIFT) + i % TERRAIN_TILES_PER_SIDE;
+        int32_t tileY = (cubeY >> TERRAIN_SHIFT) + i / TERRAIN_TILES_PER_SIDE;
+        uint32_t roll = terrainNoise(tileX, tileY) & 0x0F;
+
+        uint8_t tile = base;
+        if (roll == 0) {
+            tile = TERRAIN_STONE;
+        } else if (roll < 3) {
+            tile = base == TERRAIN_GRASS ? TERRAIN_FLOWERS : TERRAIN_GRASS;
+        }
+        packed[i >> 1] |= tile << ((i & 1) * 4);
+    }
+}
@@ -0,0 +1,386 @@
+// transport.cpp
+#include "transport.h"
+#include <string.h>
+#include <algorithm>
+
+#ifdef ESP_PLATFORM
+#include "driver/gpio.h"
+#include "esp_sleep.h"
+#include <Arduino.h>
+
+static const int RX_RING_SIZE = 1024;
+static const int EVENT_QUEUE_LEN = 16;
+static const uint8_t MAX_FACES_PER_UART = 4;
+
+//RX edges that wake the chip from light sleep; noise on an open face rarely makes three
+static const int WAKE_EDGES = 3;
+
+//How long a face sharing a UART listens for a neighbor before the next face gets the pins
+static const uint32_t MUX_SLOT_MS = 20;
+
+//State of one hardware UART, shared by every face wired to it
+struct UartPort {
+    bool installed = false;
+    QueueHandle_t events = nullptr;
+    UartTransport* faces[MAX_FACES_PER_UART] = {};
+    uint8_t faceCount = 0;
+    uint8_t active = 0;
+    uint32_t slotStart = 0;
+
+    void route(UartTransport* face) {
+        uart_set_pin(face->_wiring.uart, face->_wiring.txPin, face->_wiring.rxPin,
+                     UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+        uart_set_baudrate(face->_wiring.uart, face->_baud);
+    }
+
+    //Hands the pins to the next face once the current one has finished sending. Nothing
+    //aligns the slots of two neighbors, so a linked face keeps the UART: rotating away would
+    //drop whatever its neighbor sends in the meantime
+    void rotate(uint32_t now) {
+        if (faceCount < 2 || faces[active]->_linked || (uint32_t)(now - slotStart) < MUX_SLOT_MS) return;
+
+        UartTransport* current = faces[active];
+        uart_port_t uart = current->_wiring.uart;
+        if (current->_txCount > 0 || uart_wait_tx_done(uart, 0) != ESP_OK) return;
+
+        //Park the old TX pin idle-high so the neighbor doesn't see a break
+        gpio_reset_pin((gpio_num_t)current->_wiring.txPin);
+        gpio_set_pull_mode((gpio_num_t)current->_wiring.txPin, GPIO_PULLUP_ONLY);
+
+        active = (active + 1) % faceCount;
+        route(faces[active]);
+
+        //Half-received bytes belong to the old face and would corrupt the new stream
+        uart_flush_input(uart);
+        slotStart = now;
+    }
+};
+
+static UartPort s_ports[UART_NUM_MAX];
+
+UartTransport::UartTransport(const FaceWiring& wiring)
+    : _wiring(wiring), _portFace(0)
+{
+}
+
+bool UartTransport::begin(uint32_t baud) {
+    UartPort& port = s_ports[_wiring.uart];
+    _baud = baud;
+
+    if (!port.installed) {
+        uart_config_t config = {};
+        config.baud_rate = baud;
+        config.data_bits = UART_DATA_8_BITS;
+        config.parity = UART_PARITY_DISABLE;
+        config.stop_bits = UART_STOP_BITS_1;
+        config.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+
+        //No driver TX ring: uart_tx_chars fills the FIFO without blocking
+        if (uart_driver_install(_wiring.uart, RX_RING_SIZE, 0, EVENT_QUEUE_LEN, &port.events, 0) != ESP_OK) {
+            Serial.printf("[UART] Driver install failed on UART%d\n", _wiring.uart);
+            return false;
+        }
+        uart_param_config(_wiring.uart, &config);
+        port.installed = true;
+    }
+
+    if (port.faceCount >= MAX_FACES_PER_UART) return false;
+
+    _portFace = port.faceCount;
+    port.faces[port.faceCount++] = this;
+    if (_portFace == 0) {
+        port.route(this);
+        port.slotStart = millis();
+    }
+    return true;
+}
+
+void UartTransport::setBaud(uint32_t baud) {
+    _baud = baud;
+    if (isActive()) {
+        uart_set_baudrate(_wiring.uart, baud);
+    }
+}
+
+bool UartTransport::isActive() const {
+    const UartPort& port = s_ports[_wiring.uart];
+    return port.faces[port.active] == this;
+}
+
+size_t UartTransport::available() {
+    if (!isActive()) return 0;
+
+    size_t buffered = 0;
+    uart_get_buffered_data_len(_wiring.uart, &buffered);
+    return buffered;
+}
+
+size_t UartTransport::read(uint8_t* dst, size_t maxLen) {
+    if (!isActive()) return 0;
+
+    int n = uart_read_bytes(_wiring.uart, dst, maxLen, 0);
+    if (n <= 0) {
+        _rxReady = false;
+        return 0;
+    }
+
+    _stats.bytesIn += n;
+    _rxReady = available() > 0;
+    return n;
+}
+
+size_t UartTransport::write(const uint8_t* src, size_t len) {
+    size_t n = std::min(len, writable());
+    for (size_t i = 0; i < n; i++) {
+        _txRing[(_txHead + _txCount) % TX_RING_SIZE] = src[i];
+        _txCount++;
+    }
+
+    drainTx();
+    return n;
+}
+
+size_t UartTransport::writable() {
+    return TX_RING_SIZE - _txCount;
+}
+
+bool UartTransport::txIdle() {
+    if (_txCount > 0) return false;
+    return !isActive() || uart_wait_tx_done(_wiring.uart, 0) == ESP_OK;
+}
+
+bool UartTransport::rxReady() {
+    return _rxReady && isActive();
+}
+
+void UartTransport::poll(uint32_t nowMs) {
+    drainTx();
+    if (isActive()) {
+        s_ports[_wiring.uart].rotate(nowMs);
+    }
+}
+
+void UartTransport::drainTx() {
+    if (!isActive()) return;
+
+    while (_txCount > 0) {
+        size_t chunk = std::min(_txCount, TX_RING_SIZE - _txHead);
+        int sent = uart_tx_chars(_wiring.uart, (const char*)&_txRing[_txHead], chunk);
+        if (sent <= 0) break;  //FIFO full
+
+        _txHead = (_txHead + sent) % TX_RING_SIZE;
+        _txCount -= sent;
+        _stats.bytesOut += sent;
+    }
+}
+
+//Only UART0 and UART1 can wake the ESP32, so faces on the others wake on their RX pin going
+//low, i.e. the first start bit
+void UartTransport::enableWakeup() {
+    if (_wiring.uart == UART_NUM_0 || _wiring.uart == UART_NUM_1) {
+        uart_set_wakeup_threshold(_wiring.uart, WAKE_EDGES);
+        esp_sleep_enable_uart_wakeup(_wiring.uart);
+    } else {
+        gpio_wakeup_enable((gpio_num_t)_wiring.rxPin, GPIO_INTR_LOW_LEVEL);
+        esp_sleep_enable_gpio_wakeup();
+    }
+}
+
+QueueHandle_t UartTransport::eventQueue() const {
+    return s_ports[_wiring.uart].events;
+}
+
+void UartTransport::serviceEvent(QueueHandle_t queue) {
+    for (int u = 0; u < UART_NUM_MAX; u++) {
+        UartPort& port = s_ports[u];
+        if (!port.installed || port.events != queue) continue;
+
+        uart_event_t event;
+        if (xQueueReceive(queue, &event, 0) != pdTRUE) return;
+
+        UartTransport* face = port.faces[port.active];
+        switch (event.type) {
+            case UART_DATA:
+                face->_rxReady = true;
+                face->_stats.rxEvents++;
+                break;
+
+            case UART_FIFO_OVF:
+            case UART_BUFFER_FULL:
+                uart_flush_input((uart_port_t)u);
+                face->_stats.overflows++;
+                face->_rxReady = false;
+                break;
+
+            case UART_FRAME_ERR:
+            case UART_PARITY_ERR:
+                face->_stats.lineErrors++;
+                break;
+
+            default:
+                break;
+        }
+        return;
+    }
+}
+
+#endif //ESP_PLATFORM
+
+//A time a is at or before b, allowing for wraparound
+static bool reached(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) <= 0;
+}
+
+MemoryTransport::MemoryTransport(ClockFn clock)
+    : _clock(clock)
+{
+}
+
+void MemoryTransport::connect(MemoryTransport& a, MemoryTransport& b) {
+    a._peer = &b;
+    b._peer = &a;
+}
+
+void MemoryTransport::disconnect(MemoryTransport& a) {
+    if (a._peer) {
+        a._peer->_rx.clear();
+        a._peer->_peer = nullptr;
+    }
+    a._rx.clear();
+    a._peer = nullptr;
+}
+
+bool MemoryTransport::begin(uint32_t baud) {
+    _baud = baud;
+    _lineFreeUs = _clock();
+    return true;
+}
+
+void MemoryTransport::setBaud(uint32_t baud) {
+    _baud = baud;
+}
+
+size_t MemoryTransport::available() {
+    dropWakeByte();
+    uint32_t now = _clock();
+    size_t ready = 0;
+    //Bytes leave one serial line in order, so ready times are monotonic
+    for (const TimedByte& b : _rx) {
+        if (!reached(b.readyUs, now)) break;
+        ready++;
+    }
+    return ready;
+}
+
+size_t MemoryTransport::read(uint8_t* dst, size_t maxLen) {
+    dropWakeByte();
+    uint32_t now = _clock();
+    size_t n = 0;
+
+    while (n < maxLen && !_rx.empty() && reached(_rx.front().readyUs, now)) {
+        const TimedByte& b = _rx.front();
+        uint32_t latency = now - b.sentUs;
+        _stats.latencyUsSum += latency;
+        if (latency > _stats.latencyUsMax) _stats.latencyUsMax = latency;
+
+        dst[n++] = corrupt(b.value, b.baud);
+        _rx.pop_front();
+    }
+
+    _stats.bytesIn += n;
+    if (n > 0) _stats.rxEvents++;
+    return n;
+}
+
+size_t MemoryTransport::write(const uint8_t* src, size_t len) {
+    if (!_peer) return 0;
+
+    uint32_t now = _clock();
+    size_t n = std::min(len, writable());
+
+    //8N1 puts 10 bits on the wire per byte
+    uint32_t byteUs = (_baud > 0) ? (10000000UL + _baud - 1) / _baud : 0;
+    if (reached(_lineFreeUs, now)) _lineFreeUs = now;
+
+    for (size_t i = 0; i < n; i++) {
+        _lineFreeUs += byteUs;
+        _peer->_rx.push_back({ src[i], now, _lineFreeUs, _baud });
+    }
+
+    _stats.bytesOut += n;
+    return n;
+}
+
+size_t MemoryTransport::writable() {
+    size_t pending = inFlight();
+    return (pending >= TX_CAPACITY) ? 0 : TX_CAPACITY - pending;
+}
+
+bool MemoryTransport::txIdle() {
+    return inFlight() == 0;
+}
+
+bool MemoryTransport::rxReady() {
+    if (available() > 0) return true;
+    bool woken = _woken;
+    _woken = false;
+    return woken;
+}
+
+void MemoryTransport::setAsleep(bool asleep) {
+    _asleep = asleep;
+}
+
+void MemoryTransport::dropWakeByte() {
+    if (!_asleep || _rx.empty() || !reached(_rx.front().readyUs, _clock())) return;
+    _rx.pop_front();
+    _stats.wakeDrops++;
+    _asleep = false;
+    _woken = true;
+}
+
+void MemoryTransport::setErrorModel(uint32_t cleanBaud, float berAtDouble, uint32_t seed) {
+    _cleanBaud = cleanBaud;
+    _berAtDouble = berAtDouble;
+    _rng = seed ? seed : 1;
+}
+
+//xorshift32, so a simulation replays the same errors for the same seed
+uint32_t MemoryTransport::nextRandom() {
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 17;
+    _rng ^= _rng << 5;
+    return _rng;
+}
+
+uint8_t MemoryTransport::corrupt(uint8_t value, uint32_t baud) {
+    if (baud != _baud) {
+        _stats.lineErrors++;
+        return nextRandom() & 0xFF;
+    }
+    if (_cleanBaud == 0 || baud <= _cleanBaud) return value;
+
+    float ber = _berAtDouble * ((float)baud / _cleanBaud - 1.0f);
+    if (ber > 0.5f) ber = 0.5f;
+    uint32_t threshold = (uint32_t)(ber * 4294967295.0f);
+
+    uint8_t flipped = value;
+    for (int bit = 0; bit < 8; bit++) {
+        if (nextRandom() < threshold) flipped ^= 1 << bit;
+    }
+    if (flipped != value) _stats.lineErrors++;
+    return flipped;
+}
+
+//Bytes written but still on the wire
+size_t MemoryTransport::inFlight() const {
+    if (!_peer) return 0;
+
+    uint32_t now = _clock();
+    size_t count = 0;
+    for (auto it = _peer->_rx.rbegin(); it != _peer->_rx.rend(); ++it) {
+        if (reached(it->readyUs, now)) break;
+        count++;
+    }
+    return count;
+}
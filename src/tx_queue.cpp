@@ -0,0 +1,160 @@
+// tx_queue.cpp
+#include "tx_queue.h"
+#include <string.h>
+
+//Own packets drop the sid, the batch header already carries it
+size_t TxQueue::recordLen(const Slot& slot, uint8_t mySid) {
+    return originOf(slot.data) == mySid ? slot.len - 1 : slot.len;
+}
+
+bool TxQueue::push(const uint8_t* packet, size_t len, Priority priority, bool supersede) {
+    if (len < PACKET_HEADER_LEN || len > MAX_PACKET) return false;
+
+    Slot* slot = nullptr;
+    bool replaced = false;
+
+    //A newer copy of the same state takes the old one's place in line
+    if (supersede) {
+        uint8_t origin = originOf(packet);
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            Slot& s = _slots[i];
+            if (s.used && s.data[0] == packet[0] && originOf(s.data) == origin) {
+                slot = &s;
+                replaced = true;
+                _stats.superseded++;
+                break;
+            }
+        }
+    }
+
+    if (!slot) {
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            if (!_slots[i].used) {
+                slot = &_slots[i];
+                break;
+            }
+        }
+    }
+
+    //Full: the newest packet of the least important class makes room, if it ranks below this one
+    if (!slot) {
+        for (uint8_t i = 0; i < SLOTS; i++) {
+            Slot& s = _slots[i];
+            if (s.priority <= priority) continue;
+            if (!slot || s.priority > slot->priority || (s.priority == slot->priority && s.order > slot->order)) {
+                slot = &s;
+            }
+        }
+        _stats.dropped++;
+        if (!slot) return false;
+        replaced = true;
+        slot->order = _nextOrder++;
+    }
+
+    if (!replaced) {
+        slot->used = true;
+        slot->order = _nextOrder++;
+        _count++;
+        if (_count > _stats.highWater) _stats.highWater = _count;
+    }
+
+    slot->priority = priority;
+    slot->len = len;
+    memcpy(slot->data, packet, len);
+    _stats.queued++;
+    return true;
+}
+
+TxQueue::Priority TxQueue::nextPriority() const {
+    bool taken[SLOTS] = {};
+    int8_t next = nextSlot(taken);
+    return next < 0 ? PRIO_BULK : _slots[next].priority;
+}
+
+//Most important, then oldest, packet not yet taken
+int8_t TxQueue::nextSlot(const bool* taken) const {
+    int8_t best = -1;
+    for (uint8_t i = 0; i < SLOTS; i++) {
+        const Slot& s = _slots[i];
+        if (!s.used || taken[i]) continue;
+        if (best < 0 || s.priority < _slots[best].priority ||
+            (s.priority == _slots[best].priority && (int32_t)(s.order - _slots[best].order) < 0)) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+size_t TxQueue::nextFrame(uint8_t* out, size_t maxBytes, uint8_t mySid) {
+    if (_count == 0) return 0;
+
+    bool taken[SLOTS] = {};
+    int8_t picked[SLOTS];
+    uint8_t numPicked = 0;
+
+    //Strict priority: if the head doesn't fit, nothing behind it jumps the line
+    int8_t head = nextSlot(taken);
+    if (_slots[head].len > maxBytes) return 0;
+    taken[head] = true;
+    picked[numPicked++] = head;
+
+    //Fill one batch with whatever else fits, still in priority order
+    size_t limit = maxBytes < MAX_PACKET ? maxBytes : MAX_PACKET;
+    size_t batchLen = PACKET_HEADER_LEN + recordLen(_slots[head], mySid);
+    if (batchLen <= limit) {
+        int8_t next;
+        while ((next = nextSlot(taken)) >= 0) {
+            taken[next] = true;
+            size_t rec = recordLen(_slots[next], mySid);
+            if (batchLen + rec > limit) continue;
+            picked[numPicked++] = next;
+            batchLen += rec;
+        }
+    }
+
+    size_t frameLen;
+    if (numPicked == 1) {
+        //A lone packet goes out as is
+        frameLen = _slots[head].len;
+        memcpy(out, _slots[head].data, frameLen);
+    } else {
+        //Link-local, so the receiver neither dedups nor forwards it and the seq stays 0
+        out[0] = PACKET_BATCH;
+        out[1] = batchLen - PACKET_HEADER_LEN;
+        out[2] = mySid;
+        out[3] = 0;
+        out[4] = 0;
+
+        frameLen = PACKET_HEADER_LEN;
+        for (uint8_t i = 0; i < numPicked; i++) {
+            const Slot& s = _slots[picked[i]];
+            if (originOf(s.data) == mySid) {
+                out[frameLen] = s.data[0] | BATCH_SHORT_RECORD;
+                out[frameLen + 1] = s.data[1];
+                memcpy(out + frameLen + 2, s.data + 3, s.len - 3);
+                frameLen += s.len - 1;
+            } else {
+                memcpy(out + frameLen, s.data, s.len);
+                frameLen += s.len;
+            }
+        }
+        _stats.coalesced += numPicked;
+    }
+
+    for (uint8_t i = 0; i < numPicked; i++) {
+        _slots[picked[i]].used = false;
+    }
+    _count -= numPicked;
+
+    _stats.frames++;
+    _stats.messages += numPicked;
+    _stats.bytesSent += frameLen;
+    return frameLen;
+}
+
+void TxQueue::clear() {
+    for (uint8_t i = 0; i < SLOTS; i++) {
+        _slots[i].used = false;
+    }
+    _count = 0;
+}
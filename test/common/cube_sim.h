@@ -0,0 +1,135 @@
+// cube_sim.h
+//
+// Several cubes in one process for the native tests. Each SimCube is a Battle on its own panel
+// with MemoryTransport faces. The firmware keeps gameClock, gameRandom and sessionRecorder as
+// globals, so every cube keeps its own set and swaps it in around each call into the cube. A CubeSim ticks the
+// powered cubes in turn on the virtual clock of host.h, a little unevenly as on real hardware.
+
+#ifndef CUBE_SIM_H
+#define CUBE_SIM_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "host.h"
+#include "battle.h"
+#include "game_clock.h"
+#include "game_random.h"
+#include "session_recorder.h"
+#include "transport.h"
+
+static uint32_t simClockUs() {
+    return (uint32_t)hostTimeUs();
+}
+
+class SimCube {
+public:
+    explicit SimCube(DeviceId id) : panel(128, 128), battle(&panel, 128, 128), _id(id) {
+        for (int i = 0; i < NUM_SIDES; i++) {
+            faces[i].reset(new MemoryTransport(simClockUs));
+        }
+    }
+
+    //Calls body with this cube's globals in place
+    template <typename F>
+    void run(F body) {
+        swapGlobals();
+        body();
+        swapGlobals();
+    }
+
+    void start(uint32_t seed, uint32_t nowMs, size_t recordBytes = 0) {
+        Transport* links[NUM_SIDES];
+        for (int i = 0; i < NUM_SIDES; i++) links[i] = faces[i].get();
+        run([&]() { battle.initReplay(seed, _id, nowMs, links, recordBytes); });
+    }
+
+    void update(uint32_t nowMs) {
+        run([&]() { battle.update(nowMs); });
+    }
+
+    uint32_t mac() { return battle.getMyMac(); }
+    uint32_t host() { return battle.getComms().getHostMac(); }
+    const Map& map() { return battle.getMap(); }
+    //This cube's recording, if it was started with one
+    const SessionRecorder& recorder() const { return _recorder; }
+
+    TFT_eSPI panel;
+    Battle battle;
+    std::unique_ptr<MemoryTransport> faces[NUM_SIDES];
+    //An unpowered cube is skipped by CubeSim::tick(), as if pulled out of the mesh
+    bool powered = true;
+
+private:
+    DeviceId _id;
+    GameClock _clock;
+    GameRandom _random;
+    SessionRecorder _recorder;
+
+    void swapGlobals() {
+        std::swap(gameClock, _clock);
+        std::swap(gameRandom, _random);
+        sessionRecorder.swap(_recorder);
+    }
+};
+
+class CubeSim {
+public:
+    static const uint32_t START_MS = 1000;
+
+    //Cubes with these device ids, started at START_MS, in no particular place yet. The first
+    //records its session into recordBytes, if any
+    explicit CubeSim(const std::vector<DeviceId>& ids, size_t recordBytes = 0) {
+        hostSetTimeUs((uint64_t)START_MS * 1000);
+        for (size_t i = 0; i < ids.size(); i++) {
+            cubes.push_back(std::unique_ptr<SimCube>(new SimCube(ids[i])));
+        }
+        for (size_t i = 0; i < cubes.size(); i++) {
+            cubes[i]->start(0xC0BE0000u + (uint32_t)i, START_MS, i == 0 ? recordBytes : 0);
+        }
+    }
+
+    //Face a of cube i against face b of cube j
+    void plug(size_t i, int a, size_t j, int b) {
+        MemoryTransport::connect(*cubes[i]->faces[a], *cubes[j]->faces[b]);
+    }
+
+    //Pulls whatever is on face a of cube i away from it
+    void unplug(size_t i, int a) {
+        MemoryTransport::disconnect(*cubes[i]->faces[a]);
+    }
+
+    //One tick of every powered cube, 10 to 16 ms after the last
+    void tick() {
+        hostAdvanceUs((10 + _ticks % 7) * 1000);
+        _ticks++;
+        uint32_t now = (uint32_t)(hostTimeUs() / 1000);
+        for (size_t i = 0; i < cubes.size(); i++) {
+            if (cubes[i]->powered) cubes[i]->update(now);
+        }
+    }
+
+    void runFor(uint32_t ms) {
+        uint64_t until = hostTimeUs() + (uint64_t)ms * 1000;
+        while (hostTimeUs() < until) tick();
+    }
+
+    //Ticks until done() holds or ms have passed. The virtual time it took, or -1
+    template <typename F>
+    int32_t runUntil(uint32_t ms, F done) {
+        uint64_t start = hostTimeUs();
+        while (hostTimeUs() - start < (uint64_t)ms * 1000) {
+            tick();
+            if (done()) return (int32_t)((hostTimeUs() - start) / 1000);
+        }
+        return -1;
+    }
+
+    std::vector<std::unique_ptr<SimCube> > cubes;
+
+private:
+    uint32_t _ticks = 0;
+};
+
+#endif //CUBE_SIM_H
@@ -0,0 +1,95 @@
+// test_bench.cpp
+//
+// Runs the benchmark suite of bench.h on the host clock and checks its report. With BENCH_OUT
+// set, the serial output goes to that file too, for tools/bench_compare.py:
+//
+//     BENCH_OUT=bench.txt pio test -e native -f test_bench
+//     python tools/bench_compare.py base.txt bench.txt
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "host.h"
+#include "bench.h"
+
+static const char* BEGIN = "[BENCH] BEGIN";
+static const char* END = "[BENCH] END";
+
+//One of each case, at its largest size
+static const char* EXPECTED[] = {
+    "BM_SpriteDrawTo/32",
+    "BM_DisplayDraw/32/16",
+    "BM_FindNearestEnemy/32",
+    "BM_FindEnemiesInRange/32",
+    "BM_SendCommands/32",
+    "BM_ProcessCommands/32",
+    "BM_MapIsCharacterInWorld/16",
+    "BM_MapIsRectInWorld/16",
+    "BM_CrowdSeparation/512",
+    "BM_CommsParseCommands/32",
+};
+
+static std::string report;
+
+static size_t count(const std::string& text, const std::string& what) {
+    size_t n = 0;
+    for (size_t pos = text.find(what); pos != std::string::npos; pos = text.find(what, pos + 1)) {
+        n++;
+    }
+    return n;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_report_is_complete(void) {
+    size_t begin = report.find(BEGIN);
+    size_t end = report.find(END);
+    TEST_ASSERT_NOT_EQUAL(std::string::npos, begin);
+    TEST_ASSERT_NOT_EQUAL(std::string::npos, end);
+    TEST_ASSERT_LESS_THAN(end, begin);
+
+    std::string json = report.substr(begin, end - begin);
+    for (size_t i = 0; i < sizeof(EXPECTED) / sizeof(EXPECTED[0]); i++) {
+        std::string name = std::string("\"name\": \"") + EXPECTED[i] + "\"";
+        TEST_ASSERT_EQUAL_UINT_MESSAGE(1, count(json, name), EXPECTED[i]);
+    }
+    TEST_ASSERT_EQUAL_UINT(count(json, "\"name\""), count(json, "\"real_time\""));
+}
+
+//Every case ran to its minimum time, or to the iteration cap
+void test_cases_ran(void) {
+    const std::string key = "\"iterations\": ";
+    size_t cases = 0;
+    for (size_t pos = report.find(key); pos != std::string::npos; pos = report.find(key, pos + 1)) {
+        unsigned long iterations = strtoul(report.c_str() + pos + key.size(), nullptr, 10);
+        TEST_ASSERT_GREATER_THAN(0, iterations);
+        TEST_ASSERT_LESS_OR_EQUAL(Benchmarks::MAX_ITERATIONS, iterations);
+        cases++;
+    }
+    TEST_ASSERT_GREATER_THAN(0, cases);
+}
+
+int main(int argc, char** argv) {
+    TFT_eSPI tft(128, 128);
+    hostUseRealTime(true);
+    hostClearSerial();
+    Benchmarks(&tft).run();
+    hostUseRealTime(false);
+    report = hostSerialOutput();
+
+    const char* out = getenv("BENCH_OUT");
+    if (out) {
+        FILE* f = fopen(out, "wb");
+        if (f) {
+            fwrite(report.data(), 1, report.size(), f);
+            fclose(f);
+        }
+    }
+
+    UNITY_BEGIN();
+    RUN_TEST(test_report_is_complete);
+    RUN_TEST(test_cases_ran);
+    return UNITY_END();
+}
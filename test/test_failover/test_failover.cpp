@@ -0,0 +1,166 @@
+// test_failover.cpp
+//
+// Cubes in a row elect the highest MAC as host. Pulling the host out must leave every cube
+// that can still reach another agreeing on a new host within HOST_LOST_MS and a few ticks,
+// placed where it was, with its pet alive. A host that was only cut off and comes back must
+// win again without anyone dropping it.
+
+#include <unity.h>
+#include "cube_sim.h"
+#include "identity.h"
+
+//Faces as Map places them, see sideOffsetsX in map.cpp
+static const int RIGHT = 0;
+static const int LEFT = 2;
+
+//Heartbeats, then a full sync, with plenty of margin
+static const uint32_t SETTLE_MS = 4000;
+//The beat stops for HOST_LOST_MS, then the new view needs a few ticks to spread
+static const uint32_t FAILOVER_MS = HostElection::HOST_LOST_MS + 100;
+
+//Three device ids, lowest key first, so the last one hosts
+static std::vector<DeviceId> rankedIds() {
+    std::vector<DeviceId> ids = { 0x240AC4000101ULL, 0x240AC4000202ULL, 0x240AC4000303ULL };
+    std::sort(ids.begin(), ids.end(), [](DeviceId a, DeviceId b) {
+        return IdentityTable::keyFor(a) < IdentityTable::keyFor(b);
+    });
+    return ids;
+}
+
+//Cubes left to right in the order given
+static void plugRow(CubeSim& sim, const std::vector<size_t>& order) {
+    for (size_t i = 0; i + 1 < order.size(); i++) {
+        sim.plug(order[i], RIGHT, order[i + 1], LEFT);
+    }
+}
+
+static bool agreeOn(CubeSim& sim, const std::vector<size_t>& cubes, uint32_t host) {
+    for (size_t i : cubes) {
+        if (sim.cubes[i]->host() != host) return false;
+        if (sim.cubes[i]->battle.getComms().getRole() != (sim.cubes[i]->mac() == host ? ROLE_HOST : ROLE_CLIENT)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//A cube with no neighbors has no role and no host
+static bool alone(CubeSim& sim, size_t i) {
+    return sim.cubes[i]->host() == 0 && sim.cubes[i]->battle.getComms().getRole() == ROLE_UNASSIGNED;
+}
+
+//Every cube in cubes knows every other one, one screen apart in the order given, and its pet
+static void assertPlaced(CubeSim& sim, const std::vector<size_t>& cubes) {
+    for (size_t viewer : cubes) {
+        SimCube& cube = *sim.cubes[viewer];
+        const Cube* first = cube.map().getCubeInfo(sim.cubes[cubes[0]]->mac());
+        TEST_ASSERT_NOT_NULL(first);
+        for (size_t k = 0; k < cubes.size(); k++) {
+            uint32_t mac = sim.cubes[cubes[k]]->mac();
+            const Cube* info = cube.map().getCubeInfo(mac);
+            TEST_ASSERT_NOT_NULL_MESSAGE(info, "cube missing from a map");
+            TEST_ASSERT_EQUAL_INT(first->x + 128 * (int)k, info->x);
+            TEST_ASSERT_EQUAL_INT(first->y, info->y);
+
+            Character* pet = cube.battle.findCharacterByMac(mac);
+            TEST_ASSERT_NOT_NULL_MESSAGE(pet, "pet missing");
+            TEST_ASSERT_TRUE(pet->isAlive());
+        }
+    }
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_row_elects_highest_mac(void) {
+    CubeSim sim(rankedIds());
+    plugRow(sim, { 0, 1, 2 });
+    int32_t took = sim.runUntil(SETTLE_MS, [&]() { return agreeOn(sim, { 0, 1, 2 }, sim.cubes[2]->mac()); });
+    TEST_ASSERT_GREATER_OR_EQUAL(0, took);
+
+    sim.runFor(SETTLE_MS);
+    assertPlaced(sim, { 0, 1, 2 });
+}
+
+//The host at the end of the row goes: the other two carry on under the higher of them
+void test_host_pulled_from_end(void) {
+    CubeSim sim(rankedIds());
+    plugRow(sim, { 0, 1, 2 });
+    sim.runFor(SETTLE_MS);
+    TEST_ASSERT_TRUE(agreeOn(sim, { 0, 1, 2 }, sim.cubes[2]->mac()));
+
+    uint32_t lost = sim.cubes[2]->mac();
+    sim.cubes[2]->powered = false;
+    int32_t took = sim.runUntil(FAILOVER_MS, [&]() { return agreeOn(sim, { 0, 1 }, sim.cubes[1]->mac()); });
+    TEST_ASSERT_GREATER_OR_EQUAL(0, took);
+    for (size_t i = 0; i < 2; i++) {
+        uint32_t failoverMs = sim.cubes[i]->battle.getComms().getElectionStats().failoverMs;
+        TEST_ASSERT_GREATER_THAN(0, failoverMs);
+        TEST_ASSERT_LESS_OR_EQUAL(FAILOVER_MS, failoverMs);
+    }
+
+    sim.runFor(SETTLE_MS);
+    TEST_ASSERT_TRUE(agreeOn(sim, { 0, 1 }, sim.cubes[1]->mac()));
+    assertPlaced(sim, { 0, 1 });
+    for (size_t i = 0; i < 2; i++) {
+        TEST_ASSERT_NULL(sim.cubes[i]->map().getCubeInfo(lost));
+        TEST_ASSERT_NULL(sim.cubes[i]->battle.findCharacterByMac(lost));
+    }
+}
+
+//The host in the middle of the row goes: each end is left on its own, hosting nobody
+void test_host_pulled_from_middle(void) {
+    CubeSim sim(rankedIds());
+    plugRow(sim, { 0, 2, 1 });
+    sim.runFor(SETTLE_MS);
+    TEST_ASSERT_TRUE(agreeOn(sim, { 0, 1, 2 }, sim.cubes[2]->mac()));
+
+    uint32_t lost = sim.cubes[2]->mac();
+    sim.cubes[2]->powered = false;
+    int32_t took = sim.runUntil(FAILOVER_MS, [&]() { return alone(sim, 0) && alone(sim, 1); });
+    TEST_ASSERT_GREATER_OR_EQUAL(0, took);
+
+    sim.runFor(SETTLE_MS);
+    for (size_t i = 0; i < 2; i++) {
+        TEST_ASSERT_TRUE(alone(sim, i));
+        assertPlaced(sim, { i });
+        TEST_ASSERT_NULL(sim.cubes[i]->map().getCubeInfo(lost));
+        TEST_ASSERT_NULL(sim.cubes[i]->battle.findCharacterByMac(lost));
+    }
+}
+
+//The host at the end of the row is cut off while it keeps running, so the other two fail over
+//to a new epoch naming it lost. Plugged back in, it wins that epoch and nobody may drop it
+void test_host_replugged(void) {
+    CubeSim sim(rankedIds());
+    plugRow(sim, { 0, 1, 2 });
+    sim.runFor(SETTLE_MS);
+    uint32_t host = sim.cubes[2]->mac();
+    TEST_ASSERT_TRUE(agreeOn(sim, { 0, 1, 2 }, host));
+
+    sim.unplug(2, LEFT);
+    int32_t took = sim.runUntil(FAILOVER_MS, [&]() { return agreeOn(sim, { 0, 1 }, sim.cubes[1]->mac()); });
+    TEST_ASSERT_GREATER_OR_EQUAL(0, took);
+    sim.runFor(SETTLE_MS);
+
+    plugRow(sim, { 0, 1, 2 });
+    took = sim.runUntil(SETTLE_MS, [&]() { return agreeOn(sim, { 0, 1, 2 }, host); });
+    TEST_ASSERT_GREATER_OR_EQUAL(0, took);
+
+    //Settled for good, not flapping through epochs
+    sim.runFor(SETTLE_MS);
+    uint16_t elections = sim.cubes[0]->battle.getComms().getElectionStats().elections;
+    sim.runFor(SETTLE_MS);
+    TEST_ASSERT_TRUE(agreeOn(sim, { 0, 1, 2 }, host));
+    TEST_ASSERT_EQUAL_UINT16(elections, sim.cubes[0]->battle.getComms().getElectionStats().elections);
+    assertPlaced(sim, { 0, 1, 2 });
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_row_elects_highest_mac);
+    RUN_TEST(test_host_pulled_from_end);
+    RUN_TEST(test_host_pulled_from_middle);
+    RUN_TEST(test_host_replugged);
+    return UNITY_END();
+}
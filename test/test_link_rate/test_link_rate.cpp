@@ -0,0 +1,147 @@
+// test_link_rate.cpp
+//
+// Two cubes on one face with MemoryTransport's error model on both ends. On a line that's
+// clean up to 1843200 baud the negotiation must climb there, fail the probe above it and stay.
+// Once the line only holds 921600, the errors at 1843200 must step the face down to 921600
+// and keep it there, with both ends agreeing on the rate throughout. The stand-in's byte and
+// latency counters, what per-face throughput is measured with, must add up at any rate.
+
+#include <unity.h>
+#include "cube_sim.h"
+
+static const int RIGHT = 0;
+static const int LEFT = 2;
+
+static const uint32_t BASE_BAUD = 115200;
+static const uint32_t GOOD_BAUD = 1843200;
+static const uint32_t DEGRADED_BAUD = 921600;
+//Bit error rates at twice the clean rate. Above a good line nothing gets through, so the
+//probe fails; on a degraded one about a frame in four is hit, too few to
+//silence the link, so it's the error windows that notice
+static const float NOISE_BER = 0.5f;
+static const float DEGRADED_BER = 0.002f;
+
+//Heartbeats, then four steps of the ladder and the failed fifth, with margin
+static const uint32_t CLIMB_MS = 5000;
+//Two bad one-second error windows in a row, the first maybe started just before, then the
+//DOWNSHIFT
+static const uint32_t FALLBACK_MS = 3500;
+
+static void setCleanBaud(CubeSim& sim, uint32_t cleanBaud, float ber, uint32_t seed) {
+    sim.cubes[0]->faces[RIGHT]->setErrorModel(cleanBaud, ber, seed);
+    sim.cubes[1]->faces[LEFT]->setErrorModel(cleanBaud, ber, seed + 1);
+}
+
+static bool bothAt(CubeSim& sim, uint32_t baud) {
+    return sim.cubes[0]->battle.getComms().getLinkBaud(RIGHT) == baud &&
+           sim.cubes[1]->battle.getComms().getLinkBaud(LEFT) == baud;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_climbs_then_falls_back(void) {
+    CubeSim sim({ 0x240AC4000101ULL, 0x240AC4000202ULL });
+    setCleanBaud(sim, GOOD_BAUD, NOISE_BER, 7);
+    sim.plug(0, RIGHT, 1, LEFT);
+    TEST_ASSERT_TRUE(bothAt(sim, BASE_BAUD));
+
+    int32_t took = sim.runUntil(CLIMB_MS, [&]() { return bothAt(sim, GOOD_BAUD); });
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(0, took, "never climbed to the clean rate");
+
+    //The step above fails its probe and caps the ladder, so the face stays put, connected
+    //through the silence of the failed probe
+    sim.runFor(CLIMB_MS);
+    TEST_ASSERT_TRUE(bothAt(sim, GOOD_BAUD));
+    TEST_ASSERT_EQUAL_UINT32(0, sim.cubes[0]->battle.getComms().getTelemetry(RIGHT).timeouts);
+    TEST_ASSERT_EQUAL_UINT32(0, sim.cubes[1]->battle.getComms().getTelemetry(LEFT).timeouts);
+    const LinkRate::Stats* rates[2] = {
+        &sim.cubes[0]->battle.getComms().getLinkRateStats(RIGHT),
+        &sim.cubes[1]->battle.getComms().getLinkRateStats(LEFT),
+    };
+    for (const LinkRate::Stats* rate : rates) {
+        TEST_ASSERT_EQUAL_UINT32(4, rate->upgrades);
+        TEST_ASSERT_EQUAL_UINT32(1, rate->failedProbes);
+        TEST_ASSERT_EQUAL_UINT32(0, rate->fallbacks);
+    }
+
+    //The line degrades
+    setCleanBaud(sim, DEGRADED_BAUD, DEGRADED_BER, 11);
+    took = sim.runUntil(FALLBACK_MS, [&]() { return bothAt(sim, DEGRADED_BAUD); });
+    TEST_ASSERT_GREATER_OR_EQUAL_MESSAGE(0, took, "never fell back");
+    TEST_ASSERT_GREATER_THAN_UINT32(0, rates[0]->fallbacks + rates[1]->fallbacks);
+
+    //Clean again at the lower rate, and the ladder stays capped below the rate that failed
+    sim.runFor(CLIMB_MS);
+    TEST_ASSERT_TRUE(bothAt(sim, DEGRADED_BAUD));
+    TEST_ASSERT_EQUAL_UINT32(0, sim.cubes[0]->battle.getComms().getTelemetry(RIGHT).timeouts);
+    TEST_ASSERT_EQUAL_UINT32(0, sim.cubes[1]->battle.getComms().getTelemetry(LEFT).timeouts);
+}
+
+//A burst at the base rate, read as each byte lands: byte k waits k + 1 byte times
+void test_stand_in_times_bytes_at_the_baud(void) {
+    hostSetTimeUs(1000000);
+    MemoryTransport a(simClockUs), b(simClockUs);
+    MemoryTransport::connect(a, b);
+    a.begin(BASE_BAUD);
+    b.begin(BASE_BAUD);
+
+    const uint32_t COUNT = 100;
+    const uint32_t byteUs = (10000000UL + BASE_BAUD - 1) / BASE_BAUD;
+    uint8_t burst[COUNT];
+    for (uint32_t i = 0; i < COUNT; i++) burst[i] = (uint8_t)i;
+    TEST_ASSERT_EQUAL_UINT32(COUNT, a.write(burst, COUNT));
+
+    uint8_t got[COUNT];
+    uint32_t n = 0;
+    for (uint32_t k = 0; k < COUNT; k++) {
+        hostAdvanceUs(byteUs);
+        TEST_ASSERT_EQUAL_UINT32(1, b.read(got + n, COUNT - n));
+        n++;
+    }
+    TEST_ASSERT_EQUAL_MEMORY(burst, got, COUNT);
+    TEST_ASSERT_TRUE(a.txIdle());
+
+    const TransportStats& out = a.getStats();
+    const TransportStats& in = b.getStats();
+    TEST_ASSERT_EQUAL_UINT32(COUNT, out.bytesOut);
+    TEST_ASSERT_EQUAL_UINT32(COUNT, in.bytesIn);
+    TEST_ASSERT_EQUAL_UINT32(COUNT, in.rxEvents);
+    TEST_ASSERT_EQUAL_UINT32(COUNT * byteUs, in.latencyUsMax);
+    TEST_ASSERT_EQUAL_UINT32(byteUs * COUNT * (COUNT + 1) / 2, in.latencyUsSum);
+    TEST_ASSERT_EQUAL_UINT32(0, in.lineErrors);
+}
+
+//Two cubes on a clean face, climbing the whole ladder. Bytes straddling a switch arrive
+//garbled but still arrive: every byte one end sends the other reads, none faster than the
+//wire allows and none later than a full TX buffer at the base rate plus a tick
+void test_face_stats_add_up(void) {
+    CubeSim sim({ 0x240AC4000101ULL, 0x240AC4000202ULL });
+    sim.plug(0, RIGHT, 1, LEFT);
+    sim.runFor(CLIMB_MS);
+
+    MemoryTransport* ends[2] = { sim.cubes[0]->faces[RIGHT].get(), sim.cubes[1]->faces[LEFT].get() };
+    const uint32_t maxLatencyUs = MemoryTransport::TX_CAPACITY * 10000000UL / BASE_BAUD + 16000;
+    for (int e = 0; e < 2; e++) {
+        const TransportStats& in = ends[e]->getStats();
+        const TransportStats& out = ends[1 - e]->getStats();
+        TEST_ASSERT_GREATER_THAN_UINT32(0, in.bytesIn);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(out.bytesOut, in.bytesIn);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(MemoryTransport::TX_CAPACITY, out.bytesOut - in.bytesIn);
+        TEST_ASSERT_GREATER_THAN_UINT32(0, in.rxEvents);
+
+        //At least one byte time at the top of the ladder, on average and at worst
+        uint32_t fastestByteUs = 10000000UL / (BASE_BAUD << LinkRate::MAX_STEP);
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(fastestByteUs, in.latencyUsSum / in.bytesIn);
+        TEST_ASSERT_GREATER_OR_EQUAL_UINT32(in.latencyUsSum / in.bytesIn, in.latencyUsMax);
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32(maxLatencyUs, in.latencyUsMax);
+    }
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_climbs_then_falls_back);
+    RUN_TEST(test_stand_in_times_bytes_at_the_baud);
+    RUN_TEST(test_face_stats_add_up);
+    return UNITY_END();
+}
@@ -0,0 +1,125 @@
+// test_power.cpp
+//
+// A cube on its own light-sleeps between ticks. Plugging a neighbor in must wake it within a
+// millisecond of the first byte landing, the tick after the wake must start straight away,
+// and the cube must stay up until the neighbor's heartbeat connects the face. Runs the
+// PowerManager on the virtual clock of host.h, where waiting is what moves time on.
+
+#include <unity.h>
+#include "cube_sim.h"
+#include "power.h"
+
+static const int RIGHT = 0;
+static const int LEFT = 2;
+
+//Alone long enough for the first sleeps to settle, and half a heartbeat out of phase with a
+//neighbor switched on then, so its beats don't land while our own keep us dozing
+static const uint32_t ALONE_MS = 2 * HEARTBEAT_INTERVAL_MS + HEARTBEAT_INTERVAL_MS / 2;
+//waitForRx() looks at the faces once per virtual millisecond
+static const uint64_t WAKE_STEP_US = 1000;
+//One byte at the 115200 baud every link starts at, start and stop bits included
+static const uint32_t BYTE_US = 10 * 1000000UL / 115200;
+//What the cube dozes through after a wake, as WAKE_HOLD_US in power.cpp
+static const uint64_t WAKE_HOLD_US = (HEARTBEAT_INTERVAL_MS + 2 * POWER_TICK_MS) * 1000ULL;
+
+struct PowerRig {
+    CubeSim sim;
+    PowerManager pm;
+    std::unique_ptr<SimCube> neighbor;
+    uint64_t nextNeighborUs = 0;
+    uint64_t neighborSentAt = 0;   //the neighbor's tick that wrote its first byte
+
+    PowerRig() : sim({ 0x240AC4000101ULL }), pm(simClockUs) {
+        SimCube& cube = *sim.cubes[0];
+        cube.run([&]() { pm.begin(); });
+    }
+
+    //Switches a second cube on with its left face against our right one
+    void plugNeighbor() {
+        neighbor.reset(new SimCube(0x240AC4000202ULL));
+        neighbor->start(0xC0BE0001u, (uint32_t)(hostTimeUs() / 1000));
+        MemoryTransport::connect(*neighbor->faces[LEFT], *sim.cubes[0]->faces[RIGHT]);
+        nextNeighborUs = hostTimeUs();
+    }
+
+    //One pass of loop() on our cube: a tick, then the idle that follows it. The neighbor
+    //ticks every POWER_TICK_MS on its own in between
+    void step() {
+        while (neighbor && hostTimeUs() >= nextNeighborUs) {
+            neighbor->update((uint32_t)(hostTimeUs() / 1000));
+            if (!neighborSentAt && neighbor->faces[LEFT]->getStats().bytesOut > 0) neighborSentAt = hostTimeUs();
+            nextNeighborUs += POWER_TICK_MS * 1000;
+        }
+        SimCube& cube = *sim.cubes[0];
+        cube.update((uint32_t)(hostTimeUs() / 1000));
+        cube.run([&]() { pm.idle(cube.battle); });
+    }
+};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_lone_cube_sleeps(void) {
+    PowerRig rig;
+    uint64_t until = hostTimeUs() + ALONE_MS * 1000ULL;
+    while (hostTimeUs() < until) rig.step();
+
+    const PowerManager::Stats& stats = rig.pm.getStats();
+    TEST_ASSERT_EQUAL_INT(PowerManager::POWER_SLEEP, rig.pm.getMode());
+    TEST_ASSERT_GREATER_THAN_UINT32(0, stats.sleeps);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.rxWakes);
+    //Ticks take no virtual time, so the whole run was billed as sleep
+    TEST_ASSERT_LESS_THAN_UINT32(POWER_DOZE_UA, rig.pm.estimatedUa());
+}
+
+void test_neighbor_wakes_sleeping_cube(void) {
+    PowerRig rig;
+    uint64_t until = hostTimeUs() + ALONE_MS * 1000ULL;
+    while (hostTimeUs() < until) rig.step();
+    TEST_ASSERT_EQUAL_INT(PowerManager::POWER_SLEEP, rig.pm.getMode());
+
+    rig.plugNeighbor();
+
+    //Whatever the neighbor sends first is the byte that wakes us. A step ends as the wait in
+    //it does, so that's when we woke
+    uint64_t wokeAt = 0;
+    until = hostTimeUs() + 2 * HEARTBEAT_INTERVAL_MS * 1000ULL;
+    while (!wokeAt && hostTimeUs() < until) {
+        rig.step();
+        if (rig.pm.getStats().rxWakes > 0) wokeAt = hostTimeUs();
+    }
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(0, rig.neighborSentAt, "neighbor never sent");
+    TEST_ASSERT_NOT_EQUAL_MESSAGE(0, wokeAt, "cube never woke");
+
+    const PowerManager::Stats& stats = rig.pm.getStats();
+    TEST_ASSERT_EQUAL_UINT32(1, rig.sim.cubes[0]->faces[RIGHT]->getStats().wakeDrops);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.rxWakes);
+    //Asleep the whole time the byte was on the wire, and up within a step of it landing
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(BYTE_US, (uint32_t)(wokeAt - rig.neighborSentAt));
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(BYTE_US + WAKE_STEP_US, (uint32_t)(wokeAt - rig.neighborSentAt));
+
+    //The tick after the wake reads the faces straight away
+    rig.step();
+    TEST_ASSERT_LESS_OR_EQUAL_UINT32(WAKE_STEP_US, stats.wakeLatencyUsMax);
+
+    //Dozing, not sleeping, until the next heartbeat connects the face
+    while (!rig.sim.cubes[0]->battle.getComms().hasNeighbors()) {
+        TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE((uint32_t)WAKE_HOLD_US, (uint32_t)(hostTimeUs() - wokeAt),
+                                                 "face did not connect before the wake hold ran out");
+        TEST_ASSERT_NOT_EQUAL(PowerManager::POWER_SLEEP, rig.pm.getMode());
+        rig.step();
+    }
+    uint32_t sleeps = stats.sleeps;
+    for (int i = 0; i < 100; i++) {
+        rig.step();
+        TEST_ASSERT_NOT_EQUAL(PowerManager::POWER_SLEEP, rig.pm.getMode());
+    }
+    TEST_ASSERT_EQUAL_UINT32(sleeps, stats.sleeps);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_lone_cube_sleeps);
+    RUN_TEST(test_neighbor_wakes_sleeping_cube);
+    return UNITY_END();
+}
@@ -0,0 +1,247 @@
+// test_reliable.cpp
+//
+// Two ReliableLinks back to back over MemoryTransport, frames length-prefixed on the byte
+// stream as Comms frames them. Each receiving end runs the frames through a fate that can
+// lose one or hold it back behind the next, so the line loses and reorders as a noisy face
+// does. Whatever the line does, every message must come out once and in order; a hole the
+// peer reports must be resent before the timeout, and a dead line must back the timeout off.
+
+#include <unity.h>
+#include <functional>
+#include <vector>
+#include "host.h"
+#include "reliable_link.h"
+#include "transport.h"
+
+static const uint32_t BAUD = 115200;
+//A frame held back goes out after the next one, or after this long on a quiet line
+static const uint32_t HOLD_MS = 30;
+
+enum Fate { PASS, DROP, HOLD };
+
+static uint32_t clockUs() {
+    return (uint32_t)hostTimeUs();
+}
+
+static uint32_t nowMs() {
+    return (uint32_t)(hostTimeUs() / 1000);
+}
+
+//Message i: its index, then bytes that follow from it, 1 to MAX_MESSAGE long in all
+static std::vector<uint8_t> message(uint16_t i) {
+    std::vector<uint8_t> msg(2 + (i * 7) % (ReliableLink::MAX_MESSAGE - 1));
+    msg[0] = i >> 8;
+    msg[1] = i & 0xFF;
+    for (size_t k = 2; k < msg.size(); k++) msg[k] = (uint8_t)(i * 31 + k);
+    return msg;
+}
+
+//The message index a frame carries, or -1 for a plain ACK
+static int messageIn(const std::vector<uint8_t>& frame) {
+    if (frame.size() < ReliableLink::HEADER_LEN + 2) return -1;
+    return frame[ReliableLink::HEADER_LEN] << 8 | frame[ReliableLink::HEADER_LEN + 1];
+}
+
+struct End {
+    ReliableLink link;
+    MemoryTransport port;
+    std::vector<uint8_t> rxBuf;
+    std::vector<uint8_t> held;
+    uint32_t heldAt = 0;
+    std::function<Fate(const std::vector<uint8_t>&)> fate;
+    std::vector<std::vector<uint8_t> > delivered;
+    std::vector<uint32_t> sentAt;   //when each frame carrying a message went out
+
+    End() : port(clockUs) {}
+
+    void transmit() {
+        uint8_t frame[ReliableLink::MAX_FRAME + 1];
+        size_t len;
+        while (port.writable() > ReliableLink::MAX_FRAME && (len = link.poll(nowMs(), frame + 1)) > 0) {
+            frame[0] = (uint8_t)len;
+            port.write(frame, len + 1);
+            if (len > ReliableLink::HEADER_LEN) sentAt.push_back(nowMs());
+        }
+    }
+
+    void receive() {
+        uint8_t buf[256];
+        size_t n;
+        while ((n = port.read(buf, sizeof(buf))) > 0) rxBuf.insert(rxBuf.end(), buf, buf + n);
+
+        while (!rxBuf.empty() && rxBuf.size() > rxBuf[0]) {
+            std::vector<uint8_t> frame(rxBuf.begin() + 1, rxBuf.begin() + 1 + rxBuf[0]);
+            rxBuf.erase(rxBuf.begin(), rxBuf.begin() + 1 + frame.size());
+
+            Fate f = fate ? fate(frame) : PASS;
+            if (f == DROP) continue;
+            if (f == HOLD && held.empty()) {
+                held = frame;
+                heldAt = nowMs();
+                continue;
+            }
+            deliver(frame);
+            release();
+        }
+        if (!held.empty() && nowMs() - heldAt >= HOLD_MS) release();
+
+        uint8_t msg[ReliableLink::MAX_MESSAGE];
+        while ((n = link.nextDelivery(msg)) > 0) delivered.push_back(std::vector<uint8_t>(msg, msg + n));
+    }
+
+    void deliver(const std::vector<uint8_t>& frame) {
+        link.onFrame(frame.data(), frame.size(), nowMs());
+    }
+
+    void release() {
+        if (held.empty()) return;
+        std::vector<uint8_t> frame;
+        frame.swap(held);
+        deliver(frame);
+    }
+};
+
+struct Pair {
+    End a, b;
+
+    Pair() {
+        hostSetTimeUs(1000000);
+        MemoryTransport::connect(a.port, b.port);
+        a.port.begin(BAUD);
+        b.port.begin(BAUD);
+        a.link.reset(1);
+        b.link.reset(2);
+    }
+
+    void step() {
+        a.transmit();
+        b.transmit();
+        hostAdvanceUs(1000);
+        a.receive();
+        b.receive();
+    }
+
+    void runFor(uint32_t ms) {
+        for (uint32_t i = 0; i < ms; i++) step();
+    }
+
+    //Sessions learned on both sides and message 0 through, so numbering and the RTT are settled
+    void handshake() {
+        std::vector<uint8_t> hello = message(0);
+        a.link.send(hello.data(), hello.size());
+        runFor(100);
+        TEST_ASSERT_EQUAL_UINT32(1, b.delivered.size());
+        b.delivered.clear();
+        a.sentAt.clear();
+    }
+};
+
+static void assertDeliveredInOrder(const End& end, uint16_t first, uint16_t count) {
+    TEST_ASSERT_EQUAL_UINT32(count, end.delivered.size());
+    for (uint16_t i = 0; i < count; i++) {
+        std::vector<uint8_t> want = message(first + i);
+        TEST_ASSERT_EQUAL_UINT32(want.size(), end.delivered[i].size());
+        TEST_ASSERT_EQUAL_MEMORY(want.data(), end.delivered[i].data(), want.size());
+    }
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_in_order_over_lossy_reordering_line(void) {
+    Pair pair;
+    //The same noise both ways, ACKs included: one frame in 8 lost, one in 8 held back
+    uint32_t rng = 12345;
+    auto noisy = [&](const std::vector<uint8_t>&) {
+        rng = rng * 1103515245u + 12345u;
+        uint32_t roll = (rng >> 16) % 8;
+        return roll == 0 ? DROP : roll == 1 ? HOLD : PASS;
+    };
+    pair.a.fate = noisy;
+    pair.b.fate = noisy;
+
+    const uint16_t COUNT = 300;
+    uint16_t queued = 0;
+    for (uint32_t ms = 0; ms < 60000 && pair.b.delivered.size() < COUNT; ms++) {
+        while (queued < COUNT && pair.a.link.backlog() < ReliableLink::BACKLOG) {
+            std::vector<uint8_t> msg = message(queued++);
+            TEST_ASSERT_TRUE(pair.a.link.send(msg.data(), msg.size()));
+        }
+        pair.step();
+    }
+
+    assertDeliveredInOrder(pair.b, 0, COUNT);
+    const ReliableLink::Stats& stats = pair.a.link.getStats();
+    TEST_ASSERT_EQUAL_UINT32(0, stats.rejected);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, stats.backlogged);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, stats.fastRetransmits);
+    TEST_ASSERT_GREATER_THAN_UINT32(stats.fastRetransmits, stats.retransmits);
+    TEST_ASSERT_GREATER_THAN_UINT32(0, pair.b.link.getStats().duplicates);
+}
+
+void test_sack_resends_only_the_hole(void) {
+    Pair pair;
+    pair.handshake();
+    uint16_t rto = pair.a.link.getStats().rtoMs;
+
+    //The first copy of message 2 is lost; 3 to 6 arrive and are sacked
+    bool lost = false;
+    pair.b.fate = [&](const std::vector<uint8_t>& frame) {
+        if (messageIn(frame) != 2 || lost) return PASS;
+        lost = true;
+        return DROP;
+    };
+    for (uint16_t i = 1; i <= 6; i++) {
+        std::vector<uint8_t> msg = message(i);
+        pair.a.link.send(msg.data(), msg.size());
+    }
+    uint32_t start = nowMs();
+    while (pair.b.delivered.size() < 6 && nowMs() - start < rto) pair.step();
+
+    assertDeliveredInOrder(pair.b, 1, 6);
+    const ReliableLink::Stats& stats = pair.a.link.getStats();
+    TEST_ASSERT_EQUAL_UINT32(1, stats.fastRetransmits);
+    TEST_ASSERT_EQUAL_UINT32(1, stats.retransmits);
+    TEST_ASSERT_EQUAL_UINT32(0, pair.b.link.getStats().duplicates);
+}
+
+void test_rto_backs_off_on_a_dead_line(void) {
+    Pair pair;
+    pair.handshake();
+    uint32_t rto = pair.a.link.getStats().rtoMs;
+
+    pair.b.fate = [](const std::vector<uint8_t>&) { return DROP; };
+    std::vector<uint8_t> msg = message(1);
+    pair.a.link.send(msg.data(), msg.size());
+    pair.runFor(10000);
+
+    //Every timeout doubles the next one, up to a ceiling it then stays at
+    const std::vector<uint32_t>& sent = pair.a.sentAt;
+    TEST_ASSERT_GREATER_THAN_UINT32(5, sent.size());
+    uint32_t ceiling = pair.a.link.getStats().rtoMs;
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(rto * 8, ceiling);
+    for (size_t i = 1; i < sent.size(); i++) {
+        TEST_ASSERT_EQUAL_UINT32(rto, sent[i] - sent[i - 1]);
+        rto = rto * 2 > ceiling ? ceiling : rto * 2;
+    }
+    TEST_ASSERT_EQUAL_UINT32(sent.size() - 1, pair.a.link.getStats().retransmits);
+    TEST_ASSERT_EQUAL_UINT32(0, pair.a.link.getStats().fastRetransmits);
+
+    //Back up: the message gets through, and a fresh RTT sample brings the timeout down again
+    pair.b.fate = nullptr;
+    pair.runFor(ceiling + 100);
+    assertDeliveredInOrder(pair.b, 1, 1);
+    msg = message(2);
+    pair.a.link.send(msg.data(), msg.size());
+    pair.runFor(100);
+    assertDeliveredInOrder(pair.b, 1, 2);
+    TEST_ASSERT_LESS_THAN_UINT32(ceiling, pair.a.link.getStats().rtoMs);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_in_order_over_lossy_reordering_line);
+    RUN_TEST(test_sack_resends_only_the_hole);
+    RUN_TEST(test_rto_backs_off_on_a_dead_line);
+    return UNITY_END();
+}
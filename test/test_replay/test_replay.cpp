@@ -0,0 +1,149 @@
+// test_replay.cpp
+//
+// Replays the sessions in corpus/ into a fresh Battle. Each was recorded by the first cube of
+// a CubeSim scenario below; a replay that stops matching its checkpoints means the simulation
+// or rendering changed. When that change is intended, record the corpus again with
+//
+//     REGEN_CORPUS=1 pio test -e native -f test_replay
+//
+// and commit the new sessions with it.
+
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "cube_sim.h"
+#include "session_recorder.h"
+#include "session_replay.h"
+
+static const int RIGHT = 0;
+static const int LEFT = 2;
+static const size_t RECORD_BYTES = 1 << 17;
+
+static const DeviceId CUBE_A = 0x240AC4000101ULL;
+static const DeviceId CUBE_B = 0x240AC4000202ULL;
+static const DeviceId CUBE_C = 0x240AC4000303ULL;
+
+static std::string corpusPath(const char* name) {
+    std::string dir = __FILE__;
+    dir = dir.substr(0, dir.find_last_of("/\\") + 1);
+    return dir + "corpus/" + name;
+}
+
+static std::vector<uint8_t> load(const char* name) {
+    std::vector<uint8_t> data;
+    FILE* f = fopen(corpusPath(name).c_str(), "rb");
+    if (!f) return data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(f);
+    return data;
+}
+
+static void save(const char* name, const SessionRecorder& recorder) {
+    FILE* f = fopen(corpusPath(name).c_str(), "wb");
+    TEST_ASSERT_NOT_NULL_MESSAGE(f, "can't write the corpus");
+    fwrite(recorder.data(), 1, recorder.size(), f);
+    fclose(f);
+}
+
+//Two cubes side by side, settling and battling
+static void recordTwoCubes(const char* name) {
+    CubeSim sim({ CUBE_A, CUBE_B }, RECORD_BYTES);
+    sim.plug(0, RIGHT, 1, LEFT);
+    sim.runFor(20000);
+    TEST_ASSERT_FALSE(sim.cubes[0]->recorder().truncated());
+    save(name, sim.cubes[0]->recorder());
+}
+
+//A row of three whose host, at the far end from the recording cube, is pulled
+static void recordHostPulled(const char* name) {
+    CubeSim sim({ CUBE_A, CUBE_B, CUBE_C }, RECORD_BYTES);
+    sim.plug(0, RIGHT, 1, LEFT);
+    sim.plug(1, RIGHT, 2, LEFT);
+    sim.runFor(8000);
+    sim.cubes[2]->powered = false;
+    sim.runFor(8000);
+    TEST_ASSERT_FALSE(sim.cubes[0]->recorder().truncated());
+    save(name, sim.cubes[0]->recorder());
+}
+
+static SessionReplay::Result replay(const std::vector<uint8_t>& session) {
+    TFT_eSPI panel(128, 128);
+    std::unique_ptr<Battle> battle(new Battle(&panel, 128, 128));
+    SessionReplay replay(session.data(), session.size());
+    TEST_ASSERT_TRUE_MESSAGE(replay.valid(), "not a session");
+    return replay.run(*battle);
+}
+
+//record is null for sessions saved from hardware, which can't be recorded again
+static void checkSession(const char* name, void (*record)(const char*)) {
+    if (record && getenv("REGEN_CORPUS")) record(name);
+
+    std::vector<uint8_t> session = load(name);
+    TEST_ASSERT_FALSE_MESSAGE(session.empty(), "corpus session missing, record it with REGEN_CORPUS=1");
+
+    SessionReplay::Result result = replay(session);
+    TEST_ASSERT_FALSE_MESSAGE(result.diverged, "replay diverged from the recording");
+    TEST_ASSERT_GREATER_THAN(0, result.checkpoints);
+}
+
+//Offset of the nth checkpoint record, 0 if there are fewer
+static size_t findCheckpoint(const std::vector<uint8_t>& session, uint32_t nth) {
+    uint32_t seen = 0;
+    for (size_t pos = SessionRecorder::HEADER_LEN; pos < session.size();) {
+        uint8_t record = session[pos];
+        if (record == SessionRecorder::REC_TICK) {
+            pos += 2;
+        } else if (record == SessionRecorder::REC_TICK_LONG) {
+            pos += 5;
+        } else if (record == SessionRecorder::REC_EVENT) {
+            pos += 6;
+        } else if (record == SessionRecorder::REC_CHECKPOINT) {
+            if (++seen == nth) return pos;
+            pos += 9;
+        } else {
+            pos += 2 + session[pos + 1];
+        }
+    }
+    return 0;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_two_cubes(void) {
+    checkSession("two_cubes.session", recordTwoCubes);
+}
+
+void test_host_pulled(void) {
+    checkSession("host_pulled.session", recordHostPulled);
+}
+
+//A replay must notice a wrong hash, and at the checkpoint that holds it
+void test_corrupted_checkpoint_diverges(void) {
+    std::vector<uint8_t> session = load("two_cubes.session");
+    TEST_ASSERT_FALSE(session.empty());
+
+    const uint32_t nth = 40;
+    size_t pos = findCheckpoint(session, nth);
+    TEST_ASSERT_NOT_EQUAL(0, pos);
+    session[pos + 1] ^= 0x01;
+
+    SessionReplay::Result result = replay(session);
+    TEST_ASSERT_TRUE(result.diverged);
+    TEST_ASSERT_EQUAL_UINT32(nth * SessionRecorder::CHECKPOINT_TICKS, result.divergedAtTick);
+    TEST_ASSERT_EQUAL_UINT32(nth - 1, result.checkpoints);
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_two_cubes);
+    RUN_TEST(test_host_pulled);
+    RUN_TEST(test_corrupted_checkpoint_diverges);
+    return UNITY_END();
+}
@@ -0,0 +1,120 @@
+// test_seam.cpp
+//
+// Two cubes side by side must show one world. A sprite straddling the seam is drawn on both
+// panels and checked pixel for pixel against one panel twice as wide, and a client must hold
+// exactly the positions its host simulated.
+
+#include <unity.h>
+#include <deque>
+#include <map>
+#include <set>
+#include <utility>
+#include "cube_sim.h"
+#include "display.h"
+#include "map.h"
+
+static const int RIGHT = 0;
+static const int LEFT = 2;
+
+static const uint32_t LEFT_CUBE = 1000;
+static const uint32_t RIGHT_CUBE = 1001;
+static const int16_t SEAM_X = Map::CUBE_SIZE;
+
+//Host ticks a client's state may trail behind
+static const size_t MAX_LAG_TICKS = 8;
+
+static CharacterPtr pet(uint32_t mac, Map& map, TFT_eSPI* tft) {
+    return CharacterPtr(new Character(mac, 0, tft, &map, nullptr));
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_sprites_line_up_across_seam(void) {
+    Map map;
+    map.addCube(LEFT_CUBE, 0, -1);
+    map.addCube(RIGHT_CUBE, LEFT_CUBE, RIGHT);
+
+    TFT_eSPI left(128, 128), right(128, 128), whole(256, 128);
+    Display leftDisplay(&map, &left, 128, 128);
+    Display rightDisplay(&map, &right, 128, 128);
+    Display wholeDisplay(&map, &whole, 256, 128);
+    leftDisplay.setMac(LEFT_CUBE);
+    rightDisplay.setMac(RIGHT_CUBE);
+    wholeDisplay.setMac(LEFT_CUBE);
+
+    CharacterList list = { pet(1, map, &whole), pet(2, map, &whole) };
+    leftDisplay.setCharacters(list);
+    rightDisplay.setCharacters(list);
+    wholeDisplay.setCharacters(list);
+
+    //From wholly left of the seam to wholly right of it, one pixel at a time
+    uint32_t straddling = 0;
+    for (int16_t x = SEAM_X - 40; x <= SEAM_X + 8; x++) {
+        list[0]->setPosition(x, 20);
+        list[1]->setPosition(SEAM_X - (x - SEAM_X) - 32, 70);
+        leftDisplay.draw(list);
+        rightDisplay.draw(list);
+        wholeDisplay.draw(list);
+
+        uint32_t mismatches = 0;
+        bool seamDrawn = false;
+        for (int16_t y = 0; y < 128; y++) {
+            for (int16_t col = 0; col < 128; col++) {
+                mismatches += left.readPixel(col, y) != whole.readPixel(col, y);
+                mismatches += right.readPixel(col, y) != whole.readPixel(SEAM_X + col, y);
+            }
+            seamDrawn |= left.readPixel(127, y) != TFT_BLACK && right.readPixel(0, y) != TFT_BLACK;
+        }
+        TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, mismatches, "panels differ from the whole world");
+        straddling += seamDrawn;
+    }
+    //Otherwise the loop above proved nothing about the seam
+    TEST_ASSERT_GREATER_THAN(0, straddling);
+}
+
+void test_client_holds_host_positions(void) {
+    CubeSim sim({ 0x240AC4000101ULL, 0x240AC4000202ULL });
+    sim.plug(0, RIGHT, 1, LEFT);
+    sim.runFor(4000);
+
+    SimCube* host = sim.cubes[0]->battle.getComms().getRole() == ROLE_HOST ? sim.cubes[0].get() : sim.cubes[1].get();
+    SimCube* client = host == sim.cubes[0].get() ? sim.cubes[1].get() : sim.cubes[0].get();
+    TEST_ASSERT_EQUAL_UINT32(host->mac(), client->host());
+
+    uint32_t pets[2] = { host->mac(), client->mac() };
+    std::map<uint32_t, std::deque<std::pair<int16_t, int16_t> > > history;
+    uint32_t checked = 0;
+    std::set<std::pair<int16_t, int16_t> > visited;
+    for (int tick = 0; tick < 500; tick++) {
+        sim.tick();
+        for (uint32_t mac : pets) {
+            Character* simulated = host->battle.findCharacterByMac(mac);
+            Character* shown = client->battle.findCharacterByMac(mac);
+            TEST_ASSERT_NOT_NULL(simulated);
+            TEST_ASSERT_NOT_NULL(shown);
+
+            std::deque<std::pair<int16_t, int16_t> >& recent = history[mac];
+            recent.push_front(std::make_pair(simulated->getX(), simulated->getY()));
+            if (recent.size() > MAX_LAG_TICKS) recent.pop_back();
+
+            //The client may still show a position from before the first one recorded here
+            if (recent.size() < MAX_LAG_TICKS) continue;
+            std::pair<int16_t, int16_t> at(shown->getX(), shown->getY());
+            visited.insert(at);
+            TEST_ASSERT_TRUE_MESSAGE(std::find(recent.begin(), recent.end(), at) != recent.end(),
+                                     "client shows a position the host never had");
+            checked++;
+        }
+    }
+    TEST_ASSERT_GREATER_THAN(0, checked);
+    //Pets that stood still would prove nothing
+    TEST_ASSERT_GREATER_THAN(16, visited.size());
+}
+
+int main(int argc, char** argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sprites_line_up_across_seam);
+    RUN_TEST(test_client_holds_host_positions);
+    return UNITY_END();
+}
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""Compares CubePets benchmark runs against a baseline.
+
+Takes benchmark reports (sent with 'b' on the debug port of a build with -DBENCH_ENABLED=1),
+either as raw serial captures or as .json files saved earlier, and prints the change in time
+per iteration of every benchmark. Exits with status 1 if any got slower than the threshold,
+so it can gate a change. Benchmarks that exist in only one run are listed but never fail.
+
+    python tools/bench_compare.py serial.bin --save bench/baseline.json
+    python tools/bench_compare.py bench/baseline.json serial.bin --threshold 10
+
+test/test_bench writes the same report from a host build (BENCH_OUT=<file>); CI compares a pull
+request's run against its base's on the same runner.
+"""
+
+import argparse
+import json
+import sys
+
+BEGIN = "[BENCH] BEGIN"
+END = "[BENCH] END"
+
+
+def load_report(path):
+    """The last report in a serial capture, or a saved .json."""
+    with open(path, "rb") as f:
+        text = f.read().decode("utf-8", "replace")
+
+    start = text.rfind(BEGIN)
+    if start >= 0:
+        end = text.find(END, start)
+        if end < 0:
+            sys.exit("%s: report is cut off" % path)
+        text = text[start + len(BEGIN):end]
+
+    try:
+        return json.loads(text)
+    except ValueError as e:
+        sys.exit("%s: not a benchmark report (%s)" % (path, e))
+
+
+def sort_key(name):
+    """BM_X/8 before BM_X/32."""
+    parts = name.split("/")
+    return [parts[0]] + [int(p) if p.isdigit() else 0 for p in parts[1:]]
+
+
+def times(report):
+    return {b["name"]: b["real_time"] for b in report["benchmarks"] if b.get("run_type", "iteration") == "iteration"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline", help="baseline report, or the run to save with --save")
+    parser.add_argument("current", nargs="?", help="report to check against the baseline")
+    parser.add_argument("--threshold", type=float, default=5.0, help="allowed slowdown in percent (default 5)")
+    parser.add_argument("--save", help="write the first report out as JSON, e.g. a new baseline")
+    args = parser.parse_args()
+
+    baseline = load_report(args.baseline)
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(baseline, f, indent=2)
+            f.write("\n")
+    if not args.current:
+        return
+
+    old = times(baseline)
+    new = times(load_report(args.current))
+
+    regressions = 0
+    width = max(len(name) for name in set(old) | set(new))
+    print("%-*s %12s %12s %8s" % (width, "benchmark", "baseline us", "current us", "change"))
+    for name in sorted(set(old) | set(new), key=sort_key):
+        if name not in new:
+            print("%-*s %12.3f %12s %8s" % (width, name, old[name], "-", "gone"))
+            continue
+        if name not in old:
+            print("%-*s %12s %12.3f %8s" % (width, name, "-", new[name], "new"))
+            continue
+
+        change = (new[name] - old[name]) / old[name] * 100 if old[name] > 0 else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  <-- regression"
+            regressions += 1
+        print("%-*s %12.3f %12.3f %+7.1f%%%s" % (width, name, old[name], new[name], change, flag))
+
+    if regressions:
+        print()
+        print("%d benchmark(s) slower by more than %.1f%%" % (regressions, args.threshold))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
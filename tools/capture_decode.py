@@ -0,0 +1,180 @@
+#!/usr/bin/env python3
+"""Decodes CubePets packet captures.
+
+Takes a raw serial capture holding capture dumps (sent with 'd' on the debug port) or a
+.pcap saved earlier. Prints bytes per face, direction and tag, so bandwidth hogs stand out,
+and retransmits of the reliable channel per second, so storms do too. See
+include/packet_capture.h for the capture format and include/comms.h for the tags.
+
+    python tools/capture_decode.py serial.bin --pcap link.pcap
+    python tools/capture_decode.py link.pcap --list
+"""
+
+import argparse
+import collections
+import struct
+import sys
+
+DUMP_MAGIC = b"\xa5\x5aCP"
+PCAP_MAGIC = 0xA1B2C3D4
+HEADER_LEN = 5
+BATCH_SHORT_RECORD = 0x80
+RELIABLE_HEADER_LEN = 5
+
+TAGS = {
+    0x01: "HEARTBEAT",
+    0x02: "COMMAND",
+    0x03: "LINK_PROBE",
+    0x04: "BATCH",
+    0x05: "RELIABLE",
+    0x06: "PATH",
+    0x07: "SPAWN",
+    0x08: "DESPAWN",
+    0x09: "HOST",
+    0x0A: "KEEPALIVE",
+    0x0B: "JOIN",
+    0x0C: "ASSIGN",
+    0x0D: "TERRAIN",
+    0x0E: "COMBAT",
+}
+DIRECTIONS = {0: "in", 1: "out"}
+
+
+def tag_name(tag):
+    return TAGS.get(tag, "0x%02x" % tag)
+
+
+def extract_pcaps(data):
+    """Pcap files inside capture dumps in a serial stream; data itself if it is a pcap."""
+    if len(data) >= 4 and struct.unpack("<I", data[:4])[0] == PCAP_MAGIC:
+        return [data]
+
+    pcaps = []
+    pos = data.find(DUMP_MAGIC)
+    while pos >= 0:
+        start = pos + 8
+        if start <= len(data):
+            length = struct.unpack(">I", data[pos + 4:start])[0]
+            body = data[start:start + length]
+            if len(body) == length and start + length < len(data) and sum(body) & 0xFF == data[start + length]:
+                pcaps.append(body)
+        pos = data.find(DUMP_MAGIC, pos + 1)
+    return pcaps
+
+
+def read_pcap(pcap):
+    """Yields (time in s, side, direction, frame)."""
+    linktype = struct.unpack("<I", pcap[20:24])[0]
+    if linktype != 147:
+        sys.exit("not a CubePets capture (link type %d)" % linktype)
+    pos = 24
+    while pos + 16 <= len(pcap):
+        sec, usec, incl, _ = struct.unpack("<IIII", pcap[pos:pos + 16])
+        packet = pcap[pos + 16:pos + 16 + incl]
+        pos += 16 + incl
+        if len(packet) >= 2:
+            yield sec + usec / 1e6, packet[0], packet[1], packet[2:]
+
+
+def packets(frame):
+    """Splits a frame into (tag, sid, seq, payload), unpacking batches."""
+    if len(frame) < HEADER_LEN:
+        return
+    tag, length, sid = frame[0], frame[1], frame[2]
+    seq = struct.unpack(">H", frame[3:5])[0]
+    payload = frame[HEADER_LEN:HEADER_LEN + length]
+    if tag != 0x04:
+        yield tag, sid, seq, payload
+        return
+
+    pos = 0
+    while pos + 2 <= len(payload):
+        record_tag, record_len = payload[pos], payload[pos + 1]
+        if record_tag & BATCH_SHORT_RECORD:
+            if pos + 4 + record_len > len(payload):
+                return
+            record_seq = struct.unpack(">H", payload[pos + 2:pos + 4])[0]
+            yield record_tag & ~BATCH_SHORT_RECORD, sid, record_seq, payload[pos + 4:pos + 4 + record_len]
+            pos += 4 + record_len
+        else:
+            if pos + HEADER_LEN + record_len > len(payload):
+                return
+            record_seq = struct.unpack(">H", payload[pos + 3:pos + 5])[0]
+            yield record_tag, payload[pos + 2], record_seq, payload[pos + 5:pos + 5 + record_len]
+            pos += HEADER_LEN + record_len
+
+
+def describe(tag, sid, seq, payload):
+    text = "%-10s sid %3d seq %5d len %3d" % (tag_name(tag), sid, seq, len(payload))
+    if tag == 0x05 and len(payload) >= RELIABLE_HEADER_LEN:
+        session, peer, rseq, ack, sack = payload[:RELIABLE_HEADER_LEN]
+        text += " | session %d/%d seq %d ack %d sack %02x" % (session, peer, rseq, ack, sack)
+        inner = payload[RELIABLE_HEADER_LEN:]
+        if len(inner) >= HEADER_LEN:
+            text += " | " + tag_name(inner[0])
+    return text
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="serial capture with dumps, or a .pcap")
+    parser.add_argument("--pcap", help="also save the last dump as a .pcap for Wireshark")
+    parser.add_argument("--list", action="store_true", help="print every packet")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        pcaps = extract_pcaps(f.read())
+    if not pcaps:
+        sys.exit("no capture dump found")
+    pcap = pcaps[-1]
+
+    if args.pcap:
+        with open(args.pcap, "wb") as f:
+            f.write(pcap)
+
+    traffic = collections.Counter()
+    counts = collections.Counter()
+    sent = collections.Counter()
+    retransmits = collections.Counter()
+    frames = 0
+    first = last = None
+
+    for when, side, direction, frame in read_pcap(pcap):
+        frames += 1
+        first = when if first is None else first
+        last = when
+        key_face = (side, DIRECTIONS.get(direction, direction))
+        traffic[key_face + ("(frame)",)] += len(frame)
+
+        for tag, sid, seq, payload in packets(frame):
+            key = key_face + (tag_name(tag),)
+            traffic[key] += HEADER_LEN + len(payload)
+            counts[key] += 1
+            if args.list:
+                print("%10.6f side %d %-3s %s" % (when, side, key_face[1], describe(tag, sid, seq, payload)))
+
+            #A reliable message seen twice on the same face and session was retransmitted
+            if tag == 0x05 and len(payload) > RELIABLE_HEADER_LEN:
+                message = key_face + (payload[0], payload[2])
+                if sent[message]:
+                    retransmits[(side, key_face[1], int(when))] += 1
+                sent[message] += 1
+
+    span = (last - first) if first is not None and last > first else 0
+    print("%d frames over %.2f s" % (frames, span))
+    print()
+    print("%-4s %-4s %-12s %8s %9s %9s" % ("side", "dir", "tag", "packets", "bytes", "bytes/s"))
+    for (side, direction, tag), size in sorted(traffic.items(), key=lambda item: -item[1]):
+        rate = size / span if span else 0
+        print("%-4d %-4s %-12s %8d %9d %9.0f" % (side, direction, tag, counts[(side, direction, tag)], size, rate))
+    print("(frame) rows are whole frames on the wire; the others are packets inside them")
+
+    if retransmits:
+        print()
+        print("reliable retransmits per second")
+        for (side, direction, second), count in sorted(retransmits.items(), key=lambda item: (item[0][2], item[0][0])):
+            print("  t=%ds side %d %-3s %d%s" % (second, side, direction, count, "  <-- storm" if count >= 10 else ""))
+
+
+if __name__ == "__main__":
+    main()
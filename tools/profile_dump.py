@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Summarizes profiler dumps from a CubePets debug serial port.
+
+Reads a raw serial capture, or asks a live device for a dump with --port, then prints
+min/avg/p99/max per stage and folded stacks ("frame;comms 1234") that flamegraph.pl or
+speedscope turn into a flame graph. Layout of a dump is described in include/profiler.h.
+
+    python tools/profile_dump.py capture.bin
+    python tools/profile_dump.py --port COM12 --folded out.folded
+"""
+
+import argparse
+import struct
+import sys
+import time
+
+MAGIC = b"\xa5\x5aPF"
+VERSION = 1
+NO_PARENT = 0xFF
+STAGE_NAMES = ["frame", "comms", "characters", "compose", "push", "ai", "move", "combat", "animate"]
+
+
+def stage_name(stage_id):
+    return STAGE_NAMES[stage_id] if stage_id < len(STAGE_NAMES) else "stage%d" % stage_id
+
+
+def find_dumps(data):
+    """Yields the body of every intact dump in data, skipping log text around them."""
+    pos = data.find(MAGIC)
+    while pos >= 0:
+        header_end = pos + 7
+        if header_end <= len(data):
+            version = data[pos + 4]
+            length = struct.unpack(">H", data[pos + 5:pos + 7])[0]
+            body = data[header_end:header_end + length]
+            if (version == VERSION and len(body) == length and header_end + length < len(data)
+                    and sum(body) & 0xFF == data[header_end + length]):
+                yield body
+        pos = data.find(MAGIC, pos + 1)
+
+
+def parse(body):
+    stages = {}
+    count = body[0]
+    pos = 1
+    for _ in range(count):
+        stage_id, parent, samples = body[pos], body[pos + 1], body[pos + 2]
+        total = struct.unpack(">I", body[pos + 3:pos + 7])[0]
+        pos += 7
+        values = list(struct.unpack(">%dH" % samples, body[pos:pos + samples * 2]))
+        pos += samples * 2
+        stages[stage_id] = {"parent": parent, "total": total, "samples": values}
+    return stages
+
+
+def percentile(sorted_values, pct):
+    index = max(0, -(-len(sorted_values) * pct // 100) - 1)
+    return sorted_values[index]
+
+
+def print_table(stages):
+    frame = stages.get(0)
+    frame_avg = sum(frame["samples"]) / len(frame["samples"]) if frame and frame["samples"] else 0
+
+    print("%-12s %7s %7s %7s %7s %7s %6s" % ("stage", "frames", "min", "avg", "p99", "max", "share"))
+    for stage_id in sorted(stages):
+        values = sorted(stages[stage_id]["samples"])
+        if not values:
+            continue
+        avg = sum(values) / len(values)
+        share = "%5.1f%%" % (100.0 * avg / frame_avg) if frame_avg else ""
+        print("%-12s %7d %7d %7.0f %7d %7d %6s" % (
+            stage_name(stage_id), stages[stage_id]["total"], values[0], avg,
+            percentile(values, 99), values[-1], share))
+    print("times in us over the last %d frames" % max(len(s["samples"]) for s in stages.values()))
+
+
+def folded(stages):
+    """Average self time of every stage, as folded stacks."""
+    def path(stage_id):
+        names = []
+        while stage_id != NO_PARENT and stage_id in stages:
+            names.append(stage_name(stage_id))
+            stage_id = stages[stage_id]["parent"]
+        return ";".join(reversed(names))
+
+    averages = {}
+    for stage_id, stage in stages.items():
+        values = stage["samples"]
+        averages[stage_id] = sum(values) / len(values) if values else 0
+
+    lines = []
+    for stage_id in sorted(stages):
+        children = sum(averages[c] for c, s in stages.items() if s["parent"] == stage_id)
+        self_time = max(0, averages[stage_id] - children)
+        lines.append("%s %d" % (path(stage_id), round(self_time)))
+    return lines
+
+
+def read_port(port, baud, wait):
+    import serial  # pyserial, only needed for live capture
+
+    with serial.Serial(port, baud, timeout=0.1) as link:
+        link.reset_input_buffer()
+        link.write(b"p")
+        data = b""
+        deadline = time.time() + wait
+        while time.time() < deadline:
+            data += link.read(4096)
+        return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", help="raw serial capture containing dumps")
+    parser.add_argument("--port", help="serial port of a live device")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--wait", type=float, default=1.0, help="seconds to listen for the dump")
+    parser.add_argument("--folded", help="write folded stacks of the last dump to this file")
+    args = parser.parse_args()
+
+    if args.port:
+        data = read_port(args.port, args.baud, args.wait)
+    elif args.capture:
+        with open(args.capture, "rb") as f:
+            data = f.read()
+    else:
+        parser.error("give a capture file or --port")
+
+    dumps = [parse(body) for body in find_dumps(data)]
+    if not dumps:
+        sys.exit("no profiler dump found")
+
+    stages = dumps[-1]
+    print_table(stages)
+    print()
+    stacks = folded(stages)
+    for line in stacks:
+        print(line)
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            f.write("\n".join(stacks) + "\n")
+
+
+if __name__ == "__main__":
+    main()
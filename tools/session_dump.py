@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+"""Saves CubePets session recordings from a serial capture.
+
+Takes a raw serial capture holding session dumps (sent with 's' on the debug port, from a
+build with -DSESSION_RECORD_BYTES=<n>) and writes the last one out as a .session file for
+SessionReplay. Prints what the session holds: ticks, duration, bytes read per face, topology
+events and checkpoints. See include/session_recorder.h for the format.
+
+    python tools/session_dump.py serial.bin --out corpus/two_cubes.session
+    python tools/session_dump.py corpus/two_cubes.session --events
+"""
+
+import argparse
+import collections
+import struct
+import sys
+
+DUMP_MAGIC = b"\xa5\x5aSN"
+VERSION = 1
+HEADER_LEN = 15
+
+REC_TICK = 0x01
+REC_TICK_LONG = 0x02
+REC_EVENT = 0x03
+REC_CHECKPOINT = 0x04
+REC_RX = 0x10
+
+EVENTS = {
+    1: "cube added",
+    2: "cube removed",
+    3: "host changed",
+    4: "character added",
+    5: "character removed",
+}
+
+
+def extract_sessions(data):
+    """Sessions inside dumps in a serial stream; data itself if it is a session."""
+    if data[:1] == bytes([VERSION]) and DUMP_MAGIC not in data:
+        return [data]
+
+    sessions = []
+    pos = data.find(DUMP_MAGIC)
+    while pos >= 0:
+        start = pos + 8
+        if start <= len(data):
+            length = struct.unpack(">I", data[pos + 4:start])[0]
+            body = data[start:start + length]
+            if len(body) == length and start + length < len(data) and sum(body) & 0xFF == data[start + length]:
+                sessions.append(body)
+        pos = data.find(DUMP_MAGIC, pos + 1)
+    return sessions
+
+
+def records(session):
+    """Yields (tick, time in ms, record, fields) for every record after the header."""
+    tick = 0
+    now = struct.unpack(">I", session[11:15])[0]
+    pos = HEADER_LEN
+    while pos < len(session):
+        kind = session[pos]
+        if kind == REC_TICK:
+            tick += 1
+            now += session[pos + 1]
+            pos += 2
+            yield tick, now, kind, ()
+        elif kind == REC_TICK_LONG:
+            tick += 1
+            now += struct.unpack(">I", session[pos + 1:pos + 5])[0]
+            pos += 5
+            yield tick, now, kind, ()
+        elif kind == REC_EVENT:
+            event, mac = struct.unpack(">BI", session[pos + 1:pos + 6])
+            pos += 6
+            yield tick, now, kind, (event, mac)
+        elif kind == REC_CHECKPOINT:
+            state, frame = struct.unpack(">II", session[pos + 1:pos + 9])
+            pos += 9
+            yield tick, now, kind, (state, frame)
+        elif kind & ~0x03 == REC_RX:
+            length = session[pos + 1]
+            pos += 2 + length
+            yield tick, now, REC_RX, (kind & 0x03, length)
+        else:
+            sys.exit("bad record 0x%02x at offset %d" % (kind, pos))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", help="serial capture with session dumps, or a .session")
+    parser.add_argument("--out", help="save the last session here")
+    parser.add_argument("--events", action="store_true", help="print every topology event")
+    args = parser.parse_args()
+
+    with open(args.capture, "rb") as f:
+        sessions = extract_sessions(f.read())
+    if not sessions:
+        sys.exit("no session dump found")
+    session = sessions[-1]
+    if session[0] != VERSION:
+        sys.exit("session version %d, expected %d" % (session[0], VERSION))
+
+    if args.out:
+        with open(args.out, "wb") as f:
+            f.write(session)
+
+    seed = struct.unpack(">I", session[1:5])[0]
+    device = int.from_bytes(session[5:11], "big")
+    start = struct.unpack(">I", session[11:15])[0]
+
+    ticks = 0
+    end = start
+    checkpoints = 0
+    rx_bytes = collections.Counter()
+    events = []
+    for tick, now, kind, fields in records(session):
+        if kind in (REC_TICK, REC_TICK_LONG):
+            ticks = tick
+            end = now
+        elif kind == REC_RX:
+            rx_bytes[fields[0]] += fields[1]
+        elif kind == REC_CHECKPOINT:
+            checkpoints += 1
+        elif kind == REC_EVENT:
+            events.append((tick, now, fields))
+
+    duration = (end - start) / 1000.0
+    print("device %012x seed %08x, %d bytes" % (device, seed, len(session)))
+    print("%d ticks over %.2f s (%.1f ms per tick), %d checkpoints, %d events" %
+          (ticks, duration, (end - start) / ticks if ticks else 0, checkpoints, len(events)))
+    for side in sorted(rx_bytes):
+        print("  side %d read %d bytes" % (side, rx_bytes[side]))
+
+    if args.events:
+        print()
+        for tick, now, (event, mac) in events:
+            print("  tick %6d  %8.3f s  %-17s %u" % (tick, (now - start) / 1000.0, EVENTS.get(event, event), mac))
+
+
+if __name__ == "__main__":
+    main()